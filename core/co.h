@@ -0,0 +1,480 @@
+#ifndef CO_H
+#define CO_H
+
+// Stackless coroutines, switch/label based
+// https://www.chiark.greenend.org.uk/~sgtatham/coroutines.html
+
+// MIT License
+//
+// Copyright (c) 2024 Justin Schartner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifdef _WIN32
+#  include <winsock2.h>
+#  include <windows.h>
+#else
+#  include <poll.h>
+#  include <time.h>
+#  include <errno.h>
+#  include <unistd.h>
+#  include <sys/epoll.h>
+#endif // _WIN32
+
+#ifndef CO_ALLOC
+#  include <stdlib.h>
+#  define CO_ALLOC malloc
+#endif // CO_ALLOC
+
+#ifndef CO_FREE
+#  include <stdlib.h>
+#  define CO_FREE free
+#endif // CO_FREE
+
+typedef unsigned long long Co_u64;
+#define u64 Co_u64
+
+#ifndef CO_DEF
+#  define CO_DEF static inline
+#endif // CO_DEF
+
+#ifdef _WIN32
+typedef SOCKET Co_Fd;
+#else
+typedef int Co_Fd;
+#endif // _WIN32
+
+// Set by another thread, once offloaded work is done
+typedef volatile long Co_Flag;
+
+#ifdef _MSC_VER
+#  define co_flag_get(f) InterlockedOr((f), 0)
+#  define co_flag_set(f) InterlockedExchange((f), 1)
+#else
+#  define co_flag_get(f) __atomic_load_n((f), __ATOMIC_ACQUIRE)
+#  define co_flag_set(f) __atomic_store_n((f), 1, __ATOMIC_RELEASE)
+#endif // _MSC_VER
+
+typedef enum {
+  CO_DONE = 0,
+  CO_SUSPENDED,
+} Co_Result;
+
+typedef enum {
+  CO_WAIT_NONE = 0, // resume on the next tick
+  CO_WAIT_TIMER,
+  CO_WAIT_READ,
+  CO_WAIT_WRITE,
+  CO_WAIT_FLAG,
+} Co_Wait;
+
+typedef enum {
+  CO_SCHED_NONE = 0,
+  CO_SCHED_READY,
+  CO_SCHED_TIMERS,
+  CO_SCHED_POLLED,
+  CO_SCHED_EPOLL,
+} Co_Sched_List;
+
+typedef struct {
+  int line;
+  int cancelled; // the owner is gone, every wait is over
+
+  Co_Wait wait;
+  u64 deadline;
+  Co_Fd fd;
+  Co_Flag *flag;
+
+  // Where 'Co_Sched' keeps it
+  Co_Sched_List list;
+  u64 pos;
+} Co;
+
+#define co_default() (Co) {			\
+    .line = 0,					\
+      .cancelled = 0,				\
+      .wait = CO_WAIT_NONE,			\
+      .list = CO_SCHED_NONE,			\
+      }
+
+// A coroutine is a function, that returns Co_Result:
+//
+//   Co_Result handler(Co *co, Ctx *ctx) {
+//     co_begin(co);
+//     co_sleep(co, 100);
+//     co_wait_readable(co, ctx->fd);
+//     ...
+//     co_end(co);
+//   }
+//
+// - locals do not survive a suspension, keep them in the context
+// - at most one co_* macro per line, 'switch' must not enclose one
+#define co_begin(co) switch((co)->line) { case 0:
+#define co_end(co) } (co)->line = 0; (co)->wait = CO_WAIT_NONE; return CO_DONE
+
+#define co_return(co) do{			\
+    (co)->line = 0;				\
+    (co)->wait = CO_WAIT_NONE;			\
+    return CO_DONE;				\
+  }while(0)
+
+#define co_suspend(co, w) do{			\
+    (co)->wait = (w);				\
+    (co)->line = __LINE__;			\
+    return CO_SUSPENDED;			\
+  case __LINE__:;				\
+  }while(0)
+
+#define co_pause(co) co_suspend((co), CO_WAIT_NONE)
+#define co_wait_until(co, cond) while(!(cond)) co_pause(co)
+
+#define co_sleep(co, ms) do{			\
+    (co)->deadline = co_now() + (ms);		\
+    co_suspend((co), CO_WAIT_TIMER);		\
+  }while(0)
+
+#define co_wait_readable(co, f) do{		\
+    (co)->fd = (f);				\
+    co_suspend((co), CO_WAIT_READ);		\
+  }while(0)
+
+#define co_wait_writable(co, f) do{		\
+    (co)->fd = (f);				\
+    co_suspend((co), CO_WAIT_WRITE);		\
+  }while(0)
+
+#define co_wait_flag(co, f) do{			\
+    (co)->flag = (f);				\
+    co_suspend((co), CO_WAIT_FLAG);		\
+  }while(0)
+
+// - monotonic milliseconds
+CO_DEF u64 co_now();
+// - whether the wait of 'co' is over, never blocks
+CO_DEF int co_ready(Co *co);
+
+// Suspended coroutines, sorted by what they wait for. Finding the ones,
+// that can continue, costs nothing for the ones that can not
+typedef struct {
+  u64 cap;
+
+  // Resumable, a ring
+  Co **ready;
+  u64 ready_pos;
+  u64 ready_len;
+
+  // CO_WAIT_TIMER, a min-heap by 'deadline'
+  Co **timers;
+  u64 timers_len;
+
+  // CO_WAIT_FLAG and fds, that epoll can not wait for
+  Co **polled;
+  u64 polled_len;
+
+#ifndef _WIN32
+  // CO_WAIT_READ/CO_WAIT_WRITE, one-shot. Readable, once one of them is
+  // over, it can wait in the event-loop like a socket
+  int epfd;
+#endif // _WIN32
+} Co_Sched;
+
+#define CO_SCHED_EVENTS 32
+
+// - room for 'cap' coroutines, returns 0 if it fails
+CO_DEF int co_sched_open(Co_Sched *c, u64 cap);
+// - file 'co' after it returned CO_SUSPENDED
+CO_DEF void co_sched_wait(Co_Sched *c, Co *co);
+// - forget 'co', wherever it waits
+CO_DEF void co_sched_cancel(Co_Sched *c, Co *co);
+// - move every coroutine, whose wait is over, to the ready ones
+CO_DEF void co_sched_poll(Co_Sched *c);
+// - the next ready coroutine, NULL if there is none
+CO_DEF Co *co_sched_next(Co_Sched *c);
+CO_DEF void co_sched_close(Co_Sched *c);
+
+#ifdef CO_IMPLEMENTATION
+
+#ifdef _WIN32
+
+CO_DEF u64 co_now() {
+  return (u64) GetTickCount64();
+}
+
+#else
+
+CO_DEF u64 co_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64) ts.tv_sec * 1000 + (u64) ts.tv_nsec / 1000000;
+}
+
+#endif // _WIN32
+
+CO_DEF int co_ready(Co *co) {
+  if(co->cancelled) {
+    return 1;
+  }
+
+  switch(co->wait) {
+  case CO_WAIT_NONE:
+    return 1;
+  case CO_WAIT_TIMER:
+    return co_now() >= co->deadline;
+  case CO_WAIT_READ:
+  case CO_WAIT_WRITE: {
+#ifdef _WIN32
+    WSAPOLLFD pfd = { .fd = co->fd, .events = co->wait == CO_WAIT_READ ? POLLRDNORM : POLLWRNORM };
+    if(WSAPoll(&pfd, 1, 0) < 0) {
+      return 1;
+    }
+#else
+    struct pollfd pfd = { .fd = co->fd, .events = co->wait == CO_WAIT_READ ? POLLIN : POLLOUT };
+    if(poll(&pfd, 1, 0) < 0) {
+      return 1;
+    }
+#endif // _WIN32
+    // Errors and hangups are reported as ready, the next read/write fails
+    return pfd.revents != 0;
+  }
+  case CO_WAIT_FLAG:
+    return co_flag_get(co->flag) != 0;
+  default:
+    return 1;
+  }
+}
+
+CO_DEF int co_sched_open(Co_Sched *c, u64 cap) {
+  c->cap = cap;
+  c->ready_pos = 0;
+  c->ready_len = 0;
+  c->timers_len = 0;
+  c->polled_len = 0;
+
+  c->ready = CO_ALLOC(sizeof(*c->ready) * cap + 1);
+  c->timers = CO_ALLOC(sizeof(*c->timers) * cap + 1);
+  c->polled = CO_ALLOC(sizeof(*c->polled) * cap + 1);
+#ifndef _WIN32
+  c->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(c->epfd < 0) {
+    c->epfd = -1;
+  }
+#endif // _WIN32
+
+  if(!c->ready || !c->timers || !c->polled
+#ifndef _WIN32
+     || c->epfd < 0
+#endif // _WIN32
+     ) {
+    co_sched_close(c);
+    return 0;
+  }
+
+  return 1;
+}
+
+CO_DEF void co_sched_close(Co_Sched *c) {
+  if(c->ready) CO_FREE(c->ready);
+  if(c->timers) CO_FREE(c->timers);
+  if(c->polled) CO_FREE(c->polled);
+  c->ready = NULL;
+  c->timers = NULL;
+  c->polled = NULL;
+#ifndef _WIN32
+  if(c->epfd >= 0) close(c->epfd);
+  c->epfd = -1;
+#endif // _WIN32
+}
+
+CO_DEF void co_sched_timers_set(Co_Sched *c, u64 pos, Co *co) {
+  c->timers[pos] = co;
+  co->pos = pos;
+}
+
+CO_DEF void co_sched_timers_up(Co_Sched *c, u64 pos) {
+  Co *co = c->timers[pos];
+  while(pos > 0) {
+    u64 parent = (pos - 1) / 2;
+    if(c->timers[parent]->deadline <= co->deadline) {
+      break;
+    }
+    co_sched_timers_set(c, pos, c->timers[parent]);
+    pos = parent;
+  }
+  co_sched_timers_set(c, pos, co);
+}
+
+CO_DEF void co_sched_timers_down(Co_Sched *c, u64 pos) {
+  Co *co = c->timers[pos];
+  while(1) {
+    u64 child = 2 * pos + 1;
+    if(child >= c->timers_len) {
+      break;
+    }
+    if(child + 1 < c->timers_len &&
+       c->timers[child + 1]->deadline < c->timers[child]->deadline) {
+      child++;
+    }
+    if(co->deadline <= c->timers[child]->deadline) {
+      break;
+    }
+    co_sched_timers_set(c, pos, c->timers[child]);
+    pos = child;
+  }
+  co_sched_timers_set(c, pos, co);
+}
+
+CO_DEF void co_sched_push_ready(Co_Sched *c, Co *co) {
+  c->ready[(c->ready_pos + c->ready_len++) % c->cap] = co;
+  co->list = CO_SCHED_READY;
+}
+
+CO_DEF void co_sched_push_polled(Co_Sched *c, Co *co) {
+  co->pos = c->polled_len;
+  c->polled[c->polled_len++] = co;
+  co->list = CO_SCHED_POLLED;
+}
+
+CO_DEF void co_sched_wait(Co_Sched *c, Co *co) {
+  co_sched_cancel(c, co);
+
+  switch(co->wait) {
+  case CO_WAIT_TIMER:
+    co->list = CO_SCHED_TIMERS;
+    c->timers[c->timers_len] = co;
+    co_sched_timers_up(c, c->timers_len++);
+    break;
+  case CO_WAIT_READ:
+  case CO_WAIT_WRITE: {
+#ifdef _WIN32
+    co_sched_push_polled(c, co);
+#else
+    struct epoll_event ev;
+    ev.events = (co->wait == CO_WAIT_READ ? EPOLLIN : EPOLLOUT) | EPOLLONESHOT;
+    ev.data.ptr = co;
+    if(epoll_ctl(c->epfd, EPOLL_CTL_ADD, co->fd, &ev) == 0) {
+      co->list = CO_SCHED_EPOLL;
+    } else if(errno == EEXIST) {
+      // Another coroutine waits for the same fd
+      co_sched_push_polled(c, co);
+    } else {
+      // Regular files are always ready, errors are reported by the next
+      // read/write
+      co_sched_push_ready(c, co);
+    }
+#endif // _WIN32
+  } break;
+  case CO_WAIT_FLAG:
+    co_sched_push_polled(c, co);
+    break;
+  default:
+    co_sched_push_ready(c, co);
+    break;
+  }
+}
+
+CO_DEF void co_sched_cancel(Co_Sched *c, Co *co) {
+  switch(co->list) {
+  case CO_SCHED_READY:
+    for(u64 i=0;i<c->ready_len;i++) {
+      u64 j = (c->ready_pos + i) % c->cap;
+      if(c->ready[j] != co) {
+	continue;
+      }
+      // Keep the order of the others
+      for(;i+1<c->ready_len;i++) {
+	c->ready[(c->ready_pos + i) % c->cap] = c->ready[(c->ready_pos + i + 1) % c->cap];
+      }
+      c->ready_len--;
+      break;
+    }
+    break;
+  case CO_SCHED_TIMERS: {
+    Co *last = c->timers[--c->timers_len];
+    if(last != co) {
+      co_sched_timers_set(c, co->pos, last);
+      co_sched_timers_up(c, last->pos);
+      co_sched_timers_down(c, last->pos);
+    }
+  } break;
+  case CO_SCHED_POLLED:
+    c->polled_len--;
+    if(co->pos < c->polled_len) {
+      c->polled[co->pos] = c->polled[c->polled_len];
+      c->polled[co->pos]->pos = co->pos;
+    }
+    break;
+  case CO_SCHED_EPOLL:
+#ifndef _WIN32
+    epoll_ctl(c->epfd, EPOLL_CTL_DEL, co->fd, NULL);
+#endif // _WIN32
+    break;
+  default:
+    break;
+  }
+
+  co->list = CO_SCHED_NONE;
+}
+
+CO_DEF void co_sched_poll(Co_Sched *c) {
+#ifndef _WIN32
+  struct epoll_event events[CO_SCHED_EVENTS];
+  int n;
+  do {
+    n = epoll_wait(c->epfd, events, CO_SCHED_EVENTS, 0);
+    for(int i=0;i<n;i++) {
+      Co *co = events[i].data.ptr;
+      co_sched_cancel(c, co);
+      co_sched_push_ready(c, co);
+    }
+  } while(n == CO_SCHED_EVENTS);
+#endif // _WIN32
+
+  u64 now = co_now();
+  while(c->timers_len > 0 && c->timers[0]->deadline <= now) {
+    Co *co = c->timers[0];
+    co_sched_cancel(c, co);
+    co_sched_push_ready(c, co);
+  }
+
+  for(u64 i=c->polled_len;i>0;i--) {
+    Co *co = c->polled[i - 1];
+    if(co_ready(co)) {
+      co_sched_cancel(c, co);
+      co_sched_push_ready(c, co);
+    }
+  }
+}
+
+CO_DEF Co *co_sched_next(Co_Sched *c) {
+  if(c->ready_len == 0) {
+    return NULL;
+  }
+
+  Co *co = c->ready[c->ready_pos];
+  c->ready_pos = (c->ready_pos + 1) % c->cap;
+  c->ready_len--;
+  co->list = CO_SCHED_NONE;
+  return co;
+}
+
+#endif // CO_IMPLEMENTATION
+
+#undef u64
+
+#endif // CO_H
@@ -37,6 +37,8 @@
 
 #ifdef _WIN32
 #  include <windows.h>
+#  include <time.h>
+#  include <wchar.h>
 
 #  define FS_SEP "\r\n"
 #  define FS_DELIM '\\'
@@ -44,14 +46,22 @@
 
 #else // _WIN32
 #  include <string.h>
+#  include <stdlib.h>
 #  include <fcntl.h>
 #  include <unistd.h>
 #  include <errno.h>
 #  include <sys/types.h>
 #  include <sys/stat.h>
+#  include <sys/mman.h>
 #  include <linux/limits.h>
+#  include <linux/falloc.h>
+#  include <sys/syscall.h>
 #  include <time.h>
 #  include <dirent.h>
+#  include <pthread.h>
+#  include <sys/inotify.h>
+#  include <sys/ioctl.h>
+#  include <sys/resource.h>
 
 #  define FS_SEP "\n"
 #  define FS_DELIM '/'
@@ -85,6 +95,11 @@ typedef enum {
   FS_ERROR_FILE_NOT_FOUND,
   FS_ERROR_INVALID_NAME,
   FS_ERROR_ACCESS_DENIED,
+  FS_ERROR_UNSUPPORTED,
+  FS_ERROR_IS_DIRECTORY,
+  FS_ERROR_LIMIT, // of open files, watches or space
+  FS_ERROR_EXISTS,
+  FS_ERROR_NOT_EMPTY,
 } Fs_Error;
 
 FS_DEF Fs_Error fs_error_last();
@@ -100,6 +115,15 @@ typedef struct {
 
 FS_DEF void fs_time_get(Fs_Time *t);
 
+typedef struct {
+  int is_dir;
+  u64 size;
+  u64 mtime; // seconds since 1970, UTC
+  u64 id;    // inode, tells a replaced file apart. 0 on windows
+} Fs_Stat;
+
+typedef struct Fs_Shared_File Fs_Shared_File;
+
 typedef struct {
 #ifdef _WIN32
   HANDLE handle;
@@ -108,6 +132,7 @@ typedef struct {
 #endif // _WIN32
   u64 size;
   u64 pos;
+  Fs_Shared_File *shared; // set by 'fs_shared_file_ref', 'fs_file_close' releases it
 } Fs_File;
 
 FS_DEF Fs_Error fs_file_stdin(Fs_File *f);
@@ -121,6 +146,29 @@ FS_DEF Fs_Error fs_file_wopen(Fs_File *f,
 			      u64 name_len);
 #define fs_file_wopenc(f, n) fs_file_wopen((f), (Fs_u8 *) (n), strlen(n))
 #define fs_file_wopens(f, s) fs_file_wopen((f), (s).data, (s).len)
+// - opens for writing, without truncating, 'f->pos' is at the end
+FS_DEF Fs_Error fs_file_aopen(Fs_File *f,
+			      u8 *name,
+			      u64 name_len);
+#define fs_file_aopenc(f, n) fs_file_aopen((f), (Fs_u8 *) (n), strlen(n))
+#define fs_file_aopens(f, s) fs_file_aopen((f), (s).data, (s).len)
+// - like 'fs_file_wopen', past the page cache (O_DIRECT). Every write must be
+//   aligned to FS_DIRECT_ALIGN in address, offset and length.
+//   FS_ERROR_UNSUPPORTED, if the filesystem can not do it (tmpfs)
+FS_DEF Fs_Error fs_file_dopen(Fs_File *f,
+			      u8 *name,
+			      u64 name_len);
+#define fs_file_dopenc(f, n) fs_file_dopen((f), (Fs_u8 *) (n), strlen(n))
+#define fs_file_dopens(f, s) fs_file_dopen((f), (s).data, (s).len)
+// - creates 'name' for writing, FS_ERROR_EXISTS if it is there already.
+//   With '*direct' it is written past the page cache, if the filesystem can.
+//   '*direct' tells, if it does
+FS_DEF Fs_Error fs_file_copen(Fs_File *f,
+			      u8 *name,
+			      u64 name_len,
+			      int *direct);
+#define fs_file_copenc(f, n, d) fs_file_copen((f), (Fs_u8 *) (n), strlen(n), (d))
+#define fs_file_copens(f, s, d) fs_file_copen((f), (s).data, (s).len, (d))
 
 FS_DEF Fs_Error fs_file_read(Fs_File *f,
 			     u8 *buf,
@@ -131,8 +179,110 @@ FS_DEF Fs_Error fs_file_write(Fs_File *f,
 			      u64 len,
 			      u64 *written);
 FS_DEF Fs_Error fs_file_seek(Fs_File *f, u64 offset);
+// - read/write at 'offset', 'f->pos' is neither used nor changed. Concurrent
+//   calls on one 'f' do not interfere, on Windows the cursor of 'f' moves
+FS_DEF Fs_Error fs_file_pread(Fs_File *f,
+			      u64 offset,
+			      u8 *buf,
+			      u64 len,
+			      u64 *read);
+FS_DEF Fs_Error fs_file_pwrite(Fs_File *f,
+			       u64 offset,
+			       u8 *buf,
+			       u64 len,
+			       u64 *written);
+// - allocates disk space for 'size' bytes up front, without changing the size
+//   of 'f'. Only a hint, FS_ERROR_NONE if the filesystem can not do it
+FS_DEF Fs_Error fs_file_reserve(Fs_File *f, u64 size);
+// - cuts or extends 'f' to 'size' bytes, 'f->pos' stays
+FS_DEF Fs_Error fs_file_truncate(Fs_File *f, u64 size);
+// - waits until the writes to 'f' are on the disk. 'data_only' skips
+//   metadata, that is not needed to read the data back (mtime)
+FS_DEF Fs_Error fs_file_sync(Fs_File *f, int data_only);
+
+#ifndef FS_COPY_BUF_SIZE
+#  define FS_COPY_BUF_SIZE (1 << 20)
+#endif // FS_COPY_BUF_SIZE
+
+// - copies 'len' bytes of 'src' at 'src_offset' to 'dst' at 'dst_offset',
+//   in the kernel where it can: a reflink (FICLONE), if the whole of 'src'
+//   goes to an empty 'dst', else 'copy_file_range'. The cursors are unused.
+//   'copied' is less than 'len', if 'src' ends before
+FS_DEF Fs_Error fs_file_copy(Fs_File *src,
+			     u64 src_offset,
+			     Fs_File *dst,
+			     u64 dst_offset,
+			     u64 len,
+			     u64 *copied);
+// - what 'fs_file_copy' falls back to, 'fs_file_pread' and 'fs_file_pwrite'
+//   through a buffer of FS_COPY_BUF_SIZE
+FS_DEF Fs_Error fs_file_copy_buffered(Fs_File *src,
+				      u64 src_offset,
+				      Fs_File *dst,
+				      u64 dst_offset,
+				      u64 len,
+				      u64 *copied);
 FS_DEF void fs_file_close(Fs_File *f);
 
+// Hints of 'fs_file_map', ignored where the system has no equivalent
+#define FS_MAP_SEQUENTIAL 0x1 // read front to back, read ahead more and drop behind
+#define FS_MAP_WILLNEED   0x2 // start reading in now
+#define FS_MAP_HUGEPAGE   0x4 // back with huge pages, if the filesystem can
+#define FS_MAP_ALLOCATED  0x8 // set by 'fs_load_file', 'data' is a heap copy
+
+typedef struct {
+  u8 *data;
+  u64 len;
+
+  u8 *base; // page aligned, 'data' lies in it
+  u64 base_len;
+  int flags;
+} Fs_Map;
+
+// - maps 'len' bytes of 'f' from 'offset' read-only, 'f' may be closed afterwards.
+//   FS_ERROR_UNSUPPORTED, if 'f' can not be mapped (pipes, some devices)
+FS_DEF Fs_Error fs_file_map(Fs_File *f, Fs_Map *m, u64 offset, u64 len, int flags);
+// - maps at most 'window' bytes from 'offset', in place of what 'm' mapped
+//   before. 'm' starts zeroed. FS_ERROR_EOF, once 'offset' is at the end
+//
+//   Fs_Map m = {0};
+//   for(u64 off=0;fs_file_map_window(&f, &m, off, window, 0) == FS_ERROR_NONE;off+=m.len) ...
+//   fs_file_unmap(&m);
+//
+FS_DEF Fs_Error fs_file_map_window(Fs_File *f, Fs_Map *m, u64 offset, u64 window, int flags);
+FS_DEF void fs_file_unmap(Fs_Map *m);
+
+#ifdef _MSC_VER
+#  define fs_atomic_inc(n) InterlockedIncrement((n))
+#  define fs_atomic_dec(n) InterlockedDecrement((n))
+#  define fs_atomic_get(n) InterlockedOr((n), 0)
+#  define fs_atomic_set(n, v) InterlockedExchange((n), (v))
+#else
+#  define fs_atomic_inc(n) __atomic_add_fetch((n), 1, __ATOMIC_ACQ_REL)
+#  define fs_atomic_dec(n) __atomic_sub_fetch((n), 1, __ATOMIC_ACQ_REL)
+#  define fs_atomic_get(n) __atomic_load_n((n), __ATOMIC_ACQUIRE)
+#  define fs_atomic_set(n, v) __atomic_store_n((n), (v), __ATOMIC_RELEASE)
+#endif // _MSC_VER
+
+// A read-only file, that many readers share. Each reader keeps its own
+// offset and reads with 'fs_file_pread', the cursor of 'file' is unused
+struct Fs_Shared_File {
+  Fs_File file;
+  volatile long refs; // atomic, retain/release from any thread
+};
+
+// - opens 'name' with one reference
+FS_DEF Fs_Error fs_shared_file_ropen(Fs_Shared_File **s,
+				     u8 *name,
+				     u64 name_len);
+#define fs_shared_file_ropenc(s, n) fs_shared_file_ropen((s), (Fs_u8 *) (n), strlen(n))
+#define fs_shared_file_ropens(s, str) fs_shared_file_ropen((s), (str).data, (str).len)
+FS_DEF Fs_Shared_File *fs_shared_file_retain(Fs_Shared_File *s);
+// - retains 's' for 'f', that reads from offset 0. 'fs_file_close(f)' releases it
+FS_DEF void fs_shared_file_ref(Fs_Shared_File *s, Fs_File *f);
+// - closes 's', once the last reference is released
+FS_DEF void fs_shared_file_release(Fs_Shared_File *s);
+
 ////////////////////////////////////////////////////
 
 #define FS_DIR_ENTRY_IS_DIR 0x1
@@ -148,6 +298,7 @@ typedef struct {
   u32 flags;
   u64 size;
   Fs_Time time;
+  u64 mtime; // seconds since 1970, UTC
 } Fs_Dir_Entry;
 
 typedef struct {
@@ -175,6 +326,326 @@ FS_DEF void fs_dir_close(Fs_Dir *d);
 
 ////////////////////////////////////////////////////
 
+// A directory, that is read in batches of FS_ITER_BUF_SIZE bytes. An
+// entry is only its name and type, 'fs_iter_stat' asks for the rest:
+//
+//   Fs_Iter it;
+//   Fs_Iter_Entry e;
+//   if(fs_iter_openc(&it, "dir/") != FS_ERROR_NONE) ...
+//   while(fs_iter_next(&it, &e) == FS_ERROR_NONE) ...
+//   fs_iter_close(&it);
+
+#ifndef FS_ITER_BUF_SIZE
+#  define FS_ITER_BUF_SIZE (32 * 1024)
+#endif // FS_ITER_BUF_SIZE
+
+typedef enum {
+  FS_TYPE_UNKNOWN = 0, // the filesystem does not tell, 'fs_iter_stat' does
+  FS_TYPE_FILE,
+  FS_TYPE_DIR,
+  FS_TYPE_LINK,
+  FS_TYPE_OTHER,
+} Fs_Type;
+
+typedef struct {
+  u8 *name; // 0-terminated, valid until the next 'fs_iter_next'
+  u64 name_len;
+  Fs_Type type;
+} Fs_Iter_Entry;
+
+typedef struct {
+#ifdef _WIN32
+  HANDLE handle;
+  WIN32_FIND_DATAW find_data;
+  int pending; // 'find_data' is not returned yet
+  u8 name[FS_MAX_PATH];
+#else
+  s32 fd;
+  u8 *buf; // FS_ITER_BUF_SIZE bytes of 'getdents64'
+  u64 pos;
+  u64 len;
+#endif // _WIN32
+} Fs_Iter;
+
+FS_DEF Fs_Error fs_iter_open(Fs_Iter *it, u8 *name, u64 name_len);
+#define fs_iter_openc(it, cstr) fs_iter_open((it), (Fs_u8 *) (cstr), strlen(cstr))
+#define fs_iter_opens(it, s) fs_iter_open((it), (s).data, (s).len)
+// - skips '.' and '..', FS_ERROR_EOF after the last entry
+FS_DEF Fs_Error fs_iter_next(Fs_Iter *it, Fs_Iter_Entry *e);
+// - stats 'e' relative to the open directory, links are not followed.
+//   Sets 'e->type', if it is FS_TYPE_UNKNOWN
+FS_DEF Fs_Error fs_iter_stat(Fs_Iter *it, Fs_Iter_Entry *e, Fs_Stat *s);
+FS_DEF void fs_iter_close(Fs_Iter *it);
+
+// The tree below a directory, walked by many threads. A thread pushes the
+// subdirectories it finds onto a queue of FS_WALK_QUEUE_CAP, that every
+// thread takes from. Once it is full, a thread walks them itself.
+
+#ifndef FS_WALK_QUEUE_CAP
+#  define FS_WALK_QUEUE_CAP 4096
+#endif // FS_WALK_QUEUE_CAP
+
+#ifndef FS_WALK_THREADS_MAX
+#  define FS_WALK_THREADS_MAX 64
+#endif // FS_WALK_THREADS_MAX
+
+typedef enum {
+  FS_WALK_CONTINUE = 0,
+  FS_WALK_SKIP, // do not descend into 'e'
+  FS_WALK_STOP,
+} Fs_Walk_Result;
+
+// - called for every entry, from many threads at once. 'dir' ends with a
+//   delimiter, 'it' is open on it for 'fs_iter_stat'
+typedef Fs_Walk_Result (*Fs_Walk_Proc)(u8 *dir, u64 dir_len, Fs_Iter *it, Fs_Iter_Entry *e, void *data);
+
+typedef struct {
+  Fs_Walk_Proc proc;
+  void *data;
+
+  u8 *queue[FS_WALK_QUEUE_CAP]; // directories, that no thread took yet
+  u64 queue_len;
+  u64 busy; // threads, that walk a directory
+  volatile long stop; // atomic, read without the lock
+
+#ifdef _WIN32
+  CRITICAL_SECTION lock;
+  CONDITION_VARIABLE cond;
+#else
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif // _WIN32
+} Fs_Walk;
+
+// - walks 'name' with 'threads' threads, the caller is one of them.
+//   Directories, that can not be opened, are skipped and links are not followed
+FS_DEF Fs_Error fs_walk(u8 *name, u64 name_len, u64 threads, Fs_Walk_Proc proc, void *data);
+#define fs_walkc(cstr, n, p, d) fs_walk((Fs_u8 *) (cstr), strlen(cstr), (n), (p), (d))
+#define fs_walks(s, n, p, d) fs_walk((s).data, (s).len, (n), (p), (d))
+
+////////////////////////////////////////////////////
+
+// A directory, that is read once and reused until it changes. Writing
+// into a file does not change the mtime of its directory, hence a
+// listing is read again, once it is FS_LISTING_MAX_AGE seconds old.
+
+#ifndef FS_LISTING_CACHE_CAP
+#  define FS_LISTING_CACHE_CAP 16
+#endif // FS_LISTING_CACHE_CAP
+
+#ifndef FS_LISTING_MAX_AGE
+#  define FS_LISTING_MAX_AGE 2
+#endif // FS_LISTING_MAX_AGE
+
+typedef struct {
+  u8 *name; // 0-terminated, points into 'Fs_Listing.names'
+  u64 name_len;
+
+  u32 flags; // FS_DIR_ENTRY_IS_DIR
+  u64 size;
+  Fs_Time time;
+  u64 mtime; // seconds since 1970, UTC
+} Fs_Listing_Entry;
+
+typedef struct {
+  Fs_Path name;
+  u64 name_len;
+
+  u64 stamp;   // modification of the directory, before it was read
+  u64 read_at; // seconds since 1970
+  u64 used_at; // 'Fs_Listing_Cache.tick' of the last lookup, 0 if unused
+
+  Fs_Listing_Entry *entries;
+  u64 entries_len;
+  u64 entries_cap;
+
+  u8 *names;
+  u64 names_len;
+  u64 names_cap;
+} Fs_Listing;
+
+// Zero-initialized, it is empty
+typedef struct {
+  Fs_Listing listings[FS_LISTING_CACHE_CAP];
+  u64 tick;
+  int watched; // an 'Fs_Watch' drops changed directories, lookups do not check them
+} Fs_Listing_Cache;
+
+// - lookup the directory 'name', that ends with a delimiter. Read it, if
+//   it is not cached or outdated. The least recently used one is evicted
+// - '*l' has no '.' and '..' and stays valid until the next lookup
+FS_DEF Fs_Error fs_listing_get(Fs_Listing_Cache *c, u8 *name, u64 name_len, Fs_Listing **l);
+#define fs_listing_getc(c, cstr, l) fs_listing_get((c), (Fs_u8 *) (cstr), strlen(cstr), (l))
+#define fs_listing_gets(c, s, l) fs_listing_get((c), (s).data, (s).len, (l))
+FS_DEF void fs_listing_cache_free(Fs_Listing_Cache *c);
+// - drops the directory with 'hash', see 'fs_file_cache_hash'
+FS_DEF void fs_listing_invalidate(Fs_Listing_Cache *c, u64 hash);
+// - a stamp, that changes whenever an entry of the directory 'name' is added, removed or renamed
+FS_DEF Fs_Error fs_listing_stamp(u8 *name, u64 name_len, u64 *stamp);
+FS_DEF Fs_Error fs_listing_read(Fs_Listing *l);
+
+////////////////////////////////////////////////////
+
+// Files, that are stat'ed and opened once and shared by every request
+// until they change. An entry is checked again, once it is
+// FS_FILE_CACHE_MAX_AGE seconds old, and reopened if its size, mtime or
+// inode moved. Names, that do not exist, are cached as well.
+//
+// A cache keeps a share of RLIMIT_NOFILE open, the rest is for sockets.
+// Once it is used up, the descriptors no file reads from are closed, their
+// entries keep the stat. If every one is read from, a file is opened without
+// keeping it.
+
+#ifndef FS_FILE_CACHE_CAP
+#  define FS_FILE_CACHE_CAP 1024 // a power of 2
+#endif // FS_FILE_CACHE_CAP
+
+#ifndef FS_FILE_CACHE_WAYS
+#  define FS_FILE_CACHE_WAYS 4
+#endif // FS_FILE_CACHE_WAYS
+
+#ifndef FS_FILE_CACHE_MAX_AGE
+#  define FS_FILE_CACHE_MAX_AGE 2
+#endif // FS_FILE_CACHE_MAX_AGE
+
+#ifndef FS_FILE_CACHE_FDS
+#  define FS_FILE_CACHE_FDS 64 // descriptors kept open, if RLIMIT_NOFILE does not tell
+#endif // FS_FILE_CACHE_FDS
+
+#ifndef FS_FILE_CACHE_FDS_SHARE
+#  define FS_FILE_CACHE_FDS_SHARE 8 // a cache keeps 1/8 of RLIMIT_NOFILE open
+#endif // FS_FILE_CACHE_FDS_SHARE
+
+typedef struct {
+  u8 *name;
+  u64 name_len;
+  u64 name_cap;
+  u64 hash;
+
+  Fs_Error error; // of the last check, FS_ERROR_NONE if the name exists
+  Fs_Stat stat;
+  Fs_Shared_File *file; // opened by the first 'fs_file_cache_open'
+
+  u64 checked_at; // seconds since 1970
+  u64 used_at;    // 'Fs_File_Cache.tick' of the last lookup, 0 if unused
+} Fs_File_Cache_Entry;
+
+// Zero-initialized, it is empty. One per thread, it has no lock
+typedef struct {
+  Fs_File_Cache_Entry *entries; // FS_FILE_CACHE_CAP, allocated by the first lookup
+  u64 tick;
+  int watched; // an 'Fs_Watch' drops changed names, entries do not expire
+
+  u64 files_len; // open descriptors of 'entries'
+  u64 files_cap; // set by the first lookup, if 0
+} Fs_File_Cache;
+
+FS_DEF Fs_Error fs_file_cache_stat(Fs_File_Cache *c, u8 *name, u64 name_len, Fs_Stat *s);
+#define fs_file_cache_statc(c, cstr, s) fs_file_cache_stat((c), (Fs_u8 *) (cstr), strlen(cstr), (s))
+#define fs_file_cache_stats(c, str, s) fs_file_cache_stat((c), (str).data, (str).len, (s))
+// - opens the regular file 'name' for reading, like 'fs_file_ropen'. 'f' shares
+//   the cached descriptor, read it with 'fs_file_pread'. 'fs_file_close' releases it
+FS_DEF Fs_Error fs_file_cache_open(Fs_File_Cache *c, u8 *name, u64 name_len, Fs_File *f);
+#define fs_file_cache_openc(c, cstr, f) fs_file_cache_open((c), (Fs_u8 *) (cstr), strlen(cstr), (f))
+#define fs_file_cache_opens(c, str, f) fs_file_cache_open((c), (str).data, (str).len, (f))
+// - the same for every spelling of a path: '/' and FS_DELIM, repeated,
+//   trailing delimiters and './' do not matter
+FS_DEF u64 fs_file_cache_hash(u8 *name, u64 name_len);
+#define fs_file_cache_hashc(cstr) fs_file_cache_hash((Fs_u8 *) (cstr), strlen(cstr))
+#define fs_file_cache_hashs(s) fs_file_cache_hash((s).data, (s).len)
+// - drops the name with 'hash', after it was written, moved or deleted.
+//   Names, that collide with it, are dropped too
+FS_DEF void fs_file_cache_invalidate(Fs_File_Cache *c, u64 hash);
+FS_DEF void fs_file_cache_clear(Fs_File_Cache *c);
+// - closes the descriptors, no file reads from. The entries keep the stat
+FS_DEF void fs_file_cache_trim(Fs_File_Cache *c);
+FS_DEF void fs_file_cache_free(Fs_File_Cache *c);
+
+////////////////////////////////////////////////////
+
+// Changes below directories, read from inotify. The events of one read
+// are coalesced, a file that is written in many pieces is one event.
+// 'fd' is readable, once there are events. Register it in 'Ip_Sockets'
+// like a listener:
+//
+//   Fs_Watch w;
+//   fs_watch_open(&w);
+//   fs_watch_addc(&w, "./rsc/");
+//   ip_sockets_get(&sockets, off)->_socket = w.fd;
+//   ip_sockets_get(&sockets, off)->flags = IP_VALID | IP_SERVER;
+//   ip_sockets_register(&sockets, off);
+//   ...
+//   // on IP_MODE_READ
+//   Fs_Watch_Event e;
+//   while(fs_watch_next(&w, &e) == FS_ERROR_NONE) fs_watch_invalidate(&e, &files, &listings);
+//
+// On windows every 'fs_watch_*' is FS_ERROR_UNSUPPORTED, keep the caches unwatched there
+
+#ifndef FS_WATCH_BUF_SIZE
+#  define FS_WATCH_BUF_SIZE (64 * 1024)
+#endif // FS_WATCH_BUF_SIZE
+
+#define FS_WATCH_CHANGED  0x01 // written or its attributes changed
+#define FS_WATCH_CREATED  0x02 // created or moved here
+#define FS_WATCH_REMOVED  0x04 // deleted or moved away
+#define FS_WATCH_IS_DIR   0x08
+#define FS_WATCH_OVERFLOW 0x10 // events were lost, anything may have changed. 'path' is empty
+#define FS_WATCH_UNWATCHED 0x20 // a directory of 'path' could not be watched, its changes are missed
+
+typedef struct {
+  u8 *path; // 0-terminated, valid until the next 'fs_watch_next'
+  u64 path_len;
+  u32 flags;
+} Fs_Watch_Event;
+
+typedef struct {
+  u8 *path; // ends with a delimiter, NULL if unused
+  u64 path_len;
+  int moved; // away, unwatched after the read it was in, unless it came back
+} Fs_Watch_Dir;
+
+typedef struct {
+  s32 fd;
+
+  Fs_Watch_Dir *dirs; // indexed by the watch descriptor
+  u64 dirs_cap;
+  Fs_Watch_Dir *roots; // of 'fs_watch_add', watched again after an overflow
+  u64 roots_len;
+  u64 roots_cap;
+  u64 moved_len; // of 'dirs'
+
+  u8 *buf; // FS_WATCH_BUF_SIZE bytes of one read
+  u64 buf_pos;
+  u64 buf_len;
+
+  Fs_Watch_Event *events; // coalesced from 'buf'
+  u64 events_len;
+  u64 events_pos;
+  u64 events_cap;
+  u32 *table; // 1 + index into 'events', by the hash of the path
+  u64 table_cap;
+  u8 *names; // paths of 'events'
+  u64 names_len;
+} Fs_Watch;
+
+FS_DEF Fs_Error fs_watch_open(Fs_Watch *w);
+// - watches 'name' and every directory below it. Directories, that are
+//   created or moved in later, are watched once their event is read
+// - the error of the first directory below, that could not be watched.
+//   The others still are, but the caches can not rely on it
+FS_DEF Fs_Error fs_watch_add(Fs_Watch *w, u8 *name, u64 name_len);
+#define fs_watch_addc(w, cstr) fs_watch_add((w), (Fs_u8 *) (cstr), strlen(cstr))
+#define fs_watch_adds(w, s) fs_watch_add((w), (s).data, (s).len)
+// - the next event, FS_ERROR_EOF if there is none. Never blocks
+FS_DEF Fs_Error fs_watch_next(Fs_Watch *w, Fs_Watch_Event *e);
+FS_DEF void fs_watch_close(Fs_Watch *w);
+// - drops what 'e' changed from 'files' and 'listings', either may be NULL.
+//   Every name below a directory, that moved, changed. Both are cleared then
+// - FS_WATCH_UNWATCHED clears them and sets 'watched' back to 0
+FS_DEF void fs_watch_invalidate(Fs_Watch_Event *e, Fs_File_Cache *files, Fs_Listing_Cache *listings);
+
+////////////////////////////////////////////////////
+
 FS_DEF Fs_Error fs_slurp_file(u8 *name,
 			      u64 name_len,
 			      u8 **data,
@@ -182,6 +653,20 @@ FS_DEF Fs_Error fs_slurp_file(u8 *name,
 #define fs_slurp_filec(cstr, d, ds) fs_slurp_file((Fs_u8 *) (cstr), strlen((cstr)), (d), (ds))
 #define fs_slurp_files(s, d, ds) fs_slurp_file((s).data, (s).len, (d), (ds))
 
+// Files below this are read, mapping them costs more than the copy
+#ifndef FS_LOAD_MAP_MIN
+#  define FS_LOAD_MAP_MIN (64 * 1024)
+#endif // FS_LOAD_MAP_MIN
+
+// - maps the file 'name' or, if it is small or can not be mapped, reads it.
+//   Either way 'fs_file_unmap' releases 'm'
+FS_DEF Fs_Error fs_load_file(u8 *name,
+			     u64 name_len,
+			     Fs_Map *m,
+			     int flags);
+#define fs_load_filec(cstr, m, fl) fs_load_file((Fs_u8 *) (cstr), strlen((cstr)), (m), (fl))
+#define fs_load_files(s, m, fl) fs_load_file((s).data, (s).len, (m), (fl))
+
 FS_DEF Fs_Error fs_write_file(u8 *name,
 			      u64 name_len,
 			      u8 *data,
@@ -189,18 +674,101 @@ FS_DEF Fs_Error fs_write_file(u8 *name,
 #define fs_write_filec(cstr, d, ds) fs_write_file((Fs_u8 *) (cstr), strlen((cstr)), (d), (ds))
 #define fs_write_files(s, d, ds) fs_write_file((s).data, (s).len, (d), (ds))
 
+// Buffered writing of a file. Small writes collect in 'buf' and leave in
+// one 'fs_file_write', once it is full:
+//
+//   Fs_Writer w;
+//   if(fs_writer_openc(&w, "out.bin", 0, 0, FS_WRITER_ATOMIC | FS_WRITER_FDATASYNC) != FS_ERROR_NONE) ...
+//   fs_writer_write(&w, &id, 1); ...
+//   if(fs_writer_close(&w) != FS_ERROR_NONE) ...
+//
+// Errors stick, every later call returns the first one
+
+#ifndef FS_WRITER_BUF_SIZE
+#  define FS_WRITER_BUF_SIZE (1 << 18)
+#endif // FS_WRITER_BUF_SIZE
+
+#ifndef FS_DIRECT_ALIGN
+#  define FS_DIRECT_ALIGN 4096
+#endif // FS_DIRECT_ALIGN
+
+#define FS_WRITER_DIRECT    0x1 // 'fs_file_dopen', if the filesystem can
+#define FS_WRITER_ATOMIC    0x2 // writes '<name>.XXXXXX.tmp', 'fs_writer_close' renames it to 'name'
+#define FS_WRITER_FSYNC     0x4 // sync on close and every 'sync_every' bytes
+#define FS_WRITER_FDATASYNC 0x8 // the same, without the metadata
+
+typedef struct {
+  Fs_File file;
+  int flags;
+
+  u8 *buf; // aligned to FS_DIRECT_ALIGN
+  u64 len;
+  u64 cap;
+  u8 *mem;
+
+  u64 written;    // to 'file', without what is in 'buf'
+  u64 sync_every; // bytes between two syncs, 0 syncs on close only
+  u64 unsynced;
+  Fs_Error error;
+
+  u8 *name;
+  u64 name_len;
+  u8 *tmp; // FS_WRITER_ATOMIC
+  u64 tmp_len;
+} Fs_Writer;
+
+// - 'cap' of 0 is FS_WRITER_BUF_SIZE. With a sync flag, every 'sync_every'
+//   bytes are synced, 0 syncs on close only
+// - FS_WRITER_ATOMIC creates a new temporary file next to 'name', which
+//   gets the permissions of the file it replaces. Without the sync flags it
+//   only hides a half written file from readers, it does not survive a crash
+FS_DEF Fs_Error fs_writer_open(Fs_Writer *w, u8 *name, u64 name_len, u64 cap, u64 sync_every, int flags);
+#define fs_writer_openc(w, cstr, c, se, fl) fs_writer_open((w), (Fs_u8 *) (cstr), strlen(cstr), (c), (se), (fl))
+#define fs_writer_opens(w, s, c, se, fl) fs_writer_open((w), (s).data, (s).len, (c), (se), (fl))
+FS_DEF Fs_Error fs_writer_write(Fs_Writer *w, u8 *data, u64 len);
+// - hands 'buf' to the kernel. With FS_WRITER_DIRECT an unaligned tail stays
+FS_DEF Fs_Error fs_writer_flush(Fs_Writer *w);
+// - 'fs_writer_flush' and waits until it is on the disk
+FS_DEF Fs_Error fs_writer_sync(Fs_Writer *w);
+// - flushes, syncs with a sync flag and renames with FS_WRITER_ATOMIC.
+//   On an error the temporary file is deleted and 'name' untouched
+FS_DEF Fs_Error fs_writer_close(Fs_Writer *w);
+// - closes without flushing. With FS_WRITER_ATOMIC nothing happened to 'name'
+FS_DEF void fs_writer_abort(Fs_Writer *w);
+
 FS_DEF int fs_exists(u8 *name, u64 name_len, int *is_file);
 #define fs_existsc(cstr, f) fs_exists((Fs_u8 *) (cstr), strlen(cstr), f)
 #define fs_existss(s, f) fs_exists((s).data, (s).len, f)
 
+FS_DEF Fs_Error fs_stat(u8 *name, u64 name_len, Fs_Stat *s);
+#define fs_statc(cstr, s) fs_stat((Fs_u8 *) (cstr), strlen(cstr), (s))
+#define fs_stats(str, s) fs_stat((str).data, (str).len, (s))
+
 FS_DEF Fs_Error fs_delete(u8 *name, u64 name_len);
 #define fs_deletec(cstr) fs_delete((Fs_u8 *) (cstr), strlen(cstr))
 #define fs_deletes(s) fs_delete((s).data, (s).len)
 
+// - renames 'src' to 'dst', replacing it. Files on another filesystem
+//   are copied with 'fs_copy' and deleted
 FS_DEF Fs_Error fs_move(u8 *src, u64 src_len, u8 *dst, u64 dst_len);
-#define fs_movec(src_cstr, dst_cstr) fs_move((Fs_u8 *) (src_cstr), strlen(cstr), (u8 *) (dst_cstr), strlen(dst_cstr))
+#define fs_movec(src_cstr, dst_cstr) fs_move((Fs_u8 *) (src_cstr), strlen(src_cstr), (Fs_u8 *) (dst_cstr), strlen(dst_cstr))
 #define fs_moves(src_s, dst_s) fs_move((src_s).data, (src_s).len, (dst_s).data, (dst_s).len)
 
+// - copies the file 'src' to 'dst', replacing it. Keeps the permissions.
+//   A partial 'dst' is deleted again
+FS_DEF Fs_Error fs_copy(u8 *src, u64 src_len, u8 *dst, u64 dst_len);
+#define fs_copyc(src_cstr, dst_cstr) fs_copy((Fs_u8 *) (src_cstr), strlen(src_cstr), (Fs_u8 *) (dst_cstr), strlen(dst_cstr))
+#define fs_copys(src_s, dst_s) fs_copy((src_s).data, (src_s).len, (dst_s).data, (dst_s).len)
+
+// - copies the tree 'src' into the directory 'dst', that is created if
+//   missing. Walks with 'fs_walk' and 'threads' threads, which copy the files
+//   they find at the same time. Links are copied as links (not on windows),
+//   other special files are skipped. Stops at the first error
+// - a 'dst' inside of 'src' is FS_ERROR_INVALID_NAME
+FS_DEF Fs_Error fs_copy_tree(u8 *src, u64 src_len, u8 *dst, u64 dst_len, u64 threads);
+#define fs_copy_treec(src_cstr, dst_cstr, n) fs_copy_tree((Fs_u8 *) (src_cstr), strlen(src_cstr), (Fs_u8 *) (dst_cstr), strlen(dst_cstr), (n))
+#define fs_copy_trees(src_s, dst_s, n) fs_copy_tree((src_s).data, (src_s).len, (dst_s).data, (dst_s).len, (n))
+
 FS_DEF Fs_Error fs_mkdir(u8 *name, u64 name_len);
 #define fs_mkdirc(cstr) fs_mkdir((Fs_u8 *) (cstr), strlen(cstr))
 #define fs_mkdirs(s) fs_mkdir((s).data, (s).len)
@@ -214,6 +782,12 @@ FS_DEF Fs_Error fs_rmdir(u8 *name, u64 name_len);
 
 #ifdef _WIN32
 
+// - FILETIME counts 100ns since 1601
+FS_DEF u64 fs_filetime_to_unix(FILETIME *ft) {
+  u64 t = ((u64) ft->dwHighDateTime << 32) | (u64) ft->dwLowDateTime;
+  return t / 10000000 - 11644473600ULL;
+}
+
 FS_DEF void fs_time_get(Fs_Time *t) {
   SYSTEMTIME time;
   GetSystemTime(&time);
@@ -238,6 +812,16 @@ FS_DEF Fs_Error fs_error_last() {
     return FS_ERROR_FILE_NOT_FOUND;
   case 5:
     return FS_ERROR_ACCESS_DENIED;
+  case 17:
+    return FS_ERROR_UNSUPPORTED;
+  case 80:
+  case 183:
+    return FS_ERROR_EXISTS;
+  case 145:
+    return FS_ERROR_NOT_EMPTY;
+  case 39:
+  case 112:
+    return FS_ERROR_LIMIT;
   default:
     fprintf(stderr, "FS_ERROR: Unhandled last_error: %ld\n", last_error); fflush(stderr);
     exit(1);
@@ -249,6 +833,7 @@ FS_DEF Fs_Error fs_file_stdin(Fs_File *f) {
   if(f->handle == INVALID_HANDLE_VALUE) {
     return fs_error_last();
   }
+  f->shared = NULL;
 
   return FS_ERROR_NONE;
 }
@@ -272,13 +857,15 @@ FS_DEF Fs_Error fs_file_ropen(Fs_File *f,
     return fs_error_last();
   }
 
-  f->size = GetFileSize(f->handle, NULL);
-  if(f->size == INVALID_FILE_SIZE) {
+  LARGE_INTEGER size;
+  if(!GetFileSizeEx(f->handle, &size)) {
     CloseHandle(f->handle);
     return fs_error_last();
   }
 
+  f->size = (u64) size.QuadPart;
   f->pos = 0;
+  f->shared = NULL;
 
   return FS_ERROR_NONE;
 
@@ -305,6 +892,93 @@ FS_DEF Fs_Error fs_file_wopen(Fs_File *f,
 
   f->pos = 0;
   f->size = INVALID_FILE_SIZE;
+  f->shared = NULL;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_file_dopen(Fs_File *f,
+			      u8 *name,
+			      u64 name_len) {
+
+  wchar_t filepath[MAX_PATH];
+  int n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, filepath, FS_MAX_PATH);
+  filepath[n] = 0;
+
+  f->handle = CreateFileW(filepath,
+			  GENERIC_WRITE,
+			  0,
+			  NULL,
+			  CREATE_ALWAYS,
+			  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING,
+			  NULL);
+  if(f->handle == INVALID_HANDLE_VALUE) {
+    return fs_error_last();
+  }
+
+  f->pos = 0;
+  f->size = 0;
+  f->shared = NULL;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_file_copen(Fs_File *f,
+			      u8 *name,
+			      u64 name_len,
+			      int *direct) {
+
+  wchar_t filepath[MAX_PATH];
+  int n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, filepath, FS_MAX_PATH);
+  filepath[n] = 0;
+
+  f->handle = CreateFileW(filepath,
+			  GENERIC_WRITE,
+			  0,
+			  NULL,
+			  CREATE_NEW,
+			  FILE_ATTRIBUTE_NORMAL | (*direct ? FILE_FLAG_NO_BUFFERING : 0),
+			  NULL);
+  if(f->handle == INVALID_HANDLE_VALUE) {
+    return fs_error_last();
+  }
+
+  f->pos = 0;
+  f->size = 0;
+  f->shared = NULL;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_file_aopen(Fs_File *f,
+			      u8 *name,
+			      u64 name_len) {
+
+  wchar_t filepath[MAX_PATH];
+  int n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, filepath, FS_MAX_PATH);
+  filepath[n] = 0;
+
+  f->handle = CreateFileW(filepath,
+			  GENERIC_WRITE,
+			  0,
+			  NULL,
+			  OPEN_ALWAYS,
+			  FILE_ATTRIBUTE_NORMAL,
+			  NULL);
+  if(f->handle == INVALID_HANDLE_VALUE) {
+    return fs_error_last();
+  }
+
+  LARGE_INTEGER zero = {0};
+  LARGE_INTEGER end;
+  if(!SetFilePointerEx(f->handle, zero, &end, FILE_END)) {
+    CloseHandle(f->handle);
+    return fs_error_last();
+  }
+
+  f->size = (u64) end.QuadPart;
+  f->pos = f->size;
+  f->shared = NULL;
 
   return FS_ERROR_NONE;
 }
@@ -349,66 +1023,250 @@ FS_DEF Fs_Error fs_file_write(Fs_File *f,
 
 FS_DEF Fs_Error fs_file_seek(Fs_File *f, u64 offset) {
 
-  f->pos = SetFilePointer(f->handle, (LONG) offset, NULL, FILE_BEGIN);
-  if(f->pos == INVALID_SET_FILE_POINTER) {
+  LARGE_INTEGER distance;
+  distance.QuadPart = (LONGLONG) offset;
+  LARGE_INTEGER pos;
+  if(!SetFilePointerEx(f->handle, distance, &pos, FILE_BEGIN)) {
     return fs_error_last();
   }
 
+  f->pos = (u64) pos.QuadPart;
   return FS_ERROR_NONE;
 }
 
-FS_DEF Fs_Error fs_dir_open(Fs_Dir *d,
-			    u8 *name,
-			    u64 name_len) {
+FS_DEF Fs_Error fs_file_pread(Fs_File *f,
+			      u64 offset,
+			      u8 *buf,
+			      u64 len,
+			      u64 *read) {
 
-  wchar_t filepath[FS_MAX_PATH];
-  int n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, filepath, FS_MAX_PATH);
-  filepath[n++] = '*';
-  filepath[n] = 0;
+  OVERLAPPED overlapped = {0};
+  overlapped.Offset = (DWORD) offset;
+  overlapped.OffsetHigh = (DWORD) (offset >> 32);
 
-  d->handle = FindFirstFileW(filepath, &d->find_data);
-  if(d->handle == INVALID_HANDLE_VALUE) {
+  DWORD bytes_read;
+  if(!ReadFile(f->handle, buf, (DWORD) len, &bytes_read, &overlapped)) {
+    if(GetLastError() == ERROR_HANDLE_EOF) {
+      *read = 0;
+      return FS_ERROR_EOF;
+    }
     return fs_error_last();
   }
 
-  d->error = FS_ERROR_NONE;
+  *read = (u64) bytes_read;
+  if(bytes_read == 0) {
+    return FS_ERROR_EOF;
+  }
+  return FS_ERROR_NONE;
+}
 
-  memcpy(d->name, name, name_len);
-  d->name_len = name_len;
-  d->name[d->name_len] = 0;
+FS_DEF Fs_Error fs_file_pwrite(Fs_File *f,
+			       u64 offset,
+			       u8 *buf,
+			       u64 len,
+			       u64 *written) {
+
+  OVERLAPPED overlapped = {0};
+  overlapped.Offset = (DWORD) offset;
+  overlapped.OffsetHigh = (DWORD) (offset >> 32);
 
+  DWORD bytes_written;
+  if(!WriteFile(f->handle, buf, (DWORD) len, &bytes_written, &overlapped)) {
+    return fs_error_last();
+  }
+
+  *written = (u64) bytes_written;
   return FS_ERROR_NONE;
 }
 
-FS_DEF void fs_file_close(Fs_File *f) {
-  CloseHandle(f->handle);
+FS_DEF Fs_Error fs_file_reserve(Fs_File *f, u64 size) {
+
+  FILE_ALLOCATION_INFO info;
+  info.AllocationSize.QuadPart = (LONGLONG) size;
+  if(!SetFileInformationByHandle(f->handle, FileAllocationInfo, &info, sizeof(info))) {
+    if(GetLastError() == ERROR_INVALID_FUNCTION) {
+      return FS_ERROR_NONE;
+    }
+    return fs_error_last();
+  }
+
+  return FS_ERROR_NONE;
 }
 
-FS_DEF Fs_Error fs_dir_next(Fs_Dir *d, Fs_Dir_Entry *e) {
+FS_DEF Fs_Error fs_file_copy(Fs_File *src,
+			     u64 src_offset,
+			     Fs_File *dst,
+			     u64 dst_offset,
+			     u64 len,
+			     u64 *copied) {
+  return fs_file_copy_buffered(src, src_offset, dst, dst_offset, len, copied);
+}
 
-  if(d->error != FS_ERROR_NONE && d->error != FS_ERROR_EOF) {
-    return d->error;
+FS_DEF Fs_Error fs_file_truncate(Fs_File *f, u64 size) {
+  FILE_END_OF_FILE_INFO info;
+  info.EndOfFile.QuadPart = (LONGLONG) size;
+  if(!SetFileInformationByHandle(f->handle, FileEndOfFileInfo, &info, sizeof(info))) {
+    return fs_error_last();
   }
+  return FS_ERROR_NONE;
+}
 
-  int n = WideCharToMultiByte(CP_UTF8,
-			      0,
-			      d->find_data.cFileName,
-			      -1,
-			      (char *) e->name,
-			      FS_MAX_PATH,
-			      0,
-			      NULL);
-  e->name_len = (u64) (n - 1);
-  e->flags = 0;
-  if(d->find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-    e->flags |= FS_DIR_ENTRY_IS_DIR;
-  }
-  if((e->name_len == 1 && e->name[0] == '.') ||
-     (e->name_len == 2 && e->name[0] == '.' && e->name[1] == '.')) {
-    e->flags |= FS_DIR_ENTRY_FROM_SYSTEM;
+FS_DEF Fs_Error fs_file_sync(Fs_File *f, int data_only) {
+  (void) data_only;
+  if(!FlushFileBuffers(f->handle)) {
+    return fs_error_last();
   }
-  e->size = ((u64) d->find_data.nFileSizeLow | (((u64) d->find_data.nFileSizeHigh) << 32));
-
+  return FS_ERROR_NONE;
+}
+
+// - the rename is durable with the file on windows
+FS_DEF Fs_Error fs_sync_parent(u8 *name, u64 name_len) {
+  (void) name;
+  (void) name_len;
+  return FS_ERROR_NONE;
+}
+
+// - handles are not limited like descriptors
+FS_DEF u64 fs_file_cache_budget(void) {
+  return FS_FILE_CACHE_FDS;
+}
+
+// - the attributes of the replaced file go with it, there is nothing to keep
+FS_DEF void fs_file_chmod_like(Fs_File *f, u8 *name, u64 name_len) {
+  (void) f;
+  (void) name;
+  (void) name_len;
+}
+
+// - 'name' is 'dir' or lies below it, compared as full paths
+FS_DEF int fs_within(u8 *dir, u64 dir_len, u8 *name, u64 name_len) {
+  wchar_t path[MAX_PATH];
+  int n = MultiByteToWideChar(CP_UTF8, 0, (char *) dir, (s32) dir_len, path, FS_MAX_PATH);
+  path[n] = 0;
+  wchar_t dir_full[MAX_PATH];
+  DWORD dir_full_len = GetFullPathNameW(path, MAX_PATH, dir_full, NULL);
+
+  n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, path, FS_MAX_PATH);
+  path[n] = 0;
+  wchar_t name_full[MAX_PATH];
+  DWORD name_full_len = GetFullPathNameW(path, MAX_PATH, name_full, NULL);
+
+  if(dir_full_len == 0 || dir_full_len >= MAX_PATH ||
+     name_full_len == 0 || name_full_len >= MAX_PATH) {
+    return 0;
+  }
+  while(dir_full_len > 0 && dir_full[dir_full_len - 1] == L'\\') dir_full_len--;
+
+  return name_full_len >= dir_full_len &&
+    _wcsnicmp(dir_full, name_full, dir_full_len) == 0 &&
+    (name_full_len == dir_full_len || name_full[dir_full_len] == L'\\');
+}
+
+FS_DEF Fs_Error fs_file_map(Fs_File *f, Fs_Map *m, u64 offset, u64 len, int flags) {
+  *m = (Fs_Map) {0};
+  m->flags = flags & ~FS_MAP_ALLOCATED;
+  if(offset >= f->size || len == 0) {
+    return FS_ERROR_NONE;
+  }
+  if(len > f->size - offset) {
+    len = f->size - offset;
+  }
+
+  // Views start at a multiple of the allocation granularity
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  u64 delta = offset % (u64) info.dwAllocationGranularity;
+
+  HANDLE mapping = CreateFileMappingW(f->handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if(mapping == NULL) {
+    return FS_ERROR_UNSUPPORTED;
+  }
+  u64 base_offset = offset - delta;
+  void *base = MapViewOfFile(mapping,
+			     FILE_MAP_READ,
+			     (DWORD) (base_offset >> 32),
+			     (DWORD) base_offset,
+			     (SIZE_T) (len + delta));
+  // The view keeps the mapping alive
+  CloseHandle(mapping);
+  if(base == NULL) {
+    return FS_ERROR_UNSUPPORTED;
+  }
+
+  m->base = base;
+  m->base_len = len + delta;
+  m->data = m->base + delta;
+  m->len = len;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF void fs_file_unmap(Fs_Map *m) {
+  if(m->flags & FS_MAP_ALLOCATED) {
+    FS_FREE(m->data);
+  } else if(m->base) {
+    UnmapViewOfFile(m->base);
+  }
+  *m = (Fs_Map) {0};
+}
+
+FS_DEF Fs_Error fs_dir_open(Fs_Dir *d,
+			    u8 *name,
+			    u64 name_len) {
+
+  wchar_t filepath[FS_MAX_PATH];
+  int n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, filepath, FS_MAX_PATH);
+  filepath[n++] = '*';
+  filepath[n] = 0;
+
+  d->handle = FindFirstFileW(filepath, &d->find_data);
+  if(d->handle == INVALID_HANDLE_VALUE) {
+    return fs_error_last();
+  }
+
+  d->error = FS_ERROR_NONE;
+
+  memcpy(d->name, name, name_len);
+  d->name_len = name_len;
+  d->name[d->name_len] = 0;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF void fs_file_close(Fs_File *f) {
+  if(f->shared) {
+    fs_shared_file_release(f->shared);
+    f->shared = NULL;
+    return;
+  }
+  CloseHandle(f->handle);
+}
+
+FS_DEF Fs_Error fs_dir_next(Fs_Dir *d, Fs_Dir_Entry *e) {
+
+  if(d->error != FS_ERROR_NONE && d->error != FS_ERROR_EOF) {
+    return d->error;
+  }
+
+  int n = WideCharToMultiByte(CP_UTF8,
+			      0,
+			      d->find_data.cFileName,
+			      -1,
+			      (char *) e->name,
+			      FS_MAX_PATH,
+			      0,
+			      NULL);
+  e->name_len = (u64) (n - 1);
+  e->flags = 0;
+  if(d->find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+    e->flags |= FS_DIR_ENTRY_IS_DIR;
+  }
+  if((e->name_len == 1 && e->name[0] == '.') ||
+     (e->name_len == 2 && e->name[0] == '.' && e->name[1] == '.')) {
+    e->flags |= FS_DIR_ENTRY_FROM_SYSTEM;
+  }
+  e->size = ((u64) d->find_data.nFileSizeLow | (((u64) d->find_data.nFileSizeHigh) << 32));
+
   memcpy(e->name_abs, d->name, d->name_len);
   memcpy(e->name_abs + d->name_len, e->name, e->name_len);
   e->name_abs_len = d->name_len + e->name_len;
@@ -423,6 +1281,7 @@ FS_DEF Fs_Error fs_dir_next(Fs_Dir *d, Fs_Dir_Entry *e) {
   e->time.hour = time.wHour;
   e->time.min = time.wMinute;
   e->time.sec = time.wSecond;
+  e->mtime = fs_filetime_to_unix(&d->find_data.ftLastWriteTime);
 
   if(d->error == FS_ERROR_EOF) {
     return FS_ERROR_EOF;
@@ -450,6 +1309,106 @@ FS_DEF void fs_dir_close(Fs_Dir *d) {
   FindClose(d->handle);
 }
 
+FS_DEF Fs_Error fs_iter_open(Fs_Iter *it, u8 *name, u64 name_len) {
+  wchar_t filepath[FS_MAX_PATH];
+  int n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, filepath, FS_MAX_PATH);
+  filepath[n++] = '*';
+  filepath[n] = 0;
+
+  // FindExInfoBasic skips the short 8.3 name
+  it->handle = FindFirstFileExW(filepath,
+				FindExInfoBasic,
+				&it->find_data,
+				FindExSearchNameMatch,
+				NULL,
+				FIND_FIRST_EX_LARGE_FETCH);
+  if(it->handle == INVALID_HANDLE_VALUE) {
+    return fs_error_last();
+  }
+  it->pending = 1;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_iter_next(Fs_Iter *it, Fs_Iter_Entry *e) {
+  for(;;) {
+    if(!it->pending) {
+      if(!FindNextFileW(it->handle, &it->find_data)) {
+	if(GetLastError() == ERROR_NO_MORE_FILES) {
+	  return FS_ERROR_EOF;
+	}
+	return fs_error_last();
+      }
+    }
+    it->pending = 0;
+
+    wchar_t *name = it->find_data.cFileName;
+    if(name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+      continue;
+    }
+
+    int n = WideCharToMultiByte(CP_UTF8, 0, name, -1, (char *) it->name, FS_MAX_PATH, 0, NULL);
+    e->name = it->name;
+    e->name_len = (u64) (n - 1);
+
+    DWORD attribs = it->find_data.dwFileAttributes;
+    if(attribs & FILE_ATTRIBUTE_REPARSE_POINT) {
+      e->type = FS_TYPE_LINK;
+    } else if(attribs & FILE_ATTRIBUTE_DIRECTORY) {
+      e->type = FS_TYPE_DIR;
+    } else {
+      e->type = FS_TYPE_FILE;
+    }
+    return FS_ERROR_NONE;
+  }
+}
+
+FS_DEF Fs_Error fs_iter_stat(Fs_Iter *it, Fs_Iter_Entry *e, Fs_Stat *s) {
+  (void) e;
+
+  // FindNextFileW has it already
+  s->is_dir = (it->find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+  s->size = ((u64) it->find_data.nFileSizeLow | (((u64) it->find_data.nFileSizeHigh) << 32));
+  s->mtime = fs_filetime_to_unix(&it->find_data.ftLastWriteTime);
+  s->id = 0;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF void fs_iter_close(Fs_Iter *it) {
+  FindClose(it->handle);
+}
+
+#define fs_walk_lock_init(w) do{ InitializeCriticalSection(&(w)->lock); InitializeConditionVariable(&(w)->cond); }while(0)
+#define fs_walk_lock_free(w) DeleteCriticalSection(&(w)->lock)
+#define fs_walk_lock(w) EnterCriticalSection(&(w)->lock)
+#define fs_walk_unlock(w) LeaveCriticalSection(&(w)->lock)
+#define fs_walk_wait(w) SleepConditionVariableCS(&(w)->cond, &(w)->lock, INFINITE)
+#define fs_walk_wake(w) WakeAllConditionVariable(&(w)->cond)
+
+FS_DEF Fs_Error fs_watch_open(Fs_Watch *w) {
+  *w = (Fs_Watch) {0};
+  w->fd = -1;
+  return FS_ERROR_UNSUPPORTED;
+}
+
+FS_DEF Fs_Error fs_watch_add(Fs_Watch *w, u8 *name, u64 name_len) {
+  (void) w;
+  (void) name;
+  (void) name_len;
+  return FS_ERROR_UNSUPPORTED;
+}
+
+FS_DEF Fs_Error fs_watch_next(Fs_Watch *w, Fs_Watch_Event *e) {
+  (void) w;
+  (void) e;
+  return FS_ERROR_UNSUPPORTED;
+}
+
+FS_DEF void fs_watch_close(Fs_Watch *w) {
+  (void) w;
+}
+
 FS_DEF int fs_exists(u8 *name, u64 name_len, int *is_file) {
   wchar_t filepath[MAX_PATH];
   int n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, filepath, FS_MAX_PATH);
@@ -460,6 +1419,38 @@ FS_DEF int fs_exists(u8 *name, u64 name_len, int *is_file) {
   return attribs != INVALID_FILE_ATTRIBUTES;
 }
 
+FS_DEF Fs_Error fs_stat(u8 *name, u64 name_len, Fs_Stat *s) {
+  wchar_t filepath[MAX_PATH];
+  int n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, filepath, FS_MAX_PATH);
+  filepath[n] = 0;
+
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if(!GetFileAttributesExW(filepath, GetFileExInfoStandard, &data)) {
+    return fs_error_last();
+  }
+
+  s->is_dir = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+  s->size = ((u64) data.nFileSizeLow | (((u64) data.nFileSizeHigh) << 32));
+  s->mtime = fs_filetime_to_unix(&data.ftLastWriteTime);
+  s->id = 0;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_listing_stamp(u8 *name, u64 name_len, u64 *stamp) {
+  wchar_t filepath[MAX_PATH];
+  int n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, filepath, FS_MAX_PATH);
+  filepath[n] = 0;
+
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if(!GetFileAttributesExW(filepath, GetFileExInfoStandard, &data)) {
+    return fs_error_last();
+  }
+
+  *stamp = ((u64) data.ftLastWriteTime.dwHighDateTime << 32) | (u64) data.ftLastWriteTime.dwLowDateTime;
+  return FS_ERROR_NONE;
+}
+
 FS_DEF Fs_Error fs_delete(u8 *name, u64 name_len) {
   wchar_t filepath[MAX_PATH];
   int n = MultiByteToWideChar(CP_UTF8, 0, (char *) name, (s32) name_len, filepath, FS_MAX_PATH);
@@ -481,7 +1472,25 @@ FS_DEF Fs_Error fs_move(u8 *src, u64 src_len, u8 *dst, u64 dst_len) {
   n = MultiByteToWideChar(CP_UTF8, 0, (char *) dst, (s32) dst_len, dst_filepath, FS_MAX_PATH);
   dst_filepath[n] = 0;
 
-  if(MoveFileW(src_filepath, dst_filepath)) {
+  // Copies and deletes across volumes itself
+  if(MoveFileExW(src_filepath, dst_filepath, MOVEFILE_COPY_ALLOWED | MOVEFILE_REPLACE_EXISTING)) {
+    return FS_ERROR_NONE;
+  } else {
+    return fs_error_last();
+  }
+}
+
+FS_DEF Fs_Error fs_copy(u8 *src, u64 src_len, u8 *dst, u64 dst_len) {
+  wchar_t src_filepath[MAX_PATH];
+  int n = MultiByteToWideChar(CP_UTF8, 0, (char *) src, (s32) src_len, src_filepath, FS_MAX_PATH);
+  src_filepath[n] = 0;
+
+  wchar_t dst_filepath[MAX_PATH];
+  n = MultiByteToWideChar(CP_UTF8, 0, (char *) dst, (s32) dst_len, dst_filepath, FS_MAX_PATH);
+  dst_filepath[n] = 0;
+
+  // Clones blocks on ReFS, copies in the kernel elsewhere
+  if(CopyFileW(src_filepath, dst_filepath, FALSE)) {
     return FS_ERROR_NONE;
   } else {
     return fs_error_last();
@@ -520,7 +1529,28 @@ FS_DEF Fs_Error fs_rmdir(u8 *name, u64 name_len) {
 FS_DEF Fs_Error fs_error_last() {
   switch(errno) {
   case 2:
+  case 20:
     return FS_ERROR_FILE_NOT_FOUND;
+  case 1:
+  case 13:
+  case 30:
+    return FS_ERROR_ACCESS_DENIED;
+  case 17:
+    return FS_ERROR_EXISTS;
+  case 18:
+  case 95:
+    return FS_ERROR_UNSUPPORTED;
+  case 39:
+    return FS_ERROR_NOT_EMPTY;
+  case 21:
+    return FS_ERROR_IS_DIRECTORY;
+  case 36:
+    return FS_ERROR_INVALID_NAME;
+  case 23:
+  case 24:
+  case 28:
+  case 122:
+    return FS_ERROR_LIMIT;
   default:
     fprintf(stderr, "FS_ERROR: Unhandled last_error: %d\n", errno);
     fprintf(stderr, "FS_ERROR: '%s'\n", strerror(errno));
@@ -542,6 +1572,7 @@ FS_DEF void fs_time_get(Fs_Time *t) {
 
 FS_DEF Fs_Error fs_file_stdin(Fs_File *f) {
   f->fd = STDIN_FILENO;
+  f->shared = NULL;
   return FS_ERROR_NONE;
 }
 
@@ -558,13 +1589,18 @@ FS_DEF Fs_Error fs_file_ropen(Fs_File *f,
   }
 
   struct stat stats;
-  if(stat((char *) buf, &stats) < 0) {
+  if(fstat(f->fd, &stats) < 0) {
     close(f->fd);
     return fs_error_last();
   }
+  if(S_ISDIR(stats.st_mode)) {
+    close(f->fd);
+    return FS_ERROR_IS_DIRECTORY;
+  }
 
   f->size = (u64) stats.st_size;
   f->pos  = 0;
+  f->shared = NULL;
 
   return FS_ERROR_NONE;
 }
@@ -593,113 +1629,546 @@ FS_DEF Fs_Error fs_file_wopen(Fs_File *f,
   memcpy(buf, name, name_len);
   buf[name_len] = 0;
 
-  f->fd = open((char *) buf, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR | S_IROTH | S_IRGRP);
+  f->fd = open((char *) buf, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IROTH | S_IRGRP);
   if(f->fd < 0) {
     return fs_error_last();
   }
 
+  f->size = 0;
+  f->pos = 0;
+  f->shared = NULL;
+
   return FS_ERROR_NONE;
 }
 
-FS_DEF Fs_Error fs_file_write(Fs_File *f,
-			      u8 *buf,
-			      u64 len,
-			      u64 *written) {
-  ssize_t ret = write(f->fd, buf, len);
-  if(ret < 0) {
-    return fs_error_last();
-  } else {
-    *written = (u64) ret;
-    return FS_ERROR_NONE;
-  }
-}
+#ifndef O_DIRECT
+#  define O_DIRECT __O_DIRECT
+#endif // O_DIRECT
 
-FS_DEF Fs_Error fs_file_seek(Fs_File *f, u64 offset) {
+FS_DEF Fs_Error fs_file_dopen(Fs_File *f,
+			      u8 *name,
+			      u64 name_len) {
+  u8 buf[FS_MAX_PATH];
+  memcpy(buf, name, name_len);
+  buf[name_len] = 0;
 
-  off_t pos = lseek(f->fd, (off_t) offset, SEEK_SET);
-  if(pos == -1) {
+  f->fd = open((char *) buf, O_CREAT | O_WRONLY | O_TRUNC | O_DIRECT, S_IRUSR | S_IWUSR | S_IROTH | S_IRGRP);
+  if(f->fd < 0) {
+    if(errno == EINVAL) {
+      return FS_ERROR_UNSUPPORTED;
+    }
     return fs_error_last();
-  } else {
-    f->pos = (u64) pos;
-    return FS_ERROR_NONE;
   }
 
-}
+  f->size = 0;
+  f->pos = 0;
+  f->shared = NULL;
 
-FS_DEF int fs_exists(u8 *name, u64 name_len, int *is_file) {
+  return FS_ERROR_NONE;
+}
 
+FS_DEF Fs_Error fs_file_copen(Fs_File *f,
+			      u8 *name,
+			      u64 name_len,
+			      int *direct) {
   u8 buf[FS_MAX_PATH];
   memcpy(buf, name, name_len);
   buf[name_len] = 0;
 
-  int result = access((char *) buf, F_OK);
-  if(result < 0) {
-    return 0;
+  f->fd = open((char *) buf, O_CREAT | O_EXCL | O_WRONLY, S_IRUSR | S_IWUSR | S_IROTH | S_IRGRP);
+  if(f->fd < 0) {
+    return fs_error_last();
   }
 
-  if(is_file) {
-    struct stat path_stat;
-    stat((char *) buf, &path_stat);
-    *is_file = S_ISREG(path_stat.st_mode) != 0;
+  // Only after creating it, an open with O_DIRECT fails on tmpfs, but
+  // leaves the file behind
+  if(*direct) {
+    int fl = fcntl(f->fd, F_GETFL);
+    *direct = fl >= 0 && fcntl(f->fd, F_SETFL, fl | O_DIRECT) == 0;
   }
 
-  return 1;
+  f->size = 0;
+  f->pos = 0;
+  f->shared = NULL;
 
+  return FS_ERROR_NONE;
 }
 
-FS_DEF Fs_Error fs_delete(u8 *name, u64 name_len) {
+FS_DEF Fs_Error fs_file_aopen(Fs_File *f,
+			      u8 *name,
+			      u64 name_len) {
   u8 buf[FS_MAX_PATH];
   memcpy(buf, name, name_len);
   buf[name_len] = 0;
 
-  if(remove((char *) buf) == 0) {
-    return FS_ERROR_NONE;
-  } else {
+  f->fd = open((char *) buf, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR | S_IROTH | S_IRGRP);
+  if(f->fd < 0) {
     return fs_error_last();
   }
-}
-
-FS_DEF Fs_Error fs_move(u8 *src, u64 src_len, u8 *dst, u64 dst_len) {
-  u8 src_filepath[FS_MAX_PATH];
-  memcpy(src_filepath, src, src_len);
-  src_filepath[src_len] = 0;
-
-  u8 dst_filepath[FS_MAX_PATH];
-  memcpy(dst_filepath, dst, dst_len);
-  dst_filepath[dst_len] = 0;
 
-  if(rename((char *) src, (char *) dst) == 0) {
-    return FS_ERROR_NONE;
-  } else {
+  off_t end = lseek(f->fd, 0, SEEK_END);
+  if(end == -1) {
+    close(f->fd);
     return fs_error_last();
   }
-}
 
-FS_DEF Fs_Error fs_mkdir(u8 *name, u64 name_len) {
-  u8 buf[FS_MAX_PATH];
-  memcpy(buf, name, name_len);
-  buf[name_len] = 0;
+  f->size = (u64) end;
+  f->pos = f->size;
+  f->shared = NULL;
 
-  if(mkdir((char *) buf, 777) == 0) {
-    return FS_ERROR_NONE;
-  } else {
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_file_write(Fs_File *f,
+			      u8 *buf,
+			      u64 len,
+			      u64 *written) {
+  ssize_t ret = write(f->fd, buf, len);
+  if(ret < 0) {
     return fs_error_last();
+  } else {
+    *written = (u64) ret;
+    f->pos += *written;
+    return FS_ERROR_NONE;
   }
 }
 
-FS_DEF Fs_Error fs_rmdir(u8 *name, u64 name_len) {
-  u8 buf[FS_MAX_PATH];
-  memcpy(buf, name, name_len);
-  buf[name_len] = 0;
+FS_DEF Fs_Error fs_file_seek(Fs_File *f, u64 offset) {
 
-  if(rmdir((char *) buf) == 0) {
-    return FS_ERROR_NONE;
-  } else {
+  off_t pos = lseek(f->fd, (off_t) offset, SEEK_SET);
+  if(pos == -1) {
     return fs_error_last();
+  } else {
+    f->pos = (u64) pos;
+    return FS_ERROR_NONE;
   }
+
 }
 
-FS_DEF void fs_file_close(Fs_File *f) {
+FS_DEF Fs_Error fs_file_pread(Fs_File *f,
+			      u64 offset,
+			      u8 *buf,
+			      u64 len,
+			      u64 *_read) {
+  ssize_t ret = pread(f->fd, buf, len, (off_t) offset);
+  if(ret < 0) {
+    return fs_error_last();
+  } else if(ret == 0) {
+    *_read = 0;
+    return FS_ERROR_EOF;
+  } else {
+    *_read = (u64) ret;
+    return FS_ERROR_NONE;
+  }
+}
+
+FS_DEF Fs_Error fs_file_pwrite(Fs_File *f,
+			       u64 offset,
+			       u8 *buf,
+			       u64 len,
+			       u64 *written) {
+  ssize_t ret = pwrite(f->fd, buf, len, (off_t) offset);
+  if(ret < 0) {
+    return fs_error_last();
+  } else {
+    *written = (u64) ret;
+    return FS_ERROR_NONE;
+  }
+}
+
+FS_DEF Fs_Error fs_file_reserve(Fs_File *f, u64 size) {
+
+  // fallocate(2) is only declared with _GNU_SOURCE
+  if(syscall(SYS_fallocate, f->fd, FALLOC_FL_KEEP_SIZE, (off_t) 0, (off_t) size) < 0) {
+    if(errno == EOPNOTSUPP || errno == ENOSYS) {
+      return FS_ERROR_NONE;
+    }
+    return fs_error_last();
+  }
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_file_truncate(Fs_File *f, u64 size) {
+  if(ftruncate(f->fd, (off_t) size) != 0) {
+    return fs_error_last();
+  }
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_file_sync(Fs_File *f, int data_only) {
+  int ret = data_only ? fdatasync(f->fd) : fsync(f->fd);
+  if(ret != 0) {
+    // Pipes and special files
+    if(errno == EINVAL) {
+      return FS_ERROR_UNSUPPORTED;
+    }
+    return fs_error_last();
+  }
+  return FS_ERROR_NONE;
+}
+
+// - syncs the directory of 'name', that a rename to it survives a crash
+FS_DEF Fs_Error fs_sync_parent(u8 *name, u64 name_len) {
+  u8 buf[FS_MAX_PATH];
+  while(name_len > 0 && name[name_len - 1] != '/') name_len--;
+  if(name_len == 0) {
+    buf[name_len++] = '.';
+  } else {
+    memcpy(buf, name, name_len);
+  }
+  buf[name_len] = 0;
+
+  int fd = open((char *) buf, O_RDONLY | O_DIRECTORY);
+  if(fd < 0) {
+    return fs_error_last();
+  }
+  int ret = fsync(fd);
+  int err = errno;
+  close(fd);
+  if(ret != 0 && err != EINVAL) {
+    errno = err;
+    return fs_error_last();
+  }
+  return FS_ERROR_NONE;
+}
+
+// - the descriptors a 'Fs_File_Cache' keeps open, a share of RLIMIT_NOFILE
+FS_DEF u64 fs_file_cache_budget(void) {
+  struct rlimit rl;
+  if(getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY) {
+    return FS_FILE_CACHE_FDS;
+  }
+
+  u64 n = (u64) rl.rlim_cur / FS_FILE_CACHE_FDS_SHARE;
+  if(n < 4) n = 4;
+  if(n > FS_FILE_CACHE_CAP) n = FS_FILE_CACHE_CAP;
+  return n;
+}
+
+// - gives 'f' the permissions of 'name', if there is such a file
+FS_DEF void fs_file_chmod_like(Fs_File *f, u8 *name, u64 name_len) {
+  u8 buf[FS_MAX_PATH];
+  memcpy(buf, name, name_len);
+  buf[name_len] = 0;
+
+  struct stat st;
+  if(stat((char *) buf, &st) == 0) {
+    fchmod(f->fd, st.st_mode & 07777);
+  }
+}
+
+// - 'name' is 'dir' or lies below it, with links resolved. Both have to exist
+FS_DEF int fs_within(u8 *dir, u64 dir_len, u8 *name, u64 name_len) {
+  char path[FS_MAX_PATH];
+  if(dir_len >= FS_MAX_PATH || name_len >= FS_MAX_PATH) {
+    return 0;
+  }
+
+  memcpy(path, dir, dir_len);
+  path[dir_len] = 0;
+  char *dir_real = realpath(path, NULL);
+  memcpy(path, name, name_len);
+  path[name_len] = 0;
+  char *name_real = realpath(path, NULL);
+
+  int within = 0;
+  if(dir_real && name_real) {
+    u64 len = strlen(dir_real);
+    if(len == 1) {
+      // '/' holds everything
+      within = 1;
+    } else {
+      within = strncmp(dir_real, name_real, len) == 0 &&
+	(name_real[len] == 0 || name_real[len] == '/');
+    }
+  }
+  free(dir_real);
+  free(name_real);
+  return within;
+}
+
+#ifndef FICLONE
+#  define FICLONE _IOW(0x94, 9, int)
+#endif // FICLONE
+
+FS_DEF Fs_Error fs_file_copy(Fs_File *src,
+			     u64 src_offset,
+			     Fs_File *dst,
+			     u64 dst_offset,
+			     u64 len,
+			     u64 *copied) {
+  *copied = 0;
+
+  // Shares the blocks of 'src' (btrfs, xfs), nothing is copied
+  if(src_offset == 0 && dst_offset == 0 && dst->size == 0 && len >= src->size) {
+    if(ioctl(dst->fd, FICLONE, src->fd) == 0) {
+      *copied = src->size;
+      return FS_ERROR_NONE;
+    }
+  }
+
+#ifdef SYS_copy_file_range
+  long long in_off = (long long) src_offset;
+  long long out_off = (long long) dst_offset;
+  while(*copied < len) {
+    u64 n = len - *copied;
+    if(n > (1ULL << 30)) n = 1ULL << 30;
+
+    long m = syscall(SYS_copy_file_range, src->fd, &in_off, dst->fd, &out_off, (size_t) n, 0u);
+    if(m < 0) {
+      // Older kernels, other filesystems or special files. Continue buffered
+      if(errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+	 errno == EOPNOTSUPP || errno == EBADF) {
+	break;
+      }
+      return fs_error_last();
+    }
+    if(m == 0) {
+      // 'src' ends early, or a filesystem that reports 0 instead of failing
+      if(*copied > 0) return FS_ERROR_NONE;
+      break;
+    }
+    *copied += (u64) m;
+  }
+  if(*copied == len) {
+    return FS_ERROR_NONE;
+  }
+#endif // SYS_copy_file_range
+
+  u64 rest;
+  Fs_Error error = fs_file_copy_buffered(src, src_offset + *copied,
+					 dst, dst_offset + *copied,
+					 len - *copied, &rest);
+  *copied += rest;
+  return error;
+}
+
+FS_DEF Fs_Error fs_file_map(Fs_File *f, Fs_Map *m, u64 offset, u64 len, int flags) {
+  *m = (Fs_Map) {0};
+  m->flags = flags & ~FS_MAP_ALLOCATED;
+  if(offset >= f->size || len == 0) {
+    return FS_ERROR_NONE;
+  }
+  if(len > f->size - offset) {
+    len = f->size - offset;
+  }
+
+  u64 delta = offset % (u64) sysconf(_SC_PAGESIZE);
+  void *base = mmap(NULL, len + delta, PROT_READ, MAP_PRIVATE, f->fd, (off_t) (offset - delta));
+  if(base == MAP_FAILED) {
+    switch(errno) {
+    case ENODEV:
+    case EINVAL:
+    case EACCES:
+      return FS_ERROR_UNSUPPORTED;
+    case ENOMEM:
+      return FS_ERROR_ALLOC_FAILED;
+    default:
+      return fs_error_last();
+    }
+  }
+
+  m->base = base;
+  m->base_len = len + delta;
+  m->data = m->base + delta;
+  m->len = len;
+
+  // Only hints, failures do not matter
+  if(flags & FS_MAP_SEQUENTIAL) {
+    madvise(m->base, m->base_len, MADV_SEQUENTIAL);
+  }
+  if(flags & FS_MAP_WILLNEED) {
+    madvise(m->base, m->base_len, MADV_WILLNEED);
+  }
+#ifdef MADV_HUGEPAGE
+  if(flags & FS_MAP_HUGEPAGE) {
+    madvise(m->base, m->base_len, MADV_HUGEPAGE);
+  }
+#endif // MADV_HUGEPAGE
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF void fs_file_unmap(Fs_Map *m) {
+  if(m->flags & FS_MAP_ALLOCATED) {
+    FS_FREE(m->data);
+  } else if(m->base) {
+    munmap(m->base, m->base_len);
+  }
+  *m = (Fs_Map) {0};
+}
+
+FS_DEF int fs_exists(u8 *name, u64 name_len, int *is_file) {
+
+  u8 buf[FS_MAX_PATH];
+  memcpy(buf, name, name_len);
+  buf[name_len] = 0;
+
+  struct stat path_stat;
+  if(stat((char *) buf, &path_stat) < 0) {
+    return 0;
+  }
+
+  if(is_file) *is_file = S_ISREG(path_stat.st_mode) != 0;
+  return 1;
+
+}
+
+FS_DEF Fs_Error fs_stat(u8 *name, u64 name_len, Fs_Stat *s) {
+  u8 buf[FS_MAX_PATH];
+  memcpy(buf, name, name_len);
+  buf[name_len] = 0;
+
+  struct stat st;
+  if(stat((char *) buf, &st) < 0) {
+    return fs_error_last();
+  }
+
+  s->is_dir = S_ISDIR(st.st_mode) != 0;
+  s->size = (u64) st.st_size;
+  s->mtime = (u64) st.st_mtim.tv_sec;
+  s->id = (u64) st.st_ino;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_listing_stamp(u8 *name, u64 name_len, u64 *stamp) {
+  u8 buf[FS_MAX_PATH];
+  memcpy(buf, name, name_len);
+  buf[name_len] = 0;
+
+  struct stat st;
+  if(stat((char *) buf, &st) < 0) {
+    return fs_error_last();
+  }
+
+  *stamp = (u64) st.st_mtim.tv_sec * 1000000000 + (u64) st.st_mtim.tv_nsec;
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_delete(u8 *name, u64 name_len) {
+  u8 buf[FS_MAX_PATH];
+  memcpy(buf, name, name_len);
+  buf[name_len] = 0;
+
+  if(remove((char *) buf) == 0) {
+    return FS_ERROR_NONE;
+  } else {
+    return fs_error_last();
+  }
+}
+
+FS_DEF Fs_Error fs_move(u8 *src, u64 src_len, u8 *dst, u64 dst_len) {
+  u8 src_filepath[FS_MAX_PATH];
+  memcpy(src_filepath, src, src_len);
+  src_filepath[src_len] = 0;
+
+  u8 dst_filepath[FS_MAX_PATH];
+  memcpy(dst_filepath, dst, dst_len);
+  dst_filepath[dst_len] = 0;
+
+  if(rename((char *) src_filepath, (char *) dst_filepath) == 0) {
+    return FS_ERROR_NONE;
+  }
+  if(errno != EXDEV) {
+    return fs_error_last();
+  }
+
+  // Another filesystem, a directory fails with FS_ERROR_IS_DIRECTORY
+  Fs_Error error = fs_copy(src, src_len, dst, dst_len);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+  return fs_delete(src, src_len);
+}
+
+FS_DEF Fs_Error fs_copy(u8 *src, u64 src_len, u8 *dst, u64 dst_len) {
+  Fs_File in;
+  Fs_Error error = fs_file_ropen(&in, src, src_len);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+
+  // Opening 'dst' truncates it, that must not be 'src'
+  struct stat st;
+  struct stat dst_st;
+  u8 buf[FS_MAX_PATH];
+  memcpy(buf, dst, dst_len);
+  buf[dst_len] = 0;
+  if(fstat(in.fd, &st) == 0 && stat((char *) buf, &dst_st) == 0 &&
+     st.st_dev == dst_st.st_dev && st.st_ino == dst_st.st_ino) {
+    fs_file_close(&in);
+    return FS_ERROR_EXISTS;
+  }
+
+  Fs_File out;
+  error = fs_file_wopen(&out, dst, dst_len);
+  if(error != FS_ERROR_NONE) {
+    fs_file_close(&in);
+    return error;
+  }
+  fchmod(out.fd, st.st_mode & 07777);
+
+  u64 copied;
+  error = fs_file_copy(&in, 0, &out, 0, in.size, &copied);
+
+  fs_file_close(&in);
+  fs_file_close(&out);
+  if(error != FS_ERROR_NONE) {
+    fs_delete(dst, dst_len);
+  }
+
+  return error;
+}
+
+FS_DEF Fs_Error fs_copy_link(u8 *src, u8 *dst) {
+  u8 target[FS_MAX_PATH];
+  ssize_t n = readlink((char *) src, (char *) target, sizeof(target) - 1);
+  if(n < 0) {
+    return fs_error_last();
+  }
+  target[n] = 0;
+
+  if(symlink((char *) target, (char *) dst) == 0) {
+    return FS_ERROR_NONE;
+  }
+  if(errno != EEXIST || unlink((char *) dst) != 0 || symlink((char *) target, (char *) dst) != 0) {
+    return fs_error_last();
+  }
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_mkdir(u8 *name, u64 name_len) {
+  u8 buf[FS_MAX_PATH];
+  memcpy(buf, name, name_len);
+  buf[name_len] = 0;
+
+  if(mkdir((char *) buf, 0777) == 0) {
+    return FS_ERROR_NONE;
+  } else {
+    return fs_error_last();
+  }
+}
+
+FS_DEF Fs_Error fs_rmdir(u8 *name, u64 name_len) {
+  u8 buf[FS_MAX_PATH];
+  memcpy(buf, name, name_len);
+  buf[name_len] = 0;
+
+  if(rmdir((char *) buf) == 0) {
+    return FS_ERROR_NONE;
+  } else {
+    return fs_error_last();
+  }
+}
+
+FS_DEF void fs_file_close(Fs_File *f) {
+  if(f->shared) {
+    fs_shared_file_release(f->shared);
+    f->shared = NULL;
+    return;
+  }
   close(f->fd);
 }
 
@@ -743,11 +2212,15 @@ FS_DEF Fs_Error fs_dir_next(Fs_Dir *d, Fs_Dir_Entry *e) {
   e->name_abs_len = d->name_len + e->name_len;
   e->name_abs[e->name_abs_len] = 0;
 
-  if(stat((char *) e->name_abs, &d->stat) < 0) {
+  // Relative to the open directory, the kernel does not walk 'name_abs' again
+  if(fstatat(dirfd(d->handle), d->ent->d_name, &d->stat, 0) < 0) {
     e->time = (Fs_Time) {0};
     e->size = 0;
+    e->mtime = 0;
   } else {
-    struct tm *tm = localtime(&d->stat.st_mtim.tv_sec);
+    // 'localtime' checks the timezone-file on every call
+    struct tm tm_buf;
+    struct tm *tm = localtime_r(&d->stat.st_mtim.tv_sec, &tm_buf);
     e->time.day = tm->tm_mday;
     e->time.month = tm->tm_mon;
     e->time.year = tm->tm_year;
@@ -756,10 +2229,12 @@ FS_DEF Fs_Error fs_dir_next(Fs_Dir *d, Fs_Dir_Entry *e) {
     e->time.sec = tm->tm_sec;
 
     e->size = d->stat.st_size;
+    e->mtime = (u64) d->stat.st_mtim.tv_sec;
   }
 
   e->flags = 0;
-  if((d->ent->d_type == DT_DIR) != 0) {
+  if(d->ent->d_type == DT_DIR ||
+     (d->ent->d_type == DT_UNKNOWN && S_ISDIR(d->stat.st_mode))) {
     e->flags |= FS_DIR_ENTRY_IS_DIR;
   }
 
@@ -776,48 +2251,876 @@ FS_DEF void fs_dir_close(Fs_Dir *d) {
   closedir(d->handle);
 }
 
+// The record of 'getdents64', glibc has no declaration
+typedef struct {
+  u64 d_ino;
+  long long d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+} Fs_Dirent64;
+
+FS_DEF Fs_Error fs_iter_open(Fs_Iter *it, u8 *name, u64 name_len) {
+  u8 buf[FS_MAX_PATH];
+  memcpy(buf, name, name_len);
+  buf[name_len] = 0;
 
-#endif // _WIN32
-
-FS_DEF Fs_Error fs_slurp_file(u8 *name,
-			      u64 name_len,
-			      u8 **_data,
-			      u64 *_data_len) {
-  Fs_Error error;
-
-  Fs_File file;
-  error = fs_file_ropen(&file, name, name_len);
-  if(error != FS_ERROR_NONE) {
-    return error;
+  it->fd = open((char *) buf, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(it->fd < 0) {
+    return fs_error_last();
   }
 
-  u8 *data = FS_ALLOC(file.size);
-  if(!data) {
-    fs_file_close(&file);
+  it->buf = FS_ALLOC(FS_ITER_BUF_SIZE);
+  if(!it->buf) {
+    close(it->fd);
     return FS_ERROR_ALLOC_FAILED;
   }
+  it->pos = 0;
+  it->len = 0;
 
-  u64 data_len = 0;
-  while(data_len < file.size) {
+  return FS_ERROR_NONE;
+}
 
-    u64 read;
-    error = fs_file_read(&file, data + data_len, file.size - data_len, &read);
-    if(error != FS_ERROR_NONE) {
-      fs_file_close(&file);
-      FS_FREE(data);
-      return error;
+FS_DEF Fs_Error fs_iter_next(Fs_Iter *it, Fs_Iter_Entry *e) {
+  for(;;) {
+    if(it->pos >= it->len) {
+      long n = syscall(SYS_getdents64, it->fd, it->buf, FS_ITER_BUF_SIZE);
+      if(n < 0) {
+	return fs_error_last();
+      } else if(n == 0) {
+	return FS_ERROR_EOF;
+      }
+      it->pos = 0;
+      it->len = (u64) n;
     }
 
-    data_len += read;
+    Fs_Dirent64 *d = (Fs_Dirent64 *) (it->buf + it->pos);
+    it->pos += d->d_reclen;
 
-  }
+    char *name = d->d_name;
+    if(name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+      continue;
+    }
 
-  *_data     = data;
-  *_data_len = data_len;
+    e->name = (u8 *) name;
+    e->name_len = strlen(name);
+    switch(d->d_type) {
+    case DT_REG: e->type = FS_TYPE_FILE; break;
+    case DT_DIR: e->type = FS_TYPE_DIR; break;
+    case DT_LNK: e->type = FS_TYPE_LINK; break;
+    case DT_UNKNOWN: e->type = FS_TYPE_UNKNOWN; break;
+    default: e->type = FS_TYPE_OTHER; break;
+    }
+    return FS_ERROR_NONE;
+  }
+}
+
+FS_DEF Fs_Error fs_iter_stat(Fs_Iter *it, Fs_Iter_Entry *e, Fs_Stat *s) {
+  struct stat st;
+  if(fstatat(it->fd, (char *) e->name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+    return fs_error_last();
+  }
+
+  s->is_dir = S_ISDIR(st.st_mode) != 0;
+  s->size = (u64) st.st_size;
+  s->mtime = (u64) st.st_mtim.tv_sec;
+  s->id = (u64) st.st_ino;
+
+  if(e->type == FS_TYPE_UNKNOWN) {
+    if(S_ISREG(st.st_mode)) e->type = FS_TYPE_FILE;
+    else if(S_ISDIR(st.st_mode)) e->type = FS_TYPE_DIR;
+    else if(S_ISLNK(st.st_mode)) e->type = FS_TYPE_LINK;
+    else e->type = FS_TYPE_OTHER;
+  }
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF void fs_iter_close(Fs_Iter *it) {
+  FS_FREE(it->buf);
+  close(it->fd);
+}
+
+#define fs_walk_lock_init(w) do{ pthread_mutex_init(&(w)->lock, NULL); pthread_cond_init(&(w)->cond, NULL); }while(0)
+#define fs_walk_lock_free(w) do{ pthread_mutex_destroy(&(w)->lock); pthread_cond_destroy(&(w)->cond); }while(0)
+#define fs_walk_lock(w) pthread_mutex_lock(&(w)->lock)
+#define fs_walk_unlock(w) pthread_mutex_unlock(&(w)->lock)
+#define fs_walk_wait(w) pthread_cond_wait(&(w)->cond, &(w)->lock)
+#define fs_walk_wake(w) pthread_cond_broadcast(&(w)->cond)
+
+#define FS_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+		       IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+FS_DEF Fs_Error fs_watch_open(Fs_Watch *w) {
+  *w = (Fs_Watch) {0};
+
+  // At most one event per 'struct inotify_event', the table stays half empty
+  w->events_cap = FS_WATCH_BUF_SIZE / sizeof(struct inotify_event) + 1;
+  w->table_cap = 1;
+  while(w->table_cap < 2 * w->events_cap) w->table_cap *= 2;
+
+  w->buf = FS_ALLOC(FS_WATCH_BUF_SIZE);
+  w->events = FS_ALLOC(w->events_cap * sizeof(*w->events));
+  w->table = FS_ALLOC(w->table_cap * sizeof(*w->table));
+  w->names = FS_ALLOC(4 * FS_WATCH_BUF_SIZE);
+  if(!w->buf || !w->events || !w->table || !w->names) {
+    fs_watch_close(w);
+    return FS_ERROR_ALLOC_FAILED;
+  }
+
+  w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(w->fd < 0) {
+    Fs_Error error = fs_error_last();
+    fs_watch_close(w);
+    return error;
+  }
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_watch_dir_set(Fs_Watch_Dir *d, u8 *path, u64 path_len) {
+  u8 *copy = FS_ALLOC(path_len + 1);
+  if(!copy) {
+    return FS_ERROR_ALLOC_FAILED;
+  }
+  memcpy(copy, path, path_len);
+  copy[path_len] = 0;
+
+  if(d->path) FS_FREE(d->path);
+  d->path = copy;
+  d->path_len = path_len;
+  return FS_ERROR_NONE;
+}
+
+// - 'path' ends with a delimiter and is 0-terminated
+FS_DEF Fs_Error fs_watch_add_tree(Fs_Watch *w, u8 *path, u64 path_len) {
+  int wd = inotify_add_watch(w->fd, (char *) path, FS_WATCH_MASK);
+  if(wd < 0) {
+    return fs_error_last();
+  }
+
+  if((u64) wd >= w->dirs_cap) {
+    u64 cap = w->dirs_cap ? w->dirs_cap : 64;
+    while(cap <= (u64) wd) cap *= 2;
+    Fs_Watch_Dir *dirs = FS_ALLOC(cap * sizeof(*dirs));
+    if(!dirs) {
+      inotify_rm_watch(w->fd, wd);
+      return FS_ERROR_ALLOC_FAILED;
+    }
+    memset(dirs, 0, cap * sizeof(*dirs));
+    if(w->dirs) {
+      memcpy(dirs, w->dirs, w->dirs_cap * sizeof(*dirs));
+      FS_FREE(w->dirs);
+    }
+    w->dirs = dirs;
+    w->dirs_cap = cap;
+  }
+  if(w->dirs[wd].moved) {
+    // It came back, before it was unwatched
+    w->dirs[wd].moved = 0;
+    w->moved_len--;
+  }
+  Fs_Error error = fs_watch_dir_set(&w->dirs[wd], path, path_len);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+
+  // Watched before it is read, a directory created in between is not missed
+  Fs_Iter it;
+  error = fs_iter_open(&it, path, path_len);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+  Fs_Iter_Entry e;
+  while(fs_iter_next(&it, &e) == FS_ERROR_NONE) {
+    Fs_Stat stat;
+    if(e.type == FS_TYPE_UNKNOWN && fs_iter_stat(&it, &e, &stat) != FS_ERROR_NONE) {
+      continue;
+    }
+    if(e.type != FS_TYPE_DIR || path_len + e.name_len + 1 >= FS_MAX_PATH) {
+      continue;
+    }
+
+    u8 sub[FS_MAX_PATH];
+    memcpy(sub, path, path_len);
+    memcpy(sub + path_len, e.name, e.name_len);
+    sub[path_len + e.name_len] = FS_DELIM;
+    sub[path_len + e.name_len + 1] = 0;
+    // The rest is still watched. A directory, that is gone meanwhile, has nothing to miss
+    Fs_Error sub_error = fs_watch_add_tree(w, sub, path_len + e.name_len + 1);
+    if(sub_error != FS_ERROR_NONE && sub_error != FS_ERROR_FILE_NOT_FOUND && error == FS_ERROR_NONE) {
+      error = sub_error;
+    }
+  }
+  fs_iter_close(&it);
+
+  return error;
+}
+
+FS_DEF Fs_Error fs_watch_add(Fs_Watch *w, u8 *name, u64 name_len) {
+  if(name_len + 1 >= FS_MAX_PATH) {
+    return FS_ERROR_INVALID_NAME;
+  }
+
+  u8 path[FS_MAX_PATH];
+  memcpy(path, name, name_len);
+  if(name_len == 0 || name[name_len - 1] != FS_DELIM) {
+    path[name_len++] = FS_DELIM;
+  }
+  path[name_len] = 0;
+
+  Fs_Error error = fs_watch_add_tree(w, path, name_len);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+
+  if(w->roots_len == w->roots_cap) {
+    u64 cap = w->roots_cap ? w->roots_cap * 2 : 4;
+    Fs_Watch_Dir *roots = FS_ALLOC(cap * sizeof(*roots));
+    if(!roots) {
+      return FS_ERROR_ALLOC_FAILED;
+    }
+    if(w->roots) {
+      memcpy(roots, w->roots, w->roots_len * sizeof(*roots));
+      FS_FREE(w->roots);
+    }
+    w->roots = roots;
+    w->roots_cap = cap;
+  }
+  w->roots[w->roots_len] = (Fs_Watch_Dir) {0};
+  error = fs_watch_dir_set(&w->roots[w->roots_len], path, name_len);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+  w->roots_len++;
+
+  return FS_ERROR_NONE;
+}
+
+// - appends the event 'path'/'name' or merges it into the one of the same path
+FS_DEF void fs_watch_push(Fs_Watch *w, u8 *path, u64 path_len, u8 *name, u64 name_len, u32 flags) {
+  u8 *p = w->names + w->names_len;
+  memcpy(p, path, path_len);
+  memcpy(p + path_len, name, name_len);
+  u64 len = path_len + name_len;
+  p[len] = 0;
+
+  u64 mask = w->table_cap - 1;
+  u64 slot = fs_file_cache_hash(p, len) & mask;
+  while(w->table[slot]) {
+    Fs_Watch_Event *e = &w->events[w->table[slot] - 1];
+    if(e->path_len == len && memcmp(e->path, p, len) == 0) {
+      e->flags |= flags;
+      return;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  w->table[slot] = (u32) (w->events_len + 1);
+  w->events[w->events_len++] = (Fs_Watch_Event) {
+    .path = p,
+    .path_len = len,
+    .flags = flags,
+  };
+  w->names_len += len + 1;
+}
+
+// - marks 'path' and every directory below it, they moved away. The rest of
+//   the read may still have events of them, 'fs_watch_drop_moved' stops watching them after it
+FS_DEF void fs_watch_move_tree(Fs_Watch *w, u8 *path, u64 path_len) {
+  for(u64 i=0;i<w->dirs_cap;i++) {
+    Fs_Watch_Dir *d = &w->dirs[i];
+    if(d->path &&
+       !d->moved &&
+       d->path_len > path_len &&
+       memcmp(d->path, path, path_len) == 0 &&
+       d->path[path_len] == FS_DELIM) {
+      d->moved = 1;
+      w->moved_len++;
+    }
+  }
+}
+
+FS_DEF void fs_watch_drop_moved(Fs_Watch *w) {
+  for(u64 i=0;w->moved_len > 0 && i<w->dirs_cap;i++) {
+    Fs_Watch_Dir *d = &w->dirs[i];
+    if(d->moved) {
+      inotify_rm_watch(w->fd, (int) i);
+      FS_FREE(d->path);
+      *d = (Fs_Watch_Dir) {0};
+      w->moved_len--;
+    }
+  }
+}
+
+// - reads and coalesces the next batch of events
+FS_DEF Fs_Error fs_watch_fill(Fs_Watch *w) {
+  w->events_len = 0;
+  w->events_pos = 0;
+  w->names_len = 0;
+  memset(w->table, 0, w->table_cap * sizeof(*w->table));
+
+  while(w->events_len == 0) {
+    if(w->buf_pos >= w->buf_len) {
+      fs_watch_drop_moved(w);
+      ssize_t n = read(w->fd, w->buf, FS_WATCH_BUF_SIZE);
+      if(n < 0) {
+	if(errno == EAGAIN || errno == EWOULDBLOCK) {
+	  return FS_ERROR_EOF;
+	}
+	return fs_error_last();
+      }
+      w->buf_pos = 0;
+      w->buf_len = (u64) n;
+    }
+
+    while(w->buf_pos < w->buf_len) {
+      struct inotify_event *ie = (struct inotify_event *) (w->buf + w->buf_pos);
+      u64 name_len = ie->len ? strlen(ie->name) : 0;
+      // The rest goes into the next batch
+      if(w->names_len + FS_MAX_PATH + name_len + 2 > 4 * FS_WATCH_BUF_SIZE) {
+	break;
+      }
+      w->buf_pos += sizeof(*ie) + ie->len;
+
+      if(ie->mask & IN_Q_OVERFLOW) {
+	// Directories, that appeared meanwhile, are not watched yet
+	u32 flags = FS_WATCH_OVERFLOW;
+	for(u64 i=0;i<w->roots_len;i++) {
+	  if(fs_watch_add_tree(w, w->roots[i].path, w->roots[i].path_len) != FS_ERROR_NONE) {
+	    flags |= FS_WATCH_UNWATCHED;
+	  }
+	}
+	fs_watch_push(w, (u8 *) "", 0, (u8 *) "", 0, flags);
+	continue;
+      }
+      if(ie->wd < 0 || (u64) ie->wd >= w->dirs_cap || !w->dirs[ie->wd].path) {
+	continue;
+      }
+      Fs_Watch_Dir *d = &w->dirs[ie->wd];
+      if(ie->mask & IN_IGNORED) {
+	if(d->moved) w->moved_len--;
+	FS_FREE(d->path);
+	*d = (Fs_Watch_Dir) {0};
+	continue;
+      }
+
+      u32 flags = 0;
+      if(ie->mask & (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE)) flags |= FS_WATCH_CHANGED;
+      if(ie->mask & (IN_CREATE | IN_MOVED_TO)) flags |= FS_WATCH_CREATED;
+      if(ie->mask & (IN_DELETE | IN_MOVED_FROM)) flags |= FS_WATCH_REMOVED;
+      if(ie->mask & IN_ISDIR) flags |= FS_WATCH_IS_DIR;
+
+      if((flags & FS_WATCH_IS_DIR) && name_len > 0 && d->path_len + name_len + 1 < FS_MAX_PATH) {
+	u8 sub[FS_MAX_PATH];
+	memcpy(sub, d->path, d->path_len);
+	memcpy(sub + d->path_len, ie->name, name_len);
+	sub[d->path_len + name_len] = FS_DELIM;
+	sub[d->path_len + name_len + 1] = 0;
+	if(ie->mask & IN_MOVED_FROM) {
+	  fs_watch_move_tree(w, sub, d->path_len + name_len);
+	} else if(ie->mask & (IN_CREATE | IN_MOVED_TO)) {
+	  Fs_Error error = fs_watch_add_tree(w, sub, d->path_len + name_len + 1);
+	  if(error != FS_ERROR_NONE && error != FS_ERROR_FILE_NOT_FOUND) {
+	    flags |= FS_WATCH_UNWATCHED;
+	  }
+	}
+	// 'w->dirs' may have moved
+	d = &w->dirs[ie->wd];
+      }
+
+      fs_watch_push(w, d->path, d->path_len, (u8 *) ie->name, name_len, flags);
+    }
+  }
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_watch_next(Fs_Watch *w, Fs_Watch_Event *e) {
+  if(w->events_pos >= w->events_len) {
+    Fs_Error error = fs_watch_fill(w);
+    if(error != FS_ERROR_NONE) {
+      return error;
+    }
+  }
+
+  *e = w->events[w->events_pos++];
+  return FS_ERROR_NONE;
+}
+
+FS_DEF void fs_watch_close(Fs_Watch *w) {
+  if(w->fd > 0) close(w->fd);
+  for(u64 i=0;i<w->dirs_cap;i++) {
+    if(w->dirs[i].path) FS_FREE(w->dirs[i].path);
+  }
+  for(u64 i=0;i<w->roots_len;i++) {
+    FS_FREE(w->roots[i].path);
+  }
+  if(w->dirs) FS_FREE(w->dirs);
+  if(w->roots) FS_FREE(w->roots);
+  if(w->buf) FS_FREE(w->buf);
+  if(w->events) FS_FREE(w->events);
+  if(w->table) FS_FREE(w->table);
+  if(w->names) FS_FREE(w->names);
+  *w = (Fs_Watch) {0};
+}
+
+
+#endif // _WIN32
+
+FS_DEF void fs_walk_dir(Fs_Walk *w, u8 *dir, u64 dir_len) {
+  Fs_Iter it;
+  if(fs_iter_open(&it, dir, dir_len) != FS_ERROR_NONE) {
+    return;
+  }
+
+  Fs_Iter_Entry e;
+  while(!fs_atomic_get(&w->stop) && fs_iter_next(&it, &e) == FS_ERROR_NONE) {
+    Fs_Walk_Result result = w->proc(dir, dir_len, &it, &e, w->data);
+    if(result == FS_WALK_STOP) {
+      fs_walk_lock(w);
+      fs_atomic_set(&w->stop, 1);
+      fs_walk_wake(w);
+      fs_walk_unlock(w);
+      break;
+    } else if(result == FS_WALK_SKIP) {
+      continue;
+    }
+
+    if(e.type == FS_TYPE_UNKNOWN) {
+      Fs_Stat stat;
+      if(fs_iter_stat(&it, &e, &stat) != FS_ERROR_NONE) {
+	continue;
+      }
+    }
+    if(e.type != FS_TYPE_DIR) {
+      continue;
+    }
+
+    u64 sub_len = dir_len + e.name_len + 1;
+    if(sub_len >= FS_MAX_PATH) {
+      continue;
+    }
+    u8 *sub = FS_ALLOC(sub_len + 1);
+    if(!sub) {
+      continue;
+    }
+    memcpy(sub, dir, dir_len);
+    memcpy(sub + dir_len, e.name, e.name_len);
+    sub[sub_len - 1] = FS_DELIM;
+    sub[sub_len] = 0;
+
+    fs_walk_lock(w);
+    int queued = w->queue_len < FS_WALK_QUEUE_CAP;
+    if(queued) {
+      w->queue[w->queue_len++] = sub;
+      fs_walk_wake(w);
+    }
+    fs_walk_unlock(w);
+
+    if(!queued) {
+      fs_walk_dir(w, sub, sub_len);
+      FS_FREE(sub);
+    }
+  }
+
+  fs_iter_close(&it);
+}
+
+FS_DEF void fs_walk_work(Fs_Walk *w) {
+  fs_walk_lock(w);
+  for(;;) {
+    while(w->queue_len == 0 && w->busy > 0 && !w->stop) {
+      fs_walk_wait(w);
+    }
+    if(w->queue_len == 0 || w->stop) {
+      break;
+    }
+
+    u8 *dir = w->queue[--w->queue_len];
+    w->busy++;
+    fs_walk_unlock(w);
+
+    fs_walk_dir(w, dir, strlen((char *) dir));
+    FS_FREE(dir);
+
+    fs_walk_lock(w);
+    w->busy--;
+    if(w->queue_len == 0 && w->busy == 0) {
+      fs_walk_wake(w);
+    }
+  }
+  fs_walk_unlock(w);
+}
+
+#ifdef _WIN32
+FS_DEF DWORD WINAPI fs_walk_thread(LPVOID w) {
+  fs_walk_work(w);
+  return 0;
+}
+#else
+FS_DEF void *fs_walk_thread(void *w) {
+  fs_walk_work(w);
+  return NULL;
+}
+#endif // _WIN32
+
+FS_DEF Fs_Error fs_walk(u8 *name, u64 name_len, u64 threads, Fs_Walk_Proc proc, void *data) {
+  if(name_len + 1 >= FS_MAX_PATH) {
+    return FS_ERROR_INVALID_NAME;
+  }
+
+  // Only the root must open
+  Fs_Iter it;
+  Fs_Error error = fs_iter_open(&it, name, name_len);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+  fs_iter_close(&it);
+
+  Fs_Walk *w = FS_ALLOC(sizeof(*w));
+  if(!w) {
+    return FS_ERROR_ALLOC_FAILED;
+  }
+  u8 *root = FS_ALLOC(name_len + 2);
+  if(!root) {
+    FS_FREE(w);
+    return FS_ERROR_ALLOC_FAILED;
+  }
+  memcpy(root, name, name_len);
+  if(name_len == 0 || (name[name_len - 1] != '/' && name[name_len - 1] != FS_DELIM)) {
+    root[name_len++] = FS_DELIM;
+  }
+  root[name_len] = 0;
+
+  w->proc = proc;
+  w->data = data;
+  w->queue[0] = root;
+  w->queue_len = 1;
+  w->busy = 0;
+  w->stop = 0;
+  fs_walk_lock_init(w);
+
+  if(threads < 1) threads = 1;
+  if(threads > FS_WALK_THREADS_MAX) threads = FS_WALK_THREADS_MAX;
+
+  // The caller is the first thread, fewer threads are fine
+#ifdef _WIN32
+  HANDLE handles[FS_WALK_THREADS_MAX];
+  u64 started = 0;
+  for(u64 i=1;i<threads;i++) {
+    handles[started] = CreateThread(NULL, 0, fs_walk_thread, w, 0, NULL);
+    if(handles[started] != NULL) started++;
+  }
+  fs_walk_work(w);
+  for(u64 i=0;i<started;i++) {
+    WaitForSingleObject(handles[i], INFINITE);
+    CloseHandle(handles[i]);
+  }
+#else
+  pthread_t handles[FS_WALK_THREADS_MAX];
+  u64 started = 0;
+  for(u64 i=1;i<threads;i++) {
+    if(pthread_create(&handles[started], NULL, fs_walk_thread, w) == 0) started++;
+  }
+  fs_walk_work(w);
+  for(u64 i=0;i<started;i++) {
+    pthread_join(handles[i], NULL);
+  }
+#endif // _WIN32
+
+  // Left over by FS_WALK_STOP
+  for(u64 i=0;i<w->queue_len;i++) {
+    FS_FREE(w->queue[i]);
+  }
+  fs_walk_lock_free(w);
+  FS_FREE(w);
+
+  return FS_ERROR_NONE;
+}
+
+typedef struct {
+  u64 src_len; // of the root, with its delimiter
+  u8 *dst;     // the root, with its delimiter
+  u64 dst_len;
+  volatile long error; // atomic, the first one
+} Fs_Copy_Tree;
+
+FS_DEF Fs_Walk_Result fs_copy_tree_entry(u8 *dir, u64 dir_len, Fs_Iter *it, Fs_Iter_Entry *e, void *data) {
+  Fs_Copy_Tree *t = data;
+
+  u8 src[FS_MAX_PATH];
+  u8 dst[FS_MAX_PATH];
+  u64 rel_len = dir_len - t->src_len;
+  u64 src_len = dir_len + e->name_len;
+  u64 dst_len = t->dst_len + rel_len + e->name_len;
+
+  Fs_Error error = FS_ERROR_NONE;
+  if(src_len >= FS_MAX_PATH || dst_len >= FS_MAX_PATH) {
+    error = FS_ERROR_INVALID_NAME;
+    goto fail;
+  }
+  memcpy(src, dir, dir_len);
+  memcpy(src + dir_len, e->name, e->name_len);
+  src[src_len] = 0;
+  memcpy(dst, t->dst, t->dst_len);
+  memcpy(dst + t->dst_len, dir + t->src_len, rel_len);
+  memcpy(dst + t->dst_len + rel_len, e->name, e->name_len);
+  dst[dst_len] = 0;
+
+  if(e->type == FS_TYPE_UNKNOWN) {
+    Fs_Stat stat;
+    error = fs_iter_stat(it, e, &stat);
+    if(error != FS_ERROR_NONE) {
+      goto fail;
+    }
+  }
+
+  switch(e->type) {
+  case FS_TYPE_DIR:
+    // Before 'fs_walk' queues it, so it exists for its entries
+    error = fs_mkdir(dst, dst_len);
+    if(error == FS_ERROR_EXISTS) error = FS_ERROR_NONE;
+    break;
+  case FS_TYPE_FILE:
+    error = fs_copy(src, src_len, dst, dst_len);
+    break;
+  case FS_TYPE_LINK:
+#ifndef _WIN32
+    error = fs_copy_link(src, dst);
+#endif // _WIN32
+    break;
+  default:
+    break;
+  }
+  if(error == FS_ERROR_NONE) {
+    return FS_WALK_CONTINUE;
+  }
+
+ fail:
+  fs_atomic_set(&t->error, (long) error);
+  return FS_WALK_STOP;
+}
+
+FS_DEF Fs_Error fs_copy_tree(u8 *src, u64 src_len, u8 *dst, u64 dst_len, u64 threads) {
+  if(dst_len + 1 >= FS_MAX_PATH) {
+    return FS_ERROR_INVALID_NAME;
+  }
+
+  Fs_Error error = fs_mkdir(dst, dst_len);
+  if(error != FS_ERROR_NONE && error != FS_ERROR_EXISTS) {
+    return error;
+  }
+
+  // The walk would find the copies and copy them again, without an end
+  if(fs_within(src, src_len, dst, dst_len)) {
+    if(error == FS_ERROR_NONE) {
+      fs_rmdir(dst, dst_len);
+    }
+    return FS_ERROR_INVALID_NAME;
+  }
+
+  u8 root[FS_MAX_PATH];
+  memcpy(root, dst, dst_len);
+  if(dst_len == 0 || (dst[dst_len - 1] != '/' && dst[dst_len - 1] != FS_DELIM)) {
+    root[dst_len++] = FS_DELIM;
+  }
+
+  // The same delimiter, that 'fs_walk' appends
+  Fs_Copy_Tree t;
+  t.src_len = src_len;
+  if(src_len == 0 || (src[src_len - 1] != '/' && src[src_len - 1] != FS_DELIM)) {
+    t.src_len++;
+  }
+  t.dst = root;
+  t.dst_len = dst_len;
+  t.error = FS_ERROR_NONE;
+
+  error = fs_walk(src, src_len, threads, fs_copy_tree_entry, &t);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+  return (Fs_Error) fs_atomic_get(&t.error);
+}
+
+FS_DEF Fs_Error fs_file_copy_buffered(Fs_File *src,
+				      u64 src_offset,
+				      Fs_File *dst,
+				      u64 dst_offset,
+				      u64 len,
+				      u64 *copied) {
+  *copied = 0;
+  if(len == 0) {
+    return FS_ERROR_NONE;
+  }
+
+  u64 cap = len < FS_COPY_BUF_SIZE ? len : FS_COPY_BUF_SIZE;
+  u8 *buf = FS_ALLOC(cap);
+  if(!buf) {
+    return FS_ERROR_ALLOC_FAILED;
+  }
+
+  Fs_Error error = FS_ERROR_NONE;
+  while(*copied < len) {
+    u64 want = len - *copied < cap ? len - *copied : cap;
+    u64 read;
+    error = fs_file_pread(src, src_offset + *copied, buf, want, &read);
+    if(error == FS_ERROR_EOF) {
+      error = FS_ERROR_NONE;
+      break;
+    }
+    if(error != FS_ERROR_NONE) {
+      break;
+    }
+
+    u64 written = 0;
+    while(written < read) {
+      u64 n;
+      error = fs_file_pwrite(dst, dst_offset + *copied + written, buf + written, read - written, &n);
+      if(error != FS_ERROR_NONE) {
+	break;
+      }
+      written += n;
+    }
+    *copied += written;
+    if(error != FS_ERROR_NONE) {
+      break;
+    }
+  }
+
+  FS_FREE(buf);
+  return error;
+}
+
+FS_DEF Fs_Error fs_slurp_file(u8 *name,
+			      u64 name_len,
+			      u8 **_data,
+			      u64 *_data_len) {
+  Fs_Error error;
+
+  Fs_File file;
+  error = fs_file_ropen(&file, name, name_len);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+
+  u8 *data = FS_ALLOC(file.size);
+  if(!data) {
+    fs_file_close(&file);
+    return FS_ERROR_ALLOC_FAILED;
+  }
+
+  u64 data_len = 0;
+  while(data_len < file.size) {
+
+    u64 read;
+    error = fs_file_read(&file, data + data_len, file.size - data_len, &read);
+    if(error != FS_ERROR_NONE) {
+      fs_file_close(&file);
+      FS_FREE(data);
+      return error;
+    }
+
+    data_len += read;
+
+  }
+  fs_file_close(&file);
+
+  *_data     = data;
+  *_data_len = data_len;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_load_file(u8 *name,
+			     u64 name_len,
+			     Fs_Map *m,
+			     int flags) {
+  Fs_Error error;
+
+  Fs_File file;
+  error = fs_file_ropen(&file, name, name_len);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+
+  if(file.size >= FS_LOAD_MAP_MIN) {
+    error = fs_file_map(&file, m, 0, file.size, flags);
+    if(error != FS_ERROR_UNSUPPORTED) {
+      fs_file_close(&file);
+      return error;
+    }
+  }
+
+  *m = (Fs_Map) {0};
+  m->flags = flags | FS_MAP_ALLOCATED;
+  m->data = FS_ALLOC(file.size ? file.size : 1);
+  if(!m->data) {
+    fs_file_close(&file);
+    return FS_ERROR_ALLOC_FAILED;
+  }
+
+  while(m->len < file.size) {
+    u64 read;
+    error = fs_file_read(&file, m->data + m->len, file.size - m->len, &read);
+    if(error != FS_ERROR_NONE) {
+      fs_file_close(&file);
+      fs_file_unmap(m);
+      return error;
+    }
+    m->len += read;
+  }
+  fs_file_close(&file);
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_file_map_window(Fs_File *f, Fs_Map *m, u64 offset, u64 window, int flags) {
+  fs_file_unmap(m);
+  if(offset >= f->size) {
+    return FS_ERROR_EOF;
+  }
+  return fs_file_map(f, m, offset, window, flags);
+}
+
+FS_DEF Fs_Error fs_shared_file_ropen(Fs_Shared_File **_s,
+				     u8 *name,
+				     u64 name_len) {
+
+  Fs_Shared_File *s = FS_ALLOC(sizeof(*s));
+  if(!s) {
+    return FS_ERROR_ALLOC_FAILED;
+  }
+
+  Fs_Error error = fs_file_ropen(&s->file, name, name_len);
+  if(error != FS_ERROR_NONE) {
+    FS_FREE(s);
+    return error;
+  }
+  s->refs = 1;
 
+  *_s = s;
   return FS_ERROR_NONE;
 }
 
+FS_DEF Fs_Shared_File *fs_shared_file_retain(Fs_Shared_File *s) {
+  fs_atomic_inc(&s->refs);
+  return s;
+}
+
+FS_DEF void fs_shared_file_ref(Fs_Shared_File *s, Fs_File *f) {
+  *f = s->file;
+  f->pos = 0;
+  f->shared = fs_shared_file_retain(s);
+}
+
+FS_DEF void fs_shared_file_release(Fs_Shared_File *s) {
+  if(fs_atomic_dec(&s->refs) == 0) {
+    fs_file_close(&s->file);
+    FS_FREE(s);
+  }
+}
+
 FS_DEF Fs_Error fs_write_file(u8 *name,
 			      u64 name_len,
 			      u8 *data,
@@ -852,6 +3155,632 @@ FS_DEF Fs_Error fs_write_file(u8 *name,
 
 }
 
+#define FS_WRITER_TMP_SUFFIX_LEN 11 // '.XXXXXX.tmp'
+#define FS_WRITER_TMP_TRIES 64
+
+static volatile long fs_writer_tmp_count = 0;
+
+FS_DEF Fs_Error fs_writer_open(Fs_Writer *w, u8 *name, u64 name_len, u64 cap, u64 sync_every, int flags) {
+  *w = (Fs_Writer) {0};
+  if(name_len + FS_WRITER_TMP_SUFFIX_LEN >= FS_MAX_PATH) {
+    return FS_ERROR_INVALID_NAME;
+  }
+  if(cap == 0) cap = FS_WRITER_BUF_SIZE;
+  cap = (cap + FS_DIRECT_ALIGN - 1) / FS_DIRECT_ALIGN * FS_DIRECT_ALIGN;
+
+  // 'name' and '<name>.XXXXXX.tmp' in one
+  w->name = FS_ALLOC(2 * name_len + FS_WRITER_TMP_SUFFIX_LEN);
+  if(!w->name) {
+    return FS_ERROR_ALLOC_FAILED;
+  }
+  memcpy(w->name, name, name_len);
+  w->name_len = name_len;
+  w->tmp = w->name + name_len;
+  memcpy(w->tmp, name, name_len);
+  w->tmp_len = name_len + FS_WRITER_TMP_SUFFIX_LEN;
+
+  w->mem = FS_ALLOC(cap + FS_DIRECT_ALIGN);
+  if(!w->mem) {
+    FS_FREE(w->name);
+    return FS_ERROR_ALLOC_FAILED;
+  }
+  w->buf = w->mem + (FS_DIRECT_ALIGN - ((u64) w->mem % FS_DIRECT_ALIGN)) % FS_DIRECT_ALIGN;
+  w->cap = cap;
+
+  Fs_Error error;
+  if(flags & FS_WRITER_ATOMIC) {
+    // Like mkstemp, a name that is not taken yet, by any other writer.
+    // The counter tells apart the writers of one second
+    u64 x = (u64) time(NULL) ^ ((u64) fs_atomic_inc(&fs_writer_tmp_count) << 32) ^ (u64) w;
+    u8 *suffix = w->tmp + name_len;
+    error = FS_ERROR_EXISTS;
+    for(u64 i=0;error == FS_ERROR_EXISTS && i<FS_WRITER_TMP_TRIES;i++) {
+      x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+      suffix[0] = '.';
+      for(u64 j=0;j<6;j++) {
+	suffix[1 + j] = "0123456789abcdefghijklmnopqrstuv"[(x >> (34 + 5 * j)) & 31];
+      }
+      memcpy(suffix + 7, ".tmp", 4);
+
+      int direct = (flags & FS_WRITER_DIRECT) != 0;
+      error = fs_file_copen(&w->file, w->tmp, w->tmp_len, &direct);
+      if(!direct) {
+	flags &= ~FS_WRITER_DIRECT;
+      }
+    }
+    if(error == FS_ERROR_NONE) {
+      fs_file_chmod_like(&w->file, w->name, w->name_len);
+    }
+
+  } else {
+    error = FS_ERROR_UNSUPPORTED;
+    if(flags & FS_WRITER_DIRECT) {
+      error = fs_file_dopen(&w->file, w->name, w->name_len);
+    }
+    if(error == FS_ERROR_UNSUPPORTED) {
+      flags &= ~FS_WRITER_DIRECT;
+      error = fs_file_wopen(&w->file, w->name, w->name_len);
+    }
+  }
+  if(error != FS_ERROR_NONE) {
+    FS_FREE(w->mem);
+    FS_FREE(w->name);
+    return error;
+  }
+  w->flags = flags;
+  w->sync_every = sync_every;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_writer_put(Fs_Writer *w, u8 *data, u64 len) {
+  while(len > 0) {
+    u64 written;
+    Fs_Error error = fs_file_write(&w->file, data, len, &written);
+    if(error != FS_ERROR_NONE) {
+      w->error = error;
+      return error;
+    }
+    data += written;
+    len -= written;
+    w->written += written;
+    w->unsynced += written;
+  }
+
+  if(w->sync_every > 0 && w->unsynced >= w->sync_every &&
+     (w->flags & (FS_WRITER_FSYNC | FS_WRITER_FDATASYNC))) {
+    w->error = fs_file_sync(&w->file, !(w->flags & FS_WRITER_FSYNC));
+    w->unsynced = 0;
+  }
+
+  return w->error;
+}
+
+FS_DEF Fs_Error fs_writer_write(Fs_Writer *w, u8 *data, u64 len) {
+  if(w->error != FS_ERROR_NONE) {
+    return w->error;
+  }
+
+  // Bigger than 'buf', copying it only costs
+  if(w->len == 0 && len >= w->cap && !(w->flags & FS_WRITER_DIRECT)) {
+    return fs_writer_put(w, data, len);
+  }
+
+  while(len > 0) {
+    u64 n = w->cap - w->len < len ? w->cap - w->len : len;
+    memcpy(w->buf + w->len, data, n);
+    w->len += n;
+    data += n;
+    len -= n;
+
+    if(w->len == w->cap && fs_writer_flush(w) != FS_ERROR_NONE) {
+      return w->error;
+    }
+  }
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_writer_flush(Fs_Writer *w) {
+  if(w->error != FS_ERROR_NONE) {
+    return w->error;
+  }
+
+  u64 n = w->len;
+  if(w->flags & FS_WRITER_DIRECT) {
+    n -= n % FS_DIRECT_ALIGN;
+  }
+  if(n == 0) {
+    return FS_ERROR_NONE;
+  }
+
+  if(fs_writer_put(w, w->buf, n) != FS_ERROR_NONE) {
+    return w->error;
+  }
+  memmove(w->buf, w->buf + n, w->len - n);
+  w->len -= n;
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_writer_sync(Fs_Writer *w) {
+  if(fs_writer_flush(w) != FS_ERROR_NONE) {
+    return w->error;
+  }
+
+  w->error = fs_file_sync(&w->file, (w->flags & FS_WRITER_FDATASYNC) && !(w->flags & FS_WRITER_FSYNC));
+  w->unsynced = 0;
+  return w->error;
+}
+
+FS_DEF Fs_Error fs_writer_close(Fs_Writer *w) {
+  if(w->error == FS_ERROR_NONE && w->len > 0) {
+    if(w->flags & FS_WRITER_DIRECT) {
+      // Pads the tail to a whole block and cuts the file back
+      u64 size = w->written + w->len;
+      u64 padded = (w->len + FS_DIRECT_ALIGN - 1) / FS_DIRECT_ALIGN * FS_DIRECT_ALIGN;
+      memset(w->buf + w->len, 0, padded - w->len);
+      if(fs_writer_put(w, w->buf, padded) == FS_ERROR_NONE) {
+	w->error = fs_file_truncate(&w->file, size);
+      }
+    } else {
+      fs_writer_put(w, w->buf, w->len);
+    }
+    w->len = 0;
+  }
+
+  int sync = (w->flags & (FS_WRITER_FSYNC | FS_WRITER_FDATASYNC)) != 0;
+  if(w->error == FS_ERROR_NONE && sync) {
+    w->error = fs_file_sync(&w->file, !(w->flags & FS_WRITER_FSYNC));
+  }
+  fs_file_close(&w->file);
+
+  Fs_Error error = w->error;
+  if(w->flags & FS_WRITER_ATOMIC) {
+    if(error == FS_ERROR_NONE) {
+      error = fs_move(w->tmp, w->tmp_len, w->name, w->name_len);
+    }
+    if(error == FS_ERROR_NONE && sync) {
+      error = fs_sync_parent(w->name, w->name_len);
+    } else if(error != FS_ERROR_NONE) {
+      fs_delete(w->tmp, w->tmp_len);
+    }
+  }
+
+  FS_FREE(w->mem);
+  FS_FREE(w->name);
+  *w = (Fs_Writer) {0};
+
+  return error;
+}
+
+FS_DEF void fs_writer_abort(Fs_Writer *w) {
+  fs_file_close(&w->file);
+  if(w->flags & FS_WRITER_ATOMIC) {
+    fs_delete(w->tmp, w->tmp_len);
+  }
+
+  FS_FREE(w->mem);
+  FS_FREE(w->name);
+  *w = (Fs_Writer) {0};
+}
+
+FS_DEF Fs_Error fs_listing_read(Fs_Listing *l) {
+  Fs_Dir dir;
+  Fs_Error error = fs_dir_open(&dir, l->name, l->name_len);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+
+  l->entries_len = 0;
+  l->names_len = 0;
+
+  Fs_Dir_Entry entry;
+  while(fs_dir_next(&dir, &entry) == FS_ERROR_NONE) {
+    if(entry.flags & FS_DIR_ENTRY_FROM_SYSTEM) {
+      continue;
+    }
+
+    if(l->entries_len == l->entries_cap) {
+      u64 cap = l->entries_cap ? l->entries_cap * 2 : 64;
+      Fs_Listing_Entry *entries = FS_ALLOC(cap * sizeof(*entries));
+      if(!entries) {
+	fs_dir_close(&dir);
+	return FS_ERROR_ALLOC_FAILED;
+      }
+      if(l->entries) {
+	memcpy(entries, l->entries, l->entries_len * sizeof(*entries));
+	FS_FREE(l->entries);
+      }
+      l->entries = entries;
+      l->entries_cap = cap;
+    }
+
+    if(l->names_len + entry.name_len + 1 > l->names_cap) {
+      u64 cap = l->names_cap ? l->names_cap * 2 : 4096;
+      while(l->names_len + entry.name_len + 1 > cap) cap *= 2;
+      u8 *names = FS_ALLOC(cap);
+      if(!names) {
+	fs_dir_close(&dir);
+	return FS_ERROR_ALLOC_FAILED;
+      }
+      if(l->names) {
+	memcpy(names, l->names, l->names_len);
+	FS_FREE(l->names);
+      }
+      l->names = names;
+      l->names_cap = cap;
+    }
+
+    // 'name' is set, once 'names' stops moving
+    Fs_Listing_Entry *e = &l->entries[l->entries_len++];
+    e->name_len = entry.name_len;
+    e->flags = entry.flags;
+    e->size = entry.size;
+    e->time = entry.time;
+    e->mtime = entry.mtime;
+
+    memcpy(l->names + l->names_len, entry.name, entry.name_len);
+    l->names_len += entry.name_len;
+    l->names[l->names_len++] = 0;
+  }
+
+  error = dir.error;
+  fs_dir_close(&dir);
+  if(error != FS_ERROR_EOF) {
+    return error;
+  }
+
+  u8 *name = l->names;
+  for(u64 i=0;i<l->entries_len;i++) {
+    l->entries[i].name = name;
+    name += l->entries[i].name_len + 1;
+  }
+
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_listing_get(Fs_Listing_Cache *c, u8 *name, u64 name_len, Fs_Listing **out) {
+  if(name_len >= FS_MAX_PATH) {
+    return FS_ERROR_INVALID_NAME;
+  }
+
+  u64 now = (u64) time(NULL);
+  c->tick++;
+
+  Fs_Listing *l = NULL;
+  Fs_Listing *lru = &c->listings[0];
+  for(u64 i=0;i<FS_LISTING_CACHE_CAP;i++) {
+    Fs_Listing *it = &c->listings[i];
+    if(it->used_at > 0 &&
+       it->name_len == name_len &&
+       memcmp(it->name, name, name_len) == 0) {
+      l = it;
+      break;
+    }
+    if(it->used_at < lru->used_at) {
+      lru = it;
+    }
+  }
+
+  if(l && c->watched) {
+    l->used_at = c->tick;
+    *out = l;
+    return FS_ERROR_NONE;
+  }
+
+  u64 stamp;
+  Fs_Error error = fs_listing_stamp(name, name_len, &stamp);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+
+  if(l && l->stamp == stamp && now - l->read_at < FS_LISTING_MAX_AGE) {
+    l->used_at = c->tick;
+    *out = l;
+    return FS_ERROR_NONE;
+  }
+
+  if(!l) {
+    l = lru;
+    memcpy(l->name, name, name_len);
+    l->name_len = name_len;
+  }
+
+  error = fs_listing_read(l);
+  if(error != FS_ERROR_NONE) {
+    l->used_at = 0;
+    return error;
+  }
+  l->stamp = stamp;
+  l->read_at = now;
+  l->used_at = c->tick;
+
+  *out = l;
+  return FS_ERROR_NONE;
+}
+
+FS_DEF void fs_listing_cache_free(Fs_Listing_Cache *c) {
+  for(u64 i=0;i<FS_LISTING_CACHE_CAP;i++) {
+    Fs_Listing *l = &c->listings[i];
+    if(l->entries) FS_FREE(l->entries);
+    if(l->names) FS_FREE(l->names);
+    *l = (Fs_Listing) {0};
+  }
+}
+
+FS_DEF void fs_listing_invalidate(Fs_Listing_Cache *c, u64 hash) {
+  for(u64 i=0;i<FS_LISTING_CACHE_CAP;i++) {
+    Fs_Listing *l = &c->listings[i];
+    if(l->used_at > 0 && fs_file_cache_hash(l->name, l->name_len) == hash) {
+      l->used_at = 0;
+    }
+  }
+}
+
+FS_DEF u64 fs_file_cache_hash(u8 *name, u64 name_len) {
+  // FNV-1a over the segments, that are not empty or '.'
+  u64 hash = 14695981039346656037ULL;
+  int first = 1;
+  u64 i = 0;
+  while(i < name_len) {
+    u64 j = i;
+    while(j < name_len && name[j] != '/' && name[j] != FS_DELIM) j++;
+
+    if(j > i && !(j - i == 1 && name[i] == '.')) {
+      if(!first) hash = (hash ^ '/') * 1099511628211ULL;
+      for(u64 k=i;k<j;k++) {
+	hash = (hash ^ name[k]) * 1099511628211ULL;
+      }
+      first = 0;
+    }
+    i = j + 1;
+  }
+  return hash;
+}
+
+FS_DEF void fs_file_cache_close(Fs_File_Cache *c, Fs_File_Cache_Entry *e) {
+  if(e->file) {
+    fs_shared_file_release(e->file);
+    e->file = NULL;
+    c->files_len--;
+  }
+}
+
+FS_DEF void fs_file_cache_drop(Fs_File_Cache *c, Fs_File_Cache_Entry *e) {
+  fs_file_cache_close(c, e);
+  e->used_at = 0;
+}
+
+// - makes room for more descriptors. The idle ones, that were not used for
+//   'files_cap / 2' lookups, are closed. All idle ones, if that is not enough
+FS_DEF void fs_file_cache_sweep(Fs_File_Cache *c) {
+  u64 keep = c->files_cap / 2;
+  for(u64 i=0;i<FS_FILE_CACHE_CAP;i++) {
+    Fs_File_Cache_Entry *e = &c->entries[i];
+    if(e->file && fs_atomic_get(&e->file->refs) == 1 && e->used_at + keep < c->tick) {
+      fs_file_cache_close(c, e);
+    }
+  }
+  if(c->files_len >= c->files_cap) {
+    fs_file_cache_trim(c);
+  }
+}
+
+// - finds or inserts 'name' and checks it again, if it is outdated
+FS_DEF Fs_Error fs_file_cache_lookup(Fs_File_Cache *c, u8 *name, u64 name_len, Fs_File_Cache_Entry **out) {
+  if(name_len >= FS_MAX_PATH) {
+    return FS_ERROR_INVALID_NAME;
+  }
+
+  if(!c->entries) {
+    c->entries = FS_ALLOC(sizeof(*c->entries) * FS_FILE_CACHE_CAP);
+    if(!c->entries) {
+      return FS_ERROR_ALLOC_FAILED;
+    }
+    memset(c->entries, 0, sizeof(*c->entries) * FS_FILE_CACHE_CAP);
+    if(c->files_cap == 0) {
+      c->files_cap = fs_file_cache_budget();
+    }
+  }
+
+  u64 hash = fs_file_cache_hash(name, name_len);
+  u64 now = (u64) time(NULL);
+  c->tick++;
+
+  Fs_File_Cache_Entry *set = &c->entries[(hash % (FS_FILE_CACHE_CAP / FS_FILE_CACHE_WAYS)) * FS_FILE_CACHE_WAYS];
+  Fs_File_Cache_Entry *e = NULL;
+  Fs_File_Cache_Entry *lru = &set[0];
+  for(u64 i=0;i<FS_FILE_CACHE_WAYS;i++) {
+    Fs_File_Cache_Entry *it = &set[i];
+    if(it->used_at > 0 &&
+       it->hash == hash &&
+       it->name_len == name_len &&
+       memcmp(it->name, name, name_len) == 0) {
+      e = it;
+      break;
+    }
+    if(it->used_at < lru->used_at) {
+      lru = it;
+    }
+  }
+
+  if(e && (c->watched || now - e->checked_at < FS_FILE_CACHE_MAX_AGE)) {
+    e->used_at = c->tick;
+    *out = e;
+    return FS_ERROR_NONE;
+  }
+
+  if(!e) {
+    e = lru;
+    fs_file_cache_drop(c, e);
+    if(e->name_cap < name_len) {
+      if(e->name) FS_FREE(e->name);
+      e->name_cap = 0;
+      e->name = FS_ALLOC(name_len);
+      if(!e->name) {
+	return FS_ERROR_ALLOC_FAILED;
+      }
+      e->name_cap = name_len;
+    }
+    memcpy(e->name, name, name_len);
+    e->name_len = name_len;
+    e->hash = hash;
+  }
+
+  Fs_Stat stat = {0};
+  Fs_Error error = fs_stat(name, name_len, &stat);
+  if(e->file && (error != FS_ERROR_NONE ||
+		 stat.size != e->stat.size ||
+		 stat.mtime != e->stat.mtime ||
+		 stat.id != e->stat.id)) {
+    fs_file_cache_close(c, e);
+  }
+  e->error = error;
+  e->stat = stat;
+  e->checked_at = now;
+  e->used_at = c->tick;
+
+  *out = e;
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_file_cache_stat(Fs_File_Cache *c, u8 *name, u64 name_len, Fs_Stat *s) {
+  Fs_File_Cache_Entry *e;
+  Fs_Error error = fs_file_cache_lookup(c, name, name_len, &e);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+  if(e->error != FS_ERROR_NONE) {
+    return e->error;
+  }
+
+  *s = e->stat;
+  return FS_ERROR_NONE;
+}
+
+FS_DEF Fs_Error fs_file_cache_open(Fs_File_Cache *c, u8 *name, u64 name_len, Fs_File *f) {
+  Fs_File_Cache_Entry *e;
+  Fs_Error error = fs_file_cache_lookup(c, name, name_len, &e);
+  if(error != FS_ERROR_NONE) {
+    return error;
+  }
+  if(e->error != FS_ERROR_NONE) {
+    return e->error;
+  }
+  if(e->stat.is_dir) {
+    return FS_ERROR_IS_DIRECTORY;
+  }
+
+  if(!e->file) {
+    if(c->files_len >= c->files_cap) {
+      fs_file_cache_sweep(c);
+    }
+    if(c->files_len >= c->files_cap) {
+      // Every kept one is read from, this one is closed by 'f'
+      return fs_file_ropen(f, name, name_len);
+    }
+
+    error = fs_shared_file_ropen(&e->file, name, name_len);
+    if(error == FS_ERROR_LIMIT) {
+      // Out of descriptors, the idle ones go first
+      fs_file_cache_trim(c);
+      error = fs_shared_file_ropen(&e->file, name, name_len);
+    }
+    if(error != FS_ERROR_NONE) {
+      if(error != FS_ERROR_ALLOC_FAILED && error != FS_ERROR_LIMIT) e->error = error;
+      return error;
+    }
+    c->files_len++;
+    // The descriptor wins, if the file changed since the stat
+    e->stat.size = e->file->file.size;
+  }
+
+  fs_shared_file_ref(e->file, f);
+  return FS_ERROR_NONE;
+}
+
+FS_DEF void fs_file_cache_invalidate(Fs_File_Cache *c, u64 hash) {
+  if(!c->entries) {
+    return;
+  }
+
+  Fs_File_Cache_Entry *set = &c->entries[(hash % (FS_FILE_CACHE_CAP / FS_FILE_CACHE_WAYS)) * FS_FILE_CACHE_WAYS];
+  for(u64 i=0;i<FS_FILE_CACHE_WAYS;i++) {
+    if(set[i].used_at > 0 && set[i].hash == hash) {
+      fs_file_cache_drop(c, &set[i]);
+    }
+  }
+}
+
+FS_DEF void fs_file_cache_clear(Fs_File_Cache *c) {
+  if(!c->entries) {
+    return;
+  }
+
+  for(u64 i=0;i<FS_FILE_CACHE_CAP;i++) {
+    fs_file_cache_drop(c, &c->entries[i]);
+  }
+}
+
+FS_DEF void fs_file_cache_trim(Fs_File_Cache *c) {
+  if(!c->entries) {
+    return;
+  }
+
+  for(u64 i=0;i<FS_FILE_CACHE_CAP;i++) {
+    Fs_File_Cache_Entry *e = &c->entries[i];
+    if(e->file && fs_atomic_get(&e->file->refs) == 1) {
+      fs_file_cache_close(c, e);
+    }
+  }
+}
+
+FS_DEF void fs_watch_invalidate(Fs_Watch_Event *e, Fs_File_Cache *files, Fs_Listing_Cache *listings) {
+  if(e->flags & FS_WATCH_UNWATCHED) {
+    if(files) files->watched = 0;
+    if(listings) listings->watched = 0;
+  }
+
+  if((e->flags & (FS_WATCH_OVERFLOW | FS_WATCH_UNWATCHED)) ||
+     ((e->flags & FS_WATCH_IS_DIR) && (e->flags & (FS_WATCH_CREATED | FS_WATCH_REMOVED)))) {
+    if(files) fs_file_cache_clear(files);
+    if(listings) {
+      for(u64 i=0;i<FS_LISTING_CACHE_CAP;i++) listings->listings[i].used_at = 0;
+    }
+    return;
+  }
+
+  u64 hash = fs_file_cache_hash(e->path, e->path_len);
+  if(files) fs_file_cache_invalidate(files, hash);
+  if(!listings) {
+    return;
+  }
+
+  // The directory of 'e' lists its size and mtime
+  u64 len = e->path_len;
+  while(len > 0 && (e->path[len - 1] == '/' || e->path[len - 1] == FS_DELIM)) len--;
+  while(len > 0 && e->path[len - 1] != '/' && e->path[len - 1] != FS_DELIM) len--;
+  fs_listing_invalidate(listings, fs_file_cache_hash(e->path, len));
+  if(e->flags & FS_WATCH_IS_DIR) {
+    fs_listing_invalidate(listings, hash);
+  }
+}
+
+FS_DEF void fs_file_cache_free(Fs_File_Cache *c) {
+  if(!c->entries) {
+    return;
+  }
+
+  for(u64 i=0;i<FS_FILE_CACHE_CAP;i++) {
+    Fs_File_Cache_Entry *e = &c->entries[i];
+    fs_file_cache_drop(c, e);
+    if(e->name) FS_FREE(e->name);
+  }
+  FS_FREE(c->entries);
+  *c = (Fs_File_Cache) {0};
+}
+
 #endif //FS_IMPLEMENTATION
 
 #undef u8
@@ -41,14 +41,26 @@
 #  define IP_IMPLEMENTATION
 #  define STR_IMPLEMENTATION
 #  define FS_IMPLEMENTATION
+#  define JDEFL_IMPLEMENTATION
 #endif // FTPSERVER_IMPLEMENTATION
 
 #include <core/ip.h>
 #include <core/str.h>
 #include <core/fs.h>
+#include <core/jdefl.h>
 #include <core/types.h>
 
-#define FTPSERVER_SOCKETS_PER_CLIENT 3 // text + data + data_acceptor
+#define FTPSERVER_SOCKETS_PER_CLIENT 2 // text + data
+
+// Passive ports of a server. A session holds one from PASV/EPSV, until
+// its data connection is accepted
+#ifndef FTPSERVER_PASSIVE_COUNT
+#  define FTPSERVER_PASSIVE_COUNT(number_of_clients) ((number_of_clients) / 4 + 1)
+#endif // FTPSERVER_PASSIVE_COUNT
+
+// Sockets to reserve for a server: sessions, passive acceptors and the listener
+#define FTPSERVER_SOCKETS_COUNT(number_of_clients)			\
+  (FTPSERVER_SOCKETS_PER_CLIENT*(number_of_clients) + FTPSERVER_PASSIVE_COUNT(number_of_clients) + 1)
 
 typedef enum {
   FTPSERVER_ACTION_KIND_NONE,
@@ -57,7 +69,22 @@ typedef enum {
   FTPSERVER_ACTION_KIND_READ_FILE,
 } Ftp_Server_Action_Kind;
 
-#define FTPSERVER_SESSION_WINDOW_SIZE 1024
+// Bytes per read and write of a transfer, that can not use sendfile
+#ifndef FTPSERVER_SESSION_WINDOW_SIZE
+#  define FTPSERVER_SESSION_WINDOW_SIZE (64 * 1024)
+#endif // FTPSERVER_SESSION_WINDOW_SIZE
+
+// Bytes buffered per write of a STOR, that can not use splice
+#ifndef FTPSERVER_SESSION_STORE_SIZE
+#  define FTPSERVER_SESSION_STORE_SIZE (1024 * 1024)
+#endif // FTPSERVER_SESSION_STORE_SIZE
+
+// The state of MODE Z, allocated once a session asks for it
+typedef struct {
+  jdefl_stream defl;
+  jinfl_stream infl;
+  u8 raw[FTPSERVER_SESSION_WINDOW_SIZE]; // uncompressed for RETR, compressed for STOR
+} Ftp_Server_Z;
 
 typedef struct {
   
@@ -65,6 +92,9 @@ typedef struct {
   u8 dir[FS_MAX_PATH];
   u64 dir_len;
   int logged_in;
+
+  // scratch of the current command, 'dir_base' + 'dir' + argument
+  u8 path[FS_MAX_PATH];
   
   // allocations
   str_builder sb;  
@@ -76,6 +106,17 @@ typedef struct {
   // response
   Ftp_Server_Action_Kind response_kind;
   Fs_File file;
+  int sendfile; // while 'ip_socket_sendfile' works for 'file'
+  Ip_Splice pipe;
+  int splice; // while 'ip_socket_splice' works for 'file'
+  u64 rest; // offset of the next RETR/STOR, set by REST
+  u64 allo; // size of the next STOR, set by ALLO
+  u64 store_hash; // of the STOR/APPE path, dropped from 'files' once it is written
+  Fs_Error store_error; // the first failed write of a STOR, the rest is dropped
+  Ftp_Server_Z *z; // MODE Z, NULL in MODE S
+  s64 passive; // acceptor of PASV/EPSV, -1 if there is none
+  s32 z_level; // set by OPTS MODE Z LEVEL
+  int quit; // close the control connection, once 'message' is written
   str message;
   
   Ftp_Server_Action_Kind data_kind;
@@ -84,21 +125,82 @@ typedef struct {
 } Ftp_Server_Session;
 
 FTPSERVER_DEF int ftpserver_session_fill_for_data(Ftp_Server_Session *s);
-
+// - close the data connection and the file of a transfer, if there is one
+FTPSERVER_DEF void ftpserver_session_close_data(Ftp_Server_Session *s, Ip_Sockets *_s, u64 data_index);
+// - write what a STOR buffered in 's->sb' to 's->file'. A failure is kept
+//   in 's->store_error'
+FTPSERVER_DEF void ftpserver_session_flush(Ftp_Server_Session *s);
+// - the reply to a STOR, that 's->store_error' ended
+#define ftpserver_store_error_message(e) ((e) == FS_ERROR_LIMIT	\
+					  ? str_fromd("452 Insufficient storage space\r\n") \
+					  : str_fromd("451 Cannot write file\r\n"))
+// - inflate 'len' bytes of 's->z->raw' into 's->sb', returns 0 on corrupt data
+FTPSERVER_DEF int ftpserver_session_inflate(Ftp_Server_Session *s, u64 len, int last);
+FTPSERVER_DEF void ftpserver_session_free_z(Ftp_Server_Session *s);
+// - appends 'n', left-padded with 'pad' to 'width' characters
+FTPSERVER_DEF void ftpserver_append_number(str_builder *sb, u64 n, u64 width, u8 pad);
+// - appends 'seconds' since 1970 as YYYYMMDDHHMMSS, in UTC (MDTM, MLSx)
+FTPSERVER_DEF void ftpserver_append_time(str_builder *sb, u64 seconds);
+// - appends the MLSx facts of a file, up to and including the space before its name
+FTPSERVER_DEF void ftpserver_append_facts(str_builder *sb, int is_dir, u64 size, u64 mtime);
+
+// First passive port, the ports of a server count down from here
+#ifndef FTPSERVER_PASSIVE_PORT
+#  define FTPSERVER_PASSIVE_PORT 60000
+#endif // FTPSERVER_PASSIVE_PORT
+
+// Read-only, after 'ftpserver_config_open'. Can be shared between
+// servers, that run in different threads
 typedef struct {
-  Ftp_Server_Session *sessions;
-  u64 number_of_clients;
   str dir_base;
   str username;
   str password;
 
-  // current directory
-  u8 path[FS_MAX_PATH];
-  u64 path_len;
+  Ip ip; // '.' replaced by ','
+  u16 passive_port;
+  volatile long passive_used; // ports handed out, atomic
+} Ftp_Server_Config;
+
+// One per event loop. Every loop opens the ftp port itself, 'ip_socket_sopen'
+// sets SO_REUSEPORT, so the kernel distributes the clients:
+//
+//   Ftp_Server_Config c;
+//   ftpserver_config_open(&c, dir, username, password);
+//   // in every thread
+//   Ftp_Server f;
+//   ftpserver_open_shared(&f, &c, number_of_clients);
+//
+typedef struct {
+  Ftp_Server_Session *sessions;
+  u64 number_of_clients;
 
-  Ip ip;
+  Ftp_Server_Config *config;
+  Ftp_Server_Config own; // of 'ftpserver_open'
+
+  // passive acceptors, 'passive_port' + i is the port of acceptor i
+  u16 passive_port;
+  u64 number_of_passive;
+  u64 *passive_free; // queue of the acceptors, no session holds
+  u64 passive_free_head;
+  u64 passive_free_len;
+  u64 *passive_session; // the session, that holds an acceptor
+
+  // listings of LIST/MLSD, per server, there is no lock
+  Fs_Listing_Cache listings;
+  // files of RETR and stats of SIZE/MDTM/MLST, dropped by STOR, DELE, ...
+  Fs_File_Cache files;
 } Ftp_Server;
 
+FTPSERVER_DEF int ftpserver_config_open(Ftp_Server_Config *c,
+					str dir,
+					str username,
+					str password);
+// - reserves FTPSERVER_PASSIVE_COUNT(number_of_clients) passive ports of 'c',
+//   that no other server uses
+FTPSERVER_DEF int ftpserver_open_shared(Ftp_Server *f,
+					Ftp_Server_Config *c,
+					u64 number_of_clients);
+// - a server, that does not share its config. 'f' must not be moved
 FTPSERVER_DEF int ftpserver_open(Ftp_Server *f, u64 number_of_clients,
 				 str dir,
 				 str username,
@@ -111,44 +213,117 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 				  u64 index,
 				  Ip_Mode mode);
 FTPSERVER_DEF void ftpserver_close(Ftp_Server *f);
+// - hand out the acceptor of session 'session_index', opens it if it is closed
+FTPSERVER_DEF int ftpserver_passive_open(Ftp_Server *f, Ip_Sockets *_s, u64 off, u64 session_index, u16 *port);
+// - close the acceptor of session 'session_index', if there is one
+FTPSERVER_DEF void ftpserver_passive_close(Ftp_Server *f, Ip_Sockets *_s, u64 off, u64 session_index);
+// - queue the acceptor 'passive_index' for the next PASV/EPSV
+FTPSERVER_DEF void ftpserver_passive_free(Ftp_Server *f, u64 passive_index);
+// - end a STOR early, with 'message' on the control connection
+FTPSERVER_DEF void ftpserver_session_store_abort(Ftp_Server *f,
+						 Ftp_Server_Session *s,
+						 Ip_Sockets *_s,
+						 u64 data_index,
+						 u64 text_index,
+						 str message);
 
 #ifdef FTPSERVER_IMPLEMENTATION
 
+FTPSERVER_DEF int ftpserver_config_open(Ftp_Server_Config *c,
+					str dir,
+					str username,
+					str password) {
+  c->dir_base = dir;
+  c->username = username;
+  c->password = password;
+  c->passive_port = FTPSERVER_PASSIVE_PORT;
+  c->passive_used = 0;
+
+  Ip ip;
+  if(ip_get_address(ip) != IP_ERROR_NONE) {
+    return 0;
+  }
+
+  u64 i = 0;
+  while(ip[i]) {
+    u8 ch = ip[i];
+    if(ch == '.') {
+      ch = ',';
+    }
+    c->ip[i] = ch;
+    i++;
+  }
+  c->ip[i] = 0;
+
+  return 1;
+}
+
 FTPSERVER_DEF int ftpserver_open(Ftp_Server *f,
 				 u64 number_of_clients,
 				 str dir,
 				 str username,
 				 str password) {
+  if(!ftpserver_config_open(&f->own, dir, username, password)) {
+    return 0;
+  }
+  return ftpserver_open_shared(f, &f->own, number_of_clients);
+}
 
-  f->number_of_clients = number_of_clients;
+// - hands the ports back, if no other server took ports after them.
+//   Otherwise they stay unused
+FTPSERVER_DEF void ftpserver_config_unreserve(Ftp_Server_Config *c, long used, u64 number_of_passive) {
+#ifdef _MSC_VER
+  InterlockedCompareExchange(&c->passive_used, used, used + (long) number_of_passive);
+#else
+  long expected = used + (long) number_of_passive;
+  __atomic_compare_exchange_n(&c->passive_used, &expected, used, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+#endif // _MSC_VER
+}
+
+FTPSERVER_DEF int ftpserver_open_shared(Ftp_Server *f,
+					Ftp_Server_Config *c,
+					u64 number_of_clients) {
+
+  u64 number_of_passive = FTPSERVER_PASSIVE_COUNT(number_of_clients);
+#ifdef _MSC_VER
+  long used = InterlockedExchangeAdd(&c->passive_used, (long) number_of_passive);
+#else
+  long used = __atomic_fetch_add(&c->passive_used, (long) number_of_passive, __ATOMIC_RELAXED);
+#endif // _MSC_VER
+  if((u64) used + number_of_passive > (u64) c->passive_port - 1024) {
+    ftpserver_config_unreserve(c, used, number_of_passive);
+    return 0;
+  }
+  f->config = c;
+  f->passive_port = (u16) (c->passive_port - (u64) used - number_of_passive);
+  f->number_of_passive = number_of_passive;
+  f->passive_free = FTPSERVER_ALLOC(sizeof(*f->passive_free) * number_of_passive);
+  f->passive_session = FTPSERVER_ALLOC(sizeof(*f->passive_session) * number_of_passive);
   f->sessions = FTPSERVER_ALLOC(sizeof(*f->sessions) * number_of_clients);
-  if(!f->sessions) {
+  if(!f->passive_free || !f->passive_session || !f->sessions) {
+    if(f->passive_free) FTPSERVER_FREE(f->passive_free);
+    if(f->passive_session) FTPSERVER_FREE(f->passive_session);
+    if(f->sessions) FTPSERVER_FREE(f->sessions);
+    ftpserver_config_unreserve(c, used, number_of_passive);
     return 0;
   }
+  for(u64 i=0;i<number_of_passive;i++) {
+    f->passive_free[i] = i;
+  }
+  f->passive_free_head = 0;
+  f->passive_free_len = number_of_passive;
+
+  f->number_of_clients = number_of_clients;
   for(u64 i=0;i<number_of_clients;i++) {
     f->sessions[i].sb = (str_builder) {0};
+    f->sessions[i].z = NULL;
+    f->sessions[i].passive = -1;
     f->sessions[i].dir[0] = '.';
     f->sessions[i].dir[1] = FS_DELIM;
     f->sessions[i].dir_len = 2;
   }
-  f->dir_base = dir;
-  f->username = username;
-  f->password = password;
-
-  Ip ip;
-  if(ip_get_address(ip) != IP_ERROR_NONE) {
-    return 0;
-  }
-
-  u64 i = 0;
-  while(ip[i]) {
-    u8 c = ip[i];
-    if(c == '.') {
-      c = ',';
-    }
-    f->ip[i] = c;
-    i++;
-  }
+  memset(&f->listings, 0, sizeof(f->listings));
+  f->files = (Fs_File_Cache) {0};
 
   return 1;
 }
@@ -172,15 +347,15 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
     TODO();
   }
 
-  Ip_Socket *socket = &_s->sockets[index];
+  Ip_Socket *socket = ip_sockets_get(_s, index);
   if(socket->flags & IP_SERVER) {
 
     if((index - off) == (len - 1)) {
 
       int found = 0;
       u64 client_index = 0;
-      for(;client_index<len - 1;client_index++) {
-	if(!(_s->sockets[off + client_index].flags & IP_VALID)) {
+      for(;client_index<f->number_of_clients;client_index++) {
+	if(!(ip_sockets_get(_s, off + client_index)->flags & IP_VALID)) {
 	  found = 1;
 	  break;
 	}
@@ -189,9 +364,18 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	TODO();
       }
 
-      Ip_Socket *client_socket = &_s->sockets[off + client_index];
+      Ip_Socket *client_socket = ip_sockets_get(_s, off + client_index);
       Ip_Address address;
-      if(ip_socket_accept(socket, client_socket, &address) != IP_ERROR_NONE) {
+      switch(ip_socket_accept(socket, client_socket, &address)) {
+      case IP_ERROR_NONE:
+	break;
+      case IP_ERROR_LIMIT:
+	// The client waits in the backlog, until a descriptor is free
+	fs_file_cache_trim(&f->files);
+	return;
+      case IP_ERROR_REPEAT:
+	return;
+      default:
 	TODO();
       }
       if(ip_sockets_register(_s, off + client_index) != IP_ERROR_NONE) {
@@ -205,25 +389,45 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
       s->request_len = 0;
       s->look_for_data_connection = 0;
       s->logged_in = 0;
+      s->quit = 0;
+      s->rest = 0;
+      s->allo = 0;
+      s->splice = 0;
+      ftpserver_session_free_z(s);
+      s->z_level = JDEFL_LVL_DEF;
+      s->dir[0] = '.';
+      s->dir[1] = FS_DELIM;
+      s->dir_len = 2;
       client_socket->flags |= IP_WRITING;
       return;
       
     } else {
 
       // session_index := relative index into 'f->sessions'
-      u64 session_index = index - off - f->number_of_clients;
+      u64 session_index = f->passive_session[index - off - 2*f->number_of_clients];
       // data_index := absolute index into 's->sockets'
-      u64 data_index = index + f->number_of_clients;
+      u64 data_index = off + f->number_of_clients + session_index;
                   
-      Ip_Socket *client = &_s->sockets[data_index];
+      Ip_Socket *client = ip_sockets_get(_s, data_index);
       Ip_Address address;
-      if(ip_socket_accept(socket, client, &address) != IP_ERROR_NONE) {
+      switch(ip_socket_accept(socket, client, &address)) {
+      case IP_ERROR_NONE:
+	break;
+      case IP_ERROR_LIMIT:
+	fs_file_cache_trim(&f->files);
+	return;
+      case IP_ERROR_REPEAT:
+	return;
+      default:
 	TODO();
       }
 	if(ip_sockets_register(_s, data_index) != IP_ERROR_NONE) {
 	      TODO();
       }
 
+      // The port is free again, for the next PASV/EPSV of any session
+      ftpserver_passive_close(f, _s, off, session_index);
+
 
       Ftp_Server_Session *s = &f->sessions[session_index];
       if(s->look_for_data_connection && s->message.len == 0) {
@@ -236,19 +440,19 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
     
   } else { // socket->flags & IP_CLIENT;
 
-    int is_data_index = f->number_of_clients*2 <= (index - off);
+    int is_data_index = f->number_of_clients <= (index - off);
 
     // session_index := relative index into 'f->sessions'
     // data_index := absolute index into 's->sockets'
     // text_index := absolute index into 's->sockets'
     u64 session_index, data_index, text_index;
     if(is_data_index) {
-      session_index = (index - off) - 2*f->number_of_clients;
+      session_index = (index - off) - f->number_of_clients;
       data_index = index;
-      text_index = index - 2*f->number_of_clients;
+      text_index = index - f->number_of_clients;
     } else {
       session_index = (index - off);
-      data_index = index + 2*f->number_of_clients;
+      data_index = index + f->number_of_clients;
       text_index = index;
     }
 
@@ -261,28 +465,76 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 
 	if(is_data_index) {
 	  u64 read;
-	  switch(ip_socket_read(socket,
-				s->sb.data,
-			        FTPSERVER_SESSION_WINDOW_SIZE,
-				&read)) {
+	  Ip_Error error;
+	  if(s->response_kind == FTPSERVER_ACTION_KIND_READ_FILE && s->splice) {
+#ifdef _WIN32
+	    Ip_File handle = s->file.handle;
+#else
+	    Ip_File handle = s->file.fd;
+#endif // _WIN32
+	    error = ip_socket_splice(socket, &s->pipe, handle, &s->file.pos, &read);
+	  } else if(s->response_kind == FTPSERVER_ACTION_KIND_READ_FILE && s->z) {
+	    error = ip_socket_read(socket,
+				   s->z->raw,
+				   FTPSERVER_SESSION_WINDOW_SIZE,
+				   &read);
+	  } else if(s->response_kind == FTPSERVER_ACTION_KIND_READ_FILE) {
+	    error = ip_socket_read(socket,
+				   s->sb.data + s->sb.len,
+				   FTPSERVER_SESSION_STORE_SIZE - s->sb.len,
+				   &read);
+	  } else {
+	    error = ip_socket_read(socket,
+				   s->sb.data,
+				   FTPSERVER_SESSION_WINDOW_SIZE,
+				   &read);
+	  }
+
+	  switch(error) {
 	  case IP_ERROR_REPEAT:
 	    keep_reading = 0;
 	    break;
-	  case IP_ERROR_EOF:
+	  case IP_ERROR_UNSUPPORTED:
+	    // Only 'ip_socket_splice', the rest is written from 's->sb'
+	    s->splice = 0;
+	    ip_splice_close(&s->pipe);
+	    break;
+	  case IP_ERROR_NO_SPACE:
+	    // Only 'ip_socket_splice', 'ftpserver_session_flush' catches the rest
+	    keep_reading = 0;
+	    ftpserver_session_store_abort(f, s, _s, data_index, text_index,
+					  ftpserver_store_error_message(FS_ERROR_LIMIT));
+	    break;
+	  case IP_ERROR_EOF: {
+	    int corrupt = 0;
+	    if(s->splice) {
+	      s->splice = 0;
+	      ip_splice_close(&s->pipe);
+	    } else {
+	      corrupt = s->z && !ftpserver_session_inflate(s, 0, 1);
+	      ftpserver_session_flush(s);
+	    }
 	    if(ip_sockets_unregister(_s, index) != IP_ERROR_NONE) TODO();
 	    ip_socket_close(socket);
 	    _s->ret = -1;
 
 	    fs_file_close(&s->file);
+	    fs_file_cache_invalidate(&f->files, s->store_hash);
 	    keep_reading = 0;
 	    *socket = ip_socket_invalid();
 
 	    s->response_kind = FTPSERVER_ACTION_KIND_MESSAGE;
-	    s->message = str_fromd("226 Transfer complete\r\n");
+	    if(corrupt) {
+	      s->message = str_fromd("451 Corrupt compressed data\r\n");
+	    } else if(s->store_error != FS_ERROR_NONE) {
+	      s->message = ftpserver_store_error_message(s->store_error);
+	    } else {
+	      s->message = str_fromd("226 Transfer complete\r\n");
+	    }
 	    s->sb.len = 0;
 	    s->request_len = 0;
-	    _s->sockets[text_index].flags |= IP_WRITING;	    
-	    break;
+	    ip_sockets_get(_s, text_index)->flags |= IP_WRITING;	    
+	  } break;
 	  case IP_ERROR_NONE: {
 	    switch(s->response_kind) {
 	    case FTPSERVER_ACTION_KIND_MESSAGE:
@@ -294,24 +546,32 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	      *socket = ip_socket_invalid();
 	    } break;
 	    case FTPSERVER_ACTION_KIND_READ_FILE: {
+	      if(s->splice) {
+		break;
+	      }
 
-	      u64 written_total = 0;
-	      while(written_total < read) {
-		u64 written;
-		switch(fs_file_write(&s->file,
-				     s->sb.data + written_total,
-				     read - written_total,
-				     &written)) {
-		case FS_ERROR_NONE:
-		  written_total += written;
-		  break;
-		default:
-		  TODO();
+	      if(s->z) {
+		if(!ftpserver_session_inflate(s, read, 0)) {
+		  keep_reading = 0;
+		  ftpserver_session_store_abort(f, s, _s, data_index, text_index,
+						str_fromd("451 Corrupt compressed data\r\n"));
+		} else if(s->store_error != FS_ERROR_NONE) {
+		  keep_reading = 0;
+		  ftpserver_session_store_abort(f, s, _s, data_index, text_index,
+						ftpserver_store_error_message(s->store_error));
+		}
+		break;
+	      }
+
+	      s->sb.len += read;
+	      if(s->sb.len == FTPSERVER_SESSION_STORE_SIZE) {
+		ftpserver_session_flush(s);
+		if(s->store_error != FS_ERROR_NONE) {
+		  keep_reading = 0;
+		  ftpserver_session_store_abort(f, s, _s, data_index, text_index,
+						ftpserver_store_error_message(s->store_error));
 		}
-		
 	      }
-	      
-	      
 	    } break;
 	    default:
 	      TODO();
@@ -368,7 +628,13 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 		      str_eqc(request, "syst")) {
 	      s->message = str_fromd("215 Windows_NT\r\n");
 	    } else if(str_eqc(request, "FEAT")) {
-	      s->message = str_fromd("211-Extensions supported\r\n211 End\r\n");
+	      s->message = str_fromd("211-Extensions supported\r\n"
+				     " MDTM\r\n"
+				     " MLST type*;size*;modify*;\r\n"
+				     " MODE Z\r\n"
+				     " REST STREAM\r\n"
+				     " SIZE\r\n"
+				     "211 End\r\n");
 	    } else if(str_eqc(request, "PWD")) {
 	      s->sb.len = 0;
 	      str_builder_appendc(&s->sb, "257 \"");
@@ -389,174 +655,266 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	      s->message = str_fromd("200 Type set\r\n");
 
 	    } else if(str_eqc(request, "TYPE A")) {
-	      s->message = str_fromd("500 Type not supported\r\n");
+	      // Listings already end in CRLF, files are sent as they are
+	      s->message = str_fromd("200 Type set\r\n");
 
 	    } else if(str_index_ofc(request, "EPRT") == 0) {
 		    s->message = str_fromd("500 This not supported\r\n");
 
 	    } else if(str_eqc(request, "EPSV")) {
-	      u16 port_to_use = 60000 - f->number_of_clients + (index - off);
+	      u16 port_to_use;
+	      if(ftpserver_passive_open(f, _s, off, index - off, &port_to_use)) {
+		s->sb.len = 0;
+		str_builder_appendf(&s->sb,
+				    "229 Entering Extended Passive Mode (|||%u|)\r\n",
+				    port_to_use);
+		s->message = str_from(s->sb.data, s->sb.len);
+	      } else {
+		s->message = str_fromd("425 Can't open data connection\r\n");
+	      }
 
+	    } else if(str_eqc(request, "PASV")) {
+	      u16 port_to_use;
+	      if(ftpserver_passive_open(f, _s, off, index - off, &port_to_use)) {
+		s->sb.len = 0;
+		str_builder_appendf(&s->sb,
+				    "227 Entering Passive Mode (%s,%u,%u)\r\n",
+				    f->config->ip,
+				    port_to_use / 256,
+				    port_to_use % 256);
+		s->message = str_from(s->sb.data, s->sb.len);
+	      } else {
+		s->message = str_fromd("425 Can't open data connection\r\n");
+	      }
+	    
+	    } else if(str_eqc(request, "LIST")) {
 	      s->sb.len = 0;
-	      str_builder_appendf(&s->sb,
-				  "229 Entering Extended Passive Mode (|||%u|)\r\n",
-				  port_to_use);
-	      s->message = str_from(s->sb.data, s->sb.len);
 
-	      // TODO: an argument should enable/disable this behaviour
-	      Ip_Socket *server = &_s->sockets[index + f->number_of_clients];
-	      if(!(server->flags & IP_VALID)) {
-		if(ip_socket_sopen(server, port_to_use, 1) != IP_ERROR_NONE) {
-		  TODO();
-		}
-		if(ip_sockets_register(_s, index + f->number_of_clients) != IP_ERROR_NONE) {
-			TODO();
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      str dirpath = str_from(s->path, f->config->dir_base.len + s->dir_len);
+
+	      Fs_Listing *listing;
+	      if(fs_listing_gets(&f->listings, dirpath, &listing) == FS_ERROR_NONE) {
+		str_builder_reserve(&s->sb, listing->entries_len * 64 + listing->names_len);
+
+		for(u64 i=0;i<listing->entries_len;i++) {
+		  Fs_Listing_Entry *e = &listing->entries[i];
+
+		  // "%crw-rw-rw- jschartner %8llu %02d-%02d-%04d %02d:%02d %s\r\n"
+		  str_builder_appendc(&s->sb, (e->flags & FS_DIR_ENTRY_IS_DIR)
+				      ? "drw-rw-rw- jschartner "
+				      : "-rw-rw-rw- jschartner ");
+		  ftpserver_append_number(&s->sb, e->size, 8, ' ');
+		  str_builder_appendc(&s->sb, " ");
+		  ftpserver_append_number(&s->sb, (u64) e->time.month, 2, '0');
+		  str_builder_appendc(&s->sb, "-");
+		  ftpserver_append_number(&s->sb, (u64) e->time.day, 2, '0');
+		  str_builder_appendc(&s->sb, "-");
+		  ftpserver_append_number(&s->sb, (u64) e->time.year, 4, '0');
+		  str_builder_appendc(&s->sb, " ");
+		  ftpserver_append_number(&s->sb, (u64) e->time.hour, 2, '0');
+		  str_builder_appendc(&s->sb, ":");
+		  ftpserver_append_number(&s->sb, (u64) e->time.min, 2, '0');
+		  str_builder_appendc(&s->sb, " ");
+		  str_builder_append(&s->sb, e->name, e->name_len);
+		  str_builder_appendc(&s->sb, "\r\n");
 		}
+
+		s->data_kind = FTPSERVER_ACTION_KIND_MESSAGE;
+		s->look_for_data_connection = 1;
+
+		s->message = str_fromd("150 Opening data connection\r\n");
+	      } else {
+
+		s->message = str_fromd("500 Cannot list directory\r\n");
 	      }
-	    
 
-	    } else if(str_eqc(request, "PASV")) {
-	      u16 port_to_use = 60000 - f->number_of_clients + (index - off);
+	    } else if(str_index_ofc(request, "SIZE ") == 0) {
 
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      memcpy(s->path + f->config->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
+	      str filepath = str_from(s->path, f->config->dir_base.len + s->dir_len + request.len - 5);
+	    
+	      Fs_Stat stat;
+	      if(fs_file_cache_stats(&f->files, filepath, &stat) == FS_ERROR_NONE && !stat.is_dir) {
+		s->sb.len = 0;
+		str_builder_appendf(&s->sb, "213 %llu\r\n", stat.size);
+		s->message = str_from(s->sb.data, s->sb.len);
+	      } else {
+		s->message = str_fromd("500 Cannot retrieve filesize\r\n");
+	      }
+	    
+	    } else if(str_eqc(request, "MLSD") ||
+		      str_index_ofc(request, "MLSD ") == 0) {
 	      s->sb.len = 0;
-	      str_builder_appendf(&s->sb,
-				  "227 Entering Passive Mode (%s,%u,%u)\r\n",
-				  f->ip,
-				  port_to_use / 256,
-				  port_to_use % 256);
-	      s->message = str_from(s->sb.data, s->sb.len);
 
-	      // TODO: an argument should enable/disable this behaviour
-	      Ip_Socket *server = &_s->sockets[index + f->number_of_clients];
-	      if(!(server->flags & IP_VALID)) {
-		if(ip_socket_sopen(server, port_to_use, 1) != IP_ERROR_NONE) {
-		  TODO();
-		}
-		if(ip_sockets_register(_s, index + f->number_of_clients) != IP_ERROR_NONE) {
-			TODO();
+	      str arg = request.len > 5 ? str_from(request.data + 5, request.len - 5) : str_null;
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      memcpy(s->path + f->config->dir_base.len + s->dir_len, arg.data, arg.len);
+	      u64 dirpath_len = f->config->dir_base.len + s->dir_len + arg.len;
+	      if(arg.len > 0 && s->path[dirpath_len - 1] != '/' && s->path[dirpath_len - 1] != FS_DELIM) {
+		s->path[dirpath_len++] = FS_DELIM;
+	      }
+	      str dirpath = str_from(s->path, dirpath_len);
+
+	      Fs_Listing *listing;
+	      if(fs_listing_gets(&f->listings, dirpath, &listing) == FS_ERROR_NONE) {
+		str_builder_reserve(&s->sb, listing->entries_len * 64 + listing->names_len);
+
+		for(u64 i=0;i<listing->entries_len;i++) {
+		  Fs_Listing_Entry *e = &listing->entries[i];
+		  ftpserver_append_facts(&s->sb,
+					 (e->flags & FS_DIR_ENTRY_IS_DIR) != 0,
+					 e->size,
+					 e->mtime);
+		  str_builder_append(&s->sb, e->name, e->name_len);
+		  str_builder_appendc(&s->sb, "\r\n");
 		}
+
+		s->data_kind = FTPSERVER_ACTION_KIND_MESSAGE;
+		s->look_for_data_connection = 1;
+
+		s->message = str_fromd("150 Opening data connection\r\n");
+	      } else {
+
+		s->message = str_fromd("550 Cannot list directory\r\n");
 	      }
-	    
-	    } else if(str_eqc(request, "LIST")) {
+
+	    } else if(str_eqc(request, "NLST") ||
+		      str_index_ofc(request, "NLST ") == 0) {
 	      s->sb.len = 0;
 
-	      memcpy(f->path, f->dir_base.data, f->dir_base.len);
-	      memcpy(f->path + f->dir_base.len, s->dir, s->dir_len);
-	      str dirpath = str_from(f->path, f->dir_base.len + s->dir_len);
-	    
-	      Fs_Dir dir;
-	      if(fs_dir_opens(&dir, dirpath) == FS_ERROR_NONE) {
-		Fs_Dir_Entry entry;
-		while(fs_dir_next(&dir, &entry) == FS_ERROR_NONE) {
-		  if(entry.flags & FS_DIR_ENTRY_FROM_SYSTEM) {
-		    continue;
-		  }
+	      // Options like '-la' are meant for 'ls', there is no such file
+	      str arg = request.len > 5 ? str_from(request.data + 5, request.len - 5) : str_null;
+	      if(arg.len > 0 && arg.data[0] == '-') {
+		arg = str_null;
+	      }
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      memcpy(s->path + f->config->dir_base.len + s->dir_len, arg.data, arg.len);
+	      u64 dirpath_len = f->config->dir_base.len + s->dir_len + arg.len;
+	      if(arg.len > 0 && s->path[dirpath_len - 1] != '/' && s->path[dirpath_len - 1] != FS_DELIM) {
+		s->path[dirpath_len++] = FS_DELIM;
+	      }
+	      str dirpath = str_from(s->path, dirpath_len);
 
-		  u8 c;
-		  if(entry.flags & FS_DIR_ENTRY_IS_DIR) {
-		    c = 'd';
-		  } else {
-		    c = '-';
-		  }
+	      Fs_Listing *listing;
+	      if(fs_listing_gets(&f->listings, dirpath, &listing) == FS_ERROR_NONE) {
+		str_builder_reserve(&s->sb, listing->entries_len * 2 + listing->names_len);
 
-#if 1
-		  str_builder_appendf(&s->sb,
-			     "%crw-rw-rw- jschartner %8llu %02d-%02d-%04d %02d:%02d %s\r\n",
-			     c,
-			     entry.size,
-			     entry.time.month,
-			     entry.time.day,
-			     entry.time.year,
-			     entry.time.hour,
-			     entry.time.min,
-			     entry.name);
+		for(u64 i=0;i<listing->entries_len;i++) {
+		  Fs_Listing_Entry *e = &listing->entries[i];
+		  str_builder_append(&s->sb, e->name, e->name_len);
+		  str_builder_appendc(&s->sb, "\r\n");
+		}
 
-#else
-		  str_builder_appendf(&s->sb,
-				      "%02d.%02d.%02d  %02d:%02d    ",
-				      entry.time.day,
-				      entry.time.month,
-				      entry.time.year,
-				  
-				      entry.time.hour,
-				      entry.time.min);
-
-		  if(entry.flags & FS_DIR_ENTRY_IS_DIR) {
-		    str_builder_appendf(&s->sb, "<DIR>         ");
-		  } else {
-		    if(entry.size > 999999) {
-		      str_builder_appendf(&s->sb,
-					  "   %3d%03d%03d",
-					  entry.size / 1000 / 1000,
-					  (entry.size / 1000) % 1000,
-					  entry.size % 1000);
-		    } else if(entry.size > 999) {
-		      str_builder_appendf(&s->sb,
-					  "       %3d%03d",
-					  (entry.size / 1000) % 1000,
-					  entry.size % 1000);
-      
-		    } else {
-		      str_builder_appendf(&s->sb,
-					  "          %3d",
-					  entry.size % 1000);
-      
-		    }
-		  }
-    
-    
+		s->data_kind = FTPSERVER_ACTION_KIND_MESSAGE;
+		s->look_for_data_connection = 1;
 
-		  str_builder_appendf(&s->sb, " %s\r\n", entry.name);
-#endif
-	
-		}
-		if(dir.error == FS_ERROR_EOF) {
-		  fs_dir_close(&dir);
-		  s->data_kind = FTPSERVER_ACTION_KIND_MESSAGE;
-		  s->look_for_data_connection = 1;
-		
-		  s->message = str_fromd("150 Opening data connection\r\n");
-		} else {
-		
-		  s->message = str_fromd("500 Cannot list directory\r\n");
-		}
-	      
+		s->message = str_fromd("150 Opening data connection\r\n");
 	      } else {
-	      
-		s->message = str_fromd("500 Cannot list directory\r\n");
+
+		s->message = str_fromd("550 Cannot list directory\r\n");
 	      }
 
-	    } else if(str_index_ofc(request, "SIZE ") == 0) {
+	    } else if(str_eqc(request, "MLST") ||
+		      str_index_ofc(request, "MLST ") == 0) {
+	      str arg = request.len > 5 ? str_from(request.data + 5, request.len - 5) : str_fromd(".");
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      memcpy(s->path + f->config->dir_base.len + s->dir_len, arg.data, arg.len);
+	      str filepath = str_from(s->path, f->config->dir_base.len + s->dir_len + arg.len);
 
-	      memcpy(f->path, f->dir_base.data, f->dir_base.len);
-	      memcpy(f->path + f->dir_base.len, s->dir, s->dir_len);
-	      memcpy(f->path + f->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
-	      str filepath = str_from(f->path, f->dir_base.len + s->dir_len + request.len - 5);
-	    
-	      if(fs_file_ropens(&s->file, filepath) == FS_ERROR_NONE) {
-		u64 size = s->file.size;
-		fs_file_close(&s->file);
+	      Fs_Stat stat;
+	      if(fs_file_cache_stats(&f->files, filepath, &stat) == FS_ERROR_NONE) {
+		s->sb.len = 0;
+		str_builder_appendc(&s->sb, "250-Listing ");
+		str_builder_appends(&s->sb, arg);
+		str_builder_appendc(&s->sb, "\r\n ");
+		ftpserver_append_facts(&s->sb, stat.is_dir, stat.size, stat.mtime);
+		str_builder_appends(&s->sb, arg);
+		str_builder_appendc(&s->sb, "\r\n250 End\r\n");
+		s->message = str_from(s->sb.data, s->sb.len);
+	      } else {
+		s->message = str_fromd("550 File not found\r\n");
+	      }
 
+	    } else if(str_index_ofc(request, "MDTM ") == 0) {
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      memcpy(s->path + f->config->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
+	      str filepath = str_from(s->path, f->config->dir_base.len + s->dir_len + request.len - 5);
+
+	      Fs_Stat stat;
+	      if(fs_file_cache_stats(&f->files, filepath, &stat) == FS_ERROR_NONE && !stat.is_dir) {
 		s->sb.len = 0;
-		str_builder_appendf(&s->sb, "213 %llu\r\n", size);
+		str_builder_appendc(&s->sb, "213 ");
+		ftpserver_append_time(&s->sb, stat.mtime);
+		str_builder_appendc(&s->sb, "\r\n");
 		s->message = str_from(s->sb.data, s->sb.len);
 	      } else {
-		s->message = str_fromd("500 Cannot retrieve filesize\r\n");
+		s->message = str_fromd("550 File not found\r\n");
 	      }
-	    
-	    } else if(str_index_ofc(request, "RETR ") == 0) {
-	      memcpy(f->path, f->dir_base.data, f->dir_base.len);
-	      memcpy(f->path + f->dir_base.len, s->dir, s->dir_len);
-	      memcpy(f->path + f->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
-	      str filepath = str_from(f->path, f->dir_base.len + s->dir_len + request.len - 5);
 
-	      if(fs_file_ropens(&s->file, filepath) == FS_ERROR_NONE) {
+	    } else if(str_index_ofc(request, "REST ") == 0) {
+	      s64 offset;
+	      if(str_parse_s64(str_from(request.data + 5, request.len - 5), &offset) &&
+		 offset >= 0) {
+		s->rest = (u64) offset;
+
 		s->sb.len = 0;
-		str_builder_reserve(&s->sb, FTPSERVER_SESSION_WINDOW_SIZE);
-		s->data_kind = FTPSERVER_ACTION_KIND_WRITE_FILE;
-		s->look_for_data_connection = 1;
+		str_builder_appendf(&s->sb, "350 Restarting at %llu\r\n", s->rest);
+		s->message = str_from(s->sb.data, s->sb.len);
+	      } else {
+		s->message = str_fromd("501 Invalid offset\r\n");
+	      }
 
-		s->message = str_fromd("150 Opening data connection\r\n");
+	    } else if(str_index_ofc(request, "ALLO ") == 0) {
+	      // ALLO <size> [R <record size>]
+	      str arg = str_from(request.data + 5, request.len - 5);
+	      s64 space = str_index_ofc(arg, " ");
+	      if(space >= 0) {
+		arg.len = (u64) space;
+	      }
+
+	      s64 size;
+	      if(str_parse_s64(arg, &size) && size >= 0) {
+		s->allo = (u64) size;
+		s->message = str_fromd("200 ALLO command successful\r\n");
+	      } else {
+		s->message = str_fromd("501 Invalid size\r\n");
+	      }
+
+	    } else if(str_index_ofc(request, "RETR ") == 0) {
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      memcpy(s->path + f->config->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
+	      str filepath = str_from(s->path, f->config->dir_base.len + s->dir_len + request.len - 5);
+
+	      u64 rest = s->rest;
+	      s->rest = 0;
+
+	      if(fs_file_cache_opens(&f->files, filepath, &s->file) == FS_ERROR_NONE) {
+		if(rest > s->file.size) {
+		  fs_file_close(&s->file);
+		  s->message = str_fromd("554 Invalid REST offset\r\n");
+		} else {
+		  // Transfers read and write at 's->file.pos', the cursor is unused
+		  s->file.pos = rest;
+		  s->sb.len = 0;
+		  str_builder_reserve(&s->sb, FTPSERVER_SESSION_WINDOW_SIZE);
+		  s->sendfile = s->z == NULL;
+		  if(s->z) {
+		    jdefl_stream_init(&s->z->defl, s->z_level);
+		  }
+		  s->data_kind = FTPSERVER_ACTION_KIND_WRITE_FILE;
+		  s->look_for_data_connection = 1;
+
+		  s->message = str_fromd("150 Opening data connection\r\n");
+		}
 	      } else {
 
 		s->message = str_fromd("500 Cannot open file for reading\r\n");
@@ -594,9 +952,9 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 		s->sb.data[s->sb.len++] = FS_DELIM;
 	      }
 
-	      memcpy(f->path, f->dir_base.data, f->dir_base.len);
-	      memcpy(f->path + f->dir_base.len, s->sb.data, s->sb.len);
-	      str dirpath = str_from(f->path, f->dir_base.len + s->sb.len);
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->sb.data, s->sb.len);
+	      str dirpath = str_from(s->path, f->config->dir_base.len + s->sb.len);
 
 	      int is_file;
 	      if(fs_existss(dirpath, &is_file) && !is_file) {
@@ -609,11 +967,12 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	      s->sb.len = 0;
 	    
 	    } else if(str_index_ofc(request, "DELE ") == 0) {
-	      memcpy(f->path, f->dir_base.data, f->dir_base.len);
-	      memcpy(f->path + f->dir_base.len, s->dir, s->dir_len);
-	      memcpy(f->path + f->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
-	      str filepath = str_from(f->path, f->dir_base.len + s->dir_len + request.len - 5);
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      memcpy(s->path + f->config->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
+	      str filepath = str_from(s->path, f->config->dir_base.len + s->dir_len + request.len - 5);
 	    
+	      fs_file_cache_invalidate(&f->files, fs_file_cache_hashs(filepath));
 	      if(fs_deletes(filepath) == FS_ERROR_NONE) {
 		s->message = str_fromd("250 command successful\r\n");
 	      } else {
@@ -627,28 +986,62 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	    
 	      s->message = str_fromd("250 command successful\r\n");
 
-	    } else if(str_index_ofc(request, "STOR ") == 0) {
-	      memcpy(f->path, f->dir_base.data, f->dir_base.len);
-	      memcpy(f->path + f->dir_base.len, s->dir, s->dir_len);
-	      memcpy(f->path + f->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
-	      str filepath = str_from(f->path, f->dir_base.len + s->dir_len + request.len - 5);
+	    } else if(str_index_ofc(request, "STOR ") == 0 ||
+		      str_index_ofc(request, "APPE ") == 0) {
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      memcpy(s->path + f->config->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
+	      str filepath = str_from(s->path, f->config->dir_base.len + s->dir_len + request.len - 5);
+
+	      int append = request.data[0] == 'A';
+	      u64 rest = s->rest;
+	      s->rest = 0;
+	      u64 allo = s->allo;
+	      s->allo = 0;
+	      s->store_hash = fs_file_cache_hashs(filepath);
+	      s->store_error = FS_ERROR_NONE;
+	      fs_file_cache_invalidate(&f->files, s->store_hash);
+
+	      // A REST'ed STOR overwrites from 'rest' on, APPE writes at the end
+	      Fs_Error error;
+	      if(append || rest > 0) {
+		error = fs_file_aopens(&s->file, filepath);
+	      } else {
+		error = fs_file_wopens(&s->file, filepath);
+	      }
 
-	      if(fs_file_wopens(&s->file, filepath) == FS_ERROR_NONE) {
+	      if(error != FS_ERROR_NONE) {
+		s->message = str_fromd("500 Cannot store file\r\n");
+	      } else if(!append && rest > s->file.size) {
+		fs_file_close(&s->file);
+		s->message = str_fromd("554 Invalid REST offset\r\n");
+	      } else if(allo > 0 &&
+			fs_file_reserve(&s->file, (append ? s->file.size : rest) + allo) != FS_ERROR_NONE) {
+		fs_file_close(&s->file);
+		s->message = str_fromd("552 Insufficient storage space\r\n");
+	      } else {
+		// Transfers write at 's->file.pos', the cursor is unused
+		if(!append) {
+		  s->file.pos = rest;
+		}
+		s->splice = !s->z && ip_splice_open(&s->pipe) == IP_ERROR_NONE;
 		s->sb.len = 0;
-		str_builder_reserve(&s->sb, FTPSERVER_SESSION_WINDOW_SIZE);
+		if(s->z) {
+		  jinfl_stream_init(&s->z->infl);
+		}
+		if(!s->splice) {
+		  str_builder_reserve(&s->sb, FTPSERVER_SESSION_STORE_SIZE);
+		}
 		s->data_kind = FTPSERVER_ACTION_KIND_READ_FILE;
 		s->look_for_data_connection = 1;
 
 		s->message = str_fromd("150 Opening data connection\r\n");
-	      } else {
-
-		s->message = str_fromd("500 Cannot store file\r\n");
 	      }
 
 	    } else if(str_index_ofc(request, "RNFR ") == 0) {
 	      s->sb.len = 0;
 	      str_builder_appendc(&s->sb, "RNFR ");
-	      str_builder_appends(&s->sb, f->dir_base);
+	      str_builder_appends(&s->sb, f->config->dir_base);
 	      str_builder_append(&s->sb, s->dir, s->dir_len);
 	      str_builder_append(&s->sb, request.data + 5, request.len - 5);
 
@@ -662,11 +1055,13 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	      } else {
 		str from = str_from(last_request.data + 5, last_request.len - 5);
 	      
-		memcpy(f->path, f->dir_base.data, f->dir_base.len);
-		memcpy(f->path + f->dir_base.len, s->dir, s->dir_len);
-		memcpy(f->path + f->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
-		str to = str_from(f->path, f->dir_base.len + s->dir_len + request.len - 5);
+		memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+		memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+		memcpy(s->path + f->config->dir_base.len + s->dir_len, request.data + 5, request.len - 5);
+		str to = str_from(s->path, f->config->dir_base.len + s->dir_len + request.len - 5);
 	      
+		fs_file_cache_invalidate(&f->files, fs_file_cache_hashs(from));
+		fs_file_cache_invalidate(&f->files, fs_file_cache_hashs(to));
 		if(fs_moves(from, to) == FS_ERROR_NONE) {
 		  s->message = str_fromd("250 command successful\r\n");
 		} else {
@@ -678,16 +1073,16 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	    } else if(str_eqc(request, "opts utf8 on") ||
 		      str_eqc(request, "noop") ||
 		      str_eqc(request, "site help") ||
-		      str_index_ofc(request, "PORT ") == 0 ||
-		      str_index_ofc(request, "REST ") == 0) {
+		      str_index_ofc(request, "PORT ") == 0) {
 	      s->message = str_fromd("500 What?\r\n");
 
 	    } else if(str_index_ofc(request, "MKD ") == 0) {
-	      memcpy(f->path, f->dir_base.data, f->dir_base.len);
-	      memcpy(f->path + f->dir_base.len, s->dir, s->dir_len);
-	      memcpy(f->path + f->dir_base.len + s->dir_len, request.data + 4, request.len - 4);
-	      str dir = str_from(f->path, f->dir_base.len + s->dir_len + request.len - 4);
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      memcpy(s->path + f->config->dir_base.len + s->dir_len, request.data + 4, request.len - 4);
+	      str dir = str_from(s->path, f->config->dir_base.len + s->dir_len + request.len - 4);
 
+	      fs_file_cache_invalidate(&f->files, fs_file_cache_hashs(dir));
 	      if(fs_mkdirs(dir) == FS_ERROR_NONE) {
 		s->message = str_fromd("250 command successful\r\n");
 	      } else {
@@ -695,20 +1090,59 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	      }
 
 	    } else if(str_index_ofc(request, "RMD ") == 0) {
-	      memcpy(f->path, f->dir_base.data, f->dir_base.len);
-	      memcpy(f->path + f->dir_base.len, s->dir, s->dir_len);
-	      memcpy(f->path + f->dir_base.len + s->dir_len, request.data + 4, request.len - 4);
-	      str dir = str_from(f->path, f->dir_base.len + s->dir_len + request.len - 4);
+	      memcpy(s->path, f->config->dir_base.data, f->config->dir_base.len);
+	      memcpy(s->path + f->config->dir_base.len, s->dir, s->dir_len);
+	      memcpy(s->path + f->config->dir_base.len + s->dir_len, request.data + 4, request.len - 4);
+	      str dir = str_from(s->path, f->config->dir_base.len + s->dir_len + request.len - 4);
 
+	      fs_file_cache_invalidate(&f->files, fs_file_cache_hashs(dir));
 	      if(fs_rmdirs(dir) == FS_ERROR_NONE) {
 		s->message = str_fromd("250 command successful\r\n");
 	      } else {
 		s->message = str_fromd("500 command was not successful\r\n");
 	      }
 
+	    } else if(str_eqc(request, "ABOR")) {
+	      if(ip_sockets_get(_s, data_index)->flags & IP_VALID) {
+		ftpserver_session_close_data(s, _s, data_index);
+		s->message = str_fromd("426 Transfer aborted\r\n226 Abort successful\r\n");
+	      } else {
+		s->message = str_fromd("225 No transfer to abort\r\n");
+	      }
+
+	    } else if(str_eqc(request, "MODE S")) {
+	      ftpserver_session_free_z(s);
+	      s->message = str_fromd("200 Mode set to S\r\n");
+
+	    } else if(str_eqc(request, "MODE Z")) {
+	      if(!s->z) {
+		s->z = FTPSERVER_ALLOC(sizeof(*s->z));
+	      }
+	      if(s->z) {
+		s->message = str_fromd("200 Mode set to Z\r\n");
+	      } else {
+		s->message = str_fromd("451 Not enough memory\r\n");
+	      }
+
+	    } else if(str_index_ofc(request, "OPTS ") == 0) {
+	      // OPTS MODE Z LEVEL <0-9>, the zlib levels, capped to the jdefl ones
+	      str arg = str_from(request.data + 5, request.len - 5);
+	      s64 level;
+	      if(str_index_ofc(arg, "MODE Z LEVEL ") == 0 &&
+		 str_parse_s64(str_from(arg.data + 13, arg.len - 13), &level) &&
+		 level >= 0 && level <= 9) {
+		s->z_level = level > JDEFL_LVL_MAX ? JDEFL_LVL_MAX : (s32) level;
+		s->message = str_fromd("200 MODE Z LEVEL set\r\n");
+	      } else {
+		s->message = str_fromd("501 Option not understood\r\n");
+	      }
+
+	    } else if(str_eqc(request, "QUIT")) {
+	      s->message = str_fromd("221 Goodbye\r\n");
+	      s->quit = 1;
+
 	    } else {
-	      printf("'"str_fmt"'\n", str_arg(request)); fflush(stdout);
-	      TODO();
+	      s->message = str_fromd("502 Command not implemented\r\n");
 	    }
 	    
 	  } else {
@@ -721,7 +1155,7 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 		// s->message = str_fromd("230 User logged in\r\n");
 		// s->logged_in = 1;
 		
-	      } else if(str_eq(username, f->username)) {
+	      } else if(str_eq(username, f->config->username)) {
 		s->message = str_fromd("331 Password required for login\r\n");
 	      
 	      }
@@ -729,7 +1163,7 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	    } else if(str_index_ofc(request, "PASS ") == 0) {
 	      str password = str_from(request.data + 5, request.len - 5);
 
-	      if(str_eq(password, f->password)) {
+	      if(str_eq(password, f->config->password)) {
 		s->message = str_fromd("230 User logged in\r\n");
 		s->logged_in = 1;
 	      } else {
@@ -754,6 +1188,8 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
     case IP_MODE_WRITE: {
 
       int keep_writing = 1;
+      int aborted = 0; // the peer of a transfer is gone
+      int failed = 0; // the file of a transfer can not be read, aborts it too
       while(keep_writing) {
 
 	switch(s->response_kind) {
@@ -763,7 +1199,19 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	    keep_writing = 0;
 	    socket->flags &= ~IP_WRITING;
 
-	    if(is_data_index) {
+	    if(!is_data_index && s->quit) {
+	      // RFC 959: the server closes the control connection after QUIT
+	      if(ip_sockets_get(_s, data_index)->flags & IP_VALID) {
+		ftpserver_session_close_data(s, _s, data_index);
+	      }
+	      ftpserver_passive_close(f, _s, off, session_index);
+	      ftpserver_session_free_z(s);
+	      if(ip_sockets_unregister(_s, index) != IP_ERROR_NONE) TODO();
+	      ip_socket_close(socket);
+	      *socket = ip_socket_invalid();
+	      _s->ret = -1;
+
+	    } else if(is_data_index) {
 	      ip_socket_close(socket);
 	      *socket = ip_socket_invalid();
 	      
@@ -771,7 +1219,7 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	      s->message = str_fromd("226 Transfer complete\r\n");
 	      s->request_len = 0;
 	      s->sb.len = 0;
-	      _s->sockets[text_index].flags |= IP_WRITING;
+	      ip_sockets_get(_s, text_index)->flags |= IP_WRITING;
 	  
 	      /* u64 server_index = f->index - f->number_of_clients; */
 	      /* ip_socket_close(&f->ip_server.sockets[server_index]); */
@@ -779,7 +1227,7 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	  
 	    } else {
 
-	      Ip_Socket *data_socket = &_s->sockets[data_index];
+	      Ip_Socket *data_socket = ip_sockets_get(_s, data_index);
 	      int data_index_connected = (data_socket->flags & IP_VALID);
 	      
 	      if(s->look_for_data_connection &&
@@ -808,6 +1256,26 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	  case IP_ERROR_REPEAT:
 	    keep_writing = 0;
 	    break;
+	  case IP_ERROR_BROKEN_PIPE:
+	  case IP_ERROR_CONNECTION_CLOSED:
+	    keep_writing = 0;
+	    if(is_data_index) {
+	      ftpserver_session_close_data(s, _s, data_index);
+	      s->response_kind = FTPSERVER_ACTION_KIND_MESSAGE;
+	      s->message = str_fromd("426 Transfer aborted\r\n");
+	      s->request_len = 0;
+	      s->sb.len = 0;
+	      ip_sockets_get(_s, text_index)->flags |= IP_WRITING;
+	    } else {
+	      if(ip_sockets_get(_s, data_index)->flags & IP_VALID) {
+		ftpserver_session_close_data(s, _s, data_index);
+	      }
+	      if(ip_sockets_unregister(_s, index) != IP_ERROR_NONE) TODO();
+	      ip_socket_close(socket);
+	      *socket = ip_socket_invalid();
+	      _s->ret = -1;
+	    }
+	    break;
 	  default:
 	    TODO();
 	    break;
@@ -818,24 +1286,107 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	case FTPSERVER_ACTION_KIND_WRITE_FILE: {
 	  Fs_File *file = &s->file;
 
-	  if(s->sb.len < FTPSERVER_SESSION_WINDOW_SIZE &&
+	  if(!aborted && s->sendfile && file->pos < file->size) {
+#ifdef _WIN32
+	    Ip_File handle = file->handle;
+#else
+	    Ip_File handle = file->fd;
+#endif // _WIN32
+
+	    u64 written;
+	    switch(ip_socket_sendfile(socket,
+				      handle,
+				      &file->pos,
+				      file->size - file->pos,
+				      &written)) {
+	    case IP_ERROR_NONE:
+	      break;
+	    case IP_ERROR_REPEAT:
+	      keep_writing = 0;
+	      break;
+	    case IP_ERROR_EOF:
+	      // The file was truncated
+	      file->size = file->pos;
+	      break;
+	    case IP_ERROR_UNSUPPORTED:
+	      s->sendfile = 0;
+	      break;
+	    case IP_ERROR_BROKEN_PIPE:
+	    case IP_ERROR_CONNECTION_CLOSED:
+	      aborted = 1;
+	      break;
+	    default:
+	      aborted = 1;
+	      failed = 1;
+	      break;
+	    }
+
+	    if(!aborted && s->sendfile && file->pos < file->size) {
+	      break;
+	    }
+	  }
+
+	  if(!aborted && s->z &&
+	     s->sb.len == 0 &&
+	     s->z->defl.state != JDEFL_STREAM_DONE) {
+
+	    u64 read = 0;
+	    if(file->pos < file->size) {
+	      switch(fs_file_pread(file,
+				   file->pos,
+				   s->z->raw,
+				   FTPSERVER_SESSION_WINDOW_SIZE,
+				   &read)) {
+	      case FS_ERROR_NONE:
+		file->pos += read;
+		break;
+	      case FS_ERROR_EOF:
+		// The file was truncated
+		file->size = file->pos;
+		break;
+	      default:
+		aborted = 1;
+		failed = 1;
+		break;
+	      }
+	    }
+
+	    if(failed) {
+	      // The stream ends here, the next RETR starts a new one
+	      s->z->defl.state = JDEFL_STREAM_DONE;
+	    } else {
+	      jdefl_flush flush = file->pos < file->size ? JDEFL_FLUSH_NONE : JDEFL_FLUSH_FINISH;
+	      str_builder_reserve(&s->sb, jdefl_stream_bound(read));
+	      s->sb.len = jdefl_stream_deflate(&s->z->defl, s->sb.data, s->z->raw, read, flush);
+	    }
+
+	  } else if(!aborted && !s->z && !s->sendfile &&
+	     s->sb.len < FTPSERVER_SESSION_WINDOW_SIZE &&
 	     file->pos < file->size) {
 
 	    u64 read;
-	    switch(fs_file_read(file,
-				s->sb.data + s->sb.len,
-			        FTPSERVER_SESSION_WINDOW_SIZE - s->sb.len,
-				&read)) {
+	    switch(fs_file_pread(file,
+				 file->pos,
+				 s->sb.data + s->sb.len,
+				 FTPSERVER_SESSION_WINDOW_SIZE - s->sb.len,
+				 &read)) {
 	    case FS_ERROR_NONE:
+	      file->pos += read;
 	      s->sb.len += read;
 	      break;
+	    case FS_ERROR_EOF:
+	      // The file was truncated
+	      file->size = file->pos;
+	      break;
 	    default:
-	      TODO();
+	      aborted = 1;
+	      failed = 1;
+	      break;
 	    }
 	    
 	  }
 
-	  if(s->sb.len == 0) {
+	  if(aborted || s->sb.len == 0) {
 	    fs_file_close(file);
 	    keep_writing = 0;
 	    if(ip_sockets_unregister(_s, index) != IP_ERROR_NONE) TODO();
@@ -843,9 +1394,16 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	    *socket = ip_socket_invalid();
 
 	    s->response_kind = FTPSERVER_ACTION_KIND_MESSAGE;
-	    s->message = str_fromd("226 Transfer complete\r\n");
+	    if(failed) {
+	      s->sb.len = 0;
+	      s->message = str_fromd("451 Requested action aborted: local error in processing\r\n");
+	    } else if(aborted) {
+	      s->message = str_fromd("426 Transfer aborted\r\n");
+	    } else {
+	      s->message = str_fromd("226 Transfer complete\r\n");
+	    }
 	    s->request_len = 0;
-	    _s->sockets[text_index].flags |= IP_WRITING;
+	    ip_sockets_get(_s, text_index)->flags |= IP_WRITING;
 
 	  } else {
 
@@ -861,6 +1419,11 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
 	    case IP_ERROR_REPEAT:
 	      keep_writing = 0;
 	      break;
+	    case IP_ERROR_BROKEN_PIPE:
+	    case IP_ERROR_CONNECTION_CLOSED:
+	      // The next round closes the transfer
+	      aborted = 1;
+	      break;
 	    default:
 	      TODO();
 	      break;
@@ -882,6 +1445,32 @@ FTPSERVER_DEF void ftpserver_next(Ftp_Server *f,
     } break;
 
     case IP_MODE_DISCONNECT: {
+      if(is_data_index && s->response_kind == FTPSERVER_ACTION_KIND_READ_FILE) {
+	// The upload is complete, the rest of it and the EOF are read next
+	break;
+      }
+
+      if(is_data_index) {
+	if(s->response_kind == FTPSERVER_ACTION_KIND_WRITE_FILE) {
+	  fs_file_close(&s->file);
+	}
+	s->response_kind = FTPSERVER_ACTION_KIND_MESSAGE;
+	s->message = str_fromd("426 Transfer aborted\r\n");
+	s->request_len = 0;
+	s->sb.len = 0;
+	ip_sockets_get(_s, text_index)->flags |= IP_WRITING;
+
+      } else {
+	if(ip_sockets_get(_s, data_index)->flags & IP_VALID) {
+	  ftpserver_session_close_data(s, _s, data_index);
+	}
+	ftpserver_passive_close(f, _s, off, session_index);
+	ftpserver_session_free_z(s);
+      }
+
+      // The socket has to leave epoll, otherwise the hangup is reported forever
+      if(ip_sockets_unregister(_s, index) != IP_ERROR_NONE) TODO();
+      ip_socket_close(socket);
       *socket = ip_socket_invalid();
       _s->ret = -1;
     } break;
@@ -901,6 +1490,21 @@ FTPSERVER_DEF int ftpserver_session_fill_for_data(Ftp_Server_Session *s) {
 
   switch(s->data_kind) {
   case FTPSERVER_ACTION_KIND_MESSAGE: {
+    if(s->z) {
+      // A listing is in memory already, it is compressed as a whole
+      str_builder sb = {0};
+      str_builder_reserve(&sb, jdefl_stream_bound(s->sb.len));
+      jdefl_stream_init(&s->z->defl, s->z_level);
+      sb.len = jdefl_stream_deflate(&s->z->defl,
+				    sb.data,
+				    s->sb.data,
+				    s->sb.len,
+				    JDEFL_FLUSH_FINISH);
+      if(s->sb.cap > 0) {
+	STR_FREE(s->sb.data);
+      }
+      s->sb = sb;
+    }
     s->response_kind = FTPSERVER_ACTION_KIND_MESSAGE;
     s->message = str_from(s->sb.data, s->sb.len);
     result = 1;
@@ -926,8 +1530,230 @@ FTPSERVER_DEF int ftpserver_session_fill_for_data(Ftp_Server_Session *s) {
   return result;
 }
 
+FTPSERVER_DEF void ftpserver_session_close_data(Ftp_Server_Session *s, Ip_Sockets *_s, u64 data_index) {
+  if(s->response_kind == FTPSERVER_ACTION_KIND_WRITE_FILE ||
+     s->response_kind == FTPSERVER_ACTION_KIND_READ_FILE) {
+    fs_file_close(&s->file);
+  }
+  if(s->splice) {
+    s->splice = 0;
+    ip_splice_close(&s->pipe);
+  }
+  s->response_kind = FTPSERVER_ACTION_KIND_MESSAGE;
+
+  Ip_Socket *data_socket = ip_sockets_get(_s, data_index);
+  if(ip_sockets_unregister(_s, data_index) != IP_ERROR_NONE) TODO();
+  ip_socket_close(data_socket);
+  *data_socket = ip_socket_invalid();
+  _s->ret = -1;
+}
+
+FTPSERVER_DEF int ftpserver_passive_open(Ftp_Server *f, Ip_Sockets *_s, u64 off, u64 session_index, u16 *port) {
+  Ftp_Server_Session *s = &f->sessions[session_index];
+
+  // A second PASV/EPSV keeps the acceptor of the first
+  if(s->passive >= 0) {
+    *port = f->passive_port + (u16) s->passive;
+    return 1;
+  }
+
+  // Ports in the ephemeral range may be taken by outgoing connections,
+  // those are skipped and queued again
+  for(u64 tries=f->passive_free_len;tries>0;tries--) {
+    u64 passive_index = f->passive_free[f->passive_free_head];
+    f->passive_free_head = (f->passive_free_head + 1) % f->number_of_passive;
+    f->passive_free_len--;
+
+    u64 acceptor_index = off + 2*f->number_of_clients + passive_index;
+    Ip_Socket *acceptor = ip_sockets_get(_s, acceptor_index);
+    *port = f->passive_port + (u16) passive_index;
+    switch(ip_socket_sopen(acceptor, *port, 1)) {
+    case IP_ERROR_NONE:
+      break;
+    case IP_ERROR_ADDRESS_IN_USE:
+      *acceptor = ip_socket_invalid();
+      ftpserver_passive_free(f, passive_index);
+      continue;
+    default:
+      *acceptor = ip_socket_invalid();
+      ftpserver_passive_free(f, passive_index);
+      return 0;
+    }
+    if(ip_sockets_register(_s, acceptor_index) != IP_ERROR_NONE) {
+      ip_socket_close(acceptor);
+      *acceptor = ip_socket_invalid();
+      ftpserver_passive_free(f, passive_index);
+      return 0;
+    }
+
+    f->passive_session[passive_index] = session_index;
+    s->passive = (s64) passive_index;
+    return 1;
+  }
+
+  return 0;
+}
+
+FTPSERVER_DEF void ftpserver_passive_free(Ftp_Server *f, u64 passive_index) {
+  u64 tail = (f->passive_free_head + f->passive_free_len) % f->number_of_passive;
+  f->passive_free[tail] = passive_index;
+  f->passive_free_len++;
+}
+
+FTPSERVER_DEF void ftpserver_passive_close(Ftp_Server *f, Ip_Sockets *_s, u64 off, u64 session_index) {
+  Ftp_Server_Session *s = &f->sessions[session_index];
+  if(s->passive < 0) {
+    return;
+  }
+
+  u64 acceptor_index = off + 2*f->number_of_clients + (u64) s->passive;
+  Ip_Socket *acceptor = ip_sockets_get(_s, acceptor_index);
+  if(acceptor->flags & IP_VALID) {
+    if(ip_sockets_unregister(_s, acceptor_index) != IP_ERROR_NONE) TODO();
+    ip_socket_close(acceptor);
+    *acceptor = ip_socket_invalid();
+    _s->ret = -1;
+  }
+
+  ftpserver_passive_free(f, (u64) s->passive);
+  s->passive = -1;
+}
+
+FTPSERVER_DEF void ftpserver_session_flush(Ftp_Server_Session *s) {
+  u64 written_total = 0;
+  while(s->store_error == FS_ERROR_NONE && written_total < s->sb.len) {
+    u64 written;
+    Fs_Error error = fs_file_pwrite(&s->file,
+				    s->file.pos,
+				    s->sb.data + written_total,
+				    s->sb.len - written_total,
+				    &written);
+    if(error != FS_ERROR_NONE) {
+      s->store_error = error;
+      break;
+    }
+    s->file.pos += written;
+    written_total += written;
+  }
+  s->sb.len = 0;
+}
+
+FTPSERVER_DEF void ftpserver_session_store_abort(Ftp_Server *f,
+						 Ftp_Server_Session *s,
+						 Ip_Sockets *_s,
+						 u64 data_index,
+						 u64 text_index,
+						 str message) {
+  ftpserver_session_close_data(s, _s, data_index);
+  fs_file_cache_invalidate(&f->files, s->store_hash);
+  s->message = message;
+  s->request_len = 0;
+  s->sb.len = 0;
+  ip_sockets_get(_s, text_index)->flags |= IP_WRITING;
+}
+
+FTPSERVER_DEF int ftpserver_session_inflate(Ftp_Server_Session *s, u64 len, int last) {
+  u8 *in = s->z->raw;
+
+  while(1) {
+    if(FTPSERVER_SESSION_STORE_SIZE - s->sb.len < JINFL_STREAM_OUT) {
+      ftpserver_session_flush(s);
+    }
+
+    u64 written;
+    jinfl_status status = jinfl_stream_inflate(&s->z->infl,
+					       &in,
+					       &len,
+					       last,
+					       s->sb.data + s->sb.len,
+					       FTPSERVER_SESSION_STORE_SIZE - s->sb.len,
+					       &written);
+    s->sb.len += written;
+
+    switch(status) {
+    case JINFL_STREAM_DONE:
+      return 1;
+    case JINFL_STREAM_ERROR:
+      return 0;
+    default:
+      if(len == 0 && written == 0) {
+	// A stream, that ends early, is corrupt
+	return !last;
+      }
+      break;
+    }
+  }
+}
+
+FTPSERVER_DEF void ftpserver_session_free_z(Ftp_Server_Session *s) {
+  if(s->z) {
+    FTPSERVER_FREE(s->z);
+    s->z = NULL;
+  }
+}
+
+FTPSERVER_DEF void ftpserver_append_number(str_builder *sb, u64 n, u64 width, u8 pad) {
+  u8 buf[20];
+  u64 len = 0;
+  do {
+    buf[sizeof(buf) - ++len] = '0' + (n % 10);
+    n /= 10;
+  } while(n > 0);
+
+  str_builder_reserve(sb, sb->len + (width > len ? width : len));
+  while(width > len) {
+    sb->data[sb->len++] = pad;
+    width--;
+  }
+  memcpy(sb->data + sb->len, buf + sizeof(buf) - len, len);
+  sb->len += len;
+}
+
+FTPSERVER_DEF void ftpserver_append_time(str_builder *sb, u64 seconds) {
+  u64 days = seconds / 86400;
+  u64 rem = seconds % 86400;
+
+  // http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+  u64 z = days + 719468;
+  u64 era = z / 146097;
+  u64 doe = z - era * 146097;
+  u64 yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+  u64 doy = doe - (365*yoe + yoe/4 - yoe/100);
+  u64 mp = (5*doy + 2) / 153;
+  u64 day = doy - (153*mp + 2)/5 + 1;
+  u64 month = mp < 10 ? mp + 3 : mp - 9;
+  u64 year = yoe + era * 400 + (month <= 2);
+
+  ftpserver_append_number(sb, year, 4, '0');
+  ftpserver_append_number(sb, month, 2, '0');
+  ftpserver_append_number(sb, day, 2, '0');
+  ftpserver_append_number(sb, rem / 3600, 2, '0');
+  ftpserver_append_number(sb, (rem / 60) % 60, 2, '0');
+  ftpserver_append_number(sb, rem % 60, 2, '0');
+}
+
+FTPSERVER_DEF void ftpserver_append_facts(str_builder *sb, int is_dir, u64 size, u64 mtime) {
+  if(is_dir) {
+    str_builder_appendc(sb, "type=dir;");
+  } else {
+    str_builder_appendc(sb, "type=file;size=");
+    ftpserver_append_number(sb, size, 0, ' ');
+    str_builder_appendc(sb, ";");
+  }
+  str_builder_appendc(sb, "modify=");
+  ftpserver_append_time(sb, mtime);
+  str_builder_appendc(sb, "; ");
+}
+
 FTPSERVER_DEF void ftpserver_close(Ftp_Server *f) {  
+  for(u64 i=0;i<f->number_of_clients;i++) {
+    ftpserver_session_free_z(&f->sessions[i]);
+  }
   FTPSERVER_FREE(f->sessions);
+  FTPSERVER_FREE(f->passive_free);
+  FTPSERVER_FREE(f->passive_session);
+  fs_listing_cache_free(&f->listings);
+  fs_file_cache_free(&f->files);
 }
 
 #endif // FTPSERVER_IMPLEMENTATION
@@ -26,6 +26,16 @@
 #include <string.h>
 #include <stdlib.h>
 
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif // _MSC_VER
+
 typedef unsigned char Http_u8;
 typedef int Http_s32;
 typedef unsigned int Http_u32;
@@ -82,11 +92,36 @@ typedef enum {
 #define HTTP_DONE 0x1
 #define HTTP_SET_BODY_CONTENT_LEN 0x2
 #define HTTP_SET_BODY_CHUNKED 0x4
-#define HTTP_FINISH_CHUNKED_BODY 0x8
 #define HTTP_CHUNKED_SKIP_RN 0x10
 #define HTTP_PROCESS_NOW 0x20
 
-#define HTTP_HEX_CAP 16
+typedef enum {
+  HTTP_CHUNKED_SIZE = 0,
+  HTTP_CHUNKED_EXTENSION,
+  HTTP_CHUNKED_SIZE_LF,
+  HTTP_CHUNKED_DATA,
+  HTTP_CHUNKED_DATA_CR,
+  HTTP_CHUNKED_DATA_LF,
+  HTTP_CHUNKED_TRAILER_START,
+  HTTP_CHUNKED_TRAILER,
+  HTTP_CHUNKED_END_LF,
+  HTTP_CHUNKED_DONE,
+} Http_Chunked_State;
+
+// Decoder for 'Transfer-Encoding: chunked', see RFC 9112 7.1
+typedef struct {
+  Http_Chunked_State state;
+  u64 size;   // of the current chunk, while parsing its size
+  u64 digits;
+  u64 remaining;
+} Http_Chunked;
+
+#define http_chunked_default() (Http_Chunked) { .state = HTTP_CHUNKED_SIZE, }
+
+typedef struct {
+  u8 *data;
+  u64 len;
+} Http_Span;
 
 typedef struct {
   s32 state;
@@ -102,8 +137,8 @@ typedef struct {
   u8 *body_data;
   u64 body_len;
 
-  u8 hex[HTTP_HEX_CAP];
   u64 hex_len;
+  Http_Chunked chunked;
 } Http;
 
 #define http_default() (Http) {			\
@@ -117,6 +152,7 @@ typedef struct {
       .flags = 0,				\
       .body_data = NULL,			\
       .body_len = 0,				\
+      .chunked = http_chunked_default(),	\
       }
 
 typedef enum {
@@ -136,6 +172,40 @@ HTTP_DEF Http_Event http_process(Http *h, u8 **data, u64 *len);
 /* HTTP_DEF Http_Event http_process_prefix(Http *h); */
 /* HTTP_DEF Http_Event http_process_header(Http *h); */
 
+typedef struct {
+  u8 *name;
+  u64 name_len;
+  u8 *value;
+  u64 value_len;
+} Http_Header;
+
+// - index of the first 'a', 'b' or 'c' in 'data', 'len' if there is none
+HTTP_DEF u64 http_find(u8 *data, u64 len, u8 a, u8 b, u8 c);
+// - the method 'data' starts with, HTTP_METHOD_NONE if there is none
+HTTP_DEF Http_Method http_method_parse(u8 *data, u64 len, u64 *method_len);
+// - the name of 'method', "none" for HTTP_METHOD_NONE
+HTTP_DEF char *http_method_name(Http_Method method);
+// - parse a fully buffered request head in one pass
+// - returns the length of the head, including the empty line. On success the
+//   path is in 'h->body_data' and 'h' continues with the body, like
+//   http_process would
+// - returns 0 if the head is incomplete or has more than '*headers_len'
+//   headers, then 'h' is untouched and http_process has to take over
+// - returns -1 if the head is malformed
+HTTP_DEF s64 http_parse_head(Http *h, u8 *data, u64 len, Http_Header *headers, u64 *headers_len);
+
+// - decode the chunked body in 'data', the spans of the body point into 'data'
+// - stops once '*spans_len' spans are written, '*spans_len' is set to the
+//   number of spans written
+// - returns the number of bytes consumed, -1 on a malformed body
+// - chunk extensions and trailers are skipped, the body is complete once
+//   'c->state' is HTTP_CHUNKED_DONE
+HTTP_DEF s64 http_chunked_decode(Http_Chunked *c, u8 *data, u64 len, Http_Span *spans, u64 *spans_len);
+// - decode a fully buffered chunked body in place, the body is moved
+//   to the start of 'data' and '*body_len' is set to its length
+// - returns the number of bytes consumed, -1 on a malformed body
+HTTP_DEF s64 http_chunked_decode_all(Http_Chunked *c, u8 *data, u64 len, u64 *body_len);
+
 #ifdef HTTP_IMPLEMENTATION
 
 static char *HTTP_METHOD_NAME[]= {
@@ -214,18 +284,112 @@ HTTP_DEF int http_equals_ignorecase(u8 *data, u64 len, char *cstr) {
 }
 
 
+HTTP_DEF u64 http_find(u8 *data, u64 len, u8 a, u8 b, u8 c) {
+  u64 i = 0;
+
+#if defined(__AVX2__)
+  __m256i a256 = _mm256_set1_epi8((char) a);
+  __m256i b256 = _mm256_set1_epi8((char) b);
+  __m256i c256 = _mm256_set1_epi8((char) c);
+  for(;i + 32 <= len;i+=32) {
+    __m256i v = _mm256_loadu_si256((__m256i *) (data + i));
+    __m256i eq = _mm256_or_si256(_mm256_cmpeq_epi8(v, a256),
+				 _mm256_or_si256(_mm256_cmpeq_epi8(v, b256),
+						 _mm256_cmpeq_epi8(v, c256)));
+    u32 bits = (u32) _mm256_movemask_epi8(eq);
+    if(bits) {
+#ifdef _MSC_VER
+      unsigned long n;
+      _BitScanForward(&n, bits);
+      return i + n;
+#else
+      return i + (u64) __builtin_ctz(bits);
+#endif // _MSC_VER
+    }
+  }
+#endif // __AVX2__
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+  __m128i a128 = _mm_set1_epi8((char) a);
+  __m128i b128 = _mm_set1_epi8((char) b);
+  __m128i c128 = _mm_set1_epi8((char) c);
+  for(;i + 16 <= len;i+=16) {
+    __m128i v = _mm_loadu_si128((__m128i *) (data + i));
+    __m128i eq = _mm_or_si128(_mm_cmpeq_epi8(v, a128),
+			      _mm_or_si128(_mm_cmpeq_epi8(v, b128),
+					   _mm_cmpeq_epi8(v, c128)));
+    u32 bits = (u32) _mm_movemask_epi8(eq);
+    if(bits) {
+#ifdef _MSC_VER
+      unsigned long n;
+      _BitScanForward(&n, bits);
+      return i + n;
+#else
+      return i + (u64) __builtin_ctz(bits);
+#endif // _MSC_VER
+    }
+  }
+#endif // __SSE2__
+
+  for(;i<len;i++) {
+    u8 d = data[i];
+    if(d == a || d == b || d == c) {
+      return i;
+    }
+  }
+
+  return len;
+}
+
+HTTP_DEF Http_Method http_method_parse(u8 *data, u64 len, u64 *method_len) {
+
+#define HTTP_METHOD_MATCH(m)						\
+  if(len >= sizeof(#m) - 1 && memcmp(data, #m, sizeof(#m) - 1) == 0) {	\
+    *method_len = sizeof(#m) - 1;					\
+    return HTTP_METHOD_##m;						\
+  }
+
+  if(len == 0) {
+    return HTTP_METHOD_NONE;
+  }
+
+  switch(data[0]) {
+  case 'G':
+    HTTP_METHOD_MATCH(GET);
+    break;
+  case 'P':
+    HTTP_METHOD_MATCH(POST);
+    HTTP_METHOD_MATCH(PUT);
+    HTTP_METHOD_MATCH(PATCH);
+    break;
+  case 'D':
+    HTTP_METHOD_MATCH(DELETE);
+    break;
+  case 'H':
+    HTTP_METHOD_MATCH(HEAD);
+    break;
+  case 'O':
+    HTTP_METHOD_MATCH(OPTIONS);
+    break;
+  default:
+    break;
+  }
+
+#undef HTTP_METHOD_MATCH
+
+  return HTTP_METHOD_NONE;
+}
+
+HTTP_DEF char *http_method_name(Http_Method method) {
+  return HTTP_METHOD_NAME[method];
+}
+
 HTTP_DEF Http_Event __http_process_prefix(Http *h, u8 *data, u64 len) {
   
   u64 key_off = 0;
-  for(u64 m=1;m<sizeof(HTTP_METHOD_NAME)/sizeof(HTTP_METHOD_NAME[0]);m++) {
-    char *method_name = HTTP_METHOD_NAME[m];
-    u64 method_name_len = strlen(method_name);
-    if(len < method_name_len) continue;
-    if(memcmp(data, method_name, method_name_len) != 0) continue;
-    
-    h->method = (Http_Method) m;
-    key_off = method_name_len;
-    break;
+  Http_Method method = http_method_parse(data, len, &key_off);
+  if(method != HTTP_METHOD_NONE) {
+    h->method = method;
   }
 
   static char http1prefix[] = "HTTP/1.";
@@ -328,19 +492,27 @@ HTTP_DEF Http_Event http_process(Http *h, u8 **_data, u64 *_len) {
     return HTTP_EVENT_BODY;
   }
   
-  if(h->body == HTTP_REQUEST_BODY_CHUNKED) {    
-    if(h->__content_length > 0) {
-      h->body_data = data;
-      h->body_len  = len;
-      if(h->body_len > (u64) h->__content_length) h->body_len = (u64) h->__content_length;
-      h->content_length += h->body_len;
-      h->__content_length -= h->body_len;
-      
-      h->state = HTTP_REQUEST_STATE_IDLE;
-      *_data = *_data + h->body_len;
-      *_len  = *_len  - h->body_len;
-      return HTTP_EVENT_BODY;
+  if(h->body == HTTP_REQUEST_BODY_CHUNKED) {
+    Http_Span span = { .data = NULL, .len = 0 };
+    u64 spans_len = 1;
+    s64 n = http_chunked_decode(&h->chunked, data, len, &span, &spans_len);
+    if(n < 0) {
+      return HTTP_EVENT_ERROR;
+    }
+    if(h->chunked.state == HTTP_CHUNKED_DONE) {
+      h->flags |= HTTP_DONE;
     }
+
+    *_data = *_data + n;
+    *_len  = *_len  - (u64) n;
+    if(spans_len == 0) {
+      return HTTP_EVENT_NOTHING;
+    }
+
+    h->body_data = span.data;
+    h->body_len  = span.len;
+    h->content_length += span.len;
+    return HTTP_EVENT_BODY;
   }
 
   u64 header_start = len;
@@ -440,7 +612,7 @@ HTTP_DEF Http_Event http_process(Http *h, u8 **_data, u64 *_len) {
 	      *_data = *_data + i;
 	      *_len = *_len - i;
 
-	      h->hex_len += h->body_len;
+	      h->hex_len += dv + h->body_len;
 	      
 	      return (Http_Event) (h->body_len > 0) * HTTP_EVENT_VALUE;
 	    } else {
@@ -492,11 +664,12 @@ HTTP_DEF Http_Event http_process(Http *h, u8 **_data, u64 *_len) {
 	  *_data = *_data + (i + 1);
 	  *_len = *_len - (i + 1);
 
-	  h->hex_len += is_value * h->body_len;	  
+	  h->hex_len += is_value * (dv + h->body_len);	  
 	  return (Http_Event) ((h->body_len > 0) * header);
 	} else {
 	  *_data = *_data + (i + 1);
 	  *_len = *_len - (i + 1);
+	  h->hex_len = 0;
 	  return HTTP_EVENT_PROCESS;
 	}
 	
@@ -542,113 +715,283 @@ HTTP_DEF Http_Event http_process(Http *h, u8 **_data, u64 *_len) {
       
     } break;
 
-    case HTTP_REQUEST_BODY_CHUNKED: {
+    }
+  }
 
-      if(h->__content_length > 0) {
-	// HTTP_REQUEST_BODY_CHUNKED
-	// h->__content_length > 0
-	// !(h->flags & HTTP_CHUNKED_SKIP_RN)
-	//     process data, no matter what
+  *_len = 0;
+  if(header_start < len) {
+    u64 is_value = (header == HTTP_REQUEST_PAIR_VALUE);
+    u64 dv = is_value * (h->hex_len == 0) * 1;
 
-	h->body_data = data;
-	h->body_len  = 1;
-	
-	h->content_length += h->body_len;
-	h->__content_length -= h->body_len;
-	
-	*_data = *_data + h->body_len;
-	*_len  = *_len  - h->body_len;
-	return HTTP_EVENT_BODY;
-	
-      } else if(h->__content_length < 0) {
+    h->body_data = data + header_start + dv;
+    h->body_len  = header_len - dv;
 
-	switch(h->state) {
+    h->hex_len += is_value * (dv + h->body_len);	  
+    return (Http_Event) ((h->body_len > 0) * header);
+  } else {
+    return HTTP_EVENT_NOTHING;
+  }
+ 
+}
 
-	case HTTP_REQUEST_STATE_IDLE: {
-	  // HTTP_REQUEST_BODY_CHUNKED
-	  // h->__content_length < 0
-	  // HTTP_REQUEST_STATE_IDLE
-	  //     collect hex data, called 'length of a chunk'
 
-	  if(h->hex_len < HTTP_HEX_CAP) h->hex[h->hex_len++] = c;
-	  
-	  
-	} break;
+HTTP_DEF s64 http_parse_head(Http *h, u8 *data, u64 len, Http_Header *headers, u64 *headers_len) {
 
-	case HTTP_REQUEST_STATE_RN: {
-	  // HTTP_REQUEST_BODY_CHUNKED
-	  // h->__content_length < 0
-	  // HTTP_REQUEST_STATE_RN
-	  //     parse 'length of a chunk' chunk
+  // 'GET /path HTTP/1.1\r\n'
+  u64 method_len;
+  Http_Method method = http_method_parse(data, len, &method_len);
+  if(method == HTTP_METHOD_NONE) {
+    return 0;
+  }
+  if(method_len >= len) {
+    return 0;
+  }
+  if(data[method_len] != ' ') {
+    return -1;
+  }
 
-	  u64 n;
-	  if(!http_parse_hex_u64(h->hex, h->hex_len, &n)) {
-	    return HTTP_EVENT_ERROR;
-	  }
-	  h->hex_len = 0;
-	  if(n == 0) {
-	    h->flags |= HTTP_FINISH_CHUNKED_BODY;
-	  }
-	  h->__content_length = (s64) n;
+  u8 *path = data + method_len + 1;
+  u64 path_len = http_find(path, len - method_len - 1, ' ', '\r', '\n');
+  u64 i = method_len + 1 + path_len;
 
-	  *_data = *_data + i + 1;
-	  *_len = *_len - (i + 1);
-	  return HTTP_EVENT_NOTHING;
-	} break;
-	  
-	}
-	
-      } else { // h->__content_length = 0
+  static char http1prefix[] = "HTTP/1.";
+  static u64 http1prefix_len = sizeof(http1prefix) - 1;
+  if(i + 1 + http1prefix_len + 3 > len) {
+    return 0;
+  }
+  if(path_len == 0 ||
+     data[i] != ' ' ||
+     memcmp(data + i + 1, http1prefix, http1prefix_len) != 0 ||
+     data[i + 1 + http1prefix_len + 1] != '\r' ||
+     data[i + 1 + http1prefix_len + 2] != '\n') {
+    return -1;
+  }
+  i += 1 + http1prefix_len + 3;
 
-        if(h->flags & HTTP_FINISH_CHUNKED_BODY) {
-	  
-	  if(h->state == HTTP_REQUEST_STATE_RNRN) {
-	    // HTTP_REQUEST_BODY_CHUNKED
-	    // h->__content_length == 0
-	    // h->flags & HTTP_FINISH_CHUNKED_BODY
-	    // h->state == HTTP_REQUEST_STATE_RNRN
-	    //     finalize
-	  
-	    h->flags |= HTTP_DONE;
-	  }
-	  
-	} else {
+  // 'Key: Value\r\n' ... '\r\n'
+  Http tmp = *h;
+  tmp.method = method;
 
-	  if(h->state == HTTP_REQUEST_STATE_RN) {
-	    // HTTP_REQUEST_BODY_CHUNKED
-	    // h->__content_length == 0
-	    // !(h->flags & HTTP_FINISH_CHUNKED_BODY)
-	    // h->state == HTTP_REQUEST_STATE_RN
-	    //     allow parsing of the next 'length of a chunk'
-	  
-	    h->__content_length = -1;
-	  }
-	  	  	  
+  u64 count = 0;
+  while(1) {
+    if(i + 2 > len) {
+      return 0;
+    }
+    if(data[i] == '\r') {
+      if(data[i + 1] != '\n') {
+	return -1;
+      }
+      i += 2;
+      break;
+    }
+
+    u8 *name = data + i;
+    u64 name_len = http_find(name, len - i, ':', '\r', '\n');
+    if(i + name_len == len) {
+      return 0;
+    }
+    if(name_len == 0 || name[name_len] != ':') {
+      return -1;
+    }
+    i += name_len + 1;
+
+    while(i < len && (data[i] == ' ' || data[i] == '\t')) i++;
+    u8 *value = data + i;
+    u64 value_len = http_find(value, len - i, '\r', '\n', '\r');
+    if(i + value_len + 1 >= len) {
+      return 0;
+    }
+    if(value[value_len] != '\r' || value[value_len + 1] != '\n') {
+      return -1;
+    }
+    i += value_len + 2;
+    while(value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t')) value_len--;
+
+    if(count == *headers_len) {
+      return 0;
+    }
+    headers[count++] = (Http_Header) {
+      .name = name, .name_len = name_len,
+      .value = value, .value_len = value_len,
+    };
+
+    if(value_len > 0 &&
+       __http_process_header(&tmp, name, name_len, value, value_len) == HTTP_EVENT_ERROR) {
+      return -1;
+    }
+  }
+
+  // Same as HTTP_REQUEST_STATE_RNRN in http_process
+  if(tmp.flags & HTTP_SET_BODY_CONTENT_LEN) {
+    tmp.flags &= ~HTTP_SET_BODY_CONTENT_LEN;
+    tmp.body = HTTP_REQUEST_BODY_CONTENT_LEN;
+  } else if(tmp.flags & HTTP_SET_BODY_CHUNKED) {
+    tmp.flags &= ~HTTP_SET_BODY_CHUNKED;
+    tmp.body = HTTP_REQUEST_BODY_CHUNKED;
+  } else {
+    tmp.flags |= HTTP_DONE;
+  }
+  tmp.state = HTTP_REQUEST_STATE_RNRN;
+  tmp.pair = HTTP_REQUEST_PAIR_KEY;
+  tmp.hex_len = 0;
+  tmp.body_data = path;
+  tmp.body_len = path_len;
+
+  *h = tmp;
+  *headers_len = count;
+
+  return (s64) i;
+}
+
+HTTP_DEF s64 http_chunked_decode(Http_Chunked *c, u8 *data, u64 len, Http_Span *spans, u64 *spans_len) {
+
+  u64 spans_cap = *spans_len;
+  u64 count = 0;
+
+  u64 i = 0;
+  while(i < len && c->state != HTTP_CHUNKED_DONE) {
+    u8 b = data[i];
+
+    switch(c->state) {
+
+    case HTTP_CHUNKED_SIZE: {
+      u8 d;
+      if('0' <= b && b <= '9') d = b - '0';
+      else if('a' <= b && b <= 'f') d = b - 'a' + 10;
+      else if('A' <= b && b <= 'F') d = b - 'A' + 10;
+      else if(c->digits > 0 && (b == ';' || b == ' ' || b == '\t')) {
+	c->state = HTTP_CHUNKED_EXTENSION;
+	i++;
+	break;
+      } else if(c->digits > 0 && b == '\r') {
+	c->state = HTTP_CHUNKED_SIZE_LF;
+	i++;
+	break;
+      } else {
+	return -1;
+      }
+
+      if(c->size > ((u64) -1 >> 4)) {
+	return -1;
+      }
+      c->size = c->size * 16 + d;
+      c->digits++;
+      i++;
+    } break;
+
+    case HTTP_CHUNKED_EXTENSION: {
+      i += http_find(data + i, len - i, '\r', '\n', '\r');
+      if(i < len) {
+	if(data[i] != '\r') {
+	  return -1;
 	}
-	
+	c->state = HTTP_CHUNKED_SIZE_LF;
+	i++;
       }
-      
     } break;
-      
+
+    case HTTP_CHUNKED_SIZE_LF: {
+      if(b != '\n') {
+	return -1;
+      }
+      i++;
+      if(c->size == 0) {
+	c->state = HTTP_CHUNKED_TRAILER_START;
+      } else {
+	c->remaining = c->size;
+	c->state = HTTP_CHUNKED_DATA;
+      }
+    } break;
+
+    case HTTP_CHUNKED_DATA: {
+      if(count == spans_cap) {
+	*spans_len = count;
+	return (s64) i;
+      }
+
+      u64 n = len - i;
+      if(n > c->remaining) n = c->remaining;
+      spans[count++] = (Http_Span) { .data = data + i, .len = n };
+      c->remaining -= n;
+      i += n;
+
+      if(c->remaining == 0) {
+	c->state = HTTP_CHUNKED_DATA_CR;
+      }
+    } break;
+
+    case HTTP_CHUNKED_DATA_CR: {
+      if(b != '\r') {
+	return -1;
+      }
+      c->state = HTTP_CHUNKED_DATA_LF;
+      i++;
+    } break;
+
+    case HTTP_CHUNKED_DATA_LF: {
+      if(b != '\n') {
+	return -1;
+      }
+      c->size = 0;
+      c->digits = 0;
+      c->state = HTTP_CHUNKED_SIZE;
+      i++;
+    } break;
+
+    case HTTP_CHUNKED_TRAILER_START: {
+      c->state = (b == '\r') ? HTTP_CHUNKED_END_LF : HTTP_CHUNKED_TRAILER;
+      i++;
+    } break;
+
+    case HTTP_CHUNKED_TRAILER: {
+      i += http_find(data + i, len - i, '\n', '\n', '\n');
+      if(i < len) {
+	c->state = HTTP_CHUNKED_TRAILER_START;
+	i++;
+      }
+    } break;
+
+    case HTTP_CHUNKED_END_LF: {
+      if(b != '\n') {
+	return -1;
+      }
+      c->state = HTTP_CHUNKED_DONE;
+      i++;
+    } break;
+
+    default:
+      return -1;
     }
   }
 
-  *_len = 0;
-  if(header_start < len) {
-    u64 is_value = (header == HTTP_REQUEST_PAIR_VALUE);
-    u64 dv = is_value * (h->hex_len == 0) * 1;
+  *spans_len = count;
+  return (s64) i;
+}
 
-    h->body_data = data + header_start + dv;
-    h->body_len  = header_len - dv;
+HTTP_DEF s64 http_chunked_decode_all(Http_Chunked *c, u8 *data, u64 len, u64 *body_len) {
 
-    h->hex_len += is_value * h->body_len;	  
-    return (Http_Event) ((h->body_len > 0) * header);
-  } else {
-    return HTTP_EVENT_NOTHING;
+  u64 out = 0;
+  u64 off = 0;
+
+  Http_Span spans[16];
+  while(off < len && c->state != HTTP_CHUNKED_DONE) {
+    u64 spans_len = sizeof(spans)/sizeof(spans[0]);
+    s64 n = http_chunked_decode(c, data + off, len - off, spans, &spans_len);
+    if(n < 0) {
+      return -1;
+    }
+
+    // Spans only ever move towards the start, 'out' <= 'span.data - data'
+    for(u64 i=0;i<spans_len;i++) {
+      memmove(data + out, spans[i].data, spans[i].len);
+      out += spans[i].len;
+    }
+    off += (u64) n;
   }
- 
-}
 
+  *body_len = out;
+  return (s64) off;
+}
 
 #endif // HTTP_IMPLEMENTATION
 
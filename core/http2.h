@@ -0,0 +1,694 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+// https://www.rfc-editor.org/rfc/rfc9113
+// https://www.rfc-editor.org/rfc/rfc7541
+
+// MIT License
+//
+// Copyright (c) 2024 Justin Schartner
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <string.h>
+
+#ifndef HTTP2_ALLOC
+#  include <stdlib.h>
+#  define HTTP2_ALLOC malloc
+#endif // HTTP2_ALLOC
+
+#ifndef HTTP2_FREE
+#  include <stdlib.h>
+#  define HTTP2_FREE free
+#endif // HTTP2_FREE
+
+typedef unsigned char Http2_u8;
+typedef short Http2_s16;
+typedef unsigned int Http2_u32;
+typedef unsigned long long Http2_u64;
+#define u8 Http2_u8
+#define s16 Http2_s16
+#define u32 Http2_u32
+#define u64 Http2_u64
+
+#ifndef HTTP2_DEF
+#  define HTTP2_DEF static inline
+#endif // HTTP2_DEF
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LEN 24
+#define HTTP2_FRAME_HEADER_LEN 9
+
+// Defaults of every SETTINGS-parameter, until the peer changes them
+#define HTTP2_HEADER_TABLE_SIZE 4096
+#define HTTP2_INITIAL_WINDOW_SIZE 65535
+#define HTTP2_MAX_FRAME_SIZE 16384
+#define HTTP2_MAX_FRAME_SIZE_LIMIT 16777215
+#define HTTP2_WINDOW_MAX 2147483647
+
+typedef enum {
+  HTTP2_FRAME_DATA          = 0x0,
+  HTTP2_FRAME_HEADERS       = 0x1,
+  HTTP2_FRAME_PRIORITY      = 0x2,
+  HTTP2_FRAME_RST_STREAM    = 0x3,
+  HTTP2_FRAME_SETTINGS      = 0x4,
+  HTTP2_FRAME_PUSH_PROMISE  = 0x5,
+  HTTP2_FRAME_PING          = 0x6,
+  HTTP2_FRAME_GOAWAY        = 0x7,
+  HTTP2_FRAME_WINDOW_UPDATE = 0x8,
+  HTTP2_FRAME_CONTINUATION  = 0x9,
+} Http2_Frame_Type;
+
+#define HTTP2_FLAG_END_STREAM  0x1
+#define HTTP2_FLAG_ACK         0x1
+#define HTTP2_FLAG_END_HEADERS 0x4
+#define HTTP2_FLAG_PADDED      0x8
+#define HTTP2_FLAG_PRIORITY    0x20
+
+#define HTTP2_SETTINGS_HEADER_TABLE_SIZE      0x1
+#define HTTP2_SETTINGS_ENABLE_PUSH            0x2
+#define HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define HTTP2_SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define HTTP2_SETTINGS_MAX_FRAME_SIZE         0x5
+#define HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE   0x6
+
+#define HTTP2_NO_ERROR            0x0
+#define HTTP2_PROTOCOL_ERROR      0x1
+#define HTTP2_INTERNAL_ERROR      0x2
+#define HTTP2_FLOW_CONTROL_ERROR  0x3
+#define HTTP2_STREAM_CLOSED       0x5
+#define HTTP2_FRAME_SIZE_ERROR    0x6
+#define HTTP2_REFUSED_STREAM      0x7
+#define HTTP2_CANCEL              0x8
+#define HTTP2_COMPRESSION_ERROR   0x9
+
+typedef struct {
+  u32 len;
+  u8 type;
+  u8 flags;
+  u32 stream;
+} Http2_Frame;
+
+HTTP2_DEF void http2_frame_parse(const u8 in[HTTP2_FRAME_HEADER_LEN], Http2_Frame *f);
+HTTP2_DEF void http2_frame_header(u8 out[HTTP2_FRAME_HEADER_LEN], u32 len, u8 type, u8 flags, u32 stream);
+
+#define http2_u32_read(p) (((u32) (p)[0] << 24) | ((u32) (p)[1] << 16) | ((u32) (p)[2] << 8) | (u32) (p)[3])
+#define http2_u32_write(p, n) do{				\
+    (p)[0] = (u8) ((n) >> 24); (p)[1] = (u8) ((n) >> 16);	\
+    (p)[2] = (u8) ((n) >> 8); (p)[3] = (u8) (n);		\
+  }while(0)
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#define HTTP2_HUFFMAN_SYMBOLS 257 // 256 octets and EOS
+#define HTTP2_HUFFMAN_EOS 256
+
+// - decode 'len' bytes of 'in' into 'out', which holds at least 'len * 8 / 5' bytes
+// - returns 0, if the padding is invalid or EOS is encoded
+HTTP2_DEF int http2_huffman_decode(const u8 *in, u64 len, u8 *out, u64 *out_len);
+HTTP2_DEF u64 http2_huffman_encoded_len(const u8 *in, u64 len);
+HTTP2_DEF u64 http2_huffman_encode(const u8 *in, u64 len, u8 *out);
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#define HTTP2_HPACK_STATIC_LEN 61
+#define HTTP2_HPACK_ENTRY_OVERHEAD 32
+#define HTTP2_HPACK_ENTRIES_CAP (HTTP2_HEADER_TABLE_SIZE / HTTP2_HPACK_ENTRY_OVERHEAD)
+
+typedef struct {
+  u8 *name;
+  u64 name_len;
+  u8 *value;
+  u64 value_len;
+} Http2_Header;
+
+// Dynamic table of a decoder. The newest entry is at 'pos', older
+// entries follow. Entries are evicted from the back.
+typedef struct {
+  Http2_Header entries[HTTP2_HPACK_ENTRIES_CAP];
+  u64 pos;
+  u64 len;
+
+  u64 size;
+  u64 max_size;
+
+  u8 *spill; // an entry bigger than the table, 'header' points into it
+} Http2_Hpack;
+
+#define http2_hpack_default() (Http2_Hpack) {	\
+    .pos = 0,					\
+      .len = 0,					\
+      .size = 0,				\
+      .max_size = HTTP2_HEADER_TABLE_SIZE,	\
+      .spill = NULL,				\
+      }
+
+typedef enum {
+  HTTP2_HPACK_EVENT_NOTHING = 0, // the block is exhausted
+  HTTP2_HPACK_EVENT_ERROR,
+  HTTP2_HPACK_EVENT_HEADER,
+} Http2_Hpack_Event;
+
+// - decode the next header-field of the block in 'data'
+// - huffman-coded strings are decoded into 'buf', which has to hold
+//   2 * '*len' bytes. 'header' is valid until the next call
+HTTP2_DEF Http2_Hpack_Event http2_hpack_next(Http2_Hpack *h,
+					     u8 **data,
+					     u64 *len,
+					     u8 *buf,
+					     Http2_Header *header);
+HTTP2_DEF void http2_hpack_free(Http2_Hpack *h);
+
+HTTP2_DEF int http2_hpack_integer_decode(u8 **data, u64 *len, u8 prefix_bits, u64 *value);
+HTTP2_DEF u64 http2_hpack_integer_encode(u8 *out, u8 first, u8 prefix_bits, u64 value);
+
+// Upper bound of 'http2_hpack_encode'
+#define http2_hpack_encoded_cap(name_len, value_len) (3 * 10 + (name_len) + (value_len))
+
+// - encode one header-field without touching a dynamic table.
+//   Names of the static table are referenced, exact matches are indexed
+// - 'name' has to be lower-case
+HTTP2_DEF u64 http2_hpack_encode(u8 *out, const u8 *name, u64 name_len, const u8 *value, u64 value_len);
+
+#ifdef HTTP2_IMPLEMENTATION
+
+HTTP2_DEF void http2_frame_parse(const u8 in[HTTP2_FRAME_HEADER_LEN], Http2_Frame *f) {
+  f->len = ((u32) in[0] << 16) | ((u32) in[1] << 8) | (u32) in[2];
+  f->type = in[3];
+  f->flags = in[4];
+  f->stream = http2_u32_read(in + 5) & 0x7fffffff;
+}
+
+HTTP2_DEF void http2_frame_header(u8 out[HTTP2_FRAME_HEADER_LEN], u32 len, u8 type, u8 flags, u32 stream) {
+  out[0] = (u8) (len >> 16);
+  out[1] = (u8) (len >> 8);
+  out[2] = (u8) len;
+  out[3] = type;
+  out[4] = flags;
+  http2_u32_write(out + 5, stream & 0x7fffffff);
+}
+
+static const u32 HTTP2_HUFFMAN_CODES[HTTP2_HUFFMAN_SYMBOLS] = {
+  0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+  0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+  0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+  0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+  0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+  0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+  0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+  0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+  0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+  0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+  0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+  0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+  0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+  0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+  0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+  0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+  0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+  0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+  0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+  0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+  0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+  0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+  0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+  0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+  0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+  0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+  0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+  0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+  0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+  0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+  0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+  0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+  0x3fffffff,
+};
+
+static const u8 HTTP2_HUFFMAN_LENS[HTTP2_HUFFMAN_SYMBOLS] = {
+  13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+  28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+  6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+  5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+  13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+  15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+  6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+  20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+  24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+  22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+  21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+  26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+  19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+  20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+  26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+  30,
+};
+
+
+// Internal nodes of the decoding-tree. Children >= 0 are nodes,
+// children < 0 are leaves of the symbol '-child - 1'.
+static s16 http2_huffman_tree[HTTP2_HUFFMAN_SYMBOLS - 1][2];
+static int http2_huffman_tree_len = 0;
+
+HTTP2_DEF void http2_huffman_tree_build() {
+  http2_huffman_tree_len = 1;
+  memset(http2_huffman_tree, 0, sizeof(http2_huffman_tree));
+
+  for(s16 sym=0;sym<HTTP2_HUFFMAN_SYMBOLS;sym++) {
+    u32 code = HTTP2_HUFFMAN_CODES[sym];
+    u8 code_len = HTTP2_HUFFMAN_LENS[sym];
+
+    s16 node = 0;
+    for(u8 i=code_len;i>1;i--) {
+      u8 bit = (code >> (i - 1)) & 1;
+      if(http2_huffman_tree[node][bit] == 0) {
+	http2_huffman_tree[node][bit] = (s16) http2_huffman_tree_len++;
+      }
+      node = http2_huffman_tree[node][bit];
+    }
+    http2_huffman_tree[node][code & 1] = (s16) (-sym - 1);
+  }
+}
+
+HTTP2_DEF int http2_huffman_decode(const u8 *in, u64 len, u8 *out, u64 *out_len) {
+  if(http2_huffman_tree_len == 0) {
+    http2_huffman_tree_build();
+  }
+
+  u64 n = 0;
+  s16 node = 0;
+  // Bits since the last symbol, all of them have to be 1
+  u32 pending = 0;
+  int pending_ones = 1;
+
+  for(u64 i=0;i<len;i++) {
+    u8 c = in[i];
+    for(int j=7;j>=0;j--) {
+      u8 bit = (c >> j) & 1;
+      pending++;
+      pending_ones &= bit;
+
+      s16 next = http2_huffman_tree[node][bit];
+      if(next < 0) {
+	s16 sym = (s16) (-next - 1);
+	if(sym == HTTP2_HUFFMAN_EOS) {
+	  return 0;
+	}
+	out[n++] = (u8) sym;
+	node = 0;
+	pending = 0;
+	pending_ones = 1;
+      } else {
+	node = next;
+      }
+    }
+  }
+
+  if(pending > 7 || !pending_ones) {
+    return 0;
+  }
+
+  *out_len = n;
+  return 1;
+}
+
+HTTP2_DEF u64 http2_huffman_encoded_len(const u8 *in, u64 len) {
+  u64 bits = 0;
+  for(u64 i=0;i<len;i++) {
+    bits += HTTP2_HUFFMAN_LENS[in[i]];
+  }
+  return (bits + 7) / 8;
+}
+
+HTTP2_DEF u64 http2_huffman_encode(const u8 *in, u64 len, u8 *out) {
+  u64 n = 0;
+  u64 acc = 0;
+  u32 acc_len = 0;
+
+  for(u64 i=0;i<len;i++) {
+    acc = (acc << HTTP2_HUFFMAN_LENS[in[i]]) | HTTP2_HUFFMAN_CODES[in[i]];
+    acc_len += HTTP2_HUFFMAN_LENS[in[i]];
+    while(acc_len >= 8) {
+      acc_len -= 8;
+      out[n++] = (u8) (acc >> acc_len);
+    }
+  }
+
+  // Pad with the most significant bits of EOS
+  if(acc_len > 0) {
+    out[n++] = (u8) ((acc << (8 - acc_len)) | (0xff >> acc_len));
+  }
+
+  return n;
+}
+
+typedef struct {
+  u8 *name;
+  u64 name_len;
+  u8 *value;
+  u64 value_len;
+} Http2_Static_Entry;
+
+static const Http2_Static_Entry HTTP2_HPACK_STATIC[HTTP2_HPACK_STATIC_LEN + 1] = {
+  { NULL, 0, NULL, 0 },
+  { (u8 *) ":authority", 10, (u8 *) "", 0 },
+  { (u8 *) ":method", 7, (u8 *) "GET", 3 },
+  { (u8 *) ":method", 7, (u8 *) "POST", 4 },
+  { (u8 *) ":path", 5, (u8 *) "/", 1 },
+  { (u8 *) ":path", 5, (u8 *) "/index.html", 11 },
+  { (u8 *) ":scheme", 7, (u8 *) "http", 4 },
+  { (u8 *) ":scheme", 7, (u8 *) "https", 5 },
+  { (u8 *) ":status", 7, (u8 *) "200", 3 },
+  { (u8 *) ":status", 7, (u8 *) "204", 3 },
+  { (u8 *) ":status", 7, (u8 *) "206", 3 },
+  { (u8 *) ":status", 7, (u8 *) "304", 3 },
+  { (u8 *) ":status", 7, (u8 *) "400", 3 },
+  { (u8 *) ":status", 7, (u8 *) "404", 3 },
+  { (u8 *) ":status", 7, (u8 *) "500", 3 },
+  { (u8 *) "accept-charset", 14, (u8 *) "", 0 },
+  { (u8 *) "accept-encoding", 15, (u8 *) "gzip, deflate", 13 },
+  { (u8 *) "accept-language", 15, (u8 *) "", 0 },
+  { (u8 *) "accept-ranges", 13, (u8 *) "", 0 },
+  { (u8 *) "accept", 6, (u8 *) "", 0 },
+  { (u8 *) "access-control-allow-origin", 27, (u8 *) "", 0 },
+  { (u8 *) "age", 3, (u8 *) "", 0 },
+  { (u8 *) "allow", 5, (u8 *) "", 0 },
+  { (u8 *) "authorization", 13, (u8 *) "", 0 },
+  { (u8 *) "cache-control", 13, (u8 *) "", 0 },
+  { (u8 *) "content-disposition", 19, (u8 *) "", 0 },
+  { (u8 *) "content-encoding", 16, (u8 *) "", 0 },
+  { (u8 *) "content-language", 16, (u8 *) "", 0 },
+  { (u8 *) "content-length", 14, (u8 *) "", 0 },
+  { (u8 *) "content-location", 16, (u8 *) "", 0 },
+  { (u8 *) "content-range", 13, (u8 *) "", 0 },
+  { (u8 *) "content-type", 12, (u8 *) "", 0 },
+  { (u8 *) "cookie", 6, (u8 *) "", 0 },
+  { (u8 *) "date", 4, (u8 *) "", 0 },
+  { (u8 *) "etag", 4, (u8 *) "", 0 },
+  { (u8 *) "expect", 6, (u8 *) "", 0 },
+  { (u8 *) "expires", 7, (u8 *) "", 0 },
+  { (u8 *) "from", 4, (u8 *) "", 0 },
+  { (u8 *) "host", 4, (u8 *) "", 0 },
+  { (u8 *) "if-match", 8, (u8 *) "", 0 },
+  { (u8 *) "if-modified-since", 17, (u8 *) "", 0 },
+  { (u8 *) "if-none-match", 13, (u8 *) "", 0 },
+  { (u8 *) "if-range", 8, (u8 *) "", 0 },
+  { (u8 *) "if-unmodified-since", 19, (u8 *) "", 0 },
+  { (u8 *) "last-modified", 13, (u8 *) "", 0 },
+  { (u8 *) "link", 4, (u8 *) "", 0 },
+  { (u8 *) "location", 8, (u8 *) "", 0 },
+  { (u8 *) "max-forwards", 12, (u8 *) "", 0 },
+  { (u8 *) "proxy-authenticate", 18, (u8 *) "", 0 },
+  { (u8 *) "proxy-authorization", 19, (u8 *) "", 0 },
+  { (u8 *) "range", 5, (u8 *) "", 0 },
+  { (u8 *) "referer", 7, (u8 *) "", 0 },
+  { (u8 *) "refresh", 7, (u8 *) "", 0 },
+  { (u8 *) "retry-after", 11, (u8 *) "", 0 },
+  { (u8 *) "server", 6, (u8 *) "", 0 },
+  { (u8 *) "set-cookie", 10, (u8 *) "", 0 },
+  { (u8 *) "strict-transport-security", 25, (u8 *) "", 0 },
+  { (u8 *) "transfer-encoding", 17, (u8 *) "", 0 },
+  { (u8 *) "user-agent", 10, (u8 *) "", 0 },
+  { (u8 *) "vary", 4, (u8 *) "", 0 },
+  { (u8 *) "via", 3, (u8 *) "", 0 },
+  { (u8 *) "www-authenticate", 16, (u8 *) "", 0 },
+};
+
+
+HTTP2_DEF int http2_hpack_integer_decode(u8 **data, u64 *len, u8 prefix_bits, u64 *value) {
+  if(*len == 0) {
+    return 0;
+  }
+
+  u8 mask = (u8) ((1 << prefix_bits) - 1);
+  u64 n = (*data)[0] & mask;
+  (*data)++;
+  (*len)--;
+
+  if(n < mask) {
+    *value = n;
+    return 1;
+  }
+
+  u32 shift = 0;
+  while(1) {
+    if(*len == 0 || shift > 56) {
+      return 0;
+    }
+    u8 b = (*data)[0];
+    (*data)++;
+    (*len)--;
+
+    n += (u64) (b & 0x7f) << shift;
+    shift += 7;
+    if(!(b & 0x80)) {
+      break;
+    }
+  }
+
+  *value = n;
+  return 1;
+}
+
+HTTP2_DEF u64 http2_hpack_integer_encode(u8 *out, u8 first, u8 prefix_bits, u64 value) {
+  u8 mask = (u8) ((1 << prefix_bits) - 1);
+  if(value < mask) {
+    out[0] = first | (u8) value;
+    return 1;
+  }
+
+  u64 n = 0;
+  out[n++] = first | mask;
+  value -= mask;
+  while(value >= 0x80) {
+    out[n++] = (u8) ((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (u8) value;
+
+  return n;
+}
+
+HTTP2_DEF int http2_hpack_string_decode(u8 **data, u64 *len, u8 **buf, u8 **out, u64 *out_len) {
+  if(*len == 0) {
+    return 0;
+  }
+  int huffman = ((*data)[0] & 0x80) != 0;
+
+  u64 n;
+  if(!http2_hpack_integer_decode(data, len, 7, &n) || n > *len) {
+    return 0;
+  }
+
+  if(huffman) {
+    if(!http2_huffman_decode(*data, n, *buf, out_len)) {
+      return 0;
+    }
+    *out = *buf;
+    *buf += *out_len;
+  } else {
+    *out = *data;
+    *out_len = n;
+  }
+
+  *data += n;
+  *len -= n;
+  return 1;
+}
+
+HTTP2_DEF void http2_hpack_evict(Http2_Hpack *h, u64 max_size) {
+  while(h->len > 0 && h->size > max_size) {
+    Http2_Header *e = &h->entries[(h->pos + h->len - 1) % HTTP2_HPACK_ENTRIES_CAP];
+    h->size -= e->name_len + e->value_len + HTTP2_HPACK_ENTRY_OVERHEAD;
+    HTTP2_FREE(e->name);
+    h->len--;
+  }
+}
+
+HTTP2_DEF int http2_hpack_insert(Http2_Hpack *h, Http2_Header *header) {
+  u64 size = header->name_len + header->value_len + HTTP2_HPACK_ENTRY_OVERHEAD;
+
+  // Copied before evicting, the name may be one of the evicted entries
+  u8 *data = HTTP2_ALLOC(header->name_len + header->value_len + 1);
+  if(!data) {
+    return 0;
+  }
+  memcpy(data, header->name, header->name_len);
+  memcpy(data + header->name_len, header->value, header->value_len);
+
+  if(size > h->max_size) {
+    // Not an error, the table is just emptied
+    http2_hpack_evict(h, 0);
+    if(h->spill) HTTP2_FREE(h->spill);
+    h->spill = data;
+    header->name = data;
+    header->value = data + header->name_len;
+    return 1;
+  }
+  http2_hpack_evict(h, h->max_size - size);
+
+  h->pos = (h->pos + HTTP2_HPACK_ENTRIES_CAP - 1) % HTTP2_HPACK_ENTRIES_CAP;
+  h->len++;
+  h->size += size;
+
+  Http2_Header *e = &h->entries[h->pos];
+  e->name = data;
+  e->name_len = header->name_len;
+  e->value = data + header->name_len;
+  e->value_len = header->value_len;
+
+  *header = *e;
+  return 1;
+}
+
+HTTP2_DEF int http2_hpack_lookup(Http2_Hpack *h, u64 index, Http2_Header *header) {
+  if(index == 0) {
+    return 0;
+  }
+
+  if(index <= HTTP2_HPACK_STATIC_LEN) {
+    const Http2_Static_Entry *e = &HTTP2_HPACK_STATIC[index];
+    header->name = e->name;
+    header->name_len = e->name_len;
+    header->value = e->value;
+    header->value_len = e->value_len;
+    return 1;
+  }
+
+  index -= HTTP2_HPACK_STATIC_LEN + 1;
+  if(index >= h->len) {
+    return 0;
+  }
+  *header = h->entries[(h->pos + index) % HTTP2_HPACK_ENTRIES_CAP];
+  return 1;
+}
+
+HTTP2_DEF Http2_Hpack_Event http2_hpack_next(Http2_Hpack *h,
+					     u8 **data,
+					     u64 *len,
+					     u8 *buf,
+					     Http2_Header *header) {
+  while(*len > 0) {
+    u8 c = (*data)[0];
+
+    if(c & 0x80) {
+      // Indexed Header Field
+      u64 index;
+      if(!http2_hpack_integer_decode(data, len, 7, &index) ||
+	 !http2_hpack_lookup(h, index, header)) {
+	return HTTP2_HPACK_EVENT_ERROR;
+      }
+      return HTTP2_HPACK_EVENT_HEADER;
+    }
+
+    if((c & 0xe0) == 0x20) {
+      // Dynamic Table Size Update
+      u64 max_size;
+      if(!http2_hpack_integer_decode(data, len, 5, &max_size) ||
+	 max_size > HTTP2_HEADER_TABLE_SIZE) {
+	return HTTP2_HPACK_EVENT_ERROR;
+      }
+      h->max_size = max_size;
+      http2_hpack_evict(h, max_size);
+      continue;
+    }
+
+    // Literal Header Field with Incremental Indexing (01xxxxxx),
+    // without Indexing (0000xxxx) or never Indexed (0001xxxx)
+    int indexing = (c & 0xc0) == 0x40;
+    u8 prefix_bits = indexing ? 6 : 4;
+
+    u64 index;
+    if(!http2_hpack_integer_decode(data, len, prefix_bits, &index)) {
+      return HTTP2_HPACK_EVENT_ERROR;
+    }
+
+    if(index == 0) {
+      if(!http2_hpack_string_decode(data, len, &buf, &header->name, &header->name_len)) {
+	return HTTP2_HPACK_EVENT_ERROR;
+      }
+    } else {
+      if(!http2_hpack_lookup(h, index, header)) {
+	return HTTP2_HPACK_EVENT_ERROR;
+      }
+    }
+    if(!http2_hpack_string_decode(data, len, &buf, &header->value, &header->value_len)) {
+      return HTTP2_HPACK_EVENT_ERROR;
+    }
+
+    if(indexing && !http2_hpack_insert(h, header)) {
+      return HTTP2_HPACK_EVENT_ERROR;
+    }
+
+    return HTTP2_HPACK_EVENT_HEADER;
+  }
+
+  return HTTP2_HPACK_EVENT_NOTHING;
+}
+
+HTTP2_DEF void http2_hpack_free(Http2_Hpack *h) {
+  http2_hpack_evict(h, 0);
+  if(h->spill) HTTP2_FREE(h->spill);
+  h->spill = NULL;
+}
+
+HTTP2_DEF u64 http2_hpack_string_encode(u8 *out, const u8 *s, u64 len) {
+  u64 huffman_len = http2_huffman_encoded_len(s, len);
+  if(huffman_len < len) {
+    u64 n = http2_hpack_integer_encode(out, 0x80, 7, huffman_len);
+    return n + http2_huffman_encode(s, len, out + n);
+  }
+
+  u64 n = http2_hpack_integer_encode(out, 0x00, 7, len);
+  memcpy(out + n, s, len);
+  return n + len;
+}
+
+HTTP2_DEF u64 http2_hpack_encode(u8 *out, const u8 *name, u64 name_len, const u8 *value, u64 value_len) {
+  u64 name_index = 0;
+  for(u64 i=1;i<=HTTP2_HPACK_STATIC_LEN;i++) {
+    const Http2_Static_Entry *e = &HTTP2_HPACK_STATIC[i];
+    if(e->name_len != name_len || memcmp(e->name, name, name_len) != 0) {
+      continue;
+    }
+    if(e->value_len == value_len && memcmp(e->value, value, value_len) == 0) {
+      return http2_hpack_integer_encode(out, 0x80, 7, i);
+    }
+    if(name_index == 0) {
+      name_index = i;
+    }
+  }
+
+  u64 n = http2_hpack_integer_encode(out, 0x00, 4, name_index);
+  if(name_index == 0) {
+    n += http2_hpack_string_encode(out + n, name, name_len);
+  }
+  n += http2_hpack_string_encode(out + n, value, value_len);
+
+  return n;
+}
+
+#endif // HTTP2_IMPLEMENTATION
+
+#undef u8
+#undef s16
+#undef u32
+#undef u64
+
+#endif // HTTP2_H
@@ -27,16 +27,37 @@
 #  define STR_IMPLEMENTATION
 #  define IP_IMPLEMENTATION
 #  define HTTP_IMPLEMENTATION
+#  define CO_IMPLEMENTATION
+#  define FS_IMPLEMENTATION
+#  define MD5_IMPLEMENTATION
 #endif // HTTPCLIENT_IMPLEMENTATION
 
 #define HTTPCLIENT_HEADERS_PAIR_DELIM "|"
 #define HTTPCLIENT_HEADERS_KEY_VALUE_DELIM ":"
 
+#include <time.h>
+#ifndef _WIN32
+#  include <pthread.h>
+#endif // _WIN32
+
 #include <core/str.h>
 #include <core/ip.h>
 #include <core/http.h>
+#include <core/co.h>
+#include <core/fs.h>
+#include <core/md5.h>
 #include <core/types.h>
 
+#ifndef HTTPCLIENT_ALLOC
+#  include <stdlib.h>
+#  define HTTPCLIENT_ALLOC malloc
+#endif // HTTPCLIENT_ALLOC
+
+#ifndef HTTPCLIENT_FREE
+#  include <stdlib.h>
+#  define HTTPCLIENT_FREE free
+#endif // HTTPCLIENT_FREE
+
 #ifndef HTTPCLIENT_DEF
 #  define HTTPCLIENT_DEF static inline
 #endif // HTTPCLIENT_DEF
@@ -60,6 +81,237 @@ HTTPCLIENT_DEF int httpclient_request(str url,
 				      str_builder *sb,
 				      Http_Client_Response *r);
 
+// Receives the response, while it arrives. The body is not kept in 'sb'
+// - 'headers' is called once before the body, may be NULL
+// - returning 0 aborts the request
+typedef int (*Http_Client_Sink_Headers)(void *data, s32 code, Http_Client_Headers headers);
+typedef int (*Http_Client_Sink_Body)(void *data, u8 *chunk, u64 chunk_len);
+
+typedef struct {
+  Http_Client_Sink_Headers headers;
+  Http_Client_Sink_Body body;
+  void *data;
+} Http_Client_Sink;
+
+// - like httpclient_request, but the body goes to 'sink'. 'r->body' stays empty
+HTTPCLIENT_DEF int httpclient_request_stream(str url,
+					     Http_Method method,
+					     str_builder *sb,
+					     Http_Client_Response *r,
+					     Http_Client_Sink *sink);
+
+// Writes the body to 'file' and feeds it to 'md5', both may be NULL.
+// The body is written regardless of the status, check 'r->code'
+typedef struct {
+  Fs_File *file;
+  Md5_Context *md5;
+  u64 len;
+} Http_Client_File_Sink;
+
+HTTPCLIENT_DEF Http_Client_Sink httpclient_sink_file(Http_Client_File_Sink *f);
+
+#ifndef HTTPCLIENT_HOSTS_CAP
+#  define HTTPCLIENT_HOSTS_CAP 8
+#endif // HTTPCLIENT_HOSTS_CAP
+
+#ifndef HTTPCLIENT_CONNECTIONS_CAP
+#  define HTTPCLIENT_CONNECTIONS_CAP 4 // per host
+#endif // HTTPCLIENT_CONNECTIONS_CAP
+
+#ifndef HTTPCLIENT_DNS_TTL
+#  define HTTPCLIENT_DNS_TTL 60 // seconds
+#endif // HTTPCLIENT_DNS_TTL
+
+#ifndef HTTPCLIENT_BUFFER_CAP
+#  define HTTPCLIENT_BUFFER_CAP 4096
+#endif // HTTPCLIENT_BUFFER_CAP
+
+#ifndef HTTPCLIENT_LOOKUPS_CAP
+#  define HTTPCLIENT_LOOKUPS_CAP 4 // threads, that resolve at once
+#endif // HTTPCLIENT_LOOKUPS_CAP
+#define HTTPCLIENT_HOSTNAME_CAP 256
+
+typedef struct {
+  Ip_Socket socket;
+  u64 requests; // answered on this connection
+
+  // Read, but not yet processed. With pipelining, the start of the next response
+  u8 buf[HTTPCLIENT_BUFFER_CAP];
+  u64 buf_pos;
+  u64 buf_len;
+} Http_Client_Connection;
+
+typedef struct {
+  char hostname[HTTPCLIENT_HOSTNAME_CAP];
+  u16 port;
+
+  Ip_Address address;
+  time_t resolved_at;
+  u64 used_at; // for eviction, see Http_Client.tick
+
+  Http_Client_Connection connections[HTTPCLIENT_CONNECTIONS_CAP];
+} Http_Client_Host;
+
+// Keeps keep-alive connections and resolved addresses per host
+typedef struct {
+  Http_Client_Host *hosts;
+  u64 hosts_len;
+  u64 tick;
+} Http_Client;
+
+HTTPCLIENT_DEF int httpclient_open(Http_Client *c);
+// - like httpclient_request, but reuses connections and addresses of 'c'
+HTTPCLIENT_DEF int httpclient_send(Http_Client *c,
+				   str url,
+				   Http_Method method,
+				   str_builder *sb,
+				   Http_Client_Response *r);
+// - send all 'n' requests at once, then read the 'n' responses in order
+// - every url has to name the same host and port
+HTTPCLIENT_DEF int httpclient_send_pipelined(Http_Client *c,
+					     str *urls,
+					     u64 n,
+					     Http_Method method,
+					     str_builder *sb,
+					     Http_Client_Response *rs);
+// - like httpclient_send, but the body goes to 'sink'
+HTTPCLIENT_DEF int httpclient_send_stream(Http_Client *c,
+					  str url,
+					  Http_Method method,
+					  str_builder *sb,
+					  Http_Client_Response *r,
+					  Http_Client_Sink *sink);
+HTTPCLIENT_DEF void httpclient_close(Http_Client *c);
+
+// Collects a response into a str_builder, as it arrives
+typedef struct {
+  Http http;
+  u64 start;
+  u64 _header;
+  u64 _value;
+  u64 _body;
+
+  int keep_alive;
+  int framed;
+
+  Http_Client_Sink *sink; // may be NULL
+  int headers_done;
+} Http_Client_Parser;
+
+typedef enum {
+  HTTPCLIENT_DONE = 0,
+  HTTPCLIENT_FAILED,
+  HTTPCLIENT_TIMEOUT,
+} Http_Client_Result;
+
+// - 'r' is NULL, unless HTTPCLIENT_DONE. Its data is only valid during the call
+typedef void (*Http_Client_Callback)(void *data, Http_Client_Result result, Http_Client_Response *r);
+
+typedef struct {
+  str_builder url;
+  Http_Method method;
+  u64 deadline; // co_now(), 0 for none
+  Http_Client_Callback callback;
+  void *data;
+} Http_Client_Call;
+
+typedef enum {
+  HTTPCLIENT_SLOT_FREE = 0,
+  HTTPCLIENT_SLOT_CONNECTING,
+  HTTPCLIENT_SLOT_WRITING,
+  HTTPCLIENT_SLOT_READING,
+  HTTPCLIENT_SLOT_IDLE, // keep-alive
+} Http_Client_Slot_State;
+
+typedef struct {
+  Http_Client_Slot_State state;
+  char hostname[HTTPCLIENT_HOSTNAME_CAP];
+  u16 port;
+
+  Http_Client_Call call;
+  str_builder sb; // the request, then the response
+  u64 written;
+  Http_Client_Parser parser;
+} Http_Client_Slot;
+
+typedef enum {
+  HTTPCLIENT_LOOKUP_FREE = 0,
+  HTTPCLIENT_LOOKUP_RUNNING,
+  HTTPCLIENT_LOOKUP_FAILED, // until the queue is through
+} Http_Client_Lookup_State;
+
+// An address, that is resolved by a thread of its own
+typedef struct {
+  Http_Client_Lookup_State state;
+  char hostname[HTTPCLIENT_HOSTNAME_CAP];
+  u16 port;
+
+  // Written by the thread, until 'done' is set
+  Ip_Address address;
+  Ip_Error error;
+  Co_Flag done;
+
+#ifdef _WIN32
+  HANDLE thread;
+#else
+  pthread_t thread;
+#endif // _WIN32
+} Http_Client_Lookup;
+
+typedef enum {
+  HTTPCLIENT_SEND_QUEUED = 0,
+  HTTPCLIENT_SEND_QUEUE_FULL, // try again, once a callback made room
+  HTTPCLIENT_SEND_INVALID_URL, // not http://, or the hostname is too long
+} Http_Client_Send_Result;
+
+// Requests, that are driven by the Ip_Sockets loop of the caller.
+// Every reserved socket is one connection:
+//
+//   Http_Client_Async a;
+//   httpclient_async_open(&a, &sockets, 64, 1024);
+//   httpclient_async_send(&a, str_fromc("http://localhost:3080/"), HTTP_METHOD_GET, 1000, on_done, NULL);
+//   while(ip_sockets_dispatch(&sockets) == IP_ERROR_NONE) ...
+//
+// - requests wait in a queue, until a connection is free, and start with the
+//   next batch of events. 'per_host' limits the connections to one host
+// - addresses are resolved by threads, the loop never waits for one. Then
+//   they are cached like in Http_Client
+typedef struct {
+  Http_Client client;
+  Ip_Sockets *sockets;
+  u64 off;
+  u64 len;
+  u64 per_host;
+
+  Http_Client_Slot *slots;
+  Http_Client_Call *queue;
+  u64 queue_len;
+  u64 queue_cap;
+
+  Http_Client_Lookup lookups[HTTPCLIENT_LOOKUPS_CAP];
+
+  u8 buf[HTTPCLIENT_BUFFER_CAP];
+} Http_Client_Async;
+
+// - reserve 'connections' sockets of 's'. At most 'queue_cap' requests wait
+HTTPCLIENT_DEF int httpclient_async_open(Http_Client_Async *a, Ip_Sockets *s, u64 connections, u64 queue_cap);
+// - queue a request, 'callback' is called exactly once, if it is queued
+// - 'timeout' in milliseconds from now, including the wait in the queue and
+//   for the address. 0 for none
+HTTPCLIENT_DEF Http_Client_Send_Result httpclient_async_send(Http_Client_Async *a,
+					 str url,
+					 Http_Method method,
+					 u64 timeout,
+					 Http_Client_Callback callback,
+					 void *data);
+// - requests, that are queued or in flight
+HTTPCLIENT_DEF u64 httpclient_async_pending(Http_Client_Async *a);
+// - every pending request fails. Waits for the addresses, that are resolved
+HTTPCLIENT_DEF void httpclient_async_close(Http_Client_Async *a);
+HTTPCLIENT_DEF void httpclient_async_handler(Ip_Sockets *s, void *ctx,
+					     u64 off, u64 len,
+					     Ip_Error error, u64 index, Ip_Mode mode);
+
 #ifdef HTTPCLIENT_IMPLEMENTATION
 
 // http(s)://%hostname%:%port%%route%
@@ -99,7 +351,7 @@ HTTPCLIENT_DEF int httpclient_parse_url(str url,
     } else {
       u64 _route_indicator = (u64) route_indicator;
       *hostname = str_from(url.data, _route_indicator);
-      url = str_from(url.data + _route_indicator + 1, url.len - _route_indicator - 1);
+      url = str_from(url.data + _route_indicator, url.len - _route_indicator);
 
       *route = url;
     }
@@ -140,10 +392,216 @@ HTTPCLIENT_DEF int httpclient_parse_url(str url,
   return 1;
 }
 
+HTTPCLIENT_DEF void httpclient_append_request(str_builder *sb,
+					     Http_Method method,
+					     str hostname,
+					     str route) {
+  str_builder_appendf(sb, "%s "str_fmt" HTTP/1.1\r\n"
+		      "Host: "str_fmt"\r\n"
+		      "\r\n",
+		      http_method_name(method),
+		      str_arg(route),
+		      str_arg(hostname));
+}
+
+HTTPCLIENT_DEF int httpclient_write_request(Ip_Socket *socket,
+					    Http_Method method,
+					    str hostname,
+					    str route,
+					    str_builder *sb) {
+  u64 sb_len = sb->len;
+  httpclient_append_request(sb, method, hostname, route);
+  str request_string = str_from(sb->data + sb_len, sb->len - sb_len);
+  sb->len = sb_len;
+
+  u64 off = 0;
+  while(off < request_string.len) {
+    u64 written;
+    if(ip_socket_write(socket,
+		       request_string.data + off,
+		       request_string.len - off,
+		       &written) != IP_ERROR_NONE) {
+      return 0;
+    }
+    off += written;
+  }
+
+  return 1;
+}
+
+HTTPCLIENT_DEF void httpclient_parser_begin(Http_Client_Parser *p, str_builder *sb, Http_Client_Sink *sink) {
+  p->http = http_default();
+  p->start = sb->len;
+  p->_header = sb->len;
+  p->_value = 0;
+  p->_body = sb->len;
+
+  p->keep_alive = 1;
+  p->framed = 0;
+
+  p->sink = sink;
+  p->headers_done = 0;
+}
+
+HTTPCLIENT_DEF int httpclient_parser_headers(Http_Client_Parser *p, str_builder *sb) {
+  if(!p->sink || p->headers_done) {
+    return 1;
+  }
+  p->headers_done = 1;
+
+  if(!p->sink->headers) {
+    return 1;
+  }
+  return p->sink->headers(p->sink->data,
+			  p->http.response_code,
+			  str_from(sb->data + p->start, p->_body - p->start));
+}
+
+// Appends headers, then body to 'sb', until the response is done
+// - returns 0 on an error
+HTTPCLIENT_DEF int httpclient_parser_feed(Http_Client_Parser *p, str_builder *sb, u8 **buf, u64 *len) {
+  Http *http = &p->http;
+
+  while(!(http->flags & HTTP_DONE) && *len > 0) {
+    switch(http_process(http, buf, len)) {
+    case HTTP_EVENT_ERROR:
+      return 0;
+    case HTTP_EVENT_KEY:
+      str_builder_append(sb, (u8 *) HTTPCLIENT_HEADERS_PAIR_DELIM, (u64) (sb->len == p->_header));
+      str_builder_append(sb, http->body_data, http->body_len);
+      p->_value = sb->len;
+      break;
+    case HTTP_EVENT_VALUE:
+      str_builder_append(sb, (u8 *) HTTPCLIENT_HEADERS_KEY_VALUE_DELIM, (u64) (sb->len == p->_value));
+      str_builder_append(sb, http->body_data, http->body_len);
+      break;
+    case HTTP_EVENT_BODY:
+      if(p->sink) {
+	if(!httpclient_parser_headers(p, sb) ||
+	   !p->sink->body(p->sink->data, http->body_data, http->body_len)) {
+	  return 0;
+	}
+      } else {
+	str_builder_append(sb, http->body_data, http->body_len);
+      }
+      break;
+    case HTTP_EVENT_PROCESS:
+      str key = str_from(sb->data + p->_header + 1, p->_value - p->_header - 1);
+      str value = str_from(sb->data + p->_value + 1, sb->len - p->_value);
+      value.len -= (value.len > 0);
+
+      if(value.len == 0) {
+	// 'HTTP/1.0 200 OK'
+	if(key.len >= 8 && memcmp(key.data, "HTTP/1.0", 8) == 0) p->keep_alive = 0;
+      } else if(http_equals_ignorecase(key.data, key.len, "connection")) {
+	if(http_equals_ignorecase(value.data, value.len, "close")) p->keep_alive = 0;
+	if(http_equals_ignorecase(value.data, value.len, "keep-alive")) p->keep_alive = 1;
+      } else if(http_equals_ignorecase(key.data, key.len, "content-length") ||
+		http_equals_ignorecase(key.data, key.len, "transfer-encoding")) {
+	p->framed = 1;
+      }
+
+      switch(__http_process_header(http,
+				   key.data, key.len,
+				   value.data, value.len)) {
+      case HTTP_EVENT_ERROR:
+	return 0;
+      case HTTP_EVENT_PATH:
+	UNREACHABLE();
+      case HTTP_EVENT_NOTHING:
+	break;
+      default:
+	UNREACHABLE();
+	break;
+      }
+
+      p->_header = sb->len;
+      p->_body = sb->len;
+	
+      break;
+    default:
+      break;
+    }
+  }
+
+  if(http->flags & HTTP_DONE) {
+    return httpclient_parser_headers(p, sb);
+  }
+
+  return 1;
+}
+
+// - only the lengths are set in 'r', since 'sb' may still move
+HTTPCLIENT_DEF void httpclient_parser_end(Http_Client_Parser *p, str_builder *sb, Http_Client_Response *r) {
+  // Without a length, the body would have ended with the connection
+  if(!p->framed && p->http.response_code != 204 && p->http.response_code != 304) {
+    p->keep_alive = 0;
+  }
+
+  r->code = p->http.response_code;
+  r->headers = str_from(NULL, p->_body - p->start);
+  r->body = str_from(NULL, sb->len - p->_body);
+}
+
+// - returns 1 on success, 0 on an error and -1 if the connection was closed
+//   before any byte of the response arrived
+HTTPCLIENT_DEF int httpclient_read_response(Http_Client_Connection *conn,
+					    str_builder *sb,
+					    Http_Client_Response *r,
+					    int *keep_alive,
+					    Http_Client_Sink *sink) {
+  u64 sb_len = sb->len;
+  int received = 0;
+
+  Http_Client_Parser p;
+  httpclient_parser_begin(&p, sb, sink);
+  while(!(p.http.flags & HTTP_DONE)) {
+
+    if(conn->buf_pos == conn->buf_len) {
+      u64 read = 0;
+      Ip_Error error = ip_socket_read(&conn->socket, conn->buf, sizeof(conn->buf), &read);
+      if(error == IP_ERROR_EOF || (error == IP_ERROR_NONE && read == 0)) {
+	sb->len = sb_len;
+	return received ? 0 : -1;
+      }
+      if(error != IP_ERROR_NONE) {
+	sb->len = sb_len;
+	return 0;
+      }
+      conn->buf_pos = 0;
+      conn->buf_len = read;
+      received = 1;
+    }
+    u8 *buf = conn->buf + conn->buf_pos;
+    u64 len = conn->buf_len - conn->buf_pos;
+
+    if(!httpclient_parser_feed(&p, sb, &buf, &len)) {
+      sb->len = sb_len;
+      return 0;
+    }
+
+    conn->buf_pos = (u64) (buf - conn->buf);
+  }
+
+  httpclient_parser_end(&p, sb, r);
+  *keep_alive = p.keep_alive;
+  conn->requests++;
+
+  return 1;
+}
+
 HTTPCLIENT_DEF int httpclient_request(str url,
 				      Http_Method method,
 				      str_builder *sb,
 				      Http_Client_Response *r) {
+  return httpclient_request_stream(url, method, sb, r, NULL);
+}
+
+HTTPCLIENT_DEF int httpclient_request_stream(str url,
+					     Http_Method method,
+					     str_builder *sb,
+					     Http_Client_Response *r,
+					     Http_Client_Sink *sink) {
   u16 port;
   str hostname, route;
   int encrypted;
@@ -160,100 +618,789 @@ HTTPCLIENT_DEF int httpclient_request(str url,
   u8 *_hostname = sb->data + sb_len;
   sb->len = sb_len;
   
-  Ip_Socket socket;
-  if(ip_socket_copen(&socket, (char *) _hostname, port, 1) != IP_ERROR_NONE) {
+  Http_Client_Connection conn;
+  conn.requests = 0;
+  conn.buf_pos = 0;
+  conn.buf_len = 0;
+  if(ip_socket_copen(&conn.socket, (char *) _hostname, port, 1) != IP_ERROR_NONE) {
     return 0;
   }
 
-  str_builder_appendf(sb, "%s "str_fmt" HTTP/1.1\r\n"
-		      "Host: "str_fmt"\r\n"
-		      "\r\n",		      
-		      HTTP_METHOD_NAME[method],
-		      str_arg(route),
-		      str_arg(hostname));
-  str request_string = str_from(sb->data + sb_len, sb->len - sb_len);
-  u64 written;
-  if(ip_socket_writes(&socket, request_string, &written) != IP_ERROR_NONE ||
-     written != request_string.len) {
-    TODO();
+  int keep_alive;
+  int ok = httpclient_write_request(&conn.socket, method, hostname, route, sb) &&
+    httpclient_read_response(&conn, sb, r, &keep_alive, sink) == 1;
+  ip_socket_close(&conn.socket);
+  if(!ok) {
+    return 0;
   }
-  sb->len = sb_len;
 
-  u64 _header, _value, _body;
-  _header = sb_len;
-  _value = 0;
-  _body = 0;
+  r->headers.data = sb->data + sb_len;
+  r->body.data = sb->data + sb_len + r->headers.len;
   
-  u8 buffer[1024];
-  Http http = http_default();
-  while(!(http.flags & HTTP_DONE)) {
+  return 1;
+}
 
-    u64 read;
-    if(ip_socket_read(&socket, buffer, sizeof(buffer), &read) != IP_ERROR_NONE) {
-      TODO();
+HTTPCLIENT_DEF int httpclient_open(Http_Client *c) {
+  c->hosts = HTTPCLIENT_ALLOC(sizeof(*c->hosts) * HTTPCLIENT_HOSTS_CAP);
+  if(!c->hosts) {
+    return 0;
+  }
+  c->hosts_len = 0;
+  c->tick = 0;
+
+  return 1;
+}
+
+// - the entry of 'hostname', it may be unresolved
+HTTPCLIENT_DEF Http_Client_Host *httpclient_host_find(Http_Client *c, str hostname, u16 port) {
+  if(hostname.len >= HTTPCLIENT_HOSTNAME_CAP) {
+    return NULL;
+  }
+
+  Http_Client_Host *host = NULL;
+  for(u64 i=0;!host && i<c->hosts_len;i++) {
+    Http_Client_Host *h = &c->hosts[i];
+    if(h->port == port &&
+       strlen(h->hostname) == hostname.len &&
+       memcmp(h->hostname, hostname.data, hostname.len) == 0) {
+      host = h;
     }
-    u8 *buf = buffer;
-    u64 len = read;
+  }
 
-    while(!(http.flags & HTTP_DONE) && len > 0) {
-      switch(http_process(&http, &buf, &len)) {
-      case HTTP_EVENT_ERROR:
-	TODO();
-      case HTTP_EVENT_KEY:
-        str_builder_append(sb, (u8 *) HTTPCLIENT_HEADERS_PAIR_DELIM, (u64) (sb->len == _header));
-	str_builder_append(sb, http.body_data, http.body_len);
-	_value = sb->len;
-	break;
-      case HTTP_EVENT_VALUE:
-	str_builder_append(sb, (u8 *) HTTPCLIENT_HEADERS_KEY_VALUE_DELIM, (u64) (sb->len == _value));
-	str_builder_append(sb, http.body_data, http.body_len);
-	break;
-      case HTTP_EVENT_BODY:
-	str_builder_append(sb, http.body_data, http.body_len);
-	break;
-      case HTTP_EVENT_PROCESS:
-	str key = str_from(sb->data + _header + 1, _value - _header - 1);
-	str value = str_from(sb->data + _value + 1, sb->len - _value);
-	value.len -= (value.len > 0);
-
-	/* printf("key: '"str_fmt"'\n", str_arg(key)); */
-	/* printf("value: '"str_fmt"'\n", str_arg(value)); */
-	/* printf("'"str_fmt"'\n", str_arg(str_from(sb->data + sb_len, sb->len - sb_len))); fflush(stdout); */
-
-	switch(__http_process_header(&http,
-				     key.data, key.len,
-				     value.data, value.len)) {
-	case HTTP_EVENT_ERROR:
-	  TODO();
-	case HTTP_EVENT_PATH:
-	  UNREACHABLE();
-	case HTTP_EVENT_NOTHING:
-	  break;
-	default:
-	  UNREACHABLE();
-	  break;
+  if(!host) {
+    if(c->hosts_len < HTTPCLIENT_HOSTS_CAP) {
+      host = &c->hosts[c->hosts_len++];
+    } else {
+      // Evict the least recently used host
+      host = &c->hosts[0];
+      for(u64 i=1;i<c->hosts_len;i++) {
+	if(c->hosts[i].used_at < host->used_at) host = &c->hosts[i];
+      }
+      for(u64 i=0;i<HTTPCLIENT_CONNECTIONS_CAP;i++) {
+	if(host->connections[i].socket.flags & IP_VALID) {
+	  ip_socket_close(&host->connections[i].socket);
 	}
+      }
+    }
 
-	_header = sb->len;
-	_body = sb->len;
-	
-	break;
-      default:
-	break;
+    memcpy(host->hostname, hostname.data, hostname.len);
+    host->hostname[hostname.len] = 0;
+    host->port = port;
+    host->resolved_at = 0;
+    for(u64 i=0;i<HTTPCLIENT_CONNECTIONS_CAP;i++) {
+      host->connections[i].socket = ip_socket_invalid();
+    }
+  }
+
+  host->used_at = c->tick++;
+
+  return host;
+}
+
+#define httpclient_host_resolved(host, now)				\
+  ((host)->resolved_at != 0 && (now) - (host)->resolved_at < HTTPCLIENT_DNS_TTL)
+
+HTTPCLIENT_DEF Http_Client_Host *httpclient_host(Http_Client *c, str hostname, u16 port) {
+  Http_Client_Host *host = httpclient_host_find(c, hostname, port);
+  if(!host) {
+    return NULL;
+  }
+
+  time_t now = time(NULL);
+  if(!httpclient_host_resolved(host, now)) {
+    if(ip_resolve(host->hostname, port, &host->address) != IP_ERROR_NONE) {
+      host->resolved_at = 0;
+      return NULL;
+    }
+    host->resolved_at = now;
+  }
+
+  return host;
+}
+
+// - an idle connection to 'host', 'reused' is set if it was not just opened
+HTTPCLIENT_DEF Http_Client_Connection *httpclient_connection(Http_Client_Host *host, int *reused) {
+
+  Http_Client_Connection *free_conn = NULL;
+  for(u64 i=0;i<HTTPCLIENT_CONNECTIONS_CAP;i++) {
+    Http_Client_Connection *conn = &host->connections[i];
+    if(!(conn->socket.flags & IP_VALID)) {
+      if(!free_conn) free_conn = conn;
+      continue;
+    }
+
+    // An idle connection has nothing to read, unless the server closed it
+    if(conn->buf_pos == conn->buf_len && ip_socket_readable(&conn->socket)) {
+      ip_socket_close(&conn->socket);
+      conn->socket = ip_socket_invalid();
+      if(!free_conn) free_conn = conn;
+      continue;
+    }
+
+    *reused = 1;
+    return conn;
+  }
+
+  if(!free_conn) {
+    return NULL;
+  }
+
+  if(ip_socket_connect(&free_conn->socket, &host->address, 1) != IP_ERROR_NONE) {
+    free_conn->socket = ip_socket_invalid();
+    return NULL;
+  }
+  free_conn->requests = 0;
+  free_conn->buf_pos = 0;
+  free_conn->buf_len = 0;
+
+  *reused = 0;
+  return free_conn;
+}
+
+HTTPCLIENT_DEF void httpclient_connection_drop(Http_Client_Connection *conn) {
+  ip_socket_close(&conn->socket);
+  conn->socket = ip_socket_invalid();
+}
+
+HTTPCLIENT_DEF int httpclient_send_impl(Http_Client *c,
+					str *urls,
+					u64 n,
+					Http_Method method,
+					str_builder *sb,
+					Http_Client_Response *rs,
+					Http_Client_Sink *sink) {
+  if(n == 0) {
+    return 1;
+  }
+
+  u16 port;
+  str hostname, route;
+  int encrypted;
+  if(!httpclient_parse_url(urls[0], &hostname, &route, &port, &encrypted)) {
+    return 0;
+  }
+  if(encrypted) {
+    TODO();
+  }
+
+  Http_Client_Host *host = httpclient_host(c, hostname, port);
+  if(!host) {
+    return 0;
+  }
+
+  u64 sb_len = sb->len;
+
+  // A reused connection may have been closed by the server in the meantime,
+  // then retry once on a new one
+  for(int attempt=0;attempt<2;attempt++) {
+    int reused;
+    Http_Client_Connection *conn = httpclient_connection(host, &reused);
+    if(!conn) {
+      return 0;
+    }
+
+    int ok = 1;
+    for(u64 i=0;ok && i<n;i++) {
+      u16 _port;
+      str _hostname;
+      ok = httpclient_parse_url(urls[i], &_hostname, &route, &_port, &encrypted) &&
+	_port == port &&
+	str_eq(_hostname, hostname) &&
+	httpclient_write_request(&conn->socket, method, hostname, route, sb);
+    }
+
+    int keep_alive = 1;
+    int result = ok;
+    for(u64 i=0;result == 1 && i<n;i++) {
+      int _keep_alive;
+      result = httpclient_read_response(conn, sb, &rs[i], &_keep_alive, sink);
+      keep_alive = keep_alive && _keep_alive;
+    }
+
+    if(result != 1 || !keep_alive) {
+      httpclient_connection_drop(conn);
+    }
+    if(result == 1) {
+      break;
+    }
+    sb->len = sb_len;
+    if(result == 0 || !reused) {
+      return 0;
+    }
+  }
+
+  // The responses lie one after another in 'sb'
+  u64 off = sb_len;
+  for(u64 i=0;i<n;i++) {
+    rs[i].headers.data = sb->data + off;
+    off += rs[i].headers.len;
+    rs[i].body.data = sb->data + off;
+    off += rs[i].body.len;
+  }
+
+  return 1;
+}
+
+HTTPCLIENT_DEF int httpclient_send(Http_Client *c,
+				   str url,
+				   Http_Method method,
+				   str_builder *sb,
+				   Http_Client_Response *r) {
+  return httpclient_send_impl(c, &url, 1, method, sb, r, NULL);
+}
+
+HTTPCLIENT_DEF int httpclient_send_pipelined(Http_Client *c,
+					     str *urls,
+					     u64 n,
+					     Http_Method method,
+					     str_builder *sb,
+					     Http_Client_Response *rs) {
+  return httpclient_send_impl(c, urls, n, method, sb, rs, NULL);
+}
+
+HTTPCLIENT_DEF int httpclient_send_stream(Http_Client *c,
+					  str url,
+					  Http_Method method,
+					  str_builder *sb,
+					  Http_Client_Response *r,
+					  Http_Client_Sink *sink) {
+  return httpclient_send_impl(c, &url, 1, method, sb, r, sink);
+}
+
+HTTPCLIENT_DEF void httpclient_close(Http_Client *c) {
+  for(u64 i=0;i<c->hosts_len;i++) {
+    for(u64 j=0;j<HTTPCLIENT_CONNECTIONS_CAP;j++) {
+      Http_Client_Connection *conn = &c->hosts[i].connections[j];
+      if(conn->socket.flags & IP_VALID) {
+	ip_socket_close(&conn->socket);
       }
-    }    
-    
+    }
   }
+  HTTPCLIENT_FREE(c->hosts);
+}
 
-  r->headers = str_from(sb->data + sb_len, _body - sb_len);
-  r->body = str_from(sb->data + _body, sb->len - _body + sb_len);
+HTTPCLIENT_DEF int httpclient_async_open(Http_Client_Async *a, Ip_Sockets *s, u64 connections, u64 queue_cap) {
+  if(!httpclient_open(&a->client)) {
+    return 0;
+  }
+
+  a->slots = HTTPCLIENT_ALLOC(sizeof(*a->slots) * connections);
+  a->queue = HTTPCLIENT_ALLOC(sizeof(*a->queue) * queue_cap);
+  if(!a->slots || !a->queue) {
+    if(a->slots) HTTPCLIENT_FREE(a->slots);
+    if(a->queue) HTTPCLIENT_FREE(a->queue);
+    httpclient_close(&a->client);
+    return 0;
+  }
+  memset(a->slots, 0, sizeof(*a->slots) * connections);
+  memset(a->queue, 0, sizeof(*a->queue) * queue_cap);
+  memset(a->lookups, 0, sizeof(a->lookups));
+
+  if(ip_sockets_reserve(s, connections, httpclient_async_handler, a, &a->off) != IP_ERROR_NONE) {
+    HTTPCLIENT_FREE(a->slots);
+    HTTPCLIENT_FREE(a->queue);
+    httpclient_close(&a->client);
+    return 0;
+  }
+
+  a->sockets = s;
+  a->len = connections;
+  a->per_host = HTTPCLIENT_CONNECTIONS_CAP;
+  a->queue_len = 0;
+  a->queue_cap = queue_cap;
+
+  return 1;
+}
+
+HTTPCLIENT_DEF Http_Client_Send_Result httpclient_async_send(Http_Client_Async *a,
+							     str url,
+							     Http_Method method,
+							     u64 timeout,
+							     Http_Client_Callback callback,
+							     void *data) {
+  u16 port;
+  str hostname, route;
+  int encrypted;
+  if(!httpclient_parse_url(url, &hostname, &route, &port, &encrypted) ||
+     encrypted ||
+     hostname.len >= HTTPCLIENT_HOSTNAME_CAP) {
+    return HTTPCLIENT_SEND_INVALID_URL;
+  }
+  if(a->queue_len == a->queue_cap) {
+    return HTTPCLIENT_SEND_QUEUE_FULL;
+  }
+
+  Http_Client_Call *call = &a->queue[a->queue_len++];
+  call->url.len = 0;
+  str_builder_appends(&call->url, url);
+  call->method = method;
+  call->deadline = timeout ? co_now() + timeout : 0;
+  call->callback = callback;
+  call->data = data;
+
+  return HTTPCLIENT_SEND_QUEUED;
+}
+
+HTTPCLIENT_DEF u64 httpclient_async_pending(Http_Client_Async *a) {
+  u64 pending = a->queue_len;
+  for(u64 i=0;i<a->len;i++) {
+    Http_Client_Slot_State state = a->slots[i].state;
+    pending += (state != HTTPCLIENT_SLOT_FREE && state != HTTPCLIENT_SLOT_IDLE);
+  }
+  return pending;
+}
+
+HTTPCLIENT_DEF void httpclient_async_drop(Http_Client_Async *a, u64 i) {
+  Ip_Socket *socket = ip_sockets_get(a->sockets, a->off + i);
+  ip_sockets_unregister(a->sockets, a->off + i);
+  ip_socket_close(socket);
+  *socket = ip_socket_invalid();
+  a->slots[i].state = HTTPCLIENT_SLOT_FREE;
+}
+
+HTTPCLIENT_DEF void httpclient_async_finish(Http_Client_Async *a, u64 i, Http_Client_Result result) {
+  Http_Client_Slot *slot = &a->slots[i];
+
+  Http_Client_Response r;
+  if(result == HTTPCLIENT_DONE) {
+    httpclient_parser_end(&slot->parser, &slot->sb, &r);
+    r.headers.data = slot->sb.data + slot->parser.start;
+    r.body.data = r.headers.data + r.headers.len;
+  }
+
+  if(result == HTTPCLIENT_DONE && slot->parser.keep_alive) {
+    slot->state = HTTPCLIENT_SLOT_IDLE;
+    ip_sockets_get(a->sockets, a->off + i)->flags &= ~IP_WRITING;
+  } else {
+    httpclient_async_drop(a, i);
+  }
+
+  // The callback may send again, that only queues
+  slot->call.callback(slot->call.data, result, result == HTTPCLIENT_DONE ? &r : NULL);
+}
+
+#ifdef _WIN32
+HTTPCLIENT_DEF DWORD WINAPI httpclient_lookup_thread(LPVOID data) {
+#else
+HTTPCLIENT_DEF void *httpclient_lookup_thread(void *data) {
+#endif // _WIN32
+  Http_Client_Lookup *l = data;
+  l->error = ip_resolve(l->hostname, l->port, &l->address);
+  co_flag_set(&l->done);
+  return 0;
+}
+
+HTTPCLIENT_DEF void httpclient_lookup_join(Http_Client_Lookup *l) {
+#ifdef _WIN32
+  WaitForSingleObject(l->thread, INFINITE);
+  CloseHandle(l->thread);
+#else
+  pthread_join(l->thread, NULL);
+#endif // _WIN32
+}
+
+// - the address of 'hostname'. NULL, while a thread resolves it or waits
+//   for a free lookup
+// - 'failed' is set, if it can not be resolved
+HTTPCLIENT_DEF Http_Client_Host *httpclient_async_host(Http_Client_Async *a, str hostname, u16 port, int *failed) {
+  *failed = 0;
+
+  Http_Client_Host *host = httpclient_host_find(&a->client, hostname, port);
+  if(!host) {
+    *failed = 1;
+    return NULL;
+  }
+  if(httpclient_host_resolved(host, time(NULL))) {
+    return host;
+  }
+
+  Http_Client_Lookup *free_lookup = NULL;
+  for(u64 i=0;i<HTTPCLIENT_LOOKUPS_CAP;i++) {
+    Http_Client_Lookup *l = &a->lookups[i];
+    if(l->state == HTTPCLIENT_LOOKUP_FREE) {
+      if(!free_lookup) free_lookup = l;
+      continue;
+    }
+    if(l->port == port &&
+       strlen(l->hostname) == hostname.len &&
+       memcmp(l->hostname, hostname.data, hostname.len) == 0) {
+      *failed = l->state == HTTPCLIENT_LOOKUP_FAILED;
+      return NULL;
+    }
+  }
+  if(!free_lookup) {
+    return NULL;
+  }
+
+  Http_Client_Lookup *l = free_lookup;
+  memcpy(l->hostname, hostname.data, hostname.len);
+  l->hostname[hostname.len] = 0;
+  l->port = port;
+  l->done = 0;
+#ifdef _WIN32
+  l->thread = CreateThread(NULL, 0, httpclient_lookup_thread, l, 0, NULL);
+  int started = l->thread != NULL;
+#else
+  int started = pthread_create(&l->thread, NULL, httpclient_lookup_thread, l) == 0;
+#endif // _WIN32
+  if(!started) {
+    // Out of threads, the next tick tries again
+    return NULL;
+  }
+  l->state = HTTPCLIENT_LOOKUP_RUNNING;
+
+  return NULL;
+}
+
+// - cache the addresses, that are resolved by now
+HTTPCLIENT_DEF void httpclient_async_lookups(Http_Client_Async *a) {
+  for(u64 i=0;i<HTTPCLIENT_LOOKUPS_CAP;i++) {
+    Http_Client_Lookup *l = &a->lookups[i];
+    if(l->state != HTTPCLIENT_LOOKUP_RUNNING || !co_flag_get(&l->done)) {
+      continue;
+    }
+    httpclient_lookup_join(l);
+
+    if(l->error != IP_ERROR_NONE) {
+      // The requests of this tick fail with it
+      l->state = HTTPCLIENT_LOOKUP_FAILED;
+      continue;
+    }
+    l->state = HTTPCLIENT_LOOKUP_FREE;
+
+    Http_Client_Host *host = httpclient_host_find(&a->client, str_fromc(l->hostname), l->port);
+    if(host) {
+      host->address = l->address;
+      host->resolved_at = time(NULL);
+    }
+  }
+}
+
+// - returns 1 if 'call' started, 0 if it has to wait and -1 if it failed
+HTTPCLIENT_DEF int httpclient_async_start(Http_Client_Async *a, Http_Client_Call *call) {
+  u16 port;
+  str hostname, route;
+  int encrypted;
+  if(!httpclient_parse_url(str_from(call->url.data, call->url.len), &hostname, &route, &port, &encrypted) ||
+     encrypted ||
+     hostname.len >= HTTPCLIENT_HOSTNAME_CAP) {
+    return -1;
+  }
+
+  u64 idle = a->len;
+  u64 other_idle = a->len;
+  u64 free_slot = a->len;
+  u64 connections = 0;
+  for(u64 i=0;i<a->len;i++) {
+    Http_Client_Slot *slot = &a->slots[i];
+    if(slot->state == HTTPCLIENT_SLOT_FREE) {
+      if(free_slot == a->len) free_slot = i;
+      continue;
+    }
+
+    int same = slot->port == port &&
+      strlen(slot->hostname) == hostname.len &&
+      memcmp(slot->hostname, hostname.data, hostname.len) == 0;
+    connections += same;
+    if(slot->state == HTTPCLIENT_SLOT_IDLE) {
+      if(same) idle = i;
+      else other_idle = i;
+    }
+  }
+
+  u64 i = idle;
+  if(i == a->len) {
+    if(connections >= a->per_host) {
+      return 0;
+    }
+
+    int failed;
+    Http_Client_Host *host = httpclient_async_host(a, hostname, port, &failed);
+    if(!host) {
+      return failed ? -1 : 0;
+    }
+
+    i = free_slot;
+    if(i == a->len && other_idle < a->len) {
+      i = other_idle;
+      httpclient_async_drop(a, i);
+    }
+    if(i == a->len) {
+      return 0;
+    }
+
+    Ip_Socket *socket = ip_sockets_get(a->sockets, a->off + i);
+    if(ip_socket_connect(socket, &host->address, 0) != IP_ERROR_NONE) {
+      *socket = ip_socket_invalid();
+      return -1;
+    }
+    if(ip_sockets_register(a->sockets, a->off + i) != IP_ERROR_NONE) {
+      ip_socket_close(socket);
+      *socket = ip_socket_invalid();
+      return -1;
+    }
+    socket->flags |= IP_WRITING;
+
+    Http_Client_Slot *slot = &a->slots[i];
+    slot->state = HTTPCLIENT_SLOT_CONNECTING;
+    memcpy(slot->hostname, hostname.data, hostname.len);
+    slot->hostname[hostname.len] = 0;
+    slot->port = port;
+  } else {
+    a->slots[i].state = HTTPCLIENT_SLOT_WRITING;
+    ip_sockets_get(a->sockets, a->off + i)->flags |= IP_WRITING;
+  }
+
+  Http_Client_Slot *slot = &a->slots[i];
+  slot->sb.len = 0;
+  httpclient_append_request(&slot->sb, call->method, hostname, route);
+  slot->written = 0;
+
+  // Swap, so that both keep their buffer
+  Http_Client_Call tmp = slot->call;
+  slot->call = *call;
+  *call = tmp;
 
-  r->code = http.response_code;
-  ip_socket_close(&socket);
-  
   return 1;
 }
 
+HTTPCLIENT_DEF void httpclient_async_tick(Http_Client_Async *a) {
+  u64 now = co_now();
+  httpclient_async_lookups(a);
+
+  for(u64 i=0;i<a->len;i++) {
+    Http_Client_Slot *slot = &a->slots[i];
+    if(slot->state != HTTPCLIENT_SLOT_FREE &&
+       slot->state != HTTPCLIENT_SLOT_IDLE &&
+       slot->call.deadline != 0 &&
+       now >= slot->call.deadline) {
+      slot->parser.keep_alive = 0;
+      httpclient_async_finish(a, i, HTTPCLIENT_TIMEOUT);
+    }
+  }
+
+  // A callback may append to the queue, while it is compacted
+  u64 kept = 0;
+  for(u64 i=0;i<a->queue_len;i++) {
+    Http_Client_Call *call = &a->queue[i];
+
+    if(call->deadline != 0 && now >= call->deadline) {
+      call->callback(call->data, HTTPCLIENT_TIMEOUT, NULL);
+      continue;
+    }
+
+    switch(httpclient_async_start(a, call)) {
+    case 1:
+      break;
+    case 0: {
+      Http_Client_Call tmp = a->queue[kept];
+      a->queue[kept] = *call;
+      *call = tmp;
+      kept++;
+    } break;
+    default:
+      call->callback(call->data, HTTPCLIENT_FAILED, NULL);
+      break;
+    }
+  }
+  a->queue_len = kept;
+
+  for(u64 i=0;i<HTTPCLIENT_LOOKUPS_CAP;i++) {
+    if(a->lookups[i].state == HTTPCLIENT_LOOKUP_FAILED) {
+      a->lookups[i].state = HTTPCLIENT_LOOKUP_FREE;
+    }
+  }
+}
+
+HTTPCLIENT_DEF void httpclient_async_write(Http_Client_Async *a, u64 i) {
+  Http_Client_Slot *slot = &a->slots[i];
+  Ip_Socket *socket = ip_sockets_get(a->sockets, a->off + i);
+
+  if(slot->state == HTTPCLIENT_SLOT_CONNECTING) {
+    if(ip_socket_connected(socket) != IP_ERROR_NONE) {
+      httpclient_async_finish(a, i, HTTPCLIENT_FAILED);
+      return;
+    }
+    slot->state = HTTPCLIENT_SLOT_WRITING;
+  }
+
+  if(slot->state != HTTPCLIENT_SLOT_WRITING) {
+    socket->flags &= ~IP_WRITING;
+    return;
+  }
+
+  while(slot->written < slot->sb.len) {
+    u64 written;
+    switch(ip_socket_write(socket,
+			   slot->sb.data + slot->written,
+			   slot->sb.len - slot->written,
+			   &written)) {
+    case IP_ERROR_NONE:
+      slot->written += written;
+      break;
+    case IP_ERROR_REPEAT:
+      return;
+    default:
+      httpclient_async_finish(a, i, HTTPCLIENT_FAILED);
+      return;
+    }
+  }
+
+  socket->flags &= ~IP_WRITING;
+  slot->state = HTTPCLIENT_SLOT_READING;
+  slot->sb.len = 0;
+  httpclient_parser_begin(&slot->parser, &slot->sb, NULL);
+}
+
+HTTPCLIENT_DEF void httpclient_async_read(Http_Client_Async *a, u64 i, Ip_Mode mode) {
+  Http_Client_Slot *slot = &a->slots[i];
+  Ip_Socket *socket = ip_sockets_get(a->sockets, a->off + i);
+
+  switch(slot->state) {
+  case HTTPCLIENT_SLOT_IDLE:
+    // Closed by the server
+    httpclient_async_drop(a, i);
+    return;
+  case HTTPCLIENT_SLOT_CONNECTING:
+  case HTTPCLIENT_SLOT_WRITING:
+    if(mode == IP_MODE_DISCONNECT) {
+      httpclient_async_finish(a, i, HTTPCLIENT_FAILED);
+    }
+    return;
+  case HTTPCLIENT_SLOT_READING:
+    break;
+  default:
+    return;
+  }
+
+  while(1) {
+    u64 read;
+    switch(ip_socket_read(socket, a->buf, sizeof(a->buf), &read)) {
+    case IP_ERROR_NONE:
+      break;
+    case IP_ERROR_REPEAT:
+      return;
+    default:
+      httpclient_async_finish(a, i, HTTPCLIENT_FAILED);
+      return;
+    }
+
+    u8 *buf = a->buf;
+    u64 len = read;
+    if(!httpclient_parser_feed(&slot->parser, &slot->sb, &buf, &len)) {
+      httpclient_async_finish(a, i, HTTPCLIENT_FAILED);
+      return;
+    }
+
+    if(slot->parser.http.flags & HTTP_DONE) {
+      // Nothing was asked for, the connection is out of sync
+      if(len > 0) slot->parser.keep_alive = 0;
+      httpclient_async_finish(a, i, HTTPCLIENT_DONE);
+      return;
+    }
+  }
+}
+
+HTTPCLIENT_DEF void httpclient_async_handler(Ip_Sockets *s, void *ctx,
+					     u64 off, u64 len,
+					     Ip_Error error, u64 index, Ip_Mode mode) {
+  (void) len;
+
+  Http_Client_Async *a = ctx;
+  if(!a->slots) {
+    return;
+  }
+
+  if(error == IP_ERROR_REPEAT) {
+    httpclient_async_tick(a);
+    return;
+  }
+
+  // Events of a batch may refer to a connection, that is closed by now
+  if(!(ip_sockets_get(s, index)->flags & IP_VALID)) {
+    return;
+  }
+
+  switch(mode) {
+  case IP_MODE_WRITE:
+    httpclient_async_write(a, index - off);
+    break;
+  case IP_MODE_READ:
+  case IP_MODE_DISCONNECT:
+    httpclient_async_read(a, index - off, mode);
+    break;
+  default:
+    break;
+  }
+}
+
+HTTPCLIENT_DEF void httpclient_async_close(Http_Client_Async *a) {
+  for(u64 i=0;i<a->len;i++) {
+    Http_Client_Slot *slot = &a->slots[i];
+    if(slot->state != HTTPCLIENT_SLOT_FREE &&
+       slot->state != HTTPCLIENT_SLOT_IDLE) {
+      slot->parser.keep_alive = 0;
+      httpclient_async_finish(a, i, HTTPCLIENT_FAILED);
+    }
+    if(slot->state == HTTPCLIENT_SLOT_IDLE) {
+      httpclient_async_drop(a, i);
+    }
+  }
+  for(u64 i=0;i<a->queue_len;i++) {
+    a->queue[i].callback(a->queue[i].data, HTTPCLIENT_FAILED, NULL);
+  }
+  for(u64 i=0;i<HTTPCLIENT_LOOKUPS_CAP;i++) {
+    if(a->lookups[i].state == HTTPCLIENT_LOOKUP_RUNNING) {
+      httpclient_lookup_join(&a->lookups[i]);
+    }
+    a->lookups[i].state = HTTPCLIENT_LOOKUP_FREE;
+  }
+
+  for(u64 i=0;i<a->len;i++) {
+    if(a->slots[i].sb.cap) STR_FREE(a->slots[i].sb.data);
+    if(a->slots[i].call.url.cap) STR_FREE(a->slots[i].call.url.data);
+  }
+  for(u64 i=0;i<a->queue_cap;i++) {
+    if(a->queue[i].url.cap) STR_FREE(a->queue[i].url.data);
+  }
+  HTTPCLIENT_FREE(a->slots);
+  HTTPCLIENT_FREE(a->queue);
+  httpclient_close(&a->client);
+
+  // The handler stays reserved in the loop
+  a->slots = NULL;
+}
+
+HTTPCLIENT_DEF int httpclient_sink_file_body(void *data, u8 *chunk, u64 chunk_len) {
+  Http_Client_File_Sink *f = data;
+
+  if(f->file) {
+    u64 off = 0;
+    while(off < chunk_len) {
+      u64 written;
+      if(fs_file_write(f->file, chunk + off, chunk_len - off, &written) != FS_ERROR_NONE ||
+	 written == 0) {
+	return 0;
+      }
+      off += written;
+    }
+  }
+  if(f->md5) {
+    md5_context_process(f->md5, chunk, chunk_len);
+  }
+  f->len += chunk_len;
+
+  return 1;
+}
+
+HTTPCLIENT_DEF Http_Client_Sink httpclient_sink_file(Http_Client_File_Sink *f) {
+  return (Http_Client_Sink) {
+    .headers = NULL,
+    .body = httpclient_sink_file_body,
+    .data = f,
+  };
+}
+
 #endif // HTTPCLIENT_IMPLEMENTATION
 
 #endif // HTTPCLIENT_H
@@ -44,6 +44,9 @@
 #  define HTTP_IMPLEMENTATION
 #  define B64_IMPLEMENTATION
 #  define VA_IMPLEMENTATION
+#  define WS_IMPLEMENTATION
+#  define HTTP2_IMPLEMENTATION
+#  define CO_IMPLEMENTATION
 #endif // HTTPSERVER_IMPLEMENTATION
 
 #include <core/str.h>
@@ -52,14 +55,20 @@
 #include <core/http.h>
 #include <core/b64.h>
 #include <core/va.h>
+#include <core/ws.h>
+#include <core/http2.h>
+#include <core/co.h>
 #include <core/types.h>
 
+#include <stddef.h>
+
 #define HTTPSERVER_SOCKETS_PER_CLIENT 1
 
 typedef enum {
   HTTPSERVER_WRITE_KIND_FIXED,
   HTTPSERVER_WRITE_KIND_FILE,
   HTTPSERVER_WRITE_KIND_FILE_CHUNKED,
+  HTTPSERVER_WRITE_KIND_SHARED,
 } Http_Server_Write_Kind;
 
 typedef struct {
@@ -79,18 +88,141 @@ typedef struct {
   u8 queue_data[HTTPSERVER_WRITE_FILE_QUEUE_DATA_CAP];
 } Http_Server_Write_File_Chunked;
 
+// A message that is serialized once and enqueued by reference into
+// many sessions. The last session that finishes writing it, frees it.
+typedef struct {
+  u64 refs;
+  u64 len;
+  u8 data[];
+} Http_Server_Shared;
+
+typedef struct {
+  Http_Server_Shared *shared;
+  u64 off;
+} Http_Server_Write_Shared;
+
 typedef struct {
   Http_Server_Write_Kind kind;
   union {
     Http_Server_Write_Fixed fixed;
     Fs_File file;
     Http_Server_Write_File_Chunked chunked;
+    Http_Server_Write_Shared shared;
   } as;
 } Http_Server_Write;
 
-#define HTTPSERVER_WRITE_CAP 8
+#ifndef HTTPSERVER_WRITE_CAP
+#  define HTTPSERVER_WRITE_CAP 8
+#endif // HTTPSERVER_WRITE_CAP
+
+#ifndef HTTPSERVER_H2_STREAMS_CAP
+#  define HTTPSERVER_H2_STREAMS_CAP 100
+#endif // HTTPSERVER_H2_STREAMS_CAP
+
+// Receive-window of a stream, sent as SETTINGS_INITIAL_WINDOW_SIZE. Not
+// less than HTTP2_INITIAL_WINDOW_SIZE, the client may use that one until
+// it acknowledged the SETTINGS
+#ifndef HTTPSERVER_H2_WINDOW
+#  define HTTPSERVER_H2_WINDOW HTTP2_INITIAL_WINDOW_SIZE
+#endif // HTTPSERVER_H2_WINDOW
+
+// A stream is given no more window, than its request-body may take. A
+// bigger one is reset
+#ifndef HTTPSERVER_H2_BODY_MAX
+#  define HTTPSERVER_H2_BODY_MAX (16 * 1024 * 1024)
+#endif // HTTPSERVER_H2_BODY_MAX
+
+// Serialized frames, before they are written
+#define HTTPSERVER_H2_OUT_CAP (64 * 1024)
+
+#define HTTPSERVER_H2_STREAM_FREE       0
+#define HTTPSERVER_H2_STREAM_RECEIVING  1 // waiting for END_STREAM
+#define HTTPSERVER_H2_STREAM_READY      2 // the request is complete
+#define HTTPSERVER_H2_STREAM_RESPONDING 3 // the response is in the write-queue
+#define HTTPSERVER_H2_STREAM_RESET      4 // reset, while responding
+
+typedef struct {
+  u32 id;
+  int state;
+  s64 window;      // for DATA to the client
+  s64 recv_window; // for DATA of the client
+
+  // Memory for path/headers/body, laid out like 'Http_Server_Session.sb'
+  str_builder sb;
+  u64 path_len, _body;
+  Http_Method method;
+
+  // The response. The writes of the handler move here from the session,
+  // once it is done, the 'Http_Server_Session.sb' they point to follows
+  // as 'response'
+  Http_Server_Write queue[HTTPSERVER_WRITE_CAP];
+  u64 queue_pos;
+  u64 queue_len;
+  str_builder response;
+  str_builder head;
+  int head_sent;
+} Http_Server_H2_Stream;
+
+typedef struct {
+  Http2_Hpack hpack;
+  Http_Server_H2_Stream streams[HTTPSERVER_H2_STREAMS_CAP];
+  u32 last_stream_id;
+  int preface; // the connection preface of the client was received
+  int goaway;
+
+  // Settings and connection-window of the client
+  s64 window;
+  s64 initial_window;
+  u32 max_frame_size;
+  s64 recv_window; // of the connection, for DATA of the client
+
+  // HEADERS, until END_HEADERS
+  str_builder block;
+  u32 block_stream;
+  u8 block_flags;
+  str_builder scratch;
+
+  // Only one stream is handed out at a time. Its writes are enqueued like
+  // HTTP/1.1 and translated into HEADERS/DATA, while they are written.
+  // The streams, that are answered, take turns by frame
+  Http_Server_H2_Stream *current;
+  u64 next;
+
+  str_builder out;
+  u64 out_pos;
+} Http_Server_H2;
+
+typedef str Http_Server_Headers;
+
+#define HTTPSERVER_HEADERS_PAIR_DELIM "|"
+#define HTTPSERVER_HEADERS_KEY_VALUE_DELIM ":"
+
+#ifndef HTTPSERVER_HEAD_HEADERS_CAP
+#  define HTTPSERVER_HEAD_HEADERS_CAP 64
+#endif // HTTPSERVER_HEAD_HEADERS_CAP
 
 typedef struct {
+  Http_Method method;
+  str path;
+  str params;
+  str body;
+  Http_Server_Headers headers;
+
+  // WS_OPCODE_TEXT/WS_OPCODE_BINARY for websocket-messages, 'body' holds
+  // the whole (defragmented) payload. Otherwise 0.
+  Ws_Opcode websocket;
+} Http_Server_Request;
+
+typedef struct Http_Server_Session Http_Server_Session;
+
+// - a coroutine, see 'core/co.h'. It returns CO_DONE, once every write
+//   of the response is enqueued
+typedef Co_Result (*Http_Server_Handler)(Co *co,
+					 Http_Server_Session *s,
+					 Http_Server_Request *r,
+					 void *data);
+
+struct Http_Server_Session {
   // State of http-request
   Http http;
 
@@ -111,20 +243,55 @@ typedef struct {
   int started_to_write;
 
   u64 inactive_cycles;
-} Http_Server_Session;
 
-#define httpserver_session_enqueue(s, w)				\
-  do {									\
-    if((s)->queue_len >= HTTPSERVER_WRITE_CAP) {			\
-      TODO();								\
-    }									\
-    (s)->queue[((s)->queue_pos + (s)->queue_len++) % HTTPSERVER_WRITE_CAP] = (w); \
-  }while(0)
+  // Set by the accept, an enqueued write marks the socket IP_WRITING
+  Ip_Sockets *sockets;
+  u64 socket_index;
+
+  // 'Http_Server.files', see 'httpserver_open_file'
+  Fs_File_Cache *files;
+
+  // Subscriptions
+  u64 generation; // incremented, whenever the slot is reused
+  u64 pending;    // bytes of shared messages, not yet written
+
+  // WebSocket, after 'httpserver_websocket_upgrade'
+  int websocket;
+  int closing;             // disconnect, once every write is done
+  Ws ws;
+  Ws_Opcode message_opcode;
+  str_builder message;     // payload of the current, maybe fragmented, message
+  u8 control[WS_CONTROL_CAP];
+  u64 control_len;
+  str_builder input;       // bytes that are read, but not yet processed
+  u64 input_pos;
+
+  // HTTP/2, after the connection preface or 'Upgrade: h2c'
+  int http2;
+  Http_Server_H2 *h2;
+  u64 preface_len; // bytes of HTTP2_PREFACE, that were read as the start of a request
+
+  // Suspended handler, see 'httpserver_spawn'. 'request' and the
+  // memory it points to, stay valid until the handler is done
+  Http_Server_Handler handler;
+  void *handler_data;
+  Co co;
+  Http_Server_Request request;
+  Co_Sched *sched;
+};
+
+// - enqueue 'w' and mark the socket for writing
+// - if the queue is full, 'w' is released and 0 is returned. The session
+//   is disconnected, once the writes before it are done
+HTTPSERVER_DEF int httpserver_session_enqueue(Http_Server_Session *s, Http_Server_Write w);
 
 #define httpserver_enqueue_fixed(s, m) httpserver_session_enqueue((s), ((Http_Server_Write) { \
 	.kind = HTTPSERVER_WRITE_KIND_FIXED,				\
 	.as.fixed = (Http_Server_Write_Fixed) { .message = (m), .off = 0, } }))
 
+// - takes a reference of 'm', unless 0 is returned
+HTTPSERVER_DEF int httpserver_enqueue_shared(Http_Server_Session *s, Http_Server_Shared *m);
+
 #define httpserver_enqueue_file(s, f) httpserver_session_enqueue((s), ((Http_Server_Write) { \
 	.kind = HTTPSERVER_WRITE_KIND_FILE,				\
 	.as.file = (f) }))
@@ -136,19 +303,6 @@ typedef struct {
 	  .queue_off = HTTPSERVER_WRITE_FILE_QUEUE_DATA_CAP,		\
 	}}))
 
-typedef str Http_Server_Headers;
-
-#define HTTPSERVER_HEADERS_PAIR_DELIM "|"
-#define HTTPSERVER_HEADERS_KEY_VALUE_DELIM ":"
-
-typedef struct {
-  Http_Method method;
-  str path;
-  str params;
-  str body;
-  Http_Server_Headers headers;
-} Http_Server_Request;
-
 HTTPSERVER_DEF int httpserver_headers_find(Http_Server_Headers headers, u8 *name, u64 name_len, str *value);
 #define httpserver_headers_findc(hs, cstr, v) httpserver_headers_find((hs), (cstr), strlen(cstr), (v))
 #define httpserver_headers_finds(hs, s, v) httpserver_headers_find((hs), (s).data, (s).len, (v))
@@ -157,6 +311,15 @@ typedef struct {
   Http_Server_Session *sessions;
   u64 number_of_clients;
 
+  // Directories, see 'httpserver_serve_files_indexed'
+  Fs_Listing_Cache listings;
+  // Files, stats and misses, see 'httpserver_open_file'
+  Fs_File_Cache files;
+
+  // Suspended handlers. On linux 'sched.epfd' is readable, once one of
+  // their fds is. Registered in the event-loop, it wakes it up
+  Co_Sched sched;
+
   u8 ip_buf[1024];
 } Http_Server;
 
@@ -171,6 +334,74 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
 				   Http_Server_Request *r);
 HTTPSERVER_DEF void httpserver_close(Http_Server *h);
 
+// - run 'handler' for 'r'. If it suspends, 'httpserver_resume' continues it
+// - returns 1, if the handler is already done
+HTTPSERVER_DEF int httpserver_spawn(Http_Server_Session *s,
+				    Http_Server_Handler handler,
+				    void *data,
+				    Http_Server_Request *r);
+// - continue the suspended handlers, whose wait is over. Only these are
+//   looked at
+// - call it once per batch of events, i.e. on IP_ERROR_REPEAT
+HTTPSERVER_DEF u64 httpserver_resume(Http_Server *h, Ip_Sockets *s, u64 off);
+
+HTTPSERVER_DEF Http_Server_Shared *httpserver_shared_alloc(u64 len);
+HTTPSERVER_DEF void httpserver_shared_release(Http_Server_Shared *m);
+
+// - forget the last request, once its response is written
+HTTPSERVER_DEF void httpserver_session_reset(Http_Server_Session *s);
+// - drop every enqueued write, releasing shared messages and files
+HTTPSERVER_DEF void httpserver_session_release(Http_Server_Session *s);
+// - disconnect the client, which is served by 'h->sessions[session_index]'
+HTTPSERVER_DEF void httpserver_session_evict(Http_Server *h,
+					     Ip_Sockets *s,
+					     u64 off,
+					     u64 session_index);
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+typedef enum {
+  HTTPSERVER_BROADCAST_SSE,       // text/event-stream, stays subscribed
+  HTTPSERVER_BROADCAST_LONG_POLL, // one response per subscription
+} Http_Server_Broadcast_Kind;
+
+typedef struct {
+  u64 session_index;
+  u64 generation;
+  Http_Server_Broadcast_Kind kind;
+} Http_Server_Subscriber;
+
+#ifndef HTTPSERVER_BROADCAST_PENDING_MAX
+#  define HTTPSERVER_BROADCAST_PENDING_MAX (256 * 1024)
+#endif // HTTPSERVER_BROADCAST_PENDING_MAX
+
+typedef struct {
+  Http_Server_Subscriber *data;
+  u64 len;
+  u64 cap;
+
+  // sessions with more than 'pending_max' unwritten bytes are evicted
+  u64 pending_max;
+  u64 evicted;
+} Http_Server_Broadcast;
+
+HTTPSERVER_DEF void httpserver_broadcast_open(Http_Server_Broadcast *b, u64 pending_max);
+HTTPSERVER_DEF void httpserver_broadcast_subscribe(Http_Server_Broadcast *b,
+						   Http_Server *h,
+						   u64 session_index,
+						   Http_Server_Broadcast_Kind kind);
+// - serialize 'event'/'data' once and enqueue it into every subscriber
+// - returns the number of sessions, which received the message
+// - if the message can not be allocated, it stops early and the
+//   remaining subscribers keep waiting. Nobody received it, if 0 is returned
+HTTPSERVER_DEF u64 httpserver_broadcast_publish(Http_Server_Broadcast *b,
+						Http_Server *h,
+						Ip_Sockets *s,
+						u64 off,
+						str event,
+						str data);
+HTTPSERVER_DEF void httpserver_broadcast_close(Http_Server_Broadcast *b);
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 
 HTTPSERVER_DEF int httpserver_is_authenticated(Http_Server_Session *s,
@@ -179,6 +410,48 @@ HTTPSERVER_DEF int httpserver_is_authenticated(Http_Server_Session *s,
 					       str password,
 					       str_builder *sb);
 
+///////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HTTPSERVER_WEBSOCKET_MESSAGE_MAX
+#  define HTTPSERVER_WEBSOCKET_MESSAGE_MAX (16 * 1024 * 1024)
+#endif // HTTPSERVER_WEBSOCKET_MESSAGE_MAX
+
+// Bytes, that are read but not processed yet. A client, that sends more
+// while its messages wait for the handler or the write-queue, is disconnected
+#ifndef HTTPSERVER_WEBSOCKET_INPUT_MAX
+#  define HTTPSERVER_WEBSOCKET_INPUT_MAX (1024 * 1024)
+#endif // HTTPSERVER_WEBSOCKET_INPUT_MAX
+
+// - answer the handshake of 'r' and turn the session into a websocket
+// - on failure '400 Bad Request' is enqueued and 0 is returned
+HTTPSERVER_DEF int httpserver_websocket_upgrade(Http_Server_Session *s,
+						Http_Server_Request *r);
+// - serialize one frame, which can be enqueued into many sessions
+HTTPSERVER_DEF Http_Server_Shared *httpserver_websocket_shared(Ws_Opcode opcode, str payload);
+HTTPSERVER_DEF int httpserver_websocket_send(Http_Server_Session *s, Ws_Opcode opcode, str payload);
+HTTPSERVER_DEF void httpserver_websocket_close(Http_Server_Session *s, u16 code);
+HTTPSERVER_DEF int httpserver_websocket_next(Http_Server *h,
+					     Ip_Sockets *s,
+					     u64 off,
+					     u64 index,
+					     int do_read,
+					     Http_Server_Request *r);
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+// - turn the session into HTTP/2. 'response' is written before the SETTINGS
+HTTPSERVER_DEF int httpserver_http2_start(Http_Server_Session *s, str response);
+// - answer 'Upgrade: h2c' of 'r'. 'r' becomes stream 1
+HTTPSERVER_DEF int httpserver_http2_upgrade(Http_Server_Session *s, Http_Server_Request *r);
+HTTPSERVER_DEF int httpserver_http2_next(Http_Server *h,
+					 Ip_Sockets *s,
+					 u64 off,
+					 u64 index,
+					 int do_read,
+					 Http_Server_Request *r);
+// - drop the writes of 'stream' and make it free
+HTTPSERVER_DEF void httpserver_http2_stream_free(Http_Server_Session *s, Http_Server_H2_Stream *stream);
+
 HTTPSERVER_DEF void httpserver_serve_files(Http_Server_Session *s,
 					   str dir,
 					   Http_Server_Request *r,
@@ -191,6 +464,15 @@ HTTPSERVER_DEF void httpserver_serve_files_head(Http_Server_Session *s,
 						str dir,
 						Http_Server_Request *r,
 						str_builder *sb);
+// - like 'httpserver_serve_files'. A path that ends with '/' is answered with
+//   its 'index.html' or, if there is none, with a listing from 'listings'
+HTTPSERVER_DEF void httpserver_serve_files_indexed(Http_Server_Session *s,
+						   Fs_Listing_Cache *listings,
+						   str dir,
+						   Http_Server_Request *r,
+						   str_builder *sb);
+HTTPSERVER_DEF void httpserver_append_html_escaped(str_builder *sb, str s);
+HTTPSERVER_DEF void httpserver_append_url_escaped(str_builder *sb, str s);
 HTTPSERVER_DEF int httpserver_open_file(Http_Server_Session *s,
 					str path,
 					Fs_File *file);
@@ -235,10 +517,27 @@ HTTPSERVER_DEF int httpserver_open(Http_Server *h, u64 number_of_clients) {
   if(!h->sessions) {
     return 0;
   }
+  if(!co_sched_open(&h->sched, number_of_clients)) {
+    HTTPSERVER_FREE(h->sessions);
+    return 0;
+  }
   for(u64 i=0;i<number_of_clients;i++) {
     h->sessions[i].sb = (str_builder) {0};
+    h->sessions[i].queue_pos = 0;
+    h->sessions[i].queue_len = 0;
+    h->sessions[i].generation = 0;
+    h->sessions[i].pending = 0;
+    h->sessions[i].message = (str_builder) {0};
+    h->sessions[i].input = (str_builder) {0};
+    h->sessions[i].h2 = NULL;
+    h->sessions[i].handler = NULL;
+    h->sessions[i].sockets = NULL;
+    h->sessions[i].files = &h->files;
+    h->sessions[i].sched = &h->sched;
   }
   h->number_of_clients = number_of_clients;
+  memset(&h->listings, 0, sizeof(h->listings));
+  h->files = (Fs_File_Cache) {0};
 
   return 1;
 }
@@ -267,7 +566,7 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
   /*
   int found = 0;
   for(u64 i=0;i<len - 1;i++) {
-    Ip_Socket *socket = &_s->sockets[off + i];
+    Ip_Socket *socket = ip_sockets_get(_s, off + i);
     if(!(socket->flags & IP_VALID)) {
       continue;
     }
@@ -294,13 +593,13 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
     return 0;
   }
 
-  Ip_Socket *socket = &_s->sockets[index];
+  Ip_Socket *socket = ip_sockets_get(_s, index);
   if(socket->flags & IP_SERVER) {
 
     int found = 0;
     u64 client_index = 0;
     while(!found && client_index<len) {
-      Ip_Socket *socket = &_s->sockets[off + client_index];
+      Ip_Socket *socket = ip_sockets_get(_s, off + client_index);
       if(socket->flags & IP_VALID) {
 	client_index++;
       } else {
@@ -312,14 +611,25 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
     }
 
     Ip_Address address;
-    if(ip_socket_accept(socket, 
-			&_s->sockets[off + client_index],
-			&address) != IP_ERROR_NONE) {
-      TODO();	
+    switch(ip_socket_accept(socket,
+			    ip_sockets_get(_s, off + client_index),
+			    &address)) {
+    case IP_ERROR_NONE:
+      break;
+    case IP_ERROR_LIMIT:
+      // The client waits in the backlog, until a descriptor is free
+      fs_file_cache_trim(&h->files);
+      return 0;
+    case IP_ERROR_REPEAT:
+      return 0;
+    default:
+      TODO();
     }
     ip_sockets_register(_s, off + client_index);
 
     Http_Server_Session *s = &h->sessions[client_index];
+    s->sockets = _s;
+    s->socket_index = off + client_index;
     s->http = http_default();
     s->sb.len = 0;
     s->path_len = 0;
@@ -329,6 +639,14 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
 
     s->started_to_write = 0;
     s->inactive_cycles = 0;
+    s->generation++;
+    s->pending = 0;
+    s->websocket = 0;
+    s->closing = 0;
+    s->input.len = 0;
+    s->input_pos = 0;
+    s->http2 = 0;
+    s->preface_len = 0;
     return 0;
 
   } else { // socket->flags & IP_CLIENT
@@ -338,36 +656,108 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
 
     switch(mode) {
     case IP_MODE_READ: {
-      int keep_reading = s->queue_len == 0; // TODO: this may not work on linux with 'epfd'
+      if(s->websocket) {
+	return httpserver_websocket_next(h, _s, off, index, 1, r);
+      }
+      if(s->http2) {
+	return httpserver_http2_next(h, _s, off, index, 1, r);
+      }
+
+      int keep_reading = s->queue_len == 0 && !s->handler; // TODO: this may not work on linux with 'epfd'
       while(keep_reading) {
 
 	u64 read;
-	switch(ip_socket_read(socket, h->ip_buf, sizeof(h->ip_buf), &read)) {
-	case IP_ERROR_NONE:
-	  break;
-	case IP_ERROR_REPEAT:
-	  keep_reading = 0;
-	  break;
-	case IP_ERROR_CONNECTION_CLOSED:
-	case IP_ERROR_CONNECTION_ABORTED:
-	  *socket = ip_socket_invalid();
-	  _s->ret = 1;
-	  keep_reading = 0;
-	  return 0;
-	default:
-	  TODO();
-	  break;
+
+	// The start of the preface, that was read, comes first
+	u64 held = s->preface_len;
+	memcpy(h->ip_buf, HTTP2_PREFACE, held);
+	s->preface_len = 0;
+
+	// Pipelined requests, that followed the previous one
+	int from_input = s->input_pos < s->input.len;
+	if(from_input) {
+	  read = s->input.len - s->input_pos;
+	  if(read > sizeof(h->ip_buf) - held) read = sizeof(h->ip_buf) - held;
+	  memcpy(h->ip_buf + held, s->input.data + s->input_pos, read);
+	  s->input_pos += read;
+	} else {
+	  switch(ip_socket_read(socket, h->ip_buf + held, sizeof(h->ip_buf) - held, &read)) {
+	  case IP_ERROR_NONE:
+	    break;
+	  case IP_ERROR_REPEAT:
+	    keep_reading = 0;
+	    break;
+	  case IP_ERROR_CONNECTION_CLOSED:
+	  case IP_ERROR_CONNECTION_ABORTED:
+	    *socket = ip_socket_invalid();
+	    _s->ret = 1;
+	    keep_reading = 0;
+	    return 0;
+	  default:
+	    TODO();
+	    break;
+	  }
 	}
 
+	read += held;
 	if(!keep_reading) {
+	  s->preface_len = held;
 	  break;
 	}
+
+	// HTTP/2 with prior knowledge. Until the preface is complete or
+	// differs, it may still be a request like 'PRIVATE / HTTP/1.1'
+	if(s->sb.len == 0 &&
+	   s->http.state == HTTP_REQUEST_STATE_IDLE &&
+	   read > 0 &&
+	   memcmp(h->ip_buf, HTTP2_PREFACE, read < HTTP2_PREFACE_LEN ? read : HTTP2_PREFACE_LEN) == 0) {
+	  if(read < HTTP2_PREFACE_LEN) {
+	    s->preface_len = read;
+	    continue;
+	  }
+	  if(!httpserver_http2_start(s, str_null)) {
+	    // Out of memory, there is no connection-state to send a GOAWAY with
+	    httpserver_session_evict(h, _s, off, index - off);
+	    return 0;
+	  }
+	  str_builder_append(&s->input, h->ip_buf, read);
+	  return httpserver_http2_next(h, _s, off, index, 0, r);
+	}
+
 	int bad_request = 0;
 
 	u8 *buf = h->ip_buf;
 	u64 buf_len = read;
 
-	while(!bad_request && buf_len > 0) {
+	// Fast path: the whole head is in this read
+	if(s->sb.len == 0 &&
+	   s->http.state == HTTP_REQUEST_STATE_IDLE &&
+	   s->http.method == HTTP_METHOD_NONE) {
+	  Http_Header headers[HTTPSERVER_HEAD_HEADERS_CAP];
+	  u64 headers_len = HTTPSERVER_HEAD_HEADERS_CAP;
+	  s64 head_len = http_parse_head(&s->http, buf, buf_len, headers, &headers_len);
+	  if(head_len < 0) {
+	    bad_request = 1;
+	  } else if(head_len > 0) {
+	    str_builder_append(&s->sb, s->http.body_data, s->http.body_len);
+	    s->path_len = s->sb.len;
+	    for(u64 i=0;i<headers_len;i++) {
+	      Http_Header *header = &headers[i];
+	      str_builder_append(&s->sb, HTTPSERVER_HEADERS_PAIR_DELIM, 1);
+	      str_builder_append(&s->sb, header->name, header->name_len);
+	      str_builder_append(&s->sb, HTTPSERVER_HEADERS_KEY_VALUE_DELIM, 1);
+	      str_builder_append(&s->sb, header->value, header->value_len);
+	    }
+	    s->_header = s->sb.len;
+	    s->_value = s->sb.len;
+	    s->_body = s->sb.len;
+
+	    buf += head_len;
+	    buf_len -= (u64) head_len;
+	  }
+	}
+
+	while(!bad_request && !(s->http.flags & HTTP_DONE) && buf_len > 0) {
 	  switch(http_process(&s->http, &buf, &buf_len)) {
 	  case HTTP_EVENT_ERROR: {
 	    bad_request = 1;
@@ -425,6 +815,22 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
 	}
 	keep_reading = 0;
 
+	// Keep what follows the request, it is processed once the response is written
+	if(bad_request) {
+	  s->input.len = 0;
+	  s->input_pos = 0;
+	} else if(from_input) {
+	  s->input_pos -= buf_len;
+	} else if(buf_len > 0) {
+	  s->input.len = 0;
+	  s->input_pos = 0;
+	  str_builder_append(&s->input, buf, buf_len);
+	}
+	if(s->input_pos == s->input.len) {
+	  s->input.len = 0;
+	  s->input_pos = 0;
+	}
+
 	// sb.data: '%path%%body%'
 	//                 ^
 	//                 start
@@ -433,9 +839,14 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
 	str_chop_by(&r->params, "?", &r->path);
 	r->body = str_from(s->sb.data + s->_body, s->sb.len - s->_body);
 	r->headers = str_from(s->sb.data, s->_body);
+	r->websocket = 0;
 
 	printf("HTTP [%llu/%llu] '"str_fmt"'\n", (index -  off), h->number_of_clients, str_arg(r->path));
 
+	if(!bad_request && httpserver_http2_upgrade(s, r)) {
+	  socket->flags |= IP_WRITING;
+	}
+
 	s->len = s->sb.cap;
 	return 1;
       }
@@ -444,7 +855,18 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
 
     case IP_MODE_WRITE: {
 
+      if(s->http2) {
+	return httpserver_http2_next(h, _s, off, index, 0, r);
+      }
+
       if(s->queue_len == 0) {
+	if(s->websocket) {
+	  return httpserver_websocket_next(h, _s, off, index, 0, r);
+	}
+	if(s->input_pos < s->input.len) {
+	  socket->flags &= ~IP_WRITING;
+	  return httpserver_next(h, _s, off, len, IP_ERROR_NONE, index, IP_MODE_READ, r);
+	}
 	UNREACHABLE();
       }
 
@@ -471,16 +893,59 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
 	      keep_writing = 0;
 	      break;
 	    default:
-	      TODO();
+	      keep_writing = 0;
+	      disconnected = 1;
 	      break;
 	    }
 	  }
 
+	  if(disconnected) {
+	    httpserver_session_evict(h, _s, off, index - off);
+	    break;
+	  }
+
 	  if(fixed->off == fixed->message.len) {
 	    s->queue_pos = (s->queue_pos + 1) % HTTPSERVER_WRITE_CAP;
 	    s->queue_len--;
 	  }
 
+	} break;
+	case HTTPSERVER_WRITE_KIND_SHARED: {
+	  Http_Server_Write_Shared *shared = &w->as.shared;
+	  Http_Server_Shared *m = shared->shared;
+
+	  if(shared->off < m->len) {
+
+	    u64 written;
+	    switch(ip_socket_write(socket,
+				   m->data + shared->off,
+				   m->len - shared->off,
+				   &written)) {
+	    case IP_ERROR_NONE:
+	      shared->off += written;
+	      s->pending -= written;
+	      break;
+	    case IP_ERROR_REPEAT:
+	      keep_writing = 0;
+	      break;
+	    default:
+	      keep_writing = 0;
+	      disconnected = 1;
+	      break;
+	    }
+	  }
+
+	  if(disconnected) {
+	    httpserver_session_evict(h, _s, off, index - off);
+	    break;
+	  }
+
+	  if(shared->off == m->len) {
+	    httpserver_shared_release(m);
+	    s->queue_pos = (s->queue_pos + 1) % HTTPSERVER_WRITE_CAP;
+	    s->queue_len--;
+	  }
+
 	} break;
 	case HTTPSERVER_WRITE_KIND_FILE: {
 
@@ -501,23 +966,27 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
 	     s->len < (s->sb.cap - s->off)) {
 
 	    u64 read;
-	    switch(fs_file_read(file,
-				s->sb.data + s->off + s->len,
-				s->sb.cap - s->off - s->len,
-				&read)) {
+	    switch(fs_file_pread(file,
+				 file->pos,
+				 s->sb.data + s->off + s->len,
+				 s->sb.cap - s->off - s->len,
+				 &read)) {
 	    case FS_ERROR_NONE:
-	      break;
 	    case FS_ERROR_EOF:
+	      file->pos += read;
+	      s->len += read;
 	      break;
 	    default:
-	      TODO();
-	      /* disconnected = 1; */
-	      /* keep_writing = 0; */
-	      /* s->queue_len = 0; */
-	      /* fs_file_close(file); */
+	      // The head is out already, only closing tells the peer
+	      keep_writing = 0;
+	      disconnected = 1;
 	      break;
 	    }
-	    s->len += read;
+	  }
+
+	  if(disconnected) {
+	    httpserver_session_evict(h, _s, off, index - off);
+	    break;
 	  }
 
 	  if(!keep_writing) {
@@ -620,16 +1089,17 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
 	    }
 
 	    u64 read;
-	    switch(fs_file_read(file,
-				s->sb.data + s->off + s->len,
-				to_read,
-				&read)) {
-	    case FS_ERROR_NONE:
-	    case FS_ERROR_EOF:
+	    Fs_Error _error = fs_file_pread(file,
+					    file->pos,
+					    s->sb.data + s->off + s->len,
+					    to_read,
+					    &read);
+	    if((_error != FS_ERROR_NONE && _error != FS_ERROR_EOF) || read == 0) {
+	      // Failed or truncated, the chunk can not be completed
+	      disconnected = 1;
 	      break;
-	    default:
-	      TODO();
 	    }
+	    file->pos += read;
 	    s->len += read;
 	    chunked->to_write -= read;
 
@@ -659,6 +1129,11 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
 
 	  }
 
+	  if(disconnected) {
+	    httpserver_session_evict(h, _s, off, index - off);
+	    break;
+	  }
+
 	  if(s->len > 0) {
 	    u64 written;
 	    switch(ip_socket_write(socket,
@@ -705,15 +1180,23 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
       }
 
       if(s->queue_len == 0) {
-	s->http = http_default();
-	s->sb.len = 0;
-	s->path_len = 0;
-	s->_header = 0;
-	s->_value = 0;
-	s->_body = 0;
-
-	s->started_to_write = 0;
 	socket->flags &= ~IP_WRITING;
+	if(s->handler) {
+	  // The rest of the response is not enqueued yet
+	  return 0;
+	}
+	httpserver_session_reset(s);
+
+	if(s->closing) {
+	  httpserver_session_evict(h, _s, off, index - off);
+	  return 0;
+	}
+	if(s->websocket && s->input_pos < s->input.len) {
+	  return httpserver_websocket_next(h, _s, off, index, 0, r);
+	}
+	if(!s->http2 && s->input_pos < s->input.len) {
+	  return httpserver_next(h, _s, off, len, IP_ERROR_NONE, index, IP_MODE_READ, r);
+	}
       }
 
       if(disconnected) {
@@ -723,8 +1206,8 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
     } break;
 
     case IP_MODE_DISCONNECT: {
-      *socket = ip_socket_invalid();
-      _s->ret = -1;
+      // The socket has to leave epoll, otherwise the hangup is reported forever
+      httpserver_session_evict(h, _s, off, index - off);
     } break;
 
     default:
@@ -737,94 +1220,1670 @@ HTTPSERVER_DEF int httpserver_next(Http_Server *h,
   return 0;
 }
 
-HTTPSERVER_DEF void httpserver_close(Http_Server *h) {
-  for(u64 i=0;i<h->number_of_clients;i++) {
-    STR_FREE(h->sessions[i].sb.data);
+// - closes the file or releases the shared message of 'w'
+HTTPSERVER_DEF void httpserver_write_release(Http_Server_Session *s, Http_Server_Write *w) {
+  switch(w->kind) {
+  case HTTPSERVER_WRITE_KIND_FIXED:
+    break;
+  case HTTPSERVER_WRITE_KIND_SHARED:
+    s->pending -= w->as.shared.shared->len - w->as.shared.off;
+    httpserver_shared_release(w->as.shared.shared);
+    break;
+  case HTTPSERVER_WRITE_KIND_FILE:
+    fs_file_close(&w->as.file);
+    break;
+  case HTTPSERVER_WRITE_KIND_FILE_CHUNKED:
+    fs_file_close(&w->as.chunked.file);
+    break;
+  default:
+    UNREACHABLE();
   }
-  HTTPSERVER_FREE(h->sessions);
 }
 
-HTTPSERVER_DEF int httpserver_is_authenticated(Http_Server_Session *s,
-					       Http_Server_Request *r,
-					       str username,
-					       str password,
-					       str_builder *sb) {
-  int authenticated;
-  str authorization;
-  if(httpserver_headers_findc(r->headers, "Authorization", &authorization)) {
-
-    if(!str_chop_by(&authorization, " ", NULL)) {
-      authenticated = 0;
-    } else {
-      u64 len = base64_decode(sb->data,
-			      sb->cap,
-			      authorization.data, authorization.len);
-      if(sb->cap < len) {
-	str_builder_reserve(sb, len);
-	base64_decode(sb->data + sb->len,
-		      sb->cap - sb->len,
-		      authorization.data, authorization.len);
-      }
-
-      str password = str_from(sb->data, len);
-      str username;
-      if(str_chop_by(&password, ":", &username)) {
-	authenticated =
-	  str_eqc(username, "admin") &&
-	  str_eqc(password, "nimda");
-      } else {
-	authenticated = 0;
-      }
-
+HTTPSERVER_DEF int httpserver_session_enqueue(Http_Server_Session *s, Http_Server_Write w) {
+  if(s->queue_len >= HTTPSERVER_WRITE_CAP) {
+    // The response can not be completed, the client gets what is enqueued
+    switch(w.kind) {
+    case HTTPSERVER_WRITE_KIND_FILE:
+      fs_file_close(&w.as.file);
+      break;
+    case HTTPSERVER_WRITE_KIND_FILE_CHUNKED:
+      fs_file_close(&w.as.chunked.file);
+      break;
+    default:
+      break;
     }
+    s->closing = 1;
+    return 0;
+  }
 
-  } else {
-    authenticated = 0;
+  s->queue[(s->queue_pos + s->queue_len++) % HTTPSERVER_WRITE_CAP] = w;
+  if(s->sockets) {
+    Ip_Socket *socket = ip_sockets_get(s->sockets, s->socket_index);
+    if(socket->flags & IP_VALID) socket->flags |= IP_WRITING;
   }
+  return 1;
+}
 
-  if(!authenticated) {
-    if(r->method == HTTP_METHOD_HEAD) {
-      httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 401 Unauthorized\r\n"
-					    "WWW-Authenticate: Basic realm=\"User Visible Realm\"\r\n"
-					    "\r\n"));
-    } else {
-      httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 401 Unauthorized\r\n"
-					    "WWW-Authenticate: Basic realm=\"User Visible Realm\"\r\n"
-					    "Content-Type: text/plain\r\n"
-					    "Content-Length: 12\r\n"
-					    "\r\n"
-					    "Unauthorized"));
+HTTPSERVER_DEF int httpserver_enqueue_shared(Http_Server_Session *s, Http_Server_Shared *m) {
+  // A full queue that ends in a shared message, coalesces 'm' into it.
+  // So a burst of small messages is bounded by 'pending', not by the
+  // number of writes.
+  if(s->queue_len >= HTTPSERVER_WRITE_CAP) {
+    Http_Server_Write *w = &s->queue[(s->queue_pos + s->queue_len - 1) % HTTPSERVER_WRITE_CAP];
+    if(w->kind == HTTPSERVER_WRITE_KIND_SHARED) {
+      Http_Server_Shared *last = w->as.shared.shared;
+      u64 last_len = last->len - w->as.shared.off;
+      Http_Server_Shared *merged = httpserver_shared_alloc(last_len + m->len);
+      if(!merged) {
+	return 0;
+      }
+      memcpy(merged->data, last->data + w->as.shared.off, last_len);
+      memcpy(merged->data + last_len, m->data, m->len);
+      merged->refs = 1;
+      httpserver_shared_release(last);
+      w->as.shared = (Http_Server_Write_Shared) { .shared = merged, .off = 0, };
+      s->pending += m->len;
+      return 1;
     }
-    return 0 ;
   }
 
+  if(!httpserver_session_enqueue(s, (Http_Server_Write) {
+	.kind = HTTPSERVER_WRITE_KIND_SHARED,
+	.as.shared = (Http_Server_Write_Shared) { .shared = m, .off = 0, } })) {
+    return 0;
+  }
+  m->refs++;
+  s->pending += m->len;
   return 1;
 }
 
-HTTPSERVER_DEF void httpserver_serve_files(Http_Server_Session *s,
-					   str dir,
-					   Http_Server_Request *r,
-					   str_builder *sb) {
+HTTPSERVER_DEF void httpserver_session_reset(Http_Server_Session *s) {
+  s->http = http_default();
+  s->sb.len = 0;
+  s->path_len = 0;
+  s->_header = 0;
+  s->_value = 0;
+  s->_body = 0;
 
-  switch(r->method) {
-  case HTTP_METHOD_GET:
-    httpserver_serve_files_get(s, dir, r, sb);
-    break;
-  case HTTP_METHOD_HEAD:
-    httpserver_serve_files_head(s, dir, r, sb);
-    break;
-  default:
-    httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 501 Not Implemented\r\n"
-					  "Content-Type: text/plain\r\n"
-					  "Content-Length: 15\r\n"
-					  "\r\n"
-					  "Not Implemented"));
-    break;
+  s->started_to_write = 0;
+}
+
+HTTPSERVER_DEF int httpserver_spawn(Http_Server_Session *s,
+				    Http_Server_Handler handler,
+				    void *data,
+				    Http_Server_Request *r) {
+  s->co = co_default();
+  s->request = *r;
+  if(handler(&s->co, s, &s->request, data) == CO_DONE) {
+    return 1;
   }
 
+  s->handler = handler;
+  s->handler_data = data;
+  co_sched_wait(s->sched, &s->co);
+  return 0;
 }
 
-HTTPSERVER_DEF void httpserver_serve_files_get(Http_Server_Session *s,
+HTTPSERVER_DEF u64 httpserver_resume(Http_Server *h, Ip_Sockets *_s, u64 off) {
+  co_sched_poll(&h->sched);
+
+  // The ones, that suspend again without waiting, continue with the next batch
+  u64 resumed = 0;
+  u64 n = h->sched.ready_len;
+  for(;resumed<n;resumed++) {
+    Co *co = co_sched_next(&h->sched);
+    Http_Server_Session *s = (Http_Server_Session *) ((u8 *) co - offsetof(Http_Server_Session, co));
+
+    Ip_Socket *socket = ip_sockets_get(_s, off + (u64) (s - h->sessions));
+    if(s->handler(&s->co, s, &s->request, s->handler_data) != CO_DONE) {
+      co_sched_wait(&h->sched, &s->co);
+    } else {
+      s->handler = NULL;
+
+      if(s->http2) {
+	// The stream is finished by the writer
+	socket->flags |= IP_WRITING;
+      } else if(s->websocket) {
+	if(s->input_pos < s->input.len) socket->flags |= IP_WRITING;
+      } else if(s->queue_len == 0) {
+	httpserver_session_reset(s);
+	if(s->input_pos < s->input.len) socket->flags |= IP_WRITING;
+      }
+    }
+
+    if(s->queue_len > 0) {
+      socket->flags |= IP_WRITING;
+    }
+  }
+
+  return resumed;
+}
+
+HTTPSERVER_DEF void httpserver_close(Http_Server *h) {
+  for(u64 i=0;i<h->number_of_clients;i++) {
+    if(h->sessions[i].sb.cap) STR_FREE(h->sessions[i].sb.data);
+    if(h->sessions[i].message.cap) STR_FREE(h->sessions[i].message.data);
+    if(h->sessions[i].input.cap) STR_FREE(h->sessions[i].input.data);
+
+    Http_Server_H2 *h2 = h->sessions[i].h2;
+    if(h2) {
+      for(u64 j=0;j<HTTPSERVER_H2_STREAMS_CAP;j++) {
+	Http_Server_H2_Stream *stream = &h2->streams[j];
+	if(stream->sb.cap) STR_FREE(stream->sb.data);
+	if(stream->response.cap) STR_FREE(stream->response.data);
+	if(stream->head.cap) STR_FREE(stream->head.data);
+      }
+      if(h2->block.cap) STR_FREE(h2->block.data);
+      if(h2->scratch.cap) STR_FREE(h2->scratch.data);
+      if(h2->out.cap) STR_FREE(h2->out.data);
+      http2_hpack_free(&h2->hpack);
+      HTTPSERVER_FREE(h2);
+    }
+  }
+  HTTPSERVER_FREE(h->sessions);
+  fs_listing_cache_free(&h->listings);
+  fs_file_cache_free(&h->files);
+  co_sched_close(&h->sched);
+}
+
+HTTPSERVER_DEF Http_Server_Shared *httpserver_shared_alloc(u64 len) {
+  Http_Server_Shared *m = HTTPSERVER_ALLOC(sizeof(*m) + len);
+  if(!m) {
+    return NULL;
+  }
+  m->refs = 0;
+  m->len = len;
+  return m;
+}
+
+HTTPSERVER_DEF void httpserver_shared_release(Http_Server_Shared *m) {
+  if(m->refs <= 1) {
+    HTTPSERVER_FREE(m);
+  } else {
+    m->refs--;
+  }
+}
+
+HTTPSERVER_DEF void httpserver_session_release(Http_Server_Session *s) {
+  if(s->handler) {
+    // Last chance for the handler, to clean up
+    co_sched_cancel(s->sched, &s->co);
+    s->co.cancelled = 1;
+    s->handler(&s->co, s, &s->request, s->handler_data);
+    s->handler = NULL;
+  }
+
+  while(s->queue_len > 0) {
+    httpserver_write_release(s, &s->queue[s->queue_pos]);
+    s->queue_pos = (s->queue_pos + 1) % HTTPSERVER_WRITE_CAP;
+    s->queue_len--;
+  }
+
+  if(s->http2 && s->h2) {
+    for(u64 i=0;i<HTTPSERVER_H2_STREAMS_CAP;i++) {
+      httpserver_http2_stream_free(s, &s->h2->streams[i]);
+    }
+    s->h2->current = NULL;
+  }
+
+  s->pending = 0;
+}
+
+HTTPSERVER_DEF void httpserver_session_evict(Http_Server *h,
+					     Ip_Sockets *_s,
+					     u64 off,
+					     u64 session_index) {
+  Http_Server_Session *s = &h->sessions[session_index];
+  httpserver_session_release(s);
+  s->generation++;
+
+  Ip_Socket *socket = ip_sockets_get(_s, off + session_index);
+  if(socket->flags & IP_VALID) {
+    ip_sockets_unregister(_s, off + session_index);
+    ip_socket_close(socket);
+    *socket = ip_socket_invalid();
+    _s->ret = -1;
+  }
+}
+
+HTTPSERVER_DEF void httpserver_broadcast_open(Http_Server_Broadcast *b, u64 pending_max) {
+  b->data = NULL;
+  b->len = 0;
+  b->cap = 0;
+  b->pending_max = pending_max;
+  b->evicted = 0;
+}
+
+HTTPSERVER_DEF void httpserver_broadcast_subscribe(Http_Server_Broadcast *b,
+						   Http_Server *h,
+						   u64 session_index,
+						   Http_Server_Broadcast_Kind kind) {
+  Http_Server_Session *s = &h->sessions[session_index];
+
+  if(kind == HTTPSERVER_BROADCAST_SSE) {
+    httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 200 OK\r\n"
+					  "Content-Type: text/event-stream\r\n"
+					  "Cache-Control: no-cache\r\n"
+					  "Connection: keep-alive\r\n"
+					  "\r\n"));
+  }
+
+  Http_Server_Subscriber subscriber = {
+    .session_index = session_index,
+    .generation = s->generation,
+    .kind = kind,
+  };
+  da_append(b, subscriber);
+}
+
+HTTPSERVER_DEF u64 httpserver_broadcast_publish(Http_Server_Broadcast *b,
+						Http_Server *h,
+						Ip_Sockets *_s,
+						u64 off,
+						str event,
+						str data) {
+
+  // Both representations are built lazily, at most once per publish:
+  //
+  //   sse:       'event: %event%\ndata: %line%\n...\n'
+  //   long-poll: 'HTTP/1.1 200 OK\r\n...\r\n%data%'
+  Http_Server_Shared *messages[2] = { NULL, NULL };
+
+  u64 delivered = 0;
+  u64 j = 0;
+  for(u64 i=0;i<b->len;i++) {
+    Http_Server_Subscriber subscriber = b->data[i];
+    Http_Server_Session *s = &h->sessions[subscriber.session_index];
+    Ip_Socket *socket = ip_sockets_get(_s, off + subscriber.session_index);
+
+    if(s->generation != subscriber.generation ||
+       !(socket->flags & IP_VALID)) {
+      // The client left or the slot was reused
+      continue;
+    }
+
+    Http_Server_Shared **m = &messages[subscriber.kind];
+    if(!(*m)) {
+
+      u64 len;
+      if(subscriber.kind == HTTPSERVER_BROADCAST_SSE) {
+	len = event.len + 8 + 1;
+	str lines = data;
+	str line;
+	do {
+	  line = str_null;
+	  str_chop_by(&lines, "\n", &line);
+	  len += 6 + line.len + 1;
+	} while(lines.len > 0);
+
+      } else {
+	len = 128 + data.len;
+      }
+
+      *m = httpserver_shared_alloc(len);
+      if(!(*m)) {
+	// Everyone, that is not reached yet, stays subscribed
+	for(;i<b->len;i++) {
+	  b->data[j++] = b->data[i];
+	}
+	break;
+      }
+
+      u8 *p = (*m)->data;
+      if(subscriber.kind == HTTPSERVER_BROADCAST_SSE) {
+	if(event.len > 0) {
+	  memcpy(p, "event: ", 7); p += 7;
+	  memcpy(p, event.data, event.len); p += event.len;
+	  *p++ = '\n';
+	}
+	str lines = data;
+	str line;
+	do {
+	  line = str_null;
+	  str_chop_by(&lines, "\n", &line);
+	  memcpy(p, "data: ", 6); p += 6;
+	  memcpy(p, line.data, line.len); p += line.len;
+	  *p++ = '\n';
+	} while(lines.len > 0);
+	*p++ = '\n';
+
+      } else {
+	p += snprintf((char *) p, 128,
+		      "HTTP/1.1 200 OK\r\n"
+		      "Content-Type: text/plain\r\n"
+		      "Cache-Control: no-cache\r\n"
+		      "Content-Length: %llu\r\n"
+		      "\r\n",
+		      data.len);
+	memcpy(p, data.data, data.len); p += data.len;
+      }
+      (*m)->len = (u64) (p - (*m)->data);
+    }
+
+    // Backpressure: a subscriber that can not keep up, is disconnected
+    // instead of buffering an unbounded amount of messages for it.
+    if(s->pending + (*m)->len > b->pending_max ||
+       !httpserver_enqueue_shared(s, *m)) {
+      httpserver_session_evict(h, _s, off, subscriber.session_index);
+      b->evicted++;
+      continue;
+    }
+    delivered++;
+
+    if(subscriber.kind == HTTPSERVER_BROADCAST_SSE) {
+      b->data[j++] = subscriber;
+    }
+  }
+  b->len = j;
+
+  for(u64 i=0;i<sizeof(messages)/sizeof(messages[0]);i++) {
+    if(messages[i] && messages[i]->refs == 0) {
+      HTTPSERVER_FREE(messages[i]);
+    }
+  }
+
+  return delivered;
+}
+
+HTTPSERVER_DEF void httpserver_broadcast_close(Http_Server_Broadcast *b) {
+  if(b->data) {
+    HTTPSERVER_FREE(b->data);
+  }
+  b->len = 0;
+  b->cap = 0;
+}
+
+HTTPSERVER_DEF int httpserver_websocket_upgrade(Http_Server_Session *s,
+						Http_Server_Request *r) {
+  str upgrade, key, version;
+  if(r->method != HTTP_METHOD_GET ||
+     !httpserver_headers_findc(r->headers, "Upgrade", &upgrade) ||
+     !str_eq_ignorecasec(upgrade, "websocket") ||
+     !httpserver_headers_findc(r->headers, "Sec-WebSocket-Key", &key) ||
+     !httpserver_headers_findc(r->headers, "Sec-WebSocket-Version", &version) ||
+     !str_eqc(version, "13")) {
+    httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 400 Bad Request\r\n"
+					  "Content-Length: 11\r\n"
+					  "Content-Type: text/plain\r\n"
+					  "\r\n"
+					  "Bad Request"));
+    return 0;
+  }
+
+  u8 accept[WS_ACCEPT_LEN];
+  ws_accept(key.data, key.len, accept);
+
+  Va va = va_s(str_from(accept, WS_ACCEPT_LEN));
+  httpserver_enqueue_fixed(s, httpserver_snprintf2_impl(s,
+							"HTTP/1.1 101 Switching Protocols\r\n"
+							"Upgrade: websocket\r\n"
+							"Connection: Upgrade\r\n"
+							"Sec-WebSocket-Accept: %\r\n"
+							"\r\n",
+							&va, 1));
+
+  s->websocket = 1;
+  s->closing = 0;
+  s->ws = ws_default();
+  s->message_opcode = 0;
+  s->message.len = 0;
+  s->input.len = 0;
+  s->input_pos = 0;
+
+  return 1;
+}
+
+HTTPSERVER_DEF Http_Server_Shared *httpserver_websocket_shared(Ws_Opcode opcode, str payload) {
+  u8 header[WS_HEADER_CAP];
+  u64 header_len = ws_frame_header(header, 1, opcode, payload.len);
+
+  Http_Server_Shared *m = httpserver_shared_alloc(header_len + payload.len);
+  if(!m) {
+    return NULL;
+  }
+  memcpy(m->data, header, header_len);
+  memcpy(m->data + header_len, payload.data, payload.len);
+
+  return m;
+}
+
+HTTPSERVER_DEF int httpserver_websocket_send(Http_Server_Session *s, Ws_Opcode opcode, str payload) {
+  Http_Server_Shared *m = httpserver_websocket_shared(opcode, payload);
+  if(!m) {
+    return 0;
+  }
+  if(!httpserver_enqueue_shared(s, m)) {
+    httpserver_shared_release(m);
+    return 0;
+  }
+  return 1;
+}
+
+HTTPSERVER_DEF void httpserver_websocket_close(Http_Server_Session *s, u16 code) {
+  if(s->closing) {
+    return;
+  }
+
+  u8 payload[2] = { (u8) (code >> 8), (u8) (code & 0xff) };
+  httpserver_websocket_send(s, WS_OPCODE_CLOSE, str_from(payload, sizeof(payload)));
+  s->closing = 1;
+}
+
+HTTPSERVER_DEF int httpserver_websocket_next(Http_Server *h,
+					     Ip_Sockets *_s,
+					     u64 off,
+					     u64 index,
+					     int do_read,
+					     Http_Server_Request *r) {
+  Http_Server_Session *s = &h->sessions[index - off];
+  Ip_Socket *socket = ip_sockets_get(_s, index);
+
+  // One read per event, accepted sockets may be blocking. epoll is
+  // level-triggered and reports the socket again, if there is more.
+  if(do_read) {
+    // The processed bytes are dropped, the rest moves to the front
+    if(s->input_pos > 0) {
+      memmove(s->input.data, s->input.data + s->input_pos, s->input.len - s->input_pos);
+      s->input.len -= s->input_pos;
+      s->input_pos = 0;
+    }
+    if(s->input.len >= HTTPSERVER_WEBSOCKET_INPUT_MAX) {
+      httpserver_session_evict(h, _s, off, index - off);
+      return 0;
+    }
+    str_builder_reserve(&s->input, s->input.len + HTTPSERVER_SB_BUFFER_SIZE);
+
+    u64 read;
+    switch(ip_socket_read(socket,
+			  s->input.data + s->input.len,
+			  s->input.cap - s->input.len,
+			  &read)) {
+    case IP_ERROR_NONE:
+      s->input.len += read;
+      break;
+    case IP_ERROR_REPEAT:
+      break;
+    default:
+      httpserver_session_evict(h, _s, off, index - off);
+      return 0;
+    }
+  }
+
+  int result = 0;
+  while(!result && !s->closing && !s->handler) {
+
+    // Leave room for the reply of a control-frame and one of the handler
+    if(s->queue_len + 2 > HTTPSERVER_WRITE_CAP) {
+      break;
+    }
+
+    u8 *data = s->input.data + s->input_pos;
+    u64 len = s->input.len - s->input_pos;
+    Ws_Event event = ws_process(&s->ws, &data, &len);
+    s->input_pos = s->input.len - len;
+
+    Ws *ws = &s->ws;
+    int is_control = ws_opcode_is_control(ws->opcode);
+
+    switch(event) {
+    case WS_EVENT_NOTHING:
+      break;
+
+    case WS_EVENT_ERROR:
+      httpserver_websocket_close(s, WS_CLOSE_PROTOCOL_ERROR);
+      break;
+
+    case WS_EVENT_FRAME: {
+      if(!ws->masked) {
+	httpserver_websocket_close(s, WS_CLOSE_PROTOCOL_ERROR);
+      } else if(is_control) {
+	s->control_len = 0;
+      } else if(ws->opcode == WS_OPCODE_CONTINUATION) {
+	if(s->message_opcode == 0) {
+	  httpserver_websocket_close(s, WS_CLOSE_PROTOCOL_ERROR);
+	}
+      } else {
+	if(s->message_opcode != 0) {
+	  // a new message, while the last one is still fragmented
+	  httpserver_websocket_close(s, WS_CLOSE_PROTOCOL_ERROR);
+	}
+	s->message_opcode = ws->opcode;
+	s->message.len = 0;
+      }
+
+      if(!is_control &&
+	 s->message.len + ws->payload_len > HTTPSERVER_WEBSOCKET_MESSAGE_MAX) {
+	httpserver_websocket_close(s, WS_CLOSE_TOO_BIG);
+      }
+    } break;
+
+    case WS_EVENT_PAYLOAD: {
+      if(is_control) {
+	memcpy(s->control + s->control_len, ws->body_data, ws->body_len);
+	s->control_len += ws->body_len;
+      } else {
+	str_builder_append(&s->message, ws->body_data, ws->body_len);
+      }
+    } break;
+
+    case WS_EVENT_FRAME_END: {
+      switch(ws->opcode) {
+      case WS_OPCODE_PING:
+	httpserver_websocket_send(s, WS_OPCODE_PONG, str_from(s->control, s->control_len));
+	break;
+      case WS_OPCODE_PONG:
+	break;
+      case WS_OPCODE_CLOSE: {
+	u16 code = WS_CLOSE_NORMAL;
+	if(s->control_len >= 2) {
+	  code = (u16) ((s->control[0] << 8) | s->control[1]);
+	}
+	httpserver_websocket_close(s, code);
+      } break;
+      default: {
+	if(!ws->fin) {
+	  break;
+	}
+
+	r->method = HTTP_METHOD_NONE;
+	r->path = str_null;
+	r->params = str_null;
+	r->headers = str_null;
+	r->body = str_from(s->message.data, s->message.len);
+	r->websocket = s->message_opcode;
+	s->message_opcode = 0;
+	result = 1;
+      } break;
+      }
+    } break;
+
+    default:
+      UNREACHABLE();
+    }
+
+    if(event == WS_EVENT_NOTHING) {
+      break;
+    }
+  }
+
+  if(s->closing || s->input_pos == s->input.len) {
+    s->input.len = 0;
+    s->input_pos = 0;
+  }
+
+  // Pending input is picked up in IP_MODE_WRITE, as soon as the queue is empty
+  if(s->queue_len > 0 || (s->input_pos < s->input.len && !s->handler)) {
+    socket->flags |= IP_WRITING;
+  } else {
+    socket->flags &= ~IP_WRITING;
+  }
+
+  return result;
+}
+
+HTTPSERVER_DEF void httpserver_http2_frame(Http_Server_H2 *h2, u8 type, u8 flags, u32 stream, u8 *payload, u64 len) {
+  str_builder_reserve(&h2->out, h2->out.len + HTTP2_FRAME_HEADER_LEN + len);
+  http2_frame_header(h2->out.data + h2->out.len, (u32) len, type, flags, stream);
+  h2->out.len += HTTP2_FRAME_HEADER_LEN;
+  if(len > 0) {
+    memcpy(h2->out.data + h2->out.len, payload, len);
+    h2->out.len += len;
+  }
+}
+
+HTTPSERVER_DEF void httpserver_http2_frame_u32(Http_Server_H2 *h2, u8 type, u32 stream, u32 n) {
+  u8 payload[4];
+  http2_u32_write(payload, n);
+  httpserver_http2_frame(h2, type, 0, stream, payload, sizeof(payload));
+}
+
+HTTPSERVER_DEF void httpserver_http2_goaway(Http_Server_Session *s, u32 code) {
+  Http_Server_H2 *h2 = s->h2;
+
+  u8 payload[8];
+  http2_u32_write(payload, h2->last_stream_id);
+  http2_u32_write(payload + 4, code);
+  httpserver_http2_frame(h2, HTTP2_FRAME_GOAWAY, 0, 0, payload, sizeof(payload));
+
+  httpserver_session_release(s);
+  s->closing = 1;
+}
+
+HTTPSERVER_DEF Http_Server_H2_Stream *httpserver_http2_stream_find(Http_Server_H2 *h2, u32 id) {
+  for(u64 i=0;i<HTTPSERVER_H2_STREAMS_CAP;i++) {
+    Http_Server_H2_Stream *stream = &h2->streams[i];
+    if(stream->state != HTTPSERVER_H2_STREAM_FREE && stream->id == id) {
+      return stream;
+    }
+  }
+  return NULL;
+}
+
+HTTPSERVER_DEF void httpserver_http2_stream_free(Http_Server_Session *s, Http_Server_H2_Stream *stream) {
+  while(stream->queue_len > 0) {
+    httpserver_write_release(s, &stream->queue[stream->queue_pos]);
+    stream->queue_pos = (stream->queue_pos + 1) % HTTPSERVER_WRITE_CAP;
+    stream->queue_len--;
+  }
+  stream->response.len = 0;
+  stream->head.len = 0;
+  stream->head_sent = 0;
+  stream->state = HTTPSERVER_H2_STREAM_FREE;
+}
+
+// - like 'httpserver_http2_stream_free'. The handler of the current stream
+//   may still write, its writes are dropped until it is done
+HTTPSERVER_DEF void httpserver_http2_stream_drop(Http_Server_Session *s, Http_Server_H2_Stream *stream) {
+  httpserver_http2_stream_free(s, stream);
+  if(stream == s->h2->current) {
+    stream->state = HTTPSERVER_H2_STREAM_RESET;
+  }
+}
+
+HTTPSERVER_DEF void httpserver_http2_stream_reset(Http_Server_Session *s, Http_Server_H2_Stream *stream, u32 code) {
+  httpserver_http2_frame_u32(s->h2, HTTP2_FRAME_RST_STREAM, stream->id, code);
+  httpserver_http2_stream_drop(s, stream);
+}
+
+HTTPSERVER_DEF int httpserver_http2_start(Http_Server_Session *s, str response) {
+  if(!s->h2) {
+    s->h2 = HTTPSERVER_ALLOC(sizeof(*s->h2));
+    if(!s->h2) {
+      return 0;
+    }
+    memset(s->h2, 0, sizeof(*s->h2));
+  }
+  Http_Server_H2 *h2 = s->h2;
+
+  // The dynamic table may still hold entries of the last connection
+  http2_hpack_free(&h2->hpack);
+  h2->hpack = http2_hpack_default();
+  for(u64 i=0;i<HTTPSERVER_H2_STREAMS_CAP;i++) {
+    h2->streams[i].state = HTTPSERVER_H2_STREAM_FREE;
+    h2->streams[i].queue_pos = 0;
+    h2->streams[i].queue_len = 0;
+  }
+  h2->last_stream_id = 0;
+  h2->preface = 0;
+  h2->goaway = 0;
+
+  h2->window = HTTP2_INITIAL_WINDOW_SIZE;
+  h2->initial_window = HTTP2_INITIAL_WINDOW_SIZE;
+  h2->max_frame_size = HTTP2_MAX_FRAME_SIZE;
+  h2->recv_window = HTTP2_INITIAL_WINDOW_SIZE;
+
+  h2->block.len = 0;
+  h2->block_stream = 0;
+  h2->current = NULL;
+  h2->next = 0;
+  h2->out.len = 0;
+  h2->out_pos = 0;
+
+  str_builder_append(&h2->out, response.data, response.len);
+
+  u8 settings[12];
+  settings[0] = 0;
+  settings[1] = HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS;
+  http2_u32_write(settings + 2, HTTPSERVER_H2_STREAMS_CAP);
+  settings[6] = 0;
+  settings[7] = HTTP2_SETTINGS_INITIAL_WINDOW_SIZE;
+  http2_u32_write(settings + 8, HTTPSERVER_H2_WINDOW);
+  httpserver_http2_frame(h2, HTTP2_FRAME_SETTINGS, 0, 0, settings, sizeof(settings));
+
+  s->http2 = 1;
+  s->closing = 0;
+  s->input.len = 0;
+  s->input_pos = 0;
+
+  return 1;
+}
+
+HTTPSERVER_DEF u32 httpserver_http2_settings(Http_Server_H2 *h2, u8 *payload, u64 len) {
+  for(u64 i=0;i + 6<=len;i+=6) {
+    u32 id = ((u32) payload[i] << 8) | payload[i + 1];
+    u32 value = http2_u32_read(payload + i + 2);
+
+    switch(id) {
+    case HTTP2_SETTINGS_ENABLE_PUSH:
+      if(value > 1) {
+	return HTTP2_PROTOCOL_ERROR;
+      }
+      break;
+    case HTTP2_SETTINGS_INITIAL_WINDOW_SIZE: {
+      if(value > HTTP2_WINDOW_MAX) {
+	return HTTP2_FLOW_CONTROL_ERROR;
+      }
+      s64 delta = (s64) value - h2->initial_window;
+      for(u64 j=0;j<HTTPSERVER_H2_STREAMS_CAP;j++) {
+	Http_Server_H2_Stream *stream = &h2->streams[j];
+	if(stream->state == HTTPSERVER_H2_STREAM_FREE) {
+	  continue;
+	}
+	stream->window += delta;
+	if(stream->window > HTTP2_WINDOW_MAX) {
+	  return HTTP2_FLOW_CONTROL_ERROR;
+	}
+      }
+      h2->initial_window = value;
+    } break;
+    case HTTP2_SETTINGS_MAX_FRAME_SIZE:
+      if(value < HTTP2_MAX_FRAME_SIZE || value > HTTP2_MAX_FRAME_SIZE_LIMIT) {
+	return HTTP2_PROTOCOL_ERROR;
+      }
+      h2->max_frame_size = value;
+      break;
+    default:
+      // The response-headers are encoded without a dynamic table,
+      // HEADER_TABLE_SIZE does not matter
+      break;
+    }
+  }
+
+  return HTTP2_NO_ERROR;
+}
+
+HTTPSERVER_DEF int httpserver_http2_upgrade(Http_Server_Session *s, Http_Server_Request *r) {
+  str upgrade, settings;
+  if(!httpserver_headers_findc(r->headers, "Upgrade", &upgrade) ||
+     !str_eq_ignorecasec(upgrade, "h2c") ||
+     !httpserver_headers_findc(r->headers, "HTTP2-Settings", &settings) ||
+     r->body.len > 0) {
+    return 0;
+  }
+
+  // HTTP2-Settings: the base64url-encoded payload of a SETTINGS-frame
+  u8 payload[128];
+  u64 payload_len = base64_decode(payload, sizeof(payload), settings.data, settings.len);
+  if(payload_len > sizeof(payload)) {
+    return 0;
+  }
+
+  if(!httpserver_http2_start(s, str_fromd("HTTP/1.1 101 Switching Protocols\r\n"
+					  "Connection: Upgrade\r\n"
+					  "Upgrade: h2c\r\n"
+					  "\r\n"))) {
+    return 0;
+  }
+  Http_Server_H2 *h2 = s->h2;
+  if(httpserver_http2_settings(h2, payload, payload_len) != HTTP2_NO_ERROR) {
+    httpserver_http2_goaway(s, HTTP2_PROTOCOL_ERROR);
+    return 1;
+  }
+
+  // The request is answered on stream 1. It lives in 's->sb', the
+  // stream only tracks the state
+  Http_Server_H2_Stream *stream = &h2->streams[0];
+  stream->id = 1;
+  stream->state = HTTPSERVER_H2_STREAM_RESPONDING;
+  stream->window = h2->initial_window;
+  stream->recv_window = 0;
+  stream->method = r->method;
+  h2->last_stream_id = 1;
+  h2->current = stream;
+
+  return 1;
+}
+
+HTTPSERVER_DEF int httpserver_http2_unpad(Http2_Frame *f, u8 **payload, u64 *len) {
+  if(!(f->flags & HTTP2_FLAG_PADDED)) {
+    return 1;
+  }
+  if(*len == 0) {
+    return 0;
+  }
+  u64 padding = (*payload)[0];
+  if(padding >= *len) {
+    return 0;
+  }
+  *payload += 1;
+  *len -= padding + 1;
+  return 1;
+}
+
+// - decode the header-block of 'h2->block_stream' into its stream
+HTTPSERVER_DEF u32 httpserver_http2_headers(Http_Server_Session *s) {
+  Http_Server_H2 *h2 = s->h2;
+  u32 id = h2->block_stream;
+  u8 flags = h2->block_flags;
+  h2->block_stream = 0;
+
+  Http_Server_H2_Stream *stream = NULL;
+  int trailers = 0;
+  if(id <= h2->last_stream_id) {
+    stream = httpserver_http2_stream_find(h2, id);
+    if(!stream || stream->state != HTTPSERVER_H2_STREAM_RECEIVING ||
+       !(flags & HTTP2_FLAG_END_STREAM)) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+    trailers = 1;
+  } else {
+    h2->last_stream_id = id;
+    for(u64 i=0;!stream && i<HTTPSERVER_H2_STREAMS_CAP;i++) {
+      if(h2->streams[i].state == HTTPSERVER_H2_STREAM_FREE) {
+	stream = &h2->streams[i];
+      }
+    }
+    if(stream) {
+      stream->id = id;
+      stream->sb.len = 0;
+      stream->path_len = 0;
+      stream->method = HTTP_METHOD_NONE;
+    }
+  }
+
+  // A refused stream is decoded as well, to keep the dynamic table in sync
+  str_builder_reserve(&h2->scratch, 2 * h2->block.len);
+  u8 *data = h2->block.data;
+  u64 len = h2->block.len;
+
+  int malformed = 0;
+  int regular = 0;
+  Http2_Header header;
+  Http2_Hpack_Event event;
+  while((event = http2_hpack_next(&h2->hpack, &data, &len, h2->scratch.data, &header)) == HTTP2_HPACK_EVENT_HEADER) {
+    if(!stream || trailers || malformed) {
+      continue;
+    }
+    str name = str_from(header.name, header.name_len);
+    str value = str_from(header.value, header.value_len);
+    str_builder *sb = &stream->sb;
+
+    if(name.len == 0 || name.data[0] != ':') {
+      regular = 1;
+      str_builder_append(sb, (u8 *) HTTPSERVER_HEADERS_PAIR_DELIM, 1);
+      str_builder_append(sb, name.data, name.len);
+      str_builder_append(sb, (u8 *) HTTPSERVER_HEADERS_KEY_VALUE_DELIM, 1);
+      str_builder_append(sb, value.data, value.len);
+
+    } else if(regular) {
+      malformed = 1;
+
+    } else if(str_eqc(name, ":method")) {
+      u64 method_len;
+      Http_Method method = http_method_parse((u8 *) value.data, value.len, &method_len);
+      if(method != HTTP_METHOD_NONE && method_len == value.len) {
+	stream->method = method;
+      }
+
+    } else if(str_eqc(name, ":path")) {
+      // The path comes first, like in HTTP/1.1
+      str_builder_reserve(sb, sb->len + value.len);
+      memmove(sb->data + value.len, sb->data, sb->len);
+      memcpy(sb->data, value.data, value.len);
+      sb->len += value.len;
+      stream->path_len = value.len;
+
+    } else if(str_eqc(name, ":authority")) {
+      str_builder_append(sb, (u8 *) HTTPSERVER_HEADERS_PAIR_DELIM "host" HTTPSERVER_HEADERS_KEY_VALUE_DELIM, 6);
+      str_builder_append(sb, value.data, value.len);
+
+    } else if(!str_eqc(name, ":scheme")) {
+      malformed = 1;
+    }
+  }
+  if(event == HTTP2_HPACK_EVENT_ERROR) {
+    return HTTP2_COMPRESSION_ERROR;
+  }
+
+  if(!stream) {
+    httpserver_http2_frame_u32(h2, HTTP2_FRAME_RST_STREAM, id, HTTP2_REFUSED_STREAM);
+    return HTTP2_NO_ERROR;
+  }
+  if(trailers) {
+    stream->state = HTTPSERVER_H2_STREAM_READY;
+    return HTTP2_NO_ERROR;
+  }
+  stream->window = h2->initial_window;
+  stream->recv_window = HTTPSERVER_H2_WINDOW;
+  if(malformed || stream->path_len == 0) {
+    httpserver_http2_stream_reset(s, stream, HTTP2_PROTOCOL_ERROR);
+    return HTTP2_NO_ERROR;
+  }
+
+  stream->_body = stream->sb.len;
+  if(flags & HTTP2_FLAG_END_STREAM) {
+    stream->state = HTTPSERVER_H2_STREAM_READY;
+  } else {
+    stream->state = HTTPSERVER_H2_STREAM_RECEIVING;
+  }
+
+  return HTTP2_NO_ERROR;
+}
+
+// - returns the error-code of a connection-error
+HTTPSERVER_DEF u32 httpserver_http2_frame_process(Http_Server_Session *s, Http2_Frame *f, u8 *payload) {
+  Http_Server_H2 *h2 = s->h2;
+
+  if(h2->block_stream != 0 &&
+     (f->type != HTTP2_FRAME_CONTINUATION || f->stream != h2->block_stream)) {
+    return HTTP2_PROTOCOL_ERROR;
+  }
+
+  u64 len = f->len;
+  Http_Server_H2_Stream *stream;
+  switch(f->type) {
+  case HTTP2_FRAME_DATA: {
+    if(f->stream == 0 || f->stream > h2->last_stream_id) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+    if(!httpserver_http2_unpad(f, &payload, &len)) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+
+    // Padding counts as well. The body is buffered, so the connection
+    // gets its window back immediately
+    if((s64) f->len > h2->recv_window) {
+      return HTTP2_FLOW_CONTROL_ERROR;
+    }
+    if(f->len > 0) {
+      httpserver_http2_frame_u32(h2, HTTP2_FRAME_WINDOW_UPDATE, 0, f->len);
+    }
+
+    stream = httpserver_http2_stream_find(h2, f->stream);
+    if(!stream || stream->state != HTTPSERVER_H2_STREAM_RECEIVING) {
+      httpserver_http2_frame_u32(h2, HTTP2_FRAME_RST_STREAM, f->stream, HTTP2_STREAM_CLOSED);
+      break;
+    }
+    if((s64) f->len > stream->recv_window) {
+      httpserver_http2_stream_reset(s, stream, HTTP2_FLOW_CONTROL_ERROR);
+      break;
+    }
+    stream->recv_window -= f->len;
+
+    u64 body_len = stream->sb.len - stream->_body + len;
+    if(body_len > HTTPSERVER_H2_BODY_MAX) {
+      httpserver_http2_stream_reset(s, stream, HTTP2_CANCEL);
+      break;
+    }
+    str_builder_append(&stream->sb, payload, len);
+
+    if(f->flags & HTTP2_FLAG_END_STREAM) {
+      stream->state = HTTPSERVER_H2_STREAM_READY;
+      break;
+    }
+
+    // The stream gets its window back, as far as the body can take it
+    s64 increment = (s64) (HTTPSERVER_H2_BODY_MAX - body_len) - stream->recv_window;
+    if(increment > (s64) f->len) {
+      increment = f->len;
+    }
+    if(increment > 0) {
+      httpserver_http2_frame_u32(h2, HTTP2_FRAME_WINDOW_UPDATE, f->stream, (u32) increment);
+      stream->recv_window += increment;
+    } else if(stream->recv_window <= 0) {
+      // Full, the rest of the body could never be sent
+      httpserver_http2_stream_reset(s, stream, HTTP2_CANCEL);
+    }
+  } break;
+
+  case HTTP2_FRAME_HEADERS: {
+    if(f->stream == 0 || !(f->stream & 1)) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+    if(!httpserver_http2_unpad(f, &payload, &len)) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+    if(f->flags & HTTP2_FLAG_PRIORITY) {
+      if(len < 5) {
+	return HTTP2_FRAME_SIZE_ERROR;
+      }
+      payload += 5;
+      len -= 5;
+    }
+
+    h2->block.len = 0;
+    str_builder_append(&h2->block, payload, len);
+    h2->block_stream = f->stream;
+    h2->block_flags = f->flags;
+    if(f->flags & HTTP2_FLAG_END_HEADERS) {
+      return httpserver_http2_headers(s);
+    }
+  } break;
+
+  case HTTP2_FRAME_CONTINUATION: {
+    if(h2->block_stream == 0) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+    str_builder_append(&h2->block, payload, len);
+    if(f->flags & HTTP2_FLAG_END_HEADERS) {
+      return httpserver_http2_headers(s);
+    }
+  } break;
+
+  case HTTP2_FRAME_PRIORITY: {
+    if(f->stream == 0) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+    if(len != 5) {
+      return HTTP2_FRAME_SIZE_ERROR;
+    }
+  } break;
+
+  case HTTP2_FRAME_RST_STREAM: {
+    if(f->stream == 0 || f->stream > h2->last_stream_id) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+    if(len != 4) {
+      return HTTP2_FRAME_SIZE_ERROR;
+    }
+    stream = httpserver_http2_stream_find(h2, f->stream);
+    if(stream) {
+      httpserver_http2_stream_drop(s, stream);
+    }
+  } break;
+
+  case HTTP2_FRAME_SETTINGS: {
+    if(f->stream != 0) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+    if(f->flags & HTTP2_FLAG_ACK) {
+      if(len != 0) {
+	return HTTP2_FRAME_SIZE_ERROR;
+      }
+      break;
+    }
+    if(len % 6 != 0) {
+      return HTTP2_FRAME_SIZE_ERROR;
+    }
+
+    u32 code = httpserver_http2_settings(h2, payload, len);
+    if(code != HTTP2_NO_ERROR) {
+      return code;
+    }
+    httpserver_http2_frame(h2, HTTP2_FRAME_SETTINGS, HTTP2_FLAG_ACK, 0, NULL, 0);
+  } break;
+
+  case HTTP2_FRAME_PING: {
+    if(f->stream != 0) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+    if(len != 8) {
+      return HTTP2_FRAME_SIZE_ERROR;
+    }
+    if(!(f->flags & HTTP2_FLAG_ACK)) {
+      httpserver_http2_frame(h2, HTTP2_FRAME_PING, HTTP2_FLAG_ACK, 0, payload, len);
+    }
+  } break;
+
+  case HTTP2_FRAME_GOAWAY: {
+    if(f->stream != 0) {
+      return HTTP2_PROTOCOL_ERROR;
+    }
+    h2->goaway = 1;
+  } break;
+
+  case HTTP2_FRAME_WINDOW_UPDATE: {
+    if(len != 4) {
+      return HTTP2_FRAME_SIZE_ERROR;
+    }
+    s64 increment = http2_u32_read(payload) & 0x7fffffff;
+
+    if(f->stream == 0) {
+      if(increment == 0) {
+	return HTTP2_PROTOCOL_ERROR;
+      }
+      if(h2->window + increment > HTTP2_WINDOW_MAX) {
+	return HTTP2_FLOW_CONTROL_ERROR;
+      }
+      h2->window += increment;
+      break;
+    }
+
+    stream = httpserver_http2_stream_find(h2, f->stream);
+    if(!stream) {
+      break;
+    }
+    if(increment == 0) {
+      httpserver_http2_stream_reset(s, stream, HTTP2_PROTOCOL_ERROR);
+    } else if(stream->window + increment > HTTP2_WINDOW_MAX) {
+      httpserver_http2_stream_reset(s, stream, HTTP2_FLOW_CONTROL_ERROR);
+    } else {
+      stream->window += increment;
+    }
+  } break;
+
+  case HTTP2_FRAME_PUSH_PROMISE:
+    return HTTP2_PROTOCOL_ERROR;
+
+  default:
+    // Unknown frames are ignored
+    break;
+  }
+
+  return HTTP2_NO_ERROR;
+}
+
+HTTPSERVER_DEF void httpserver_http2_process(Http_Server_Session *s) {
+  Http_Server_H2 *h2 = s->h2;
+
+  while(!s->closing) {
+    u8 *data = s->input.data + s->input_pos;
+    u64 len = s->input.len - s->input_pos;
+
+    if(!h2->preface) {
+      u64 n = len < HTTP2_PREFACE_LEN ? len : HTTP2_PREFACE_LEN;
+      if(memcmp(data, HTTP2_PREFACE, n) != 0) {
+	httpserver_http2_goaway(s, HTTP2_PROTOCOL_ERROR);
+	break;
+      }
+      if(n < HTTP2_PREFACE_LEN) {
+	break;
+      }
+      s->input_pos += HTTP2_PREFACE_LEN;
+      h2->preface = 1;
+      continue;
+    }
+
+    if(len < HTTP2_FRAME_HEADER_LEN) {
+      break;
+    }
+    Http2_Frame f;
+    http2_frame_parse(data, &f);
+    if(f.len > HTTP2_MAX_FRAME_SIZE) {
+      httpserver_http2_goaway(s, HTTP2_FRAME_SIZE_ERROR);
+      break;
+    }
+    if(len < HTTP2_FRAME_HEADER_LEN + f.len) {
+      break;
+    }
+    s->input_pos += HTTP2_FRAME_HEADER_LEN + f.len;
+
+    u32 code = httpserver_http2_frame_process(s, &f, data + HTTP2_FRAME_HEADER_LEN);
+    if(code != HTTP2_NO_ERROR) {
+      httpserver_http2_goaway(s, code);
+    }
+  }
+
+  // Keep the incomplete frame
+  if(s->closing || s->input_pos == s->input.len) {
+    s->input.len = 0;
+  } else {
+    s->input.len -= s->input_pos;
+    memmove(s->input.data, s->input.data + s->input_pos, s->input.len);
+  }
+  s->input_pos = 0;
+}
+
+// - collect the HTTP/1.1 head, the handler enqueued, and encode it as HEADERS
+// - returns the number of bytes of 'data', that belong to the head
+HTTPSERVER_DEF u64 httpserver_http2_head(Http_Server_Session *s, Http_Server_H2_Stream *stream, u8 *data, u64 len) {
+  Http_Server_H2 *h2 = s->h2;
+
+  u64 head_len = stream->head.len;
+  str_builder_append(&stream->head, data, len);
+  s32 end = str_index_ofc(str_from(stream->head.data, stream->head.len), "\r\n\r\n");
+  if(end < 0) {
+    return len;
+  }
+  u64 consumed = (u64) end + 4 - head_len;
+
+  // 'HTTP/1.1 200 OK\r\nKey: Value\r\n...'
+  str head = str_from(stream->head.data, (u64) end);
+  str line = str_null;
+  str status = str_null;
+  str_chop_by(&head, "\n", &line);
+  str_chop_by(&line, " ", &status);
+  status = str_from(line.data, line.len < 3 ? line.len : 3);
+
+  str_builder *block = &h2->scratch;
+  block->len = 0;
+  str_builder_reserve(block, http2_hpack_encoded_cap(7, status.len));
+  block->len += http2_hpack_encode(block->data, (u8 *) ":status", 7, status.data, status.len);
+
+  while(head.len > 0) {
+    line = str_null;
+    str_chop_by(&head, "\n", &line);
+    if(line.len > 0 && line.data[line.len - 1] == '\r') {
+      line.len--;
+    }
+
+    str name = str_null;
+    if(!str_chop_by(&line, HTTPSERVER_HEADERS_KEY_VALUE_DELIM, &name)) {
+      continue;
+    }
+    str_trim(&line);
+    for(u64 i=0;i<name.len;i++) {
+      if('A' <= name.data[i] && name.data[i] <= 'Z') {
+	name.data[i] += 'a' - 'A';
+      }
+    }
+
+    // Connection-specific headers are not allowed in HTTP/2
+    if(str_eqc(name, "connection") ||
+       str_eqc(name, "keep-alive") ||
+       str_eqc(name, "proxy-connection") ||
+       str_eqc(name, "transfer-encoding") ||
+       str_eqc(name, "upgrade")) {
+      continue;
+    }
+
+    str_builder_reserve(block, block->len + http2_hpack_encoded_cap(name.len, line.len));
+    block->len += http2_hpack_encode(block->data + block->len,
+				     name.data, name.len,
+				     line.data, line.len);
+  }
+
+  u64 off = 0;
+  u8 type = HTTP2_FRAME_HEADERS;
+  do {
+    u64 n = block->len - off;
+    if(n > h2->max_frame_size) {
+      n = h2->max_frame_size;
+    }
+    u8 flags = off + n == block->len ? HTTP2_FLAG_END_HEADERS : 0;
+    httpserver_http2_frame(h2, type, flags, stream->id, block->data + off, n);
+    type = HTTP2_FRAME_CONTINUATION;
+    off += n;
+  } while(off < block->len);
+
+  stream->head.len = 0;
+  stream->head_sent = 1;
+  return consumed;
+}
+
+// - moves the writes of the handler into 'h2->current'. Once it is done,
+//   the stream is left to the writer and the next one can be handed out
+HTTPSERVER_DEF void httpserver_http2_collect(Http_Server_Session *s) {
+  Http_Server_H2 *h2 = s->h2;
+  Http_Server_H2_Stream *stream = h2->current;
+  if(!stream) {
+    return;
+  }
+
+  while(s->queue_len > 0 &&
+	(stream->state == HTTPSERVER_H2_STREAM_RESET || stream->queue_len < HTTPSERVER_WRITE_CAP)) {
+    Http_Server_Write *w = &s->queue[s->queue_pos];
+    if(stream->state == HTTPSERVER_H2_STREAM_RESET) {
+      httpserver_write_release(s, w);
+    } else {
+      stream->queue[(stream->queue_pos + stream->queue_len++) % HTTPSERVER_WRITE_CAP] = *w;
+    }
+    s->queue_pos = (s->queue_pos + 1) % HTTPSERVER_WRITE_CAP;
+    s->queue_len--;
+  }
+  if(s->handler || s->queue_len > 0) {
+    return;
+  }
+
+  // The writes point into 's->sb', it goes with them
+  str_builder sb = stream->response;
+  stream->response = s->sb;
+  s->sb = sb;
+  s->sb.len = 0;
+
+  if(stream->state == HTTPSERVER_H2_STREAM_RESET) {
+    httpserver_http2_stream_free(s, stream);
+  }
+  h2->current = NULL;
+}
+
+// - 1, if 'stream' has a frame to serialize
+HTTPSERVER_DEF int httpserver_http2_stream_pending(Http_Server_H2 *h2, Http_Server_H2_Stream *stream) {
+  if(stream->state != HTTPSERVER_H2_STREAM_RESPONDING) {
+    return 0;
+  }
+  if(stream->queue_len == 0) {
+    // The end of the response, unless the handler still writes
+    return stream != h2->current;
+  }
+  return !stream->head_sent || (h2->window > 0 && stream->window > 0);
+}
+
+// - serialize the next frame of 'stream' into 'h2->out'
+// - returns 0, if nothing can be serialized
+HTTPSERVER_DEF int httpserver_http2_serialize_stream(Http_Server_Session *s, Http_Server_H2_Stream *stream) {
+  Http_Server_H2 *h2 = s->h2;
+  if(!httpserver_http2_stream_pending(h2, stream)) {
+    return 0;
+  }
+
+  if(stream->queue_len == 0) {
+    if(stream->head_sent) {
+      httpserver_http2_frame(h2, HTTP2_FRAME_DATA, HTTP2_FLAG_END_STREAM, stream->id, NULL, 0);
+    } else {
+      httpserver_http2_frame_u32(h2, HTTP2_FRAME_RST_STREAM, stream->id, HTTP2_INTERNAL_ERROR);
+    }
+    httpserver_http2_stream_free(s, stream);
+    return 1;
+  }
+
+  Http_Server_Write *w = &stream->queue[stream->queue_pos];
+  Fs_File *file = NULL;
+  u8 *data = NULL;
+  u64 len = 0;
+  switch(w->kind) {
+  case HTTPSERVER_WRITE_KIND_FIXED:
+    data = w->as.fixed.message.data + w->as.fixed.off;
+    len = w->as.fixed.message.len - w->as.fixed.off;
+    break;
+  case HTTPSERVER_WRITE_KIND_SHARED:
+    data = w->as.shared.shared->data + w->as.shared.off;
+    len = w->as.shared.shared->len - w->as.shared.off;
+    break;
+  case HTTPSERVER_WRITE_KIND_FILE:
+    file = &w->as.file;
+    break;
+  case HTTPSERVER_WRITE_KIND_FILE_CHUNKED:
+    // DATA-frames are the chunks
+    file = &w->as.chunked.file;
+    break;
+  default:
+    UNREACHABLE();
+  }
+
+  u64 n = 0;
+  if(!stream->head_sent) {
+    if(file) {
+      // A body without a head
+      httpserver_http2_stream_reset(s, stream, HTTP2_INTERNAL_ERROR);
+      return 1;
+    }
+    n = httpserver_http2_head(s, stream, data, len);
+
+  } else {
+    s64 window = h2->window < stream->window ? h2->window : stream->window;
+    n = (u64) window;
+    if(n > h2->max_frame_size) {
+      n = h2->max_frame_size;
+    }
+
+    if(file) {
+      if(n > file->size - file->pos) {
+	n = file->size - file->pos;
+      }
+      str_builder_reserve(&h2->out, h2->out.len + HTTP2_FRAME_HEADER_LEN + n);
+
+      u64 read = 0;
+      if(n > 0) {
+	switch(fs_file_pread(file, file->pos, h2->out.data + h2->out.len + HTTP2_FRAME_HEADER_LEN, n, &read)) {
+	case FS_ERROR_NONE:
+	case FS_ERROR_EOF:
+	  file->pos += read;
+	  break;
+	default:
+	  // The head is out already, only this stream is given up
+	  httpserver_http2_stream_reset(s, stream, HTTP2_INTERNAL_ERROR);
+	  return 1;
+	}
+      }
+      if(read == 0) {
+	// Fully transmitted
+	file->pos = file->size;
+      } else {
+	http2_frame_header(h2->out.data + h2->out.len, (u32) read, HTTP2_FRAME_DATA, 0, stream->id);
+	h2->out.len += HTTP2_FRAME_HEADER_LEN + read;
+      }
+      n = read;
+
+    } else {
+      if(n > len) {
+	n = len;
+      }
+      if(n > 0) {
+	httpserver_http2_frame(h2, HTTP2_FRAME_DATA, 0, stream->id, data, n);
+      }
+    }
+
+    h2->window -= (s64) n;
+    stream->window -= (s64) n;
+  }
+
+  int done;
+  switch(w->kind) {
+  case HTTPSERVER_WRITE_KIND_FIXED:
+    w->as.fixed.off += n;
+    done = w->as.fixed.off == w->as.fixed.message.len;
+    break;
+  case HTTPSERVER_WRITE_KIND_SHARED:
+    w->as.shared.off += n;
+    s->pending -= n;
+    done = w->as.shared.off == w->as.shared.shared->len;
+    if(done) {
+      httpserver_shared_release(w->as.shared.shared);
+    }
+    break;
+  default:
+    done = file->pos == file->size;
+    if(done) {
+      fs_file_close(file);
+    }
+    break;
+  }
+
+  if(done) {
+    stream->queue_pos = (stream->queue_pos + 1) % HTTPSERVER_WRITE_CAP;
+    stream->queue_len--;
+  }
+
+  return 1;
+}
+
+// - serialize the next frame into 'h2->out'. The streams take turns
+// - returns 0, if nothing can be serialized
+HTTPSERVER_DEF int httpserver_http2_serialize(Http_Server_Session *s) {
+  Http_Server_H2 *h2 = s->h2;
+  httpserver_http2_collect(s);
+
+  for(u64 i=0;i<HTTPSERVER_H2_STREAMS_CAP;i++) {
+    u64 j = (h2->next + i) % HTTPSERVER_H2_STREAMS_CAP;
+    if(httpserver_http2_serialize_stream(s, &h2->streams[j])) {
+      h2->next = (j + 1) % HTTPSERVER_H2_STREAMS_CAP;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// - 1, if 'httpserver_http2_serialize' has something to do
+HTTPSERVER_DEF int httpserver_http2_pending(Http_Server_Session *s) {
+  Http_Server_H2 *h2 = s->h2;
+  if(h2->current && s->queue_len > 0 &&
+     (h2->current->state == HTTPSERVER_H2_STREAM_RESET || h2->current->queue_len < HTTPSERVER_WRITE_CAP)) {
+    return 1;
+  }
+  if(h2->current && !s->handler) {
+    return 1;
+  }
+  for(u64 i=0;i<HTTPSERVER_H2_STREAMS_CAP;i++) {
+    if(httpserver_http2_stream_pending(h2, &h2->streams[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+HTTPSERVER_DEF int httpserver_http2_next(Http_Server *h,
+					 Ip_Sockets *_s,
+					 u64 off,
+					 u64 index,
+					 int do_read,
+					 Http_Server_Request *r) {
+  Http_Server_Session *s = &h->sessions[index - off];
+  Http_Server_H2 *h2 = s->h2;
+  Ip_Socket *socket = ip_sockets_get(_s, index);
+
+  // One read per event, see 'httpserver_websocket_next'
+  if(do_read) {
+    str_builder_reserve(&s->input, s->input.len + HTTPSERVER_SB_BUFFER_SIZE);
+
+    u64 read;
+    switch(ip_socket_read(socket,
+			  s->input.data + s->input.len,
+			  s->input.cap - s->input.len,
+			  &read)) {
+    case IP_ERROR_NONE:
+      s->input.len += read;
+      break;
+    case IP_ERROR_REPEAT:
+      break;
+    default:
+      httpserver_session_evict(h, _s, off, index - off);
+      return 0;
+    }
+  }
+
+  // Control-frames are answered right away, requests are only collected
+  httpserver_http2_process(s);
+
+  // Streams are handed out in order, one by one. The write waits for the
+  // response of the next one, so it is interleaved with the others
+  httpserver_http2_collect(s);
+  int result = 0;
+  if(!s->closing && !h2->current) {
+    Http_Server_H2_Stream *stream = NULL;
+    for(u64 i=0;i<HTTPSERVER_H2_STREAMS_CAP;i++) {
+      Http_Server_H2_Stream *candidate = &h2->streams[i];
+      if(candidate->state == HTTPSERVER_H2_STREAM_READY &&
+	 (!stream || candidate->id < stream->id)) {
+	stream = candidate;
+      }
+    }
+
+    if(stream) {
+      stream->state = HTTPSERVER_H2_STREAM_RESPONDING;
+      h2->current = stream;
+
+      r->method = stream->method;
+      r->params = str_from(stream->sb.data, stream->path_len);
+      str_chop_by(&r->params, "?", &r->path);
+      r->body = str_from(stream->sb.data + stream->_body, stream->sb.len - stream->_body);
+      r->headers = str_from(stream->sb.data, stream->_body);
+      r->websocket = 0;
+
+      printf("HTTP/2 [%llu/%llu] '"str_fmt"'\n", (index -  off), h->number_of_clients, str_arg(r->path));
+      result = 1;
+    }
+  }
+
+  while(!result) {
+    while(h2->out.len - h2->out_pos < HTTPSERVER_H2_OUT_CAP &&
+	  httpserver_http2_serialize(s)) {
+    }
+    if(h2->out_pos == h2->out.len) {
+      break;
+    }
+
+    u64 written;
+    switch(ip_socket_write(socket,
+			   h2->out.data + h2->out_pos,
+			   h2->out.len - h2->out_pos,
+			   &written)) {
+    case IP_ERROR_NONE:
+      h2->out_pos += written;
+      break;
+    case IP_ERROR_REPEAT:
+      break;
+    default:
+      httpserver_session_evict(h, _s, off, index - off);
+      return 0;
+    }
+
+    if(h2->out_pos < h2->out.len) {
+      break;
+    }
+    h2->out.len = 0;
+    h2->out_pos = 0;
+  }
+
+  if(s->closing && h2->out_pos == h2->out.len) {
+    httpserver_session_evict(h, _s, off, index - off);
+    return 0;
+  }
+
+  if(result ||
+     h2->out_pos < h2->out.len ||
+     httpserver_http2_pending(s)) {
+    socket->flags |= IP_WRITING;
+  } else {
+    socket->flags &= ~IP_WRITING;
+  }
+
+  return result;
+}
+
+HTTPSERVER_DEF int httpserver_is_authenticated(Http_Server_Session *s,
+					       Http_Server_Request *r,
+					       str username,
+					       str password,
+					       str_builder *sb) {
+  int authenticated;
+  str authorization;
+  if(httpserver_headers_findc(r->headers, "Authorization", &authorization)) {
+
+    if(!str_chop_by(&authorization, " ", NULL)) {
+      authenticated = 0;
+    } else {
+      u64 len = base64_decode(sb->data,
+			      sb->cap,
+			      authorization.data, authorization.len);
+      if(sb->cap < len) {
+	str_builder_reserve(sb, len);
+	base64_decode(sb->data + sb->len,
+		      sb->cap - sb->len,
+		      authorization.data, authorization.len);
+      }
+
+      str password = str_from(sb->data, len);
+      str username;
+      if(str_chop_by(&password, ":", &username)) {
+	authenticated =
+	  str_eqc(username, "admin") &&
+	  str_eqc(password, "nimda");
+      } else {
+	authenticated = 0;
+      }
+
+    }
+
+  } else {
+    authenticated = 0;
+  }
+
+  if(!authenticated) {
+    if(r->method == HTTP_METHOD_HEAD) {
+      httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 401 Unauthorized\r\n"
+					    "WWW-Authenticate: Basic realm=\"User Visible Realm\"\r\n"
+					    "\r\n"));
+    } else {
+      httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 401 Unauthorized\r\n"
+					    "WWW-Authenticate: Basic realm=\"User Visible Realm\"\r\n"
+					    "Content-Type: text/plain\r\n"
+					    "Content-Length: 12\r\n"
+					    "\r\n"
+					    "Unauthorized"));
+    }
+    return 0 ;
+  }
+
+  return 1;
+}
+
+HTTPSERVER_DEF void httpserver_serve_files(Http_Server_Session *s,
+					   str dir,
+					   Http_Server_Request *r,
+					   str_builder *sb) {
+
+  switch(r->method) {
+  case HTTP_METHOD_GET:
+    httpserver_serve_files_get(s, dir, r, sb);
+    break;
+  case HTTP_METHOD_HEAD:
+    httpserver_serve_files_head(s, dir, r, sb);
+    break;
+  default:
+    httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 501 Not Implemented\r\n"
+					  "Content-Type: text/plain\r\n"
+					  "Content-Length: 15\r\n"
+					  "\r\n"
+					  "Not Implemented"));
+    break;
+  }
+
+}
+
+HTTPSERVER_DEF void httpserver_serve_files_get(Http_Server_Session *s,
 					       str dir,
 					       Http_Server_Request *r,
 					       str_builder *sb) {
@@ -905,18 +2964,167 @@ HTTPSERVER_DEF void httpserver_serve_files_head(Http_Server_Session *s,
 
 }
 
-// - create file handle inside 'file' specified by 'path'
+HTTPSERVER_DEF void httpserver_serve_files_indexed(Http_Server_Session *s,
+						   Fs_Listing_Cache *listings,
+						   str dir,
+						   Http_Server_Request *r,
+						   str_builder *sb) {
+
+  if((r->method != HTTP_METHOD_GET && r->method != HTTP_METHOD_HEAD) ||
+     r->path.len == 0 ||
+     r->path.data[r->path.len - 1] != '/') {
+    httpserver_serve_files(s, dir, r, sb);
+    return;
+  }
+
+  // Reserve once, the paths below point into 'sb'
+  u64 sb_len = sb->len;
+  str_builder_reserve(sb, sb->len + 3 * (dir.len + r->path.len + 16));
+
+  Http_Server_Request index = *r;
+  index.path = str_from(sb->data + sb->len, r->path.len + 10);
+  str_builder_appends(sb, r->path);
+  str_builder_appendc(sb, "index.html");
+  str url = str_from(index.path.data, r->path.len);
+
+  str path;
+  if(!httpserver_translate_path(s, dir, index.path, sb, &path)) {
+    sb->len = sb_len;
+    return;
+  }
+
+  Fs_Stat stat;
+  if(fs_file_cache_stats(s->files, path, &stat) == FS_ERROR_NONE && !stat.is_dir) {
+    httpserver_serve_files(s, dir, &index, sb);
+    sb->len = sb_len;
+    return;
+  }
+
+  Fs_Listing *listing;
+  switch(fs_listing_get(listings, path.data, path.len - 10, &listing)) {
+  case FS_ERROR_NONE:
+    break;
+  case FS_ERROR_FILE_NOT_FOUND:
+  case FS_ERROR_ACCESS_DENIED:
+    httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 404 Not Found\r\n"
+					  "Content-Length: 9\r\n"
+					  "Content-Type: text/plain\r\n"
+					  "\r\n"
+					  "Not Found"));
+    sb->len = sb_len;
+    return;
+  default:
+    httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 500 Internal Server Error\r\n"
+					  "Content-Length: 21\r\n"
+					  "Content-Type: text/plain\r\n"
+					  "\r\n"
+					  "Internal Server Error"));
+    sb->len = sb_len;
+    return;
+  }
+
+  // The body goes into 's->sb', like the response-headers. 'r' may point
+  // there too and is not used anymore, once it grows
+  str_builder *out = &s->sb;
+  u64 body_off = out->len;
+  str_builder_reserve(out, out->len + 256 + 4 * url.len + listing->entries_len * 64 + 4 * listing->names_len);
+
+  str_builder_appendc(out, "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Index of ");
+  httpserver_append_html_escaped(out, url);
+  str_builder_appendc(out, "</title></head>\n<body><h1>Index of ");
+  httpserver_append_html_escaped(out, url);
+  str_builder_appendc(out, "</h1><pre>\n");
+  if(url.len > 1) {
+    str_builder_appendc(out, "<a href=\"../\">../</a>\n");
+  }
+  for(u64 i=0;i<listing->entries_len;i++) {
+    Fs_Listing_Entry *e = &listing->entries[i];
+    str name = str_from(e->name, e->name_len);
+    int is_dir = (e->flags & FS_DIR_ENTRY_IS_DIR) != 0;
+
+    str_builder_appendc(out, "<a href=\"");
+    httpserver_append_url_escaped(out, name);
+    if(is_dir) str_builder_appendc(out, "/");
+    str_builder_appendc(out, "\">");
+    httpserver_append_html_escaped(out, name);
+    if(is_dir) str_builder_appendc(out, "/");
+    str_builder_appendc(out, "</a>");
+    if(!is_dir) {
+      str_builder_appendc(out, " ");
+      str_builder_appends64(out, (s64) e->size);
+    }
+    str_builder_appendc(out, "\n");
+  }
+  str_builder_appendc(out, "</pre></body></html>\n");
+  u64 body_len = out->len - body_off;
+  sb->len = sb_len;
+
+  // The head must not move the body
+  str_builder_reserve(out, out->len + 128);
+  Va va = va_n(body_len);
+  httpserver_enqueue_fixed(s, httpserver_snprintf2_impl(s,
+							"HTTP/1.1 200 OK\r\n"
+							"Content-Length: %\r\n"
+							"Content-Type: text/html; charset=utf-8\r\n"
+							"\r\n",
+							&va, 1));
+  if(r->method == HTTP_METHOD_GET) {
+    httpserver_enqueue_fixed(s, str_from(out->data + body_off, body_len));
+  }
+}
+
+HTTPSERVER_DEF void httpserver_append_html_escaped(str_builder *sb, str s) {
+  u64 start = 0;
+  for(u64 i=0;i<s.len;i++) {
+    char *escaped;
+    switch(s.data[i]) {
+    case '&': escaped = "&amp;"; break;
+    case '<': escaped = "&lt;"; break;
+    case '>': escaped = "&gt;"; break;
+    case '"': escaped = "&quot;"; break;
+    default: continue;
+    }
+    str_builder_append(sb, s.data + start, i - start);
+    str_builder_append(sb, (u8 *) escaped, strlen(escaped));
+    start = i + 1;
+  }
+  str_builder_append(sb, s.data + start, s.len - start);
+}
+
+HTTPSERVER_DEF void httpserver_append_url_escaped(str_builder *sb, str s) {
+  static const char hex[] = "0123456789ABCDEF";
+
+  str_builder_reserve(sb, sb->len + 3 * s.len);
+  for(u64 i=0;i<s.len;i++) {
+    u8 c = s.data[i];
+    if(('a' <= c && c <= 'z') ||
+       ('A' <= c && c <= 'Z') ||
+       ('0' <= c && c <= '9') ||
+       c == '-' || c == '.' || c == '_' || c == '~') {
+      sb->data[sb->len++] = c;
+    } else {
+      sb->data[sb->len++] = '%';
+      sb->data[sb->len++] = hex[c >> 4];
+      sb->data[sb->len++] = hex[c & 0xf];
+    }
+  }
+}
+
+// - create file handle inside 'file' specified by 'path'. It shares the
+//   descriptor of 's->files', read it with 'fs_file_pread'
 // - on error write to 'Http_Server'
 HTTPSERVER_DEF int httpserver_open_file(Http_Server_Session *s,
 					str path,
 					Fs_File *file) {
 
-  switch(fs_file_ropens(file, path)) {
+  switch(fs_file_cache_opens(s->files, path, file)) {
   case FS_ERROR_NONE:
     // caller of 'open_file' now owns the file
     return 1;
   case FS_ERROR_FILE_NOT_FOUND:
   case FS_ERROR_ACCESS_DENIED:
+  case FS_ERROR_IS_DIRECTORY:
+  case FS_ERROR_INVALID_NAME:
     httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 404 Not Found\r\n"
 					  "Content-Length: 9\r\n"
 					  "Content-Type: text/plain\r\n"
@@ -30,11 +30,15 @@
 #else 
 #  include <unistd.h>
 #  include <netinet/in.h>
+#  include <netinet/tcp.h>
 #  include <netdb.h>
 #  include <arpa/inet.h>
 #  include <errno.h>
 #  include <fcntl.h>
 #  include <sys/epoll.h>
+#  include <sys/sendfile.h>
+#  include <sys/syscall.h>
+#  include <poll.h>
 #  include <string.h>
 #  include <ifaddrs.h>
 #endif // _WIN32
@@ -77,6 +81,10 @@ typedef enum {
   IP_ERROR_NOT_A_SOCKET,
   IP_ERROR_NO_SUCH_FILE_OR_DIRECTORY,
   IP_ERROR_BROKEN_PIPE,
+  IP_ERROR_UNSUPPORTED,
+  IP_ERROR_ADDRESS_IN_USE,
+  IP_ERROR_NO_SPACE, // the disk or the quota is full
+  IP_ERROR_LIMIT, // out of descriptors, of the process or the system
 } Ip_Error;
 
 IP_DEF Ip_Error ip_error_last();
@@ -123,6 +131,16 @@ typedef struct {
 IP_DEF Ip_Error ip_socket_copen(Ip_Socket *s, char *hosntame, u16 port, int blocking);
 IP_DEF Ip_Error ip_socket_sopen(Ip_Socket *s, u16 port, int blocking);
 
+// - look up 'hostname', so that connecting later skips the lookup
+IP_DEF Ip_Error ip_resolve(char *hostname, u16 port, Ip_Address *a);
+// - if not 'blocking', the connect may still be in progress. The socket turns
+//   writable once it is done, then ask 'ip_socket_connected'
+IP_DEF Ip_Error ip_socket_connect(Ip_Socket *s, Ip_Address *a, int blocking);
+IP_DEF Ip_Error ip_socket_connected(Ip_Socket *s);
+// - whether a read would not block, never blocks itself. An idle client
+//   connection that is readable was closed by the peer
+IP_DEF int ip_socket_readable(Ip_Socket *s);
+
 IP_DEF Ip_Error ip_socket_read(Ip_Socket *s, u8 *buf, u64 buf_len, u64 *read);
 #define ip_socket_reads(s, str) ip_socket_read((s), (str).data, (str).len, &((str).len))
 
@@ -130,8 +148,48 @@ IP_DEF Ip_Error ip_socket_write(Ip_Socket *s, u8 *buf, u64 buf_len, u64 *written
 #define ip_socket_writec(s, cstr, n) ip_socket_write((s), (cstr), ip_strlen(cstr), (n))
 #define ip_socket_writes(s, str, n) ip_socket_write((s), (str).data, (str).len, (n))
 
+#ifdef _WIN32
+typedef HANDLE Ip_File;
+#else
+typedef int Ip_File;
+#endif // _WIN32
+
+// - send 'len' bytes of 'file' from '*offset' on, without copying them through
+//   userspace. Advances '*offset', not the position of 'file'
+// - IP_ERROR_UNSUPPORTED if the platform or the file can not do it, then
+//   fall back to read and write
+// - unlike 'ip_socket_write', a peer that hung up raises SIGPIPE on POSIX.
+//   The application decides to ignore it
+IP_DEF Ip_Error ip_socket_sendfile(Ip_Socket *s, Ip_File file, u64 *offset, u64 len, u64 *written);
+
+// Bytes moved per 'ip_socket_splice', the kernel may cap the pipe below it
+#ifndef IP_SPLICE_SIZE
+#  define IP_SPLICE_SIZE (1024 * 1024)
+#endif // IP_SPLICE_SIZE
+
+// A pipe, to move bytes from a socket into a file without copying them
+// through userspace
+typedef struct {
+#ifndef _WIN32
+  int pipe[2];
+#endif // _WIN32
+  u64 pending; // bytes in the pipe, that are not in the file yet
+} Ip_Splice;
+
+// - IP_ERROR_UNSUPPORTED if the platform can not do it
+IP_DEF Ip_Error ip_splice_open(Ip_Splice *p);
+// - read from 's' and write to 'file' at '*offset', advances '*offset', not the
+//   position of 'file'. IP_ERROR_EOF, once 's' is done
+// - IP_ERROR_UNSUPPORTED if 'file' can not do it, then fall back to read and
+//   write. '*moved' bytes were written nonetheless
+IP_DEF Ip_Error ip_socket_splice(Ip_Socket *s, Ip_Splice *p, Ip_File file, u64 *offset, u64 *moved);
+IP_DEF void ip_splice_close(Ip_Splice *p);
+
 IP_DEF Ip_Error ip_socket_accept(Ip_Socket *s, Ip_Socket *client, Ip_Address *a);
 IP_DEF void ip_socket_set_blocking(Ip_Socket *s, int blocking);
+// - send small writes at once. Else the body, written after the header, waits
+//   for the delayed ACK of the peer
+IP_DEF void ip_socket_set_nodelay(Ip_Socket *s, int nodelay);
 IP_DEF Ip_Error ip_socket_address(Ip_Socket *s, Ip_Address *a);
 
 IP_DEF void ip_socket_close(Ip_Socket *s);
@@ -144,10 +202,45 @@ typedef enum {
 
 #define IP_SOCKETS_EP_EVENTS 32
 
+typedef struct Ip_Sockets Ip_Sockets;
+
+// Called for every event on a slot in [off, off + len), and once per
+// batch of events with IP_ERROR_REPEAT (then 'index' is 'off'). The
+// context of the connection is 'ip_sockets_ctx(s, index)'
+typedef void (*Ip_Handler)(Ip_Sockets *s, void *ctx,
+			   u64 off, u64 len,
+			   Ip_Error error, u64 index, Ip_Mode mode);
+
 typedef struct {
-  Ip_Socket *sockets;
+  Ip_Handler handler;
+  void *ctx;
+  u64 off;
+  u64 len;
+} Ip_Protocol;
+
+#define IP_PROTOCOL_NONE ((u64) -1)
+
+typedef struct {
+  Ip_Socket socket;
+  u64 protocol; // the owner
+  void *ctx; // of the connection, left to the owner
+} Ip_Slot;
+
+#ifndef IP_SOCKETS_CHUNK
+#  define IP_SOCKETS_CHUNK 256
+#endif // IP_SOCKETS_CHUNK
+
+struct Ip_Sockets {
+  // The slots, IP_SOCKETS_CHUNK per allocation. Growing never moves one,
+  // a pointer of 'ip_sockets_get' stays valid
+  Ip_Slot **chunks;
+  u64 chunks_count;
   u64 sockets_count;
 
+  Ip_Protocol *protocols;
+  u64 protocols_count;
+  u64 reserved;
+
   s32 ret;
   u64 off;
 #ifdef _WIN32
@@ -158,7 +251,7 @@ typedef struct {
   s32 epfd;
 #endif // _WIN32
 
-} Ip_Sockets;
+};
 
 IP_DEF Ip_Error ip_sockets_open(Ip_Sockets *s, u64 n);
 IP_DEF Ip_Error ip_sockets_next(Ip_Sockets *s, u64 *index, Ip_Mode *m);
@@ -167,6 +260,19 @@ IP_DEF void ip_sockets_close(Ip_Sockets *s);
 IP_DEF Ip_Error ip_sockets_register(Ip_Sockets *s, u64 index);
 IP_DEF Ip_Error ip_sockets_unregister(Ip_Sockets *s, u64 index);
 
+#define ip_sockets_slot(s, index) (&(s)->chunks[(index) / IP_SOCKETS_CHUNK][(index) % IP_SOCKETS_CHUNK])
+// - the socket of slot 'index'
+#define ip_sockets_get(s, index) (&ip_sockets_slot((s), (index))->socket)
+// - the context of the connection in slot 'index', NULL until it is set
+#define ip_sockets_ctx(s, index) (ip_sockets_slot((s), (index))->ctx)
+
+// - reserve 'len' consecutive slots for 'handler', grows the sockets if needed
+// - the slots are [*off, *off + len), the last one is meant for the listener
+IP_DEF Ip_Error ip_sockets_reserve(Ip_Sockets *s, u64 len, Ip_Handler handler, void *ctx, u64 *off);
+// - wait for the next event and hand it to the owner of the slot
+IP_DEF Ip_Error ip_sockets_dispatch(Ip_Sockets *s);
+IP_DEF Ip_Error ip_sockets_grow(Ip_Sockets *s, u64 n);
+
 #ifdef IP_IMPLEMENTATION
 
 #define ip_return_defer(n) do { result = (n); goto defer; }while(0)
@@ -196,6 +302,13 @@ IP_DEF Ip_Error ip_error_last() {
     return IP_ERROR_CONNECTION_ABORTED;
   case 10061:
     return IP_ERROR_CONNECTION_REFUSED;
+  case 10048:
+    return IP_ERROR_ADDRESS_IN_USE;
+  case 39:
+  case 112:
+    return IP_ERROR_NO_SPACE;
+  case 10024:
+    return IP_ERROR_LIMIT;
   default:
     fprintf(stderr, "IP_ERROR: Unhandled last_error: %ld\n", last_error); fflush(stderr);
     exit(1);
@@ -254,57 +367,60 @@ IP_DEF Ip_Error ip_get_address(Ip ip) {
 
 static int ip_wsa_inited = 0;
 
-IP_DEF Ip_Error ip_socket_copen(Ip_Socket *s, char *hostname, u16 port, int blocking) {
-
-  Ip_Error result = IP_ERROR_NONE;
-  struct addrinfo* addr = NULL;
-  s->_socket = INVALID_SOCKET;
-  s->flags = 0;
+IP_DEF Ip_Error ip_resolve(char *hostname, u16 port, Ip_Address *a) {
 
   if(!ip_wsa_inited) {
 
     WSADATA wsaData;   
     if(WSAStartup(0x202, (void *) &wsaData) != 0) {
-      ip_return_defer(IP_ERROR_WSA_STARTUP_FAILED);
+      return IP_ERROR_WSA_STARTUP_FAILED;
     }
 
     ip_wsa_inited = 1;
   }
 
-  s->_socket = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, 0, 0, 0);
-  if(s->_socket == INVALID_SOCKET) {
-    ip_return_defer(ip_error_last());
-  }
-
   struct addrinfo hints;
   memset(&hints, 0, sizeof(hints));
   hints.ai_family = AF_INET;
   hints.ai_socktype = SOCK_STREAM;
   hints.ai_protocol = IPPROTO_TCP;
 
-  u8 port_buf[32];
-  u8 *port_buf_ptr = port_buf + sizeof(port_buf) - 2;
-  while(port) {
-    *port_buf_ptr-- = port % 10 + '0';
-    port /= 10;
+  struct addrinfo* addr = NULL;
+  if(getaddrinfo(hostname, NULL, &hints, &addr) != 0) {
+    return IP_ERROR_UNKNOWN_HOSTNAME;
   }
-  port_buf_ptr++;
-  port_buf[31] = 0;
 
-  if(getaddrinfo(hostname, (char *) port_buf_ptr, &hints, &addr) != 0) {
-    ip_return_defer(IP_ERROR_UNKNOWN_HOSTNAME);
-  }
+  memset(&a->addr, 0, sizeof(a->addr));
+  memcpy(&a->addr, addr->ai_addr, sizeof(a->addr));
+  a->addr.sin_port = htons(port);
+  a->addr_len = (int) sizeof(a->addr);
+  freeaddrinfo(addr);
+
+  return IP_ERROR_NONE;
+}
+
+IP_DEF Ip_Error ip_socket_connect(Ip_Socket *s, Ip_Address *a, int blocking) {
 
-  if(connect(s->_socket, addr->ai_addr, (int) addr->ai_addrlen) != 0) {
+  Ip_Error result = IP_ERROR_NONE;
+  s->_socket = INVALID_SOCKET;
+  s->flags = 0;
+
+  s->_socket = WSASocketW(AF_INET, SOCK_STREAM, IPPROTO_TCP, 0, 0, 0);
+  if(s->_socket == INVALID_SOCKET) {
     ip_return_defer(ip_error_last());
   }
 
-  s->flags = IP_VALID | IP_CLIENT;
-
   ip_socket_set_blocking(s, blocking);
 
+  if(connect(s->_socket, (struct sockaddr *) &a->addr, a->addr_len) != 0 &&
+     WSAGetLastError() != WSAEWOULDBLOCK) {
+    ip_return_defer(ip_error_last());
+  }
+
+  s->flags |= IP_VALID | IP_CLIENT;
+  ip_socket_set_nodelay(s, 1);
+
  defer:
-  if(addr != NULL) freeaddrinfo(addr);
   if(result != IP_ERROR_NONE && s->_socket != INVALID_SOCKET) {
     DWORD last_error = GetLastError();
     closesocket(s->_socket);
@@ -313,6 +429,43 @@ IP_DEF Ip_Error ip_socket_copen(Ip_Socket *s, char *hostname, u16 port, int bloc
   return result;
 }
 
+IP_DEF Ip_Error ip_socket_copen(Ip_Socket *s, char *hostname, u16 port, int blocking) {
+  s->flags = 0;
+
+  Ip_Address a;
+  Ip_Error error = ip_resolve(hostname, port, &a);
+  if(error != IP_ERROR_NONE) {
+    return error;
+  }
+
+  return ip_socket_connect(s, &a, blocking);
+}
+
+IP_DEF Ip_Error ip_socket_connected(Ip_Socket *s) {
+  int error = 0;
+  int error_len = sizeof(error);
+  if(getsockopt(s->_socket, SOL_SOCKET, SO_ERROR, (char *) &error, &error_len) != 0) {
+    return ip_error_last();
+  }
+
+  switch(error) {
+  case 0:
+    return IP_ERROR_NONE;
+  case WSAECONNREFUSED:
+    return IP_ERROR_CONNECTION_REFUSED;
+  default:
+    return IP_ERROR_CONNECTION_ABORTED;
+  }
+}
+
+IP_DEF int ip_socket_readable(Ip_Socket *s) {
+  WSAPOLLFD pfd = { .fd = s->_socket, .events = POLLRDNORM };
+  if(WSAPoll(&pfd, 1, 0) < 0) {
+    return 1;
+  }
+  return pfd.revents != 0;
+}
+
 IP_DEF Ip_Error ip_socket_sopen(Ip_Socket *s, u16 port, int blocking) {
 
   Ip_Error result = IP_ERROR_NONE;
@@ -390,6 +543,36 @@ IP_DEF Ip_Error ip_socket_write(Ip_Socket *s, u8 *buf, u64 buf_len, u64 *written
   }
 }
 
+IP_DEF Ip_Error ip_socket_sendfile(Ip_Socket *s, Ip_File file, u64 *offset, u64 len, u64 *written) {
+  (void) s;
+  (void) file;
+  (void) offset;
+  (void) len;
+  (void) written;
+
+  // TransmitFile blocks on non-overlapped sockets
+  return IP_ERROR_UNSUPPORTED;
+}
+
+IP_DEF Ip_Error ip_splice_open(Ip_Splice *p) {
+  p->pending = 0;
+  return IP_ERROR_UNSUPPORTED;
+}
+
+IP_DEF Ip_Error ip_socket_splice(Ip_Socket *s, Ip_Splice *p, Ip_File file, u64 *offset, u64 *moved) {
+  (void) s;
+  (void) p;
+  (void) file;
+  (void) offset;
+
+  *moved = 0;
+  return IP_ERROR_UNSUPPORTED;
+}
+
+IP_DEF void ip_splice_close(Ip_Splice *p) {
+  (void) p;
+}
+
 IP_DEF Ip_Error ip_socket_accept(Ip_Socket *s, Ip_Socket *client, Ip_Address *a) {
 
   a->addr_len = (int) sizeof(a->addr);
@@ -413,6 +596,7 @@ IP_DEF Ip_Error ip_socket_accept(Ip_Socket *s, Ip_Socket *client, Ip_Address *a)
 		sizeof(s32)) != 0) {
     exit(69);
   }
+  ip_socket_set_nodelay(client, 1);
 
   return IP_ERROR_NONE;
 }
@@ -431,6 +615,11 @@ IP_DEF void ip_socket_set_blocking(Ip_Socket *s, int blocking) {
 
 }
 
+IP_DEF void ip_socket_set_nodelay(Ip_Socket *s, int nodelay) {
+  BOOL value = nodelay ? TRUE : FALSE;
+  setsockopt(s->_socket, IPPROTO_TCP, TCP_NODELAY, (char *) &value, sizeof(value));
+}
+
 IP_DEF void ip_socket_close(Ip_Socket *s) {
   closesocket(s->_socket);
   s->flags = 0;
@@ -438,22 +627,76 @@ IP_DEF void ip_socket_close(Ip_Socket *s) {
 
 IP_DEF Ip_Error ip_sockets_open(Ip_Sockets *s, u64 n) {
 
-  u64 sockets_size = n * sizeof(*s->sockets);
-  u64 fd_size = 8 + n * sizeof(SOCKET);
+  s->chunks = NULL;
+  s->chunks_count = 0;
+  s->sockets_count = 0;
+  s->protocols = NULL;
+  s->protocols_count = 0;
+  s->reserved = 0;
+  s->set_reading = NULL;
+  s->set_writing = NULL;
+  s->ret = -1;
+
+  return ip_sockets_grow(s, n);
+}
+
+IP_DEF Ip_Error ip_sockets_grow(Ip_Sockets *s, u64 n) {
+
+  u64 chunks_count = (n + IP_SOCKETS_CHUNK - 1) / IP_SOCKETS_CHUNK;
+  if(chunks_count <= s->chunks_count && s->set_reading) {
+    return IP_ERROR_NONE;
+  }
+  n = chunks_count * IP_SOCKETS_CHUNK;
 
-  u8 *memory = IP_ALLOC(sockets_size + 2 * fd_size);
+  // The sets are filled in 'ip_sockets_next', keep them for this batch
+  u64 fd_size = 8 + n * sizeof(SOCKET);
+  u8 *memory = IP_ALLOC(2 * fd_size);
   if(!memory) {
     return IP_ERROR_ALLOC_FAILED;
   }
-  s->sockets = (Ip_Socket *) memory;
-  s->set_reading = (fd_set *) (memory + sockets_size);
-  s->set_writing = (fd_set *) (memory + sockets_size + fd_size);
+  Ip_Slot **chunks = IP_ALLOC(chunks_count * sizeof(*chunks) + 1);
+  if(!chunks) {
+    IP_FREE(memory);
+    return IP_ERROR_ALLOC_FAILED;
+  }
+  for(u64 i=0;i<chunks_count;i++) {
+    if(i < s->chunks_count) {
+      chunks[i] = s->chunks[i];
+      continue;
+    }
 
-  for(u64 i=0;i<n;i++) {
-    s->sockets[i] = ip_socket_invalid();
+    chunks[i] = IP_ALLOC(IP_SOCKETS_CHUNK * sizeof(**chunks));
+    if(!chunks[i]) {
+      for(u64 j=s->chunks_count;j<i;j++) IP_FREE(chunks[j]);
+      IP_FREE(chunks);
+      IP_FREE(memory);
+      return IP_ERROR_ALLOC_FAILED;
+    }
+    for(u64 j=0;j<IP_SOCKETS_CHUNK;j++) {
+      chunks[i][j] = (Ip_Slot) {
+	.socket = ip_socket_invalid(),
+	.protocol = IP_PROTOCOL_NONE,
+	.ctx = NULL,
+      };
+    }
   }
+
+  fd_set *set_reading = (fd_set *) memory;
+  fd_set *set_writing = (fd_set *) (memory + fd_size);
+  if(s->set_reading) {
+    set_reading->fd_count = s->set_reading->fd_count;
+    memcpy(set_reading->fd_array, s->set_reading->fd_array, s->set_reading->fd_count * sizeof(SOCKET));
+    set_writing->fd_count = s->set_writing->fd_count;
+    memcpy(set_writing->fd_array, s->set_writing->fd_array, s->set_writing->fd_count * sizeof(SOCKET));
+    IP_FREE(s->set_reading);
+  }
+  if(s->chunks) IP_FREE(s->chunks);
+
+  s->chunks = chunks;
+  s->chunks_count = chunks_count;
+  s->set_reading = set_reading;
+  s->set_writing = set_writing;
   s->sockets_count = n;
-  s->ret = -1;
 
   return IP_ERROR_NONE;
 }
@@ -469,7 +712,7 @@ IP_DEF Ip_Error ip_sockets_next(Ip_Sockets *s, u64 *index, Ip_Mode *m) {
     s->set_writing->fd_count = 0;
 
     for(u64 i=0;i<s->sockets_count;i++) {
-      Ip_Socket *socket = &s->sockets[i];
+      Ip_Socket *socket = ip_sockets_get(s, i);
 
       if(socket->flags & IP_VALID) {
 	s->set_reading->fd_array[s->set_reading->fd_count++] = socket->_socket;
@@ -505,7 +748,7 @@ IP_DEF Ip_Error ip_sockets_next(Ip_Sockets *s, u64 *index, Ip_Mode *m) {
   while(s->off < s->sockets_count*2) {
     u64 i = s->off / 2;
 
-    Ip_Socket *socket = &s->sockets[i];
+    Ip_Socket *socket = ip_sockets_get(s, i);
     if(socket->flags & IP_VALID) {
 
       if((s->off & 0x1) == 0) {
@@ -513,7 +756,7 @@ IP_DEF Ip_Error ip_sockets_next(Ip_Sockets *s, u64 *index, Ip_Mode *m) {
 
 	int found = 0;
 	for(u64 j=s->set_reading->fd_count - 1;!found && j<s->set_reading->fd_count;j--) {
-	  found = found || (s->set_reading->fd_array[j] == s->sockets[i]._socket);
+	  found = found || (s->set_reading->fd_array[j] == socket->_socket);
 	}
 
 	if(found) {
@@ -530,7 +773,7 @@ IP_DEF Ip_Error ip_sockets_next(Ip_Sockets *s, u64 *index, Ip_Mode *m) {
 
 	int found = 0;
 	for(u64 j=s->set_writing->fd_count - 1;!found && j<s->set_writing->fd_count;j--) {
-	  found = found || (s->set_writing->fd_array[j] == s->sockets[i]._socket);
+	  found = found || (s->set_writing->fd_array[j] == socket->_socket);
 	}
 
 	if(found) {
@@ -556,12 +799,15 @@ IP_DEF Ip_Error ip_sockets_next(Ip_Sockets *s, u64 *index, Ip_Mode *m) {
 IP_DEF void ip_sockets_close(Ip_Sockets *s) {
 
   for(u64 i=0;i<s->sockets_count;i++) {
-    Ip_Socket *socket = &s->sockets[i];
+    Ip_Socket *socket = ip_sockets_get(s, i);
     if(!(socket->flags & IP_VALID)) continue;
     ip_socket_close(socket);
   }
 
-  IP_FREE(s->sockets);
+  for(u64 i=0;i<s->chunks_count;i++) IP_FREE(s->chunks[i]);
+  if(s->chunks) IP_FREE(s->chunks);
+  if(s->set_reading) IP_FREE(s->set_reading);
+  if(s->protocols) IP_FREE(s->protocols);
 }
 
 IP_DEF Ip_Error ip_sockets_register(Ip_Sockets *s, u64 index) {
@@ -594,6 +840,14 @@ IP_DEF Ip_Error ip_error_last() {
     return IP_ERROR_NOT_A_SOCKET;
   case 32:
     return IP_ERROR_BROKEN_PIPE;
+  case 98:
+    return IP_ERROR_ADDRESS_IN_USE;
+  case 28:
+  case 122:
+    return IP_ERROR_NO_SPACE;
+  case 23:
+  case 24:
+    return IP_ERROR_LIMIT;
   default:
     fprintf(stderr, "IP_ERROR: Unhandled last_error: %d\n", errno);
     fprintf(stderr, "IP_ERROR: '%s'\n", strerror(errno));
@@ -640,7 +894,30 @@ IP_DEF Ip_Error ip_get_address(Ip ip) {
   
 }
 
-IP_DEF Ip_Error ip_socket_copen(Ip_Socket *s, char *hostname, u16 port, int blocking) {
+IP_DEF Ip_Error ip_resolve(char *hostname, u16 port, Ip_Address *a) {
+
+  // Unlike gethostbyname, safe to call from several threads
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+
+  struct addrinfo *addr = NULL;
+  if(getaddrinfo(hostname, NULL, &hints, &addr) != 0 || !addr) {
+    return IP_ERROR_UNKNOWN_HOSTNAME;
+  }
+
+  memset(&a->addr, 0, sizeof(a->addr));
+  memcpy(&a->addr, addr->ai_addr, sizeof(a->addr));
+  a->addr.sin_port = htons(port);
+  a->addr_len = sizeof(a->addr);
+  freeaddrinfo(addr);
+
+  return IP_ERROR_NONE;
+}
+
+IP_DEF Ip_Error ip_socket_connect(Ip_Socket *s, Ip_Address *a, int blocking) {
   Ip_Error result = IP_ERROR_NONE;
   s->_socket = -1; 
   s->flags = 0;  
@@ -650,28 +927,15 @@ IP_DEF Ip_Error ip_socket_copen(Ip_Socket *s, char *hostname, u16 port, int bloc
     ip_return_defer(ip_error_last());
   }
 
-  struct hostent *hostent = gethostbyname(hostname);
-  if(!hostent) {
-    ip_return_defer(IP_ERROR_UNKNOWN_HOSTNAME);
-  }
-
-  in_addr_t in_addr = inet_addr(inet_ntoa(*(struct in_addr *) *(hostent->h_addr_list)));
-  if(in_addr == (in_addr_t) -1) {
-    ip_return_defer(IP_ERROR_UNKNOWN_HOSTNAME);
-  }
-
-  struct sockaddr_in addr = {0};
-  addr.sin_addr.s_addr = in_addr;
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(port);
+  ip_socket_set_blocking(s, blocking);
 
-  if(connect(s->_socket, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+  if(connect(s->_socket, (struct sockaddr *) &a->addr, a->addr_len) < 0 &&
+     errno != EINPROGRESS) {
     ip_return_defer(ip_error_last());
   }
 
-  s->flags = IP_VALID | IP_CLIENT; 
-
-  ip_socket_set_blocking(s, blocking);
+  s->flags |= IP_VALID | IP_CLIENT; 
+  ip_socket_set_nodelay(s, 1);
 
  defer:
   if(result != IP_ERROR_NONE && s->_socket >= 0) {
@@ -680,6 +944,44 @@ IP_DEF Ip_Error ip_socket_copen(Ip_Socket *s, char *hostname, u16 port, int bloc
   return result; 
 }
 
+IP_DEF Ip_Error ip_socket_copen(Ip_Socket *s, char *hostname, u16 port, int blocking) {
+  s->_socket = -1;
+  s->flags = 0;
+
+  Ip_Address a;
+  Ip_Error error = ip_resolve(hostname, port, &a);
+  if(error != IP_ERROR_NONE) {
+    return error;
+  }
+
+  return ip_socket_connect(s, &a, blocking);
+}
+
+IP_DEF Ip_Error ip_socket_connected(Ip_Socket *s) {
+  int error = 0;
+  socklen_t error_len = sizeof(error);
+  if(getsockopt(s->_socket, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0) {
+    return ip_error_last();
+  }
+
+  switch(error) {
+  case 0:
+    return IP_ERROR_NONE;
+  case ECONNREFUSED:
+    return IP_ERROR_CONNECTION_REFUSED;
+  default:
+    return IP_ERROR_CONNECTION_ABORTED;
+  }
+}
+
+IP_DEF int ip_socket_readable(Ip_Socket *s) {
+  struct pollfd pfd = { .fd = s->_socket, .events = POLLIN };
+  if(poll(&pfd, 1, 0) < 0) {
+    return 1;
+  }
+  return pfd.revents != 0;
+}
+
 IP_DEF Ip_Error ip_socket_sopen(Ip_Socket *s, u16 port, int blocking) {
 
   Ip_Error result = IP_ERROR_NONE;
@@ -718,7 +1020,7 @@ IP_DEF Ip_Error ip_socket_sopen(Ip_Socket *s, u16 port, int blocking) {
   s->flags = IP_VALID | IP_SERVER; 
 
  defer:
-  if(result != IP_ERROR_NONE && s->_socket < 0) {
+  if(result != IP_ERROR_NONE && s->_socket >= 0) {
     close(s->_socket);
   }
   return result;
@@ -737,6 +1039,11 @@ IP_DEF void ip_socket_set_blocking(Ip_Socket *s, int blocking) {
   fcntl(s->_socket, F_SETFL, flags);
 }
 
+IP_DEF void ip_socket_set_nodelay(Ip_Socket *s, int nodelay) {
+  int value = nodelay != 0;
+  setsockopt(s->_socket, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+}
+
 IP_DEF Ip_Error ip_socket_address(Ip_Socket *s, Ip_Address *a) {
   socklen_t addr_len = (socklen_t) sizeof(a->addr);
   if(getpeername(s->_socket, (struct sockaddr *) &a->addr, &addr_len) != 0) {
@@ -760,7 +1067,7 @@ IP_DEF Ip_Error ip_socket_read(Ip_Socket *s, u8 *buf, u64 buf_len, u64 *_read) {
 
 IP_DEF Ip_Error ip_socket_write(Ip_Socket *s, u8 *buf, u64 buf_len, u64 *written) {
 
-  s32 ret = write(s->_socket, (char *) buf, buf_len);
+  s32 ret = send(s->_socket, (char *) buf, buf_len, MSG_NOSIGNAL);
   if(ret < 0) {
     return ip_error_last();
   } else if(ret == 0) {
@@ -771,6 +1078,101 @@ IP_DEF Ip_Error ip_socket_write(Ip_Socket *s, u8 *buf, u64 buf_len, u64 *written
   }
 }
 
+IP_DEF Ip_Error ip_socket_sendfile(Ip_Socket *s, Ip_File file, u64 *offset, u64 len, u64 *written) {
+  off_t off = (off_t) *offset;
+  ssize_t ret = sendfile(s->_socket, file, &off, len);
+  if(ret < 0) {
+    if(errno == EINVAL || errno == ENOSYS || errno == EOVERFLOW) {
+      return IP_ERROR_UNSUPPORTED;
+    }
+    return ip_error_last();
+  } else if(ret == 0) {
+    return IP_ERROR_EOF;
+  }
+
+  *offset = (u64) off;
+  *written = (u64) ret;
+  return IP_ERROR_NONE;
+}
+
+// splice(2) and F_SETPIPE_SZ are only declared with _GNU_SOURCE
+#ifndef SPLICE_F_MOVE
+#  define SPLICE_F_MOVE 1
+#endif // SPLICE_F_MOVE
+#ifndef SPLICE_F_NONBLOCK
+#  define SPLICE_F_NONBLOCK 2
+#endif // SPLICE_F_NONBLOCK
+#ifndef F_SETPIPE_SZ
+#  define F_SETPIPE_SZ 1031
+#endif // F_SETPIPE_SZ
+
+IP_DEF Ip_Error ip_splice_open(Ip_Splice *p) {
+  if(pipe(p->pipe) < 0) {
+    return ip_error_last();
+  }
+  // Only a hint, the default of 64K works too
+  fcntl(p->pipe[1], F_SETPIPE_SZ, IP_SPLICE_SIZE);
+  p->pending = 0;
+
+  return IP_ERROR_NONE;
+}
+
+IP_DEF Ip_Error ip_socket_splice(Ip_Socket *s, Ip_Splice *p, Ip_File file, u64 *offset, u64 *moved) {
+  *moved = 0;
+
+  if(p->pending == 0) {
+    long ret = syscall(SYS_splice, s->_socket, NULL, p->pipe[1], NULL,
+		       (size_t) IP_SPLICE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(ret < 0) {
+      if(errno == EINVAL || errno == ENOSYS) {
+	return IP_ERROR_UNSUPPORTED;
+      }
+      return ip_error_last();
+    } else if(ret == 0) {
+      return IP_ERROR_EOF;
+    }
+    p->pending = (u64) ret;
+  }
+
+  while(p->pending > 0) {
+    long long off = (long long) *offset;
+    long ret = syscall(SYS_splice, p->pipe[0], NULL, file, &off,
+		       (size_t) p->pending, SPLICE_F_MOVE);
+    if(ret < 0 && (errno == EINVAL || errno == ENOSYS)) {
+      break;
+    } else if(ret < 0) {
+      return ip_error_last();
+    }
+    p->pending -= (u64) ret;
+    *offset += (u64) ret;
+    *moved += (u64) ret;
+  }
+
+  if(p->pending == 0) {
+    return IP_ERROR_NONE;
+  }
+
+  // 'file' can not be spliced into, what is in the pipe is written by hand
+  u8 buf[4096];
+  while(p->pending > 0) {
+    ssize_t n = p->pending < sizeof(buf) ? p->pending : sizeof(buf);
+    n = read(p->pipe[0], buf, (size_t) n);
+    if(n <= 0 || pwrite(file, buf, (size_t) n, (off_t) *offset) != n) {
+      return ip_error_last();
+    }
+    p->pending -= (u64) n;
+    *offset += (u64) n;
+    *moved += (u64) n;
+  }
+
+  return IP_ERROR_UNSUPPORTED;
+}
+
+IP_DEF void ip_splice_close(Ip_Splice *p) {
+  close(p->pipe[0]);
+  close(p->pipe[1]);
+}
+
 IP_DEF void ip_socket_close(Ip_Socket *s) {
   close(s->_socket);
   s->flags = 0;
@@ -790,24 +1192,30 @@ IP_DEF Ip_Error ip_socket_accept(Ip_Socket *s, Ip_Socket *client, Ip_Address *a)
   client->flags = IP_VALID | IP_CLIENT;
   client->flags |= s->flags & IP_BLOCKING;
   // ip_socket_set_blocking(client, s->flags & IP_BLOCKING);
+  ip_socket_set_nodelay(client, 1);
 
   return IP_ERROR_NONE;
 }
 
 IP_DEF Ip_Error ip_sockets_open(Ip_Sockets *s, u64 n) {
-  s->sockets = IP_ALLOC(n * sizeof(*s->sockets));
-  if(!s->sockets) {
-    return IP_ERROR_ALLOC_FAILED;
-  }
-  s->sockets_count = n;
-  for(u64 i=0;i<s->sockets_count;i++) {
-    s->sockets[i] = ip_socket_invalid();
+  s->chunks = NULL;
+  s->chunks_count = 0;
+  s->sockets_count = 0;
+  s->protocols = NULL;
+  s->protocols_count = 0;
+  s->reserved = 0;
+
+  Ip_Error error = ip_sockets_grow(s, n);
+  if(error != IP_ERROR_NONE) {
+    return error;
   }
 
   s->epfd = epoll_create(1);
   if(s->epfd < 0) {
-    IP_FREE(s->sockets);
-    return ip_error_last();
+    error = ip_error_last();
+    for(u64 i=0;i<s->chunks_count;i++) IP_FREE(s->chunks[i]);
+    if(s->chunks) IP_FREE(s->chunks);
+    return error;
   }
 
   s->ret = -1;
@@ -816,6 +1224,46 @@ IP_DEF Ip_Error ip_sockets_open(Ip_Sockets *s, u64 n) {
   return IP_ERROR_NONE;
 }
 
+IP_DEF Ip_Error ip_sockets_grow(Ip_Sockets *s, u64 n) {
+
+  u64 chunks_count = (n + IP_SOCKETS_CHUNK - 1) / IP_SOCKETS_CHUNK;
+  if(chunks_count <= s->chunks_count) {
+    return IP_ERROR_NONE;
+  }
+
+  Ip_Slot **chunks = IP_ALLOC(chunks_count * sizeof(*chunks) + 1);
+  if(!chunks) {
+    return IP_ERROR_ALLOC_FAILED;
+  }
+  for(u64 i=0;i<chunks_count;i++) {
+    if(i < s->chunks_count) {
+      chunks[i] = s->chunks[i];
+      continue;
+    }
+
+    chunks[i] = IP_ALLOC(IP_SOCKETS_CHUNK * sizeof(**chunks));
+    if(!chunks[i]) {
+      for(u64 j=s->chunks_count;j<i;j++) IP_FREE(chunks[j]);
+      IP_FREE(chunks);
+      return IP_ERROR_ALLOC_FAILED;
+    }
+    for(u64 j=0;j<IP_SOCKETS_CHUNK;j++) {
+      chunks[i][j] = (Ip_Slot) {
+	.socket = ip_socket_invalid(),
+	.protocol = IP_PROTOCOL_NONE,
+	.ctx = NULL,
+      };
+    }
+  }
+  if(s->chunks) IP_FREE(s->chunks);
+
+  s->chunks = chunks;
+  s->chunks_count = chunks_count;
+  s->sockets_count = chunks_count * IP_SOCKETS_CHUNK;
+
+  return IP_ERROR_NONE;
+}
+
 IP_DEF Ip_Error ip_sockets_next(Ip_Sockets *s, u64 *index, Ip_Mode *m) {
 
  repeat:
@@ -857,7 +1305,7 @@ IP_DEF Ip_Error ip_sockets_next(Ip_Sockets *s, u64 *index, Ip_Mode *m) {
   if(ep_event->events & EPOLLOUT) {
     ep_event->events &= ~EPOLLOUT;
 
-    if(s->sockets[*index].flags & IP_WRITING) {
+    if(ip_sockets_get(s, *index)->flags & IP_WRITING) {
       *m = IP_MODE_WRITE;
       return IP_ERROR_NONE;
     }
@@ -872,16 +1320,18 @@ IP_DEF Ip_Error ip_sockets_next(Ip_Sockets *s, u64 *index, Ip_Mode *m) {
 IP_DEF void ip_sockets_close(Ip_Sockets *s) {
 
   for(u64 i=0;i<s->sockets_count;i++) {
-    Ip_Socket *socket = &s->sockets[i];
+    Ip_Socket *socket = ip_sockets_get(s, i);
     if(!(socket->flags & IP_VALID)) continue;
     ip_socket_close(socket);
   }
-  IP_FREE(s->sockets);
+  for(u64 i=0;i<s->chunks_count;i++) IP_FREE(s->chunks[i]);
+  if(s->chunks) IP_FREE(s->chunks);
+  if(s->protocols) IP_FREE(s->protocols);
   close(s->epfd);
 }
 
 IP_DEF Ip_Error ip_sockets_register(Ip_Sockets *s, u64 index) {
-  Ip_Socket *socket = &s->sockets[index];
+  Ip_Socket *socket = ip_sockets_get(s, index);
   if(socket->flags & IP_VALID) {
 
     struct epoll_event ep_event;
@@ -899,7 +1349,7 @@ IP_DEF Ip_Error ip_sockets_register(Ip_Sockets *s, u64 index) {
 #define u64 Ip_u64
     if(epoll_ctl(s->epfd, 
 		 EPOLL_CTL_ADD, 
-		 s->sockets[index]._socket, 
+		 socket->_socket, 
 		 &ep_event) != 0) {
       return ip_error_last();
     } else {
@@ -915,7 +1365,7 @@ IP_DEF Ip_Error ip_sockets_register(Ip_Sockets *s, u64 index) {
 IP_DEF Ip_Error ip_sockets_unregister(Ip_Sockets *s, u64 index) {
   if(epoll_ctl(s->epfd, 
 	       EPOLL_CTL_DEL, 
-	       s->sockets[index]._socket, 
+	       ip_sockets_get(s, index)->_socket, 
 	       NULL) != 0) {
     return ip_error_last();
   }
@@ -925,7 +1375,71 @@ IP_DEF Ip_Error ip_sockets_unregister(Ip_Sockets *s, u64 index) {
 
 
 #endif // _WIN32
-       //
+
+IP_DEF Ip_Error ip_sockets_reserve(Ip_Sockets *s, u64 len, Ip_Handler handler, void *ctx, u64 *off) {
+
+  if(s->reserved + len > s->sockets_count) {
+    Ip_Error error = ip_sockets_grow(s, s->reserved + len);
+    if(error != IP_ERROR_NONE) {
+      return error;
+    }
+  }
+
+  Ip_Protocol *protocols = IP_ALLOC((s->protocols_count + 1) * sizeof(*protocols));
+  if(!protocols) {
+    return IP_ERROR_ALLOC_FAILED;
+  }
+  for(u64 i=0;i<s->protocols_count;i++) {
+    protocols[i] = s->protocols[i];
+  }
+  if(s->protocols) IP_FREE(s->protocols);
+  s->protocols = protocols;
+
+  u64 protocol = s->protocols_count++;
+  s->protocols[protocol] = (Ip_Protocol) {
+    .handler = handler,
+    .ctx = ctx,
+    .off = s->reserved,
+    .len = len,
+  };
+  for(u64 i=0;i<len;i++) {
+    ip_sockets_slot(s, s->reserved + i)->protocol = protocol;
+  }
+
+  *off = s->reserved;
+  s->reserved += len;
+
+  return IP_ERROR_NONE;
+}
+
+IP_DEF Ip_Error ip_sockets_dispatch(Ip_Sockets *s) {
+
+  u64 index;
+  Ip_Mode mode = IP_MODE_READ;
+  Ip_Error error = ip_sockets_next(s, &index, &mode);
+
+  if(error == IP_ERROR_REPEAT) {
+    for(u64 i=0;i<s->protocols_count;i++) {
+      Ip_Protocol *p = &s->protocols[i];
+      p->handler(s, p->ctx, p->off, p->len, error, p->off, mode);
+    }
+    return IP_ERROR_NONE;
+  }
+  if(error != IP_ERROR_NONE) {
+    return error;
+  }
+
+  u64 protocol = ip_sockets_slot(s, index)->protocol;
+  if(protocol == IP_PROTOCOL_NONE) {
+    return IP_ERROR_NONE;
+  }
+
+  Ip_Protocol *p = &s->protocols[protocol];
+  p->handler(s, p->ctx, p->off, p->len, error, index, mode);
+
+  return IP_ERROR_NONE;
+}
+
 #endif // IP_IMPLEMENTATION
 
 #undef u8
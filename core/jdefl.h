@@ -150,6 +150,90 @@ JDEFL_DEF u64 jinflate(u8 *out,
 		       u8 *in,
 		       u64 in_len);
 
+//////////////////////////////////////////////////////////////////
+
+// Streaming zlib (RFC 1950), for data that does not fit into memory at once
+//
+//    jdefl_stream_init(d, JDEFL_LVL_DEF);
+//    u64 n = jdefl_stream_deflate(d, out, in, in_len, JDEFL_FLUSH_NONE);
+//    ...
+//    n = jdefl_stream_deflate(d, out, NULL, 0, JDEFL_FLUSH_FINISH);
+//
+// Matches reach back into earlier calls, up to JDEFL_WIN_SIZ bytes.
+
+#define JDEFL_STREAM_SIZ (1 << 16) // bytes appended to the window at once
+// - bytes 'out' needs for 'n' bytes of input, including a flush
+#define jdefl_stream_bound(n) ((n) + (n)/8 + 32)
+
+typedef enum {
+  JDEFL_FLUSH_NONE = 0,
+  JDEFL_FLUSH_SYNC,   // byte align, everything so far can be inflated
+  JDEFL_FLUSH_FINISH, // end the stream, write the checksum
+} jdefl_flush;
+
+typedef enum {
+  JDEFL_STREAM_HEADER = 0,
+  JDEFL_STREAM_BLOCK,   // a block is open
+  JDEFL_STREAM_FLUSHED, // no block is open
+  JDEFL_STREAM_DONE,
+} jdefl_stream_state;
+
+typedef struct {
+  jdefl j;
+  s32 lvl;
+  jdefl_stream_state state;
+  u32 adler;
+  s32 base; // position of 'buf[0]' in the stream
+  u64 len;
+  u8 buf[JDEFL_WIN_SIZ + JDEFL_STREAM_SIZ + 4];
+} jdefl_stream;
+
+JDEFL_DEF u32 jdefl_adler32(u32 adler, const u8 *p, u64 n);
+
+JDEFL_DEF void jdefl_stream_init(jdefl_stream *d, s32 lvl);
+// - returns the bytes written to 'out', at most 'jdefl_stream_bound(in_len)'
+JDEFL_DEF u64 jdefl_stream_deflate(jdefl_stream *d,
+				   u8 *out,
+				   u8 *in,
+				   u64 in_len,
+				   jdefl_flush flush);
+JDEFL_DEF u8 *jdefl_stream_block(jdefl_stream *d, u8 *q, u64 start, u64 end);
+
+#define JINFL_STREAM_SIZ 4096 // input bytes buffered at once
+#define JINFL_STREAM_OUT JDEFL_MAX_MATCH // the least space 'out' needs
+
+typedef enum {
+  JINFL_STREAM_MORE = 0,
+  JINFL_STREAM_DONE,
+  JINFL_STREAM_ERROR,
+} jinfl_status;
+
+typedef struct {
+  jinfl j;
+  s32 state;
+  s32 last; // the current block is the last one
+  s32 len;  // bytes left in a stored block
+  u32 adler;
+  u64 total;
+  u64 in_pos, in_len;
+  u8 in[JINFL_STREAM_SIZ];
+  u8 win[JDEFL_WIN_SIZ];
+} jinfl_stream;
+
+JDEFL_DEF void jinfl_stream_init(jinfl_stream *s);
+// - consumes '*in', writes at most 'out_len' bytes to 'out', returns
+//   JINFL_STREAM_MORE until the stream is done
+// - 'last': nothing follows '*in', a stream that ends early is an error
+// - call again while it consumes input or writes output
+JDEFL_DEF jinfl_status jinfl_stream_inflate(jinfl_stream *s,
+					    u8 **in,
+					    u64 *in_len,
+					    int last,
+					    u8 *out,
+					    u64 out_len,
+					    u64 *written);
+
+
 #ifdef JDEFL_IMPLEMENTATION
 
 JDEFL_DEF u32 jdefl_uload32(const void *p) {
@@ -168,7 +252,7 @@ JDEFL_DEF u32 jdefl_hash32(const void *p) {
 
 JDEFL_DEF s32 jdefl_ilog2(s32 n) {
 #define lt(n) n,n,n,n, n,n,n,n, n,n,n,n ,n,n,n,n
-  static const u8 tbl[256] = {-1,0,1,1,2,2,2,2,3,3,3,3,
+  static const s8 tbl[256] = {-1,0,1,1,2,2,2,2,3,3,3,3,
 			      3,3,3,3,lt(4),lt(5),lt(5),lt(6),lt(6),lt(6),lt(6),
 			      lt(7),lt(7),lt(7),lt(7),lt(7),lt(7),lt(7),lt(7)
   }; s32 tt, t;
@@ -353,8 +437,9 @@ static const u8 jinfl_mirror[256] = {
 JDEFL_DEF s32 jinfl_build(u32 *tree, u8 *lens, s32 symcnt) {
   s32 n, cnt[16], first[16], codes[16];
   memset(cnt, 0, sizeof(cnt));
-  cnt[0] = first[0] = codes[0] = 0;
   for (n = 0; n < symcnt; ++n) cnt[lens[n]]++;
+  /* unused symbols get no code */
+  cnt[0] = first[0] = codes[0] = 0;
   for (n = 1; n <= 15; n++) {
     codes[n] = (codes[n-1] + cnt[n-1]) << 1;
     first[n] = first[n-1] + cnt[n-1];
@@ -364,7 +449,7 @@ JDEFL_DEF s32 jinfl_build(u32 *tree, u8 *lens, s32 symcnt) {
     if (!len) continue;
     code = codes[len]++;
     slot = first[len]++;
-    tree[slot] = (u32) ((code << (32-len)) | (n << 4) | len);
+    tree[slot] = ((u32) code << (32-len)) | (u32) (n << 4) | (u32) len;
   } return first[15];
 }
 
@@ -387,7 +472,7 @@ JDEFL_DEF s32 jinfl_decode(u8 **in, u8 *end, jinfl *j, u32 *tree, s32 max) {
   /* bsearch next prefix code */
 #define jinfl_rev16(n) ((jinfl_mirror[(n)&0xff] << 8) | jinfl_mirror[((n)>>8)&0xff])
   u32 key, lo = 0, hi = (u32) max;
-  u32 search = (u32) (jinfl_rev16(j->bits) << 16) | 0xffff;
+  u32 search = ((u32) jinfl_rev16(j->bits) << 16) | 0xffff;
   while (lo < hi) {
     u32 guess = (lo + hi) / 2;
     if (search < tree[guess]) hi = guess;
@@ -522,6 +607,469 @@ JDEFL_DEF u64 jinflate(u8 *out,
   return (u64) (out-o);
 }
 
+//////////////////////////////////////////////////////////
+
+JDEFL_DEF u32 jdefl_adler32(u32 adler, const u8 *p, u64 n) {
+  u32 a = adler & 0xffff;
+  u32 b = adler >> 16;
+  while(n > 0) {
+    /* largest k, for which 'b' can not overflow */
+    u64 k = n < 5552 ? n : 5552;
+    n -= k;
+    while(k--) {
+      a += *p++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+JDEFL_DEF void jdefl_stream_init(jdefl_stream *d, s32 lvl) {
+  d->j.bits = d->j.cnt = 0;
+  d->j.i = 0;
+  d->j.max = (u64) -1;
+  for(u64 k=0;k<JDEFL_HASH_SIZ;k++) {
+    d->j.tbl[k] = JDEFL_NIL;
+  }
+
+  if(lvl < JDEFL_LVL_MIN) lvl = JDEFL_LVL_MIN;
+  if(lvl > JDEFL_LVL_MAX) lvl = JDEFL_LVL_MAX;
+  d->lvl = lvl;
+  d->state = JDEFL_STREAM_HEADER;
+  d->adler = 1;
+  d->base = 0;
+  d->len = 0;
+}
+
+JDEFL_DEF u8 *jdefl_stream_block(jdefl_stream *d, u8 *q, u64 start, u64 end) {
+  jdefl *j = &d->j;
+  u8 *in = d->buf;
+  s32 base = d->base;
+  s32 lvl = d->lvl;
+  s32 max_chain = (lvl < 8) ? (1<<(lvl+1)): (1<<13);
+
+  /* like 'jdeflate', with stream positions in 'tbl' and 'prv' */
+  u64 p = start;
+  while (p < end) {
+    s32 run, best_len = 0, dist = 0;
+    s32 pos = base + (s32) p;
+    s32 max_match = ((end-p)>JDEFL_MAX_MATCH) ? JDEFL_MAX_MATCH:(s32) (end-p);
+    if (max_match > JDEFL_MIN_MATCH) {
+      s32 limit = ((pos-JDEFL_WIN_SIZ)<JDEFL_NIL)?JDEFL_NIL:(pos-JDEFL_WIN_SIZ);
+      s32 chain_len = max_chain;
+      s32 i = j->tbl[jdefl_hash32(&in[p])];
+      while (i > limit) {
+	u8 *m = &in[i - base];
+	if (m[best_len] == in[p+best_len] &&
+	    (jdefl_uload32(m) == jdefl_uload32(&in[p]))){
+	  s32 n = JDEFL_MIN_MATCH;
+	  while (n < max_match && m[n] == in[p+n]) n++;
+	  if (n > best_len) {
+	    best_len = n;
+	    dist = pos - i;
+	    if (n == max_match)
+	      break;
+	  }
+	}
+	if (!(--chain_len)) break;
+	i = j->prv[i&JDEFL_WIN_MSK];
+      }
+    }
+    if (lvl >= 5 && best_len >= JDEFL_MIN_MATCH && best_len < max_match){
+      const s32 x = pos + 1;
+      s32 tar_len = best_len + 1;
+      s32 limit = ((x-JDEFL_WIN_SIZ)<JDEFL_NIL)?JDEFL_NIL:(x-JDEFL_WIN_SIZ);
+      s32 chain_len = max_chain;
+      s32 i = j->tbl[jdefl_hash32(&in[p])];
+      while (i > limit) {
+	u8 *m = &in[i - base];
+	if (m[best_len] == in[p+1+best_len] &&
+	    (jdefl_uload32(m) == jdefl_uload32(&in[p+1]))){
+	  s32 n = JDEFL_MIN_MATCH;
+	  while (n < tar_len && m[n] == in[p+1+n]) n++;
+	  if (n == tar_len) {
+	    best_len = 0;
+	    break;
+	  }
+	}
+	if (!(--chain_len)) break;
+	i = j->prv[i&JDEFL_WIN_MSK];
+      }
+    }
+    if (best_len >= JDEFL_MIN_MATCH) {
+      q = jdefl_match(q, j, dist, best_len);
+      run = best_len;
+    } else {
+      q = jdefl_lit(q, j, in[p]);
+      run = 1;
+    }
+    while (run-- != 0) {
+      unsigned h = jdefl_hash32(&in[p]);
+      j->prv[pos&JDEFL_WIN_MSK] = j->tbl[h];
+      j->tbl[h] = pos++;
+      p++;
+    }
+  }
+  return q;
+}
+
+JDEFL_DEF u64 jdefl_stream_deflate(jdefl_stream *d,
+				   u8 *out,
+				   u8 *in,
+				   u64 in_len,
+				   jdefl_flush flush) {
+  jdefl *j = &d->j;
+  u8 *q = out;
+
+  if(d->state == JDEFL_STREAM_DONE) {
+    return 0;
+  }
+
+  if(d->state == JDEFL_STREAM_HEADER) {
+    /* CMF: deflate, 32K window. FLG: the level, (CMF*256 + FLG) % 31 == 0 */
+    static const u8 flg[JDEFL_LVL_MAX + 1] = {0x01,0x01,0x5E,0x5E,0x5E,0x5E,0x9C,0x9C,0xDA};
+    *q++ = 0x78;
+    *q++ = flg[d->lvl];
+    d->state = JDEFL_STREAM_FLUSHED;
+  }
+
+  while(in_len > 0) {
+    u64 n = in_len < JDEFL_STREAM_SIZ ? in_len : JDEFL_STREAM_SIZ;
+
+    if(d->len + n > JDEFL_WIN_SIZ + JDEFL_STREAM_SIZ) {
+      /* keep the last window, for matches */
+      u64 drop = d->len - JDEFL_WIN_SIZ;
+      memmove(d->buf, d->buf + drop, JDEFL_WIN_SIZ);
+      d->base += (s32) drop;
+      d->len = JDEFL_WIN_SIZ;
+    }
+
+    if((u64) d->base + d->len + n > (1u << 30)) {
+      /* rebase, by a multiple of the window, to keep 'prv' intact */
+      s32 shift = d->base & ~JDEFL_WIN_MSK;
+      for(u64 k=0;k<JDEFL_HASH_SIZ;k++) {
+	j->tbl[k] = (j->tbl[k] < shift) ? JDEFL_NIL : j->tbl[k] - shift;
+      }
+      for(u64 k=0;k<JDEFL_WIN_SIZ;k++) {
+	j->prv[k] = (j->prv[k] < shift) ? JDEFL_NIL : j->prv[k] - shift;
+      }
+      d->base -= shift;
+    }
+
+    memcpy(d->buf + d->len, in, n);
+    d->adler = jdefl_adler32(d->adler, in, n);
+
+    if(d->state != JDEFL_STREAM_BLOCK) {
+      q = jdefl_put(q, j, 0x00, 1); /* block, not the last one */
+      q = jdefl_put(q, j, 0x01, 2); /* static huffman */
+      d->state = JDEFL_STREAM_BLOCK;
+    }
+    q = jdefl_stream_block(d, q, d->len, d->len + n);
+    d->len += n;
+
+    in += n;
+    in_len -= n;
+  }
+
+  if(flush != JDEFL_FLUSH_NONE && d->state == JDEFL_STREAM_BLOCK) {
+    q = jdefl_put(q, j, 0, 7); /* end of block */
+    d->state = JDEFL_STREAM_FLUSHED;
+  }
+
+  if(flush == JDEFL_FLUSH_SYNC) {
+    /* empty stored block */
+    q = jdefl_put(q, j, 0x00, 3);
+    if(j->cnt > 0) q = jdefl_put(q, j, 0, 8 - j->cnt);
+    q = jdefl_put(q, j, 0x0000, 16);
+    q = jdefl_put(q, j, 0xFFFF, 16);
+
+  } else if(flush == JDEFL_FLUSH_FINISH) {
+    /* empty last block */
+    q = jdefl_put(q, j, 0x01, 1);
+    q = jdefl_put(q, j, 0x01, 2);
+    q = jdefl_put(q, j, 0, 7);
+    if(j->cnt > 0) q = jdefl_put(q, j, 0, 8 - j->cnt);
+
+    *q++ = (u8) (d->adler >> 24);
+    *q++ = (u8) (d->adler >> 16);
+    *q++ = (u8) (d->adler >> 8);
+    *q++ = (u8) d->adler;
+    d->state = JDEFL_STREAM_DONE;
+  }
+
+  return (u64) (q - out);
+}
+
+enum jinfl_stream_states {
+  JINFL_STREAM_HDR = 0, JINFL_STREAM_BLOCK, JINFL_STREAM_STORED,
+  JINFL_STREAM_DYN, JINFL_STREAM_BLK, JINFL_STREAM_TRAILER, JINFL_STREAM_END
+};
+
+JDEFL_DEF void jinfl_stream_init(jinfl_stream *s) {
+  memset(&s->j, 0, sizeof(s->j));
+  s->state = JINFL_STREAM_HDR;
+  s->last = 0;
+  s->len = 0;
+  s->adler = 1;
+  s->total = 0;
+  s->in_pos = 0;
+  s->in_len = 0;
+}
+
+JDEFL_DEF jinfl_status jinfl_stream_inflate(jinfl_stream *s,
+					    u8 **in,
+					    u64 *in_len,
+					    int last,
+					    u8 *out,
+					    u64 out_len,
+					    u64 *written) {
+  static const s16 dbase[30+2] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
+				  257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+  static const u8 dbits[30+2] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,
+				 10,10,11,11,12,12,13,13,0,0};
+  static const s16 lbase[29+2] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,
+				  43,51,59,67,83,99,115,131,163,195,227,258,0,0};
+  static const u8 lbits[29+2] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,
+				 4,4,4,5,5,5,5,0,0,0};
+  static const s8 order[] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+
+#define jinfl_stream_put(c) (*o++ = s->win[s->total++ & JDEFL_WIN_MSK] = (u8) (c))
+
+  jinfl *j = &s->j;
+  u8 *o = out, *oe = out + out_len;
+  u8 *a = out; /* output, that is not in 's->adler' yet */
+  jinfl_status status = JINFL_STREAM_MORE;
+
+  while(status == JINFL_STREAM_MORE) {
+
+    /* take in, what fits */
+    if(s->in_pos > 0) {
+      memmove(s->in, s->in + s->in_pos, s->in_len - s->in_pos);
+      s->in_len -= s->in_pos;
+      s->in_pos = 0;
+    }
+    u64 n = sizeof(s->in) - s->in_len;
+    if(n > *in_len) n = *in_len;
+    memcpy(s->in + s->in_len, *in, n);
+    s->in_len += n;
+    *in += n;
+    *in_len -= n;
+
+    int eof = last && *in_len == 0;
+    u8 *p = s->in, *e = s->in + s->in_len;
+    int step = 1, starved = 0;
+    while(step) {
+      u64 avail = (u64) (e - p);
+
+      /* bits for the longest step, but the dynamic header */
+      if(s->state != JINFL_STREAM_HDR && s->state != JINFL_STREAM_STORED) {
+	if(avail < 8 && !eof) {
+	  starved = 1;
+	  break;
+	}
+	if(avail == 0 && j->bitcnt == 0) {
+	  status = JINFL_STREAM_ERROR;
+	  break;
+	}
+	jinfl_get(&p, e, j, 0);
+      }
+
+      switch(s->state) {
+      case JINFL_STREAM_HDR: {
+	if(avail < 2) {
+	  if(eof) status = JINFL_STREAM_ERROR;
+	  starved = 1;
+	  step = 0;
+	  break;
+	}
+	/* deflate, no preset dictionary */
+	u32 cmf = p[0], flg = p[1];
+	if((cmf & 0x0f) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20)) {
+	  status = JINFL_STREAM_ERROR;
+	  break;
+	}
+	p += 2;
+	s->state = JINFL_STREAM_BLOCK;
+      } break;
+      case JINFL_STREAM_BLOCK: {
+	s->last = jinfl_get(&p, e, j, 1);
+	s32 type = jinfl_get(&p, e, j, 2);
+	if(type == 0x00) {
+	  jinfl_get(&p, e, j, j->bitcnt & 7);
+	  s32 len = jinfl_get(&p, e, j, 16);
+	  s32 nlen = jinfl_get(&p, e, j, 16);
+	  if(len != (~nlen & 0xffff)) {
+	    status = JINFL_STREAM_ERROR;
+	    break;
+	  }
+	  s->len = len;
+	  s->state = JINFL_STREAM_STORED;
+	} else if(type == 0x01) {
+	  s32 k; u8 lens[288+32];
+	  for (k = 0; k <= 143; k++) lens[k] = 8;
+	  for (k = 144; k <= 255; k++) lens[k] = 9;
+	  for (k = 256; k <= 279; k++) lens[k] = 7;
+	  for (k = 280; k <= 287; k++) lens[k] = 8;
+	  for (k = 0; k < 32; k++) lens[288+k] = 5;
+	  j->tlit  = jinfl_build(j->lits, lens, 288);
+	  j->tdist = jinfl_build(j->dsts, lens + 288, 32);
+	  s->state = JINFL_STREAM_BLK;
+	} else if(type == 0x02) {
+	  s->state = JINFL_STREAM_DYN;
+	} else {
+	  status = JINFL_STREAM_ERROR;
+	}
+      } break;
+      case JINFL_STREAM_STORED: {
+	if(s->len == 0) {
+	  s->state = s->last ? JINFL_STREAM_TRAILER : JINFL_STREAM_BLOCK;
+	  break;
+	}
+	if(o == oe) {
+	  step = 0;
+	  break;
+	}
+	/* bytes in the bit buffer first, the stream is byte aligned */
+	if(j->bitcnt >= 8) {
+	  jinfl_stream_put(j->bits & 0xff);
+	  j->bits >>= 8;
+	  j->bitcnt -= 8;
+	  s->len--;
+	  break;
+	}
+	if(avail == 0) {
+	  if(eof) status = JINFL_STREAM_ERROR;
+	  starved = 1;
+	  step = 0;
+	  break;
+	}
+	u64 k = (u64) s->len;
+	if(k > avail) k = avail;
+	if(k > (u64) (oe - o)) k = (u64) (oe - o);
+	for(u64 m=0;m<k;m++) jinfl_stream_put(p[m]);
+	p += k;
+	s->len -= (s32) k;
+      } break;
+      case JINFL_STREAM_DYN: {
+	/* the longest header is about 560 bytes */
+	if(avail < 640 && !eof) {
+	  starved = 1;
+	  step = 0;
+	  break;
+	}
+	s32 k, i, nlit, ndist, nlen;
+	u8 nlens[19] = {0}, lens[288+32];
+	nlit = 257 + jinfl_get(&p, e, j, 5);
+	ndist = 1 + jinfl_get(&p, e, j, 5);
+	nlen = 4 + jinfl_get(&p, e, j, 4);
+	if(nlit > 286 || ndist > 30) {
+	  status = JINFL_STREAM_ERROR;
+	  break;
+	}
+	for (k = 0; k < nlen; k++)
+	  nlens[(s32) order[k]] = (u8) jinfl_get(&p, e, j, 3);
+	j->tlen = jinfl_build(j->lens, nlens, 19);
+	if(j->tlen == 0) {
+	  status = JINFL_STREAM_ERROR;
+	  break;
+	}
+
+	/* decode code lengths */
+	for (k = 0; k < nlit + ndist && status == JINFL_STREAM_MORE;) {
+	  s32 sym = jinfl_decode(&p, e, j, j->lens, j->tlen);
+	  s32 rep = 0, val = 0;
+	  switch (sym) {default: lens[k++] = (u8) sym; break;
+	  case 16:
+	    if(k == 0) status = JINFL_STREAM_ERROR;
+	    else rep = 3+jinfl_get(&p, e, j, 2), val = lens[k-1];
+	    break;
+	  case 17: rep = 3+jinfl_get(&p, e, j, 3); break;
+	  case 18: rep = 11+jinfl_get(&p, e, j, 7); break;}
+	  if(k + rep > nlit + ndist) status = JINFL_STREAM_ERROR;
+	  for(i=0;i<rep && status == JINFL_STREAM_MORE;i++) lens[k++] = (u8) val;
+	}
+	if(status != JINFL_STREAM_MORE) break;
+
+	/* build lit/dist trees */
+	j->tlit  = jinfl_build(j->lits, lens, nlit);
+	j->tdist = jinfl_build(j->dsts, lens+nlit, ndist);
+	if(j->tlit == 0) {
+	  status = JINFL_STREAM_ERROR;
+	  break;
+	}
+	s->state = JINFL_STREAM_BLK;
+      } break;
+      case JINFL_STREAM_BLK: {
+	if(oe - o < JINFL_STREAM_OUT) {
+	  step = 0;
+	  break;
+	}
+	s32 sym = jinfl_decode(&p, e, j, j->lits, j->tlit);
+	if (sym > 256) {sym -= 257; /* match symbol */
+	  if(sym >= 29 || j->tdist == 0) {
+	    status = JINFL_STREAM_ERROR;
+	    break;
+	  }
+	  s32 len = jinfl_get(&p, e, j, lbits[sym]) + lbase[sym];
+	  s32 dsym = jinfl_decode(&p, e, j, j->dsts, j->tdist);
+	  if(dsym >= 30) {
+	    status = JINFL_STREAM_ERROR;
+	    break;
+	  }
+	  u64 offs = (u64) jinfl_get(&p, e, j, dbits[dsym]) + dbase[dsym];
+	  if (offs > s->total) {
+	    status = JINFL_STREAM_ERROR;
+	    break;
+	  }
+	  while (len--) {
+	    u8 c = s->win[(s->total - offs) & JDEFL_WIN_MSK];
+	    jinfl_stream_put(c);
+	  }
+	} else if (sym == 256) {
+	  s->state = s->last ? JINFL_STREAM_TRAILER : JINFL_STREAM_BLOCK;
+	} else {
+	  jinfl_stream_put(sym);
+	}
+      } break;
+      case JINFL_STREAM_TRAILER: {
+	jinfl_get(&p, e, j, j->bitcnt & 7);
+	u32 adler = (u32) jinfl_get(&p, e, j, 8) << 24;
+	adler |= (u32) jinfl_get(&p, e, j, 8) << 16;
+	adler |= (u32) jinfl_get(&p, e, j, 8) << 8;
+	adler |= (u32) jinfl_get(&p, e, j, 8);
+
+	s->adler = jdefl_adler32(s->adler, a, (u64) (o - a));
+	a = o;
+	s->state = JINFL_STREAM_END;
+	status = adler == s->adler ? JINFL_STREAM_DONE : JINFL_STREAM_ERROR;
+      } break;
+      case JINFL_STREAM_END: {
+	status = JINFL_STREAM_DONE;
+      } break;
+      default:
+	status = JINFL_STREAM_ERROR;
+      }
+
+      if(status != JINFL_STREAM_MORE) {
+	step = 0;
+      }
+    }
+    s->in_pos = (u64) (p - s->in);
+
+    /* more input only helps, if it was missing */
+    if(!starved || *in_len == 0) {
+      break;
+    }
+  }
+
+  s->adler = jdefl_adler32(s->adler, a, (u64) (o - a));
+  *written = (u64) (o - out);
+  return status;
+#undef jinfl_stream_put
+}
+
 #endif // JDEFL_IMPLEMENTATION
 
 #undef u8
@@ -0,0 +1,189 @@
+#ifndef SHA1_H_
+#define SHA1_H_
+
+// https://www.ietf.org/rfc/rfc3174.txt
+
+// MIT License
+// 
+// Copyright (c) 2024 Justin Schartner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <string.h>
+
+typedef unsigned char Sha1_u8;
+typedef unsigned int Sha1_u32;
+typedef unsigned long long int Sha1_u64;
+
+#define u8 Sha1_u8
+#define u32 Sha1_u32
+#define u64 Sha1_u64
+
+#ifndef SHA1_DEF
+#  define SHA1_DEF static inline
+#endif // SHA1_DEF
+
+#define SHA1_CONTEXT_WINDOW_SIZE (512 / 8)
+#define SHA1_DIGEST_LEN 20
+
+typedef struct { u8 bs[SHA1_DIGEST_LEN]; } Sha1;
+
+#define Sha1_fmt "%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x"
+#define Sha1_arg(m) \
+  (m).bs[0], (m).bs[1], (m).bs[2], (m).bs[3], (m).bs[4],	\
+    (m).bs[5], (m).bs[6], (m).bs[7], (m).bs[8], (m).bs[9],	\
+    (m).bs[10], (m).bs[11], (m).bs[12], (m).bs[13], (m).bs[14],	\
+    (m).bs[15], (m).bs[16], (m).bs[17], (m).bs[18], (m).bs[19]
+
+typedef struct {
+  u64 len;
+  u8 window[SHA1_CONTEXT_WINDOW_SIZE];
+  u32 state[5];
+} Sha1_Context;
+
+#define Sha1_Context_base() (Sha1_Context) { .len = 0, .window = {0}, .state = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 } }
+
+SHA1_DEF void sha1_context_process_impl(Sha1_Context *self);
+SHA1_DEF void sha1_context_process(Sha1_Context *self, u8 *data, u64 data_len);
+SHA1_DEF Sha1 sha1_context_finalize(Sha1_Context *self);
+
+SHA1_DEF Sha1 sha1(u8 *data, u64 data_len);
+
+#ifdef SHA1_IMPLEMENTATION
+
+#define SHA1_ROTATE(X, N) (((X) << (N)) | ((X) >> (32 - (N))))
+
+SHA1_DEF void sha1_context_process_impl(Sha1_Context *self) {
+
+  u32 w[80];
+  for(u32 i=0;i<16;i++) {
+    w[i] =
+      ((u32) self->window[i*4 + 0] << 24) |
+      ((u32) self->window[i*4 + 1] << 16) |
+      ((u32) self->window[i*4 + 2] <<  8) |
+      ((u32) self->window[i*4 + 3] <<  0);
+  }
+  for(u32 i=16;i<80;i++) {
+    u32 x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+    w[i] = SHA1_ROTATE(x, 1);
+  }
+
+  u32 a = self->state[0];
+  u32 b = self->state[1];
+  u32 c = self->state[2];
+  u32 d = self->state[3];
+  u32 e = self->state[4];
+
+  for(u32 i=0;i<80;i++) {
+
+    u32 f, k;
+    switch(i / 20) {
+    case 0:
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+      break;
+    case 1:
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+      break;
+    case 2:
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+      break;
+    default:
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+      break;
+    }
+
+    u32 temp = SHA1_ROTATE(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = SHA1_ROTATE(b, 30);
+    b = a;
+    a = temp;
+  }
+
+  self->state[0] += a;
+  self->state[1] += b;
+  self->state[2] += c;
+  self->state[3] += d;
+  self->state[4] += e;
+}
+
+SHA1_DEF void sha1_context_process(Sha1_Context *self, u8 *data, u64 data_len) {
+  u64 relative_pos = self->len % 64;
+
+  u64 off = 0;
+  while(off < data_len) {
+    u64 len = 64 - relative_pos;
+    if(data_len < off + len) len = data_len - off;
+    memcpy(self->window + relative_pos, data + off, len);
+    self->len += len;
+    off += len;
+    relative_pos += len;
+    if(relative_pos == 64) {
+      sha1_context_process_impl(self);
+      relative_pos = 0;
+    }
+  }
+}
+
+SHA1_DEF Sha1 sha1_context_finalize(Sha1_Context *self) {
+  u64 relative_pos = self->len % 64;
+  u64 bits = self->len * 8;
+
+  Sha1_Context temp = *self;
+
+  temp.window[relative_pos++] = 0x80;
+  if(relative_pos > SHA1_CONTEXT_WINDOW_SIZE - 8) {
+    memset(temp.window + relative_pos, 0, SHA1_CONTEXT_WINDOW_SIZE - relative_pos);
+    sha1_context_process_impl(&temp);
+    relative_pos = 0;
+  }
+  memset(temp.window + relative_pos, 0, SHA1_CONTEXT_WINDOW_SIZE - 8 - relative_pos);
+  for(u32 i=0;i<8;i++) {
+    temp.window[SHA1_CONTEXT_WINDOW_SIZE - 1 - i] = (u8) (bits >> (i * 8));
+  }
+  sha1_context_process_impl(&temp);
+
+  Sha1 digest;
+  for(u32 i=0;i<5;i++) {
+    digest.bs[i*4 + 0] = (u8) (temp.state[i] >> 24);
+    digest.bs[i*4 + 1] = (u8) (temp.state[i] >> 16);
+    digest.bs[i*4 + 2] = (u8) (temp.state[i] >>  8);
+    digest.bs[i*4 + 3] = (u8) (temp.state[i] >>  0);
+  }
+
+  return digest;
+}
+
+SHA1_DEF Sha1 sha1(u8 *data, u64 data_len) {
+  Sha1_Context context = Sha1_Context_base();
+  sha1_context_process(&context, data, data_len);
+  return sha1_context_finalize(&context);
+}
+
+#endif // SHA1_IMPLEMENTATION
+
+#undef u8
+#undef u32
+#undef u64
+
+#endif // SHA1_H_
@@ -0,0 +1,337 @@
+#ifndef WS_H
+#define WS_H
+
+// https://www.rfc-editor.org/rfc/rfc6455
+
+// MIT License
+// 
+// Copyright (c) 2024 Justin Schartner
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+#endif
+
+#ifdef WS_IMPLEMENTATION
+#  define SHA1_IMPLEMENTATION
+#  define B64_IMPLEMENTATION
+#endif // WS_IMPLEMENTATION
+
+#include <core/sha1.h>
+#include <core/b64.h>
+
+typedef unsigned char Ws_u8;
+typedef int Ws_s32;
+typedef unsigned int Ws_u32;
+typedef unsigned long long Ws_u64;
+#define u8 Ws_u8
+#define s32 Ws_s32
+#define u32 Ws_u32
+#define u64 Ws_u64
+
+#ifndef WS_DEF
+#  define WS_DEF static inline
+#endif // WS_DEF
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_ACCEPT_LEN 28
+#define WS_HEADER_CAP 14
+#define WS_CONTROL_CAP 125
+
+typedef enum {
+  WS_OPCODE_CONTINUATION = 0x0,
+  WS_OPCODE_TEXT         = 0x1,
+  WS_OPCODE_BINARY       = 0x2,
+  WS_OPCODE_CLOSE        = 0x8,
+  WS_OPCODE_PING         = 0x9,
+  WS_OPCODE_PONG         = 0xa,
+} Ws_Opcode;
+
+#define ws_opcode_is_control(o) (((o) & 0x8) != 0)
+
+#define WS_CLOSE_NORMAL         1000
+#define WS_CLOSE_GOING_AWAY     1001
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_TOO_BIG        1009
+
+#define WS_STATE_HEADER  0
+#define WS_STATE_PAYLOAD 1
+#define WS_STATE_END     2
+
+typedef struct {
+  s32 state;
+
+  u8 header[WS_HEADER_CAP];
+  u64 header_len;
+  u64 header_need;
+
+  // Current frame
+  int fin;
+  Ws_Opcode opcode;
+  int masked;
+  u8 mask[4];
+  u64 payload_len;
+  u64 payload_off;
+
+  // Output of 'WS_EVENT_PAYLOAD', already unmasked
+  u8 *body_data;
+  u64 body_len;
+} Ws;
+
+#define ws_default() (Ws) {			\
+    .state = WS_STATE_HEADER,			\
+      .header_len = 0,				\
+      .header_need = 2,				\
+      .body_data = NULL,			\
+      .body_len = 0,				\
+      }
+
+typedef enum {
+  WS_EVENT_NOTHING = 0,
+  WS_EVENT_ERROR,
+  WS_EVENT_FRAME,     // header of a frame is parsed
+  WS_EVENT_PAYLOAD,   // 'body_data'/'body_len' hold (a part of) the payload
+  WS_EVENT_FRAME_END, // the frame is complete
+} Ws_Event;
+
+// - consume bytes from 'data', unmasks the payload in place
+// - returns WS_EVENT_NOTHING, once 'data' is exhausted
+WS_DEF Ws_Event ws_process(Ws *w, u8 **data, u64 *len);
+
+// - xor 'data' with 'mask', 'off' is the position inside of the payload
+WS_DEF void ws_unmask(u8 *data, u64 len, u8 mask[4], u64 off);
+
+// - write an unmasked (server to client) frame-header into 'out'
+// - returns the length of the header
+WS_DEF u64 ws_frame_header(u8 out[WS_HEADER_CAP], int fin, Ws_Opcode opcode, u64 payload_len);
+
+// - compute 'Sec-WebSocket-Accept' for the 'Sec-WebSocket-Key' 'key'
+WS_DEF void ws_accept(u8 *key, u64 key_len, u8 out[WS_ACCEPT_LEN]);
+
+#ifdef WS_IMPLEMENTATION
+
+WS_DEF void ws_unmask(u8 *data, u64 len, u8 mask[4], u64 off) {
+
+  u8 m[4];
+  for(u64 j=0;j<4;j++) {
+    m[j] = mask[(off + j) & 0x3];
+  }
+  u32 key;
+  memcpy(&key, m, sizeof(key));
+
+  // Every step below consumes a multiple of 4 bytes, so 'm' stays aligned
+  // with the payload when falling through to the next (smaller) width.
+  u64 i = 0;
+
+#if defined(__AVX2__)
+  __m256i key256 = _mm256_set1_epi32((int) key);
+  for(;i + 32 <= len;i+=32) {
+    __m256i v = _mm256_loadu_si256((__m256i *) (data + i));
+    _mm256_storeu_si256((__m256i *) (data + i), _mm256_xor_si256(v, key256));
+  }
+#endif // __AVX2__
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+  __m128i key128 = _mm_set1_epi32((int) key);
+  for(;i + 16 <= len;i+=16) {
+    __m128i v = _mm_loadu_si128((__m128i *) (data + i));
+    _mm_storeu_si128((__m128i *) (data + i), _mm_xor_si128(v, key128));
+  }
+#endif // __SSE2__
+
+  u64 key64 = (u64) key | ((u64) key << 32);
+  for(;i + 8 <= len;i+=8) {
+    u64 v;
+    memcpy(&v, data + i, sizeof(v));
+    v ^= key64;
+    memcpy(data + i, &v, sizeof(v));
+  }
+
+  for(;i<len;i++) {
+    data[i] ^= m[i & 0x3];
+  }
+}
+
+WS_DEF Ws_Event ws_process(Ws *w, u8 **_data, u64 *_len) {
+
+  u8 *data = *_data;
+  u64 len = *_len;
+
+  switch(w->state) {
+
+  case WS_STATE_HEADER: {
+    if(len == 0) {
+      return WS_EVENT_NOTHING;
+    }
+
+    u64 i = 0;
+    while(i < len && w->header_len < w->header_need) {
+      w->header[w->header_len++] = data[i++];
+
+      if(w->header_len == 2) {
+	u8 len7 = w->header[1] & 0x7f;
+	w->header_need = 2;
+	if(len7 == 126) {
+	  w->header_need += 2;
+	} else if(len7 == 127) {
+	  w->header_need += 8;
+	}
+	if(w->header[1] & 0x80) {
+	  w->header_need += 4;
+	}
+      }
+    }
+    *_data = data + i;
+    *_len = len - i;
+
+    if(w->header_len < w->header_need) {
+      return WS_EVENT_NOTHING;
+    }
+
+    u8 b0 = w->header[0];
+    u8 b1 = w->header[1];
+    w->fin = (b0 & 0x80) != 0;
+    w->opcode = (Ws_Opcode) (b0 & 0x0f);
+    w->masked = (b1 & 0x80) != 0;
+
+    u64 off = 2;
+    u64 payload_len = b1 & 0x7f;
+    if(payload_len == 126) {
+      payload_len = ((u64) w->header[2] << 8) | (u64) w->header[3];
+      off += 2;
+    } else if(payload_len == 127) {
+      payload_len = 0;
+      for(u64 j=0;j<8;j++) {
+	payload_len = (payload_len << 8) | (u64) w->header[2 + j];
+      }
+      off += 8;
+    }
+    if(w->masked) {
+      memcpy(w->mask, w->header + off, 4);
+    }
+    w->payload_len = payload_len;
+    w->payload_off = 0;
+
+    w->header_len = 0;
+    w->header_need = 2;
+
+    if(b0 & 0x70) {
+      // reserved bits, no extensions are negotiated
+      return WS_EVENT_ERROR;
+    }
+    switch(w->opcode) {
+    case WS_OPCODE_CONTINUATION:
+    case WS_OPCODE_TEXT:
+    case WS_OPCODE_BINARY:
+      break;
+    case WS_OPCODE_CLOSE:
+    case WS_OPCODE_PING:
+    case WS_OPCODE_PONG:
+      if(!w->fin || w->payload_len > WS_CONTROL_CAP) {
+	return WS_EVENT_ERROR;
+      }
+      break;
+    default:
+      return WS_EVENT_ERROR;
+    }
+
+    if(w->payload_len == 0) {
+      w->state = WS_STATE_END;
+    } else {
+      w->state = WS_STATE_PAYLOAD;
+    }
+    return WS_EVENT_FRAME;
+  } break;
+
+  case WS_STATE_PAYLOAD: {
+    if(len == 0) {
+      return WS_EVENT_NOTHING;
+    }
+
+    u64 n = w->payload_len - w->payload_off;
+    if(n > len) n = len;
+
+    if(w->masked) {
+      ws_unmask(data, n, w->mask, w->payload_off);
+    }
+    w->body_data = data;
+    w->body_len = n;
+    w->payload_off += n;
+    if(w->payload_off == w->payload_len) {
+      w->state = WS_STATE_END;
+    }
+
+    *_data = data + n;
+    *_len = len - n;
+    return WS_EVENT_PAYLOAD;
+  } break;
+
+  case WS_STATE_END: {
+    w->state = WS_STATE_HEADER;
+    return WS_EVENT_FRAME_END;
+  } break;
+
+  default:
+    return WS_EVENT_ERROR;
+  }
+
+}
+
+WS_DEF u64 ws_frame_header(u8 out[WS_HEADER_CAP], int fin, Ws_Opcode opcode, u64 payload_len) {
+  u64 len = 0;
+  out[len++] = (u8) ((fin ? 0x80 : 0x00) | (opcode & 0x0f));
+  if(payload_len < 126) {
+    out[len++] = (u8) payload_len;
+  } else if(payload_len <= 0xffff) {
+    out[len++] = 126;
+    out[len++] = (u8) (payload_len >> 8);
+    out[len++] = (u8) (payload_len & 0xff);
+  } else {
+    out[len++] = 127;
+    for(s32 j=7;j>=0;j--) {
+      out[len++] = (u8) (payload_len >> (j * 8));
+    }
+  }
+  return len;
+}
+
+WS_DEF void ws_accept(u8 *key, u64 key_len, u8 out[WS_ACCEPT_LEN]) {
+  static u8 guid[] = WS_GUID;
+
+  Sha1_Context context = Sha1_Context_base();
+  sha1_context_process(&context, key, key_len);
+  sha1_context_process(&context, guid, sizeof(guid) - 1);
+  Sha1 digest = sha1_context_finalize(&context);
+
+  base64_encode(out, WS_ACCEPT_LEN, digest.bs, SHA1_DIGEST_LEN);
+}
+
+#endif // WS_IMPLEMENTATION
+
+#undef u8
+#undef s32
+#undef u32
+#undef u64
+
+#endif // WS_H
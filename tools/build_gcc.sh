@@ -5,6 +5,8 @@ mkdir bin 2> /dev/null
 FLAGS=
 
 gcc $FLAGS -o bin/fttp src/fttp.c
+gcc $FLAGS -o bin/http_bench src/http_bench.c
+gcc $FLAGS -o bin/check src/check.c
 # gcc $FLAGS -o bin/shot src/shot.c
 gcc $FLAGS -o bin/color_picker src/color_picker.c -lGLX -lX11 -lGL -lm
 gcc $FLAGS -o bin/music_player src/music_player.c -lasound -lm
@@ -5,6 +5,8 @@ set FLAGS=
 
 gcc %FLAGS% -o bin\shot src\shot.c
 gcc %FLAGS% -o bin\fttp src\fttp.c -lws2_32
+gcc %FLAGS% -o bin\http_bench src\http_bench.c
+gcc %FLAGS% -o bin\check src\check.c
 gcc %FLAGS% -o bin\color_picker src\color_picker.c -lgdi32 -lopengl32
 gcc %FLAGS% -o bin\music_player src\music_player.c -lole32 -lxaudio2_8
 gcc %FLAGS% -o bin\image_converter src\image_converter.c
@@ -5,6 +5,8 @@ set FLAGS=
 
 cl %FLAGS% /Fe:bin\shot src\shot.c
 cl %FLAGS% /Fe:bin\fttp src\fttp.c ws2_32.lib Iphlpapi.lib
+cl %FLAGS% /Fe:bin\http_bench src\http_bench.c
+cl %FLAGS% /Fe:bin\check src\check.c
 cl %FLAGS% /Fe:bin\color_picker src\color_picker.c gdi32.lib user32.lib opengl32.lib
 cl %FLAGS% /Fe:bin\music_player src\music_player.c ole32.lib
 cl %FLAGS% /Fe:bin\image_converter src\image_converter.c
@@ -0,0 +1,285 @@
+#include <stdio.h>
+
+#include <core/types.h>
+
+#define HTTP2_IMPLEMENTATION
+#include <core/http2.h>
+
+#define JDEFL_IMPLEMENTATION
+#include <core/jdefl.h>
+
+#define FS_IMPLEMENTATION
+#include <core/fs.h>
+
+#define CO_IMPLEMENTATION
+#include <core/co.h>
+
+#define IP_IMPLEMENTATION
+#include <core/ip.h>
+
+// Regression checks of the core headers, that need no network
+//
+//   check        run every check, exits with 1 if one fails
+//
+// Build with -fsanitize=address, most of them are about memory.
+
+static int failed = 0;
+
+#define check(cond) do{							\
+    if(!(cond)) {							\
+      fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); \
+      failed = 1;							\
+    }									\
+  }while(0)
+
+// Appends a literal with incremental indexing, the name from 'index'
+// or, if 0, from 'name'
+u64 hpack_literal(u8 *out, u64 index, char *name, u8 c, u64 value_len) {
+  u64 n = http2_hpack_integer_encode(out, 0x40, 6, index);
+  if(index == 0) {
+    u64 name_len = strlen(name);
+    n += http2_hpack_integer_encode(out + n, 0x00, 7, name_len);
+    memcpy(out + n, name, name_len);
+    n += name_len;
+  }
+  n += http2_hpack_integer_encode(out + n, 0x00, 7, value_len);
+  memset(out + n, c, value_len);
+  return n + value_len;
+}
+
+// The name of a literal is the dynamic entry, that inserting it evicts
+void check_hpack_eviction(void) {
+  static u8 block[3 * HTTP2_HEADER_TABLE_SIZE];
+  static u8 buf[2 * sizeof(block)];
+
+  u64 len = 0;
+  len += hpack_literal(block + len, 0, "x-big", 'a', 4000);
+  len += hpack_literal(block + len, HTTP2_HPACK_STATIC_LEN + 1, NULL, 'b', 100);
+  len += hpack_literal(block + len, HTTP2_HPACK_STATIC_LEN + 1, NULL, 'c', HTTP2_HEADER_TABLE_SIZE);
+
+  Http2_Hpack h = http2_hpack_default();
+  Http2_Header header;
+  u8 *data = block;
+
+  check(http2_hpack_next(&h, &data, &len, buf, &header) == HTTP2_HPACK_EVENT_HEADER);
+  check(header.value_len == 4000 && h.len == 1);
+
+  // Evicts 'x-big', fits itself
+  check(http2_hpack_next(&h, &data, &len, buf, &header) == HTTP2_HPACK_EVENT_HEADER);
+  check(header.name_len == 5 && memcmp(header.name, "x-big", 5) == 0);
+  check(header.value_len == 100 && header.value[99] == 'b');
+  check(h.len == 1);
+
+  // Bigger than the table, empties it
+  check(http2_hpack_next(&h, &data, &len, buf, &header) == HTTP2_HPACK_EVENT_HEADER);
+  check(header.name_len == 5 && memcmp(header.name, "x-big", 5) == 0);
+  check(header.value_len == HTTP2_HEADER_TABLE_SIZE && header.value[0] == 'c');
+  check(h.len == 0 && h.size == 0);
+
+  check(http2_hpack_next(&h, &data, &len, buf, &header) == HTTP2_HPACK_EVENT_NOTHING);
+  http2_hpack_free(&h);
+}
+
+// Runs and short periods are matches, that overlap their own output
+void check_jinfl_overlap(void) {
+  static u8 in[1 << 17];
+  static u8 deflated[jdefl_stream_bound(sizeof(in))];
+  static u8 inflated[sizeof(in) + JINFL_STREAM_OUT];
+  static jdefl_stream d;
+  static jinfl_stream s;
+
+  for(u64 i=0;i<sizeof(in);i++) {
+    in[i] = (i / 4096) % 2 ? 'a' : (u8) ('a' + i % 3);
+  }
+
+  jdefl_stream_init(&d, 5);
+  u64 n = 0;
+  for(u64 i=0;i<sizeof(in);i+=JDEFL_STREAM_SIZ) {
+    n += jdefl_stream_deflate(&d, deflated + n, in + i, JDEFL_STREAM_SIZ, JDEFL_FLUSH_NONE);
+  }
+  n += jdefl_stream_deflate(&d, deflated + n, NULL, 0, JDEFL_FLUSH_FINISH);
+  check(n < sizeof(in) / 16);
+
+  jinfl_stream_init(&s);
+  u8 *p = deflated;
+  u64 p_len = n;
+  u64 len = 0;
+  jinfl_status status = JINFL_STREAM_MORE;
+  while(status == JINFL_STREAM_MORE && len < sizeof(inflated)) {
+    u64 written;
+    status = jinfl_stream_inflate(&s, &p, &p_len, 1, inflated + len, sizeof(inflated) - len, &written);
+    len += written;
+    if(written == 0 && p_len == 0) {
+      break;
+    }
+  }
+  check(status == JINFL_STREAM_DONE);
+  check(len == sizeof(in) && memcmp(in, inflated, len) == 0);
+}
+
+void watch_drain(Fs_Watch *w, Fs_File_Cache *files, Fs_Listing_Cache *listings) {
+  Fs_Watch_Event e;
+  while(fs_watch_next(w, &e) == FS_ERROR_NONE) {
+    fs_watch_invalidate(&e, files, listings);
+  }
+}
+
+#define watch_file(cstr, data) fs_write_filec((cstr), (u8 *) (data), strlen(data))
+
+// A directory, that is renamed and created again in one read, is served
+// from where it is now. The moved one is still watched
+void check_watch_rename(void) {
+  char root[] = "/tmp/check.XXXXXX";
+  if(!mkdtemp(root)) {
+    check(!"mkdtemp");
+    return;
+  }
+  char d[64], d_f[64], e[64], e_f[64];
+  snprintf(d, sizeof(d), "%s/d", root);
+  snprintf(d_f, sizeof(d_f), "%s/d/f.txt", root);
+  snprintf(e, sizeof(e), "%s/e", root);
+  snprintf(e_f, sizeof(e_f), "%s/e/f.txt", root);
+
+  check(fs_mkdirc(d) == FS_ERROR_NONE);
+  check(watch_file(d_f, "one") == FS_ERROR_NONE);
+
+  Fs_Watch w;
+  check(fs_watch_open(&w) == FS_ERROR_NONE);
+  check(fs_watch_addc(&w, root) == FS_ERROR_NONE);
+  Fs_File_Cache files = { .watched = 1 };
+  Fs_Listing_Cache listings = { .watched = 1 };
+
+  Fs_Stat s;
+  check(fs_file_cache_statc(&files, d_f, &s) == FS_ERROR_NONE && s.size == 3);
+  check(fs_file_cache_statc(&files, e_f, &s) == FS_ERROR_FILE_NOT_FOUND);
+
+  check(fs_movec(d, e) == FS_ERROR_NONE);
+  check(fs_mkdirc(d) == FS_ERROR_NONE);
+  check(watch_file(d_f, "three") == FS_ERROR_NONE);
+  watch_drain(&w, &files, &listings);
+  check(files.watched && listings.watched);
+
+  check(fs_file_cache_statc(&files, d_f, &s) == FS_ERROR_NONE && s.size == 5);
+  Fs_File f;
+  check(fs_file_cache_openc(&files, e_f, &f) == FS_ERROR_NONE);
+  u8 buf[8];
+  u64 read = 0;
+  check(fs_file_pread(&f, 0, buf, sizeof(buf), &read) == FS_ERROR_NONE);
+  check(read == 3 && memcmp(buf, "one", 3) == 0);
+  fs_file_close(&f);
+
+  check(watch_file(e_f, "four") == FS_ERROR_NONE);
+  watch_drain(&w, &files, &listings);
+  check(fs_file_cache_statc(&files, e_f, &s) == FS_ERROR_NONE && s.size == 4);
+
+  fs_watch_close(&w);
+  fs_file_cache_free(&files);
+  fs_listing_cache_free(&listings);
+  fs_deletec(d_f);
+  fs_deletec(e_f);
+  fs_rmdirc(d);
+  fs_rmdirc(e);
+  fs_rmdirc(root);
+}
+
+// Timers are over in the order of their deadlines, a cancelled one never.
+// A fd or a flag is only looked at, once it is waited for
+void check_co_sched(void) {
+  Co_Sched c;
+  check(co_sched_open(&c, 8));
+
+  u64 now = co_now();
+  Co timers[4];
+  u64 deadlines[4] = { now - 5, now - 50, now + 100000, now - 20 };
+  for(u64 i=0;i<4;i++) {
+    timers[i] = co_default();
+    timers[i].wait = CO_WAIT_TIMER;
+    timers[i].deadline = deadlines[i];
+    co_sched_wait(&c, &timers[i]);
+  }
+  co_sched_cancel(&c, &timers[3]);
+  co_sched_poll(&c);
+  check(co_sched_next(&c) == &timers[1]);
+  check(co_sched_next(&c) == &timers[0]);
+  check(co_sched_next(&c) == NULL);
+  check(c.timers_len == 1);
+
+  int fds[2];
+  check(pipe(fds) == 0);
+  Co read = co_default();
+  read.wait = CO_WAIT_READ;
+  read.fd = fds[0];
+  co_sched_wait(&c, &read);
+  Co_Flag flag = 0;
+  Co flagged = co_default();
+  flagged.wait = CO_WAIT_FLAG;
+  flagged.flag = &flag;
+  co_sched_wait(&c, &flagged);
+
+  co_sched_poll(&c);
+  check(co_sched_next(&c) == NULL);
+  check(write(fds[1], "x", 1) == 1);
+  co_flag_set(&flag);
+  co_sched_poll(&c);
+  Co *a = co_sched_next(&c);
+  Co *b = co_sched_next(&c);
+  check((a == &read && b == &flagged) || (a == &flagged && b == &read));
+  check(co_sched_next(&c) == NULL);
+
+  // Readable still, but no longer waited for
+  co_sched_poll(&c);
+  check(co_sched_next(&c) == NULL);
+
+  close(fds[0]);
+  close(fds[1]);
+  co_sched_close(&c);
+}
+
+void sockets_ignore(Ip_Sockets *s, void *ctx, u64 off, u64 len, Ip_Error error, u64 index, Ip_Mode mode) {
+  (void) s;
+  (void) ctx;
+  (void) off;
+  (void) len;
+  (void) error;
+  (void) index;
+  (void) mode;
+}
+
+// A slot stays, where it is, while more are reserved. So does the context
+// of its connection
+void check_sockets_stable(void) {
+  Ip_Sockets s;
+  check(ip_sockets_open(&s, 0) == IP_ERROR_NONE);
+
+  int connection;
+  u64 off;
+  check(ip_sockets_reserve(&s, 2, sockets_ignore, NULL, &off) == IP_ERROR_NONE);
+  Ip_Socket *socket = ip_sockets_get(&s, off + 1);
+  socket->flags = IP_WRITING;
+  ip_sockets_ctx(&s, off + 1) = &connection;
+
+  u64 more;
+  check(ip_sockets_reserve(&s, 10 * IP_SOCKETS_CHUNK, sockets_ignore, NULL, &more) == IP_ERROR_NONE);
+  check(more == off + 2);
+  check(ip_sockets_get(&s, off + 1) == socket && socket->flags == IP_WRITING);
+  check(ip_sockets_ctx(&s, off + 1) == &connection);
+  check(ip_sockets_ctx(&s, more + 10 * IP_SOCKETS_CHUNK - 1) == NULL);
+  check(ip_sockets_slot(&s, more + 10 * IP_SOCKETS_CHUNK - 1)->protocol == 1);
+
+  socket->flags = 0;
+  ip_sockets_close(&s);
+}
+
+int main(void) {
+  check_hpack_eviction();
+  check_jinfl_overlap();
+  check_watch_rename();
+  check_co_sched();
+  check_sockets_stable();
+
+  if(failed) {
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -28,17 +28,16 @@ int load_font(char *font_file_path,
   int NUMBER_OF_GLYPHS = 96;
 
   int result = 1;
-  char *ttf_data = NULL; // fs_slurp_file
-  u64 ttf_data_len;
+  Fs_Map ttf = {0};      // fs_load_file
   char *bitmap = NULL;   // malloc
   f->glyphs = NULL;      // malloc
   
-  if(fs_slurp_filec(font_file_path, (u8 **) &ttf_data, &ttf_data_len) != FS_ERROR_NONE) {
+  if(fs_load_filec(font_file_path, &ttf, FS_MAP_WILLNEED) != FS_ERROR_NONE) {
     return_defer(0);
   }
 
   stbtt_fontinfo font_info;
-  if (!stbtt_InitFont(&font_info, (const unsigned char *) ttf_data, 0)) {
+  if (!stbtt_InitFont(&font_info, (const unsigned char *) ttf.data, 0)) {
     return_defer(0);
   }
   float scale = stbtt_ScaleForPixelHeight(&font_info, font_height);
@@ -153,7 +152,7 @@ int load_font(char *font_file_path,
   }
   
  defer:
-  if(ttf_data != NULL) free(ttf_data);
+  fs_file_unmap(&ttf);
   if(bitmap != NULL) free(bitmap);
   if(!result && f->glyphs) free(f->glyphs);
   
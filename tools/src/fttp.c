@@ -1,4 +1,7 @@
 #include <stdio.h>
+#ifndef _WIN32
+#  include <signal.h>
+#endif // _WIN32
 
 #include <core/types.h>
 
@@ -11,8 +14,114 @@
 #define CLIENTS 1024
 #define HTTPSERVER_SOCKETS_COUNT		\
   ((HTTPSERVER_SOCKETS_PER_CLIENT*CLIENTS) + 1)
-#define FTPSERVER_SOCKETS_COUNT			\
-  ((FTPSERVER_SOCKETS_PER_CLIENT*CLIENTS) + 1)
+
+typedef struct {
+  Http_Server server;
+  str dir;
+  str_builder *sb;
+} Fttp_Http;
+
+#define FTTP_SLEEP "/.sleep/"
+#define FTTP_SLEEP_MAX 60000
+
+// A handler, that waits without holding up the others:
+// 'GET /.sleep/<ms>' is answered after <ms> milliseconds
+Co_Result fttp_sleep(Co *co, Http_Server_Session *s, Http_Server_Request *r, void *data) {
+  (void) data;
+
+  // Locals do not survive a suspension, 'r' does
+  s64 ms;
+  str arg = str_from(r->path.data + sizeof(FTTP_SLEEP) - 1, r->path.len - (sizeof(FTTP_SLEEP) - 1));
+  if(!str_parse_s64(arg, &ms) || ms < 0 || ms > FTTP_SLEEP_MAX) {
+    ms = 0;
+  }
+
+  co_begin(co);
+  co_sleep(co, (u64) ms);
+  if(co->cancelled) {
+    co_return(co);
+  }
+  httpserver_enqueue_fixed(s, str_fromd("HTTP/1.1 200 OK\r\n"
+					"Content-Type: text/plain\r\n"
+					"Content-Length: 6\r\n"
+					"\r\n"
+					"slept\n"));
+  co_end(co);
+}
+
+void fttp_http(Ip_Sockets *s, void *ctx, u64 off, u64 len, Ip_Error error, u64 index, Ip_Mode mode) {
+  Fttp_Http *http = ctx;
+
+  if(error == IP_ERROR_REPEAT) {
+    httpserver_resume(&http->server, s, off);
+  }
+
+  Http_Server_Request request;
+  if(httpserver_next(&http->server,
+		     s,
+		     off,
+		     len,
+		     error,
+		     index,
+		     mode,
+		     &request)) {
+    Http_Server_Session *session = &http->server.sessions[index - off];
+    if(str_index_ofc(request.path, FTTP_SLEEP) == 0) {
+      httpserver_spawn(session, fttp_sleep, NULL, &request);
+      return;
+    }
+    // if(httpserver_is_authenticated(session,
+    // 			       &request,
+    // 			       username,
+    // 			       password,
+    // 			       http->sb)) {
+    //   httpserver_serve_files(session, http->dir, &request, http->sb);
+    // }
+    httpserver_serve_files_indexed(session, &http->server.listings, http->dir, &request, http->sb);
+    if(session->queue_len > 0) ip_sockets_get(s, index)->flags |= IP_WRITING;
+  }
+}
+
+// Readable, once a suspended handler can continue. They are resumed
+// with the batch
+void fttp_wake(Ip_Sockets *s, void *ctx, u64 off, u64 len, Ip_Error error, u64 index, Ip_Mode mode) {
+  (void) s;
+  (void) ctx;
+  (void) off;
+  (void) len;
+  (void) error;
+  (void) index;
+  (void) mode;
+}
+
+void fttp_ftp(Ip_Sockets *s, void *ctx, u64 off, u64 len, Ip_Error error, u64 index, Ip_Mode mode) {
+  ftpserver_next(ctx, s, off, len, error, index, mode);
+}
+
+typedef struct {
+  Fs_Watch watch;
+  Http_Server *http;
+  Ftp_Server *ftp;
+} Fttp_Watch;
+
+// Changes of 'dir', the caches of both servers skip their stats
+void fttp_watch(Ip_Sockets *s, void *ctx, u64 off, u64 len, Ip_Error error, u64 index, Ip_Mode mode) {
+  (void) s;
+  (void) off;
+  (void) len;
+  (void) index;
+  Fttp_Watch *w = ctx;
+
+  if(error != IP_ERROR_NONE || mode != IP_MODE_READ) {
+    return;
+  }
+
+  Fs_Watch_Event e;
+  while(fs_watch_next(&w->watch, &e) == FS_ERROR_NONE) {
+    fs_watch_invalidate(&e, &w->http->files, &w->http->listings);
+    fs_watch_invalidate(&e, &w->ftp->files, &w->ftp->listings);
+  }
+}
 
 int main_asdfafd() {
 
@@ -53,22 +162,40 @@ int main() {
 	 str_arg(authorization_b64));
 
 
+#ifndef _WIN32
+  // sendfile has no MSG_NOSIGNAL, a peer that hung up must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+#endif // _WIN32
+
   Ip_Sockets sockets;
-  if(ip_sockets_open(&sockets, HTTPSERVER_SOCKETS_COUNT + FTPSERVER_SOCKETS_COUNT) != IP_ERROR_NONE) {
+  if(ip_sockets_open(&sockets, 0) != IP_ERROR_NONE) {
     return 1;
   }
 
   /////////////////////////////////////////////////////////
 
   u16 http_port = 3080;
-  Http_Server server;
-  if(!httpserver_open(&server, CLIENTS)) {
+  Fttp_Http http = { .dir = dir, .sb = &sb };
+  if(!httpserver_open(&http.server, CLIENTS)) {
+    return 1;
+  }
+  u64 http_off;
+  if(ip_sockets_reserve(&sockets, HTTPSERVER_SOCKETS_COUNT, fttp_http, &http, &http_off) != IP_ERROR_NONE) {
     return 1;
   }
-  if(ip_socket_sopen(&sockets.sockets[HTTPSERVER_SOCKETS_COUNT - 1], http_port, 0) != IP_ERROR_NONE) {
+  if(ip_socket_sopen(ip_sockets_get(&sockets, http_off + HTTPSERVER_SOCKETS_COUNT - 1), http_port, 0) != IP_ERROR_NONE) {
     return 1;
   }
-  if(ip_sockets_register(&sockets, HTTPSERVER_SOCKETS_COUNT - 1) != IP_ERROR_NONE) {
+  if(ip_sockets_register(&sockets, http_off + HTTPSERVER_SOCKETS_COUNT - 1) != IP_ERROR_NONE) {
+    return 1;
+  }
+  u64 wake_off;
+  if(ip_sockets_reserve(&sockets, 1, fttp_wake, NULL, &wake_off) != IP_ERROR_NONE) {
+    return 1;
+  }
+  ip_sockets_get(&sockets, wake_off)->_socket = http.server.sched.epfd;
+  ip_sockets_get(&sockets, wake_off)->flags = IP_VALID | IP_SERVER;
+  if(ip_sockets_register(&sockets, wake_off) != IP_ERROR_NONE) {
     return 1;
   }
 		
@@ -83,62 +210,54 @@ int main() {
 		     password)) {
     return 1;
   }
-  if(ip_socket_sopen(&sockets.sockets[HTTPSERVER_SOCKETS_COUNT + FTPSERVER_SOCKETS_COUNT - 1], ftp_port, 0) != IP_ERROR_NONE) {
+  u64 ftp_off;
+  if(ip_sockets_reserve(&sockets, FTPSERVER_SOCKETS_COUNT(CLIENTS), fttp_ftp, &ftp_server, &ftp_off) != IP_ERROR_NONE) {
+    return 1;
+  }
+  if(ip_socket_sopen(ip_sockets_get(&sockets, ftp_off + FTPSERVER_SOCKETS_COUNT(CLIENTS) - 1), ftp_port, 0) != IP_ERROR_NONE) {
     return 1;
   }
-  if(ip_sockets_register(&sockets, HTTPSERVER_SOCKETS_COUNT + FTPSERVER_SOCKETS_COUNT - 1) != IP_ERROR_NONE) {
+  if(ip_sockets_register(&sockets, ftp_off + FTPSERVER_SOCKETS_COUNT(CLIENTS) - 1) != IP_ERROR_NONE) {
     return 1;
   }
 
   /////////////////////////////////////////////////////////
 
+  // Without a watch, the caches check their entries every few seconds
+  Fttp_Watch watch = { .http = &http.server, .ftp = &ftp_server };
+  u64 watch_off;
+  if(fs_watch_open(&watch.watch) == FS_ERROR_NONE &&
+     fs_watch_adds(&watch.watch, dir) == FS_ERROR_NONE &&
+     ip_sockets_reserve(&sockets, 1, fttp_watch, &watch, &watch_off) == IP_ERROR_NONE) {
+    ip_sockets_get(&sockets, watch_off)->_socket = watch.watch.fd;
+    ip_sockets_get(&sockets, watch_off)->flags = IP_VALID | IP_SERVER;
+    if(ip_sockets_register(&sockets, watch_off) == IP_ERROR_NONE) {
+      http.server.files.watched = 1;
+      http.server.listings.watched = 1;
+      ftp_server.files.watched = 1;
+      ftp_server.listings.watched = 1;
+    } else {
+      *ip_sockets_get(&sockets, watch_off) = ip_socket_invalid();
+    }
+  }
+
+  /////////////////////////////////////////////////////////
+
   printf("Listening on http://localhost:%u\n", http_port);
   printf("Listening on ftp://localhost:%u\n", ftp_port);
 
   while(1) {
-
-    u64 index;
-    Ip_Mode mode;
-    Ip_Error error = ip_sockets_next(&sockets, &index, &mode);
-
-    if(index < HTTPSERVER_SOCKETS_COUNT) {
-      Http_Server_Request request;
-      if(httpserver_next(&server,
-			 &sockets,
-			 0,
-			 HTTPSERVER_SOCKETS_COUNT,
-			 error,
-			 index,
-			 mode,
-			 &request)) {
-	Http_Server_Session *s = &server.sessions[index];
-	// if(httpserver_is_authenticated(s,
-	// 			       &request,
-	// 			       username,
-	// 			       password,
-	// 			       &sb)) {
-	//   httpserver_serve_files(s, dir, &request, &sb);
-	// }
-	httpserver_serve_files(s, dir, &request, &sb);
-	if(server.sessions[index].queue_len > 0) sockets.sockets[index].flags |= IP_WRITING;
-      }
-
-    } else {
-      ftpserver_next(&ftp_server,
-		     &sockets,
-		     HTTPSERVER_SOCKETS_COUNT,
-		     FTPSERVER_SOCKETS_COUNT,
-		     error,
-		     index,
-		     mode);
-
+    if(ip_sockets_dispatch(&sockets) != IP_ERROR_NONE) {
+      break;
     }
-
   }
 
-  httpserver_close(&server);
+  *ip_sockets_get(&sockets, wake_off) = ip_socket_invalid(); // closed by 'httpserver_close'
+  httpserver_close(&http.server);
   ftpserver_close(&ftp_server);
-  ip_sockets_close(&sockets);
+  ip_sockets_close(&sockets); // closes 'watch.watch.fd' too
+  watch.watch.fd = -1;
+  fs_watch_close(&watch.watch);
   STR_FREE(sb.data);
 
   return 0;
@@ -147,6 +147,14 @@ int transform(Assoc input, Assoc output) {
 
   int width = 0, height = 0, channels = 0;
   unsigned char *data = NULL;
+
+  Fs_Map map = {0};
+  if(input.type != FORMAT_TYPE_PNM &&
+     fs_load_filec(input.name, &map, FS_MAP_SEQUENTIAL) != FS_ERROR_NONE) {
+    fprintf(stderr, "ERROR: Can not open '%s'\n", input.name);
+    return 1;
+  }
+
   switch(input.type) {
   case FORMAT_TYPE_NONE: 
     return 1; // unreachable
@@ -155,20 +163,22 @@ int transform(Assoc input, Assoc output) {
   case FORMAT_TYPE_TGA:
   case FORMAT_TYPE_BMP:
   case FORMAT_TYPE_HDR: {
-    data = stbi_load(input.name, &width, &height, &channels, 0);
+    data = stbi_load_from_memory(map.data, (int) map.len, &width, &height, &channels, 0);
   } break;
   case FORMAT_TYPE_PNM: {
     data = pnm_load(input.name, &width, &height, &channels, 0);
   } break;
   case FORMAT_TYPE_QOI: {
     qoi_desc desc;
-    data = qoi_read(input.name, &desc, 0);
+    data = qoi_decode(map.data, (int) map.len, &desc, 0);
     width = desc.width;
     height = desc.height;
     channels = desc.channels;
   } break;
   }
 
+  fs_file_unmap(&map);
+
   if(!data) {
     fprintf(stderr, "ERROR: Can not decode '%s' expected format: '%s'\n",
 	    input.name, format_type_name(input.type));
@@ -9,6 +9,9 @@
 #define MUI_IMPLEMENTATION
 #include <core/mui.h>
 
+#define FS_IMPLEMENTATION
+#include <core/fs.h>
+
 // Decoding
 
 #define PNM_IMPLEMENTATION
@@ -82,16 +85,24 @@ void load_file(char *path) {
 
   qoi_desc desc;	
   unsigned char *data = NULL;
+
+  // Read once, for every decoder
+  Fs_Map map;
+  if(fs_load_filec(path, &map, FS_MAP_SEQUENTIAL) != FS_ERROR_NONE) {
+    fprintf(stderr, "ERROR: Can not open '%s'\n", path); fflush(stderr);
+    return;
+  }
   
-  data = qoi_read(path, &desc, 4);
+  data = qoi_decode(map.data, (int) map.len, &desc, 4);
   img_width = desc.width;
   img_height = desc.height;
   if(!data) {
     data = pnm_load(path, &img_width, &img_height, NULL, 4);
   }
   if(!data) {
-    data = stbi_load(path, &img_width, &img_height, 0, 4);
+    data = stbi_load_from_memory(map.data, (int) map.len, &img_width, &img_height, 0, 4);
   }  
+  fs_file_unmap(&map);
   if(!data) {
     fprintf(stderr, "ERROR: Can not open '%s'\n", path); fflush(stderr);
     return; 
@@ -216,10 +216,11 @@ int main(int argc, char **argv) {
   }
   char *filepath = argv[1];
 
-  Memory mem;
-  if(fs_slurp_filec(filepath, &mem.data, &mem.len) != FS_ERROR_NONE) {
-    fprintf(stderr, "ERROR: Cannot slurp file: '%s'\n", filepath); return 1;
+  Fs_Map map;
+  if(fs_load_filec(filepath, &map, FS_MAP_SEQUENTIAL | FS_MAP_WILLNEED) != FS_ERROR_NONE) {
+    fprintf(stderr, "ERROR: Cannot load file: '%s'\n", filepath); return 1;
   }
+  Memory mem = { .data = map.data, .len = map.len, .pos = 0 };
 
   int flt_or_pcm;
   s32 channels, sample_rate;
@@ -415,6 +416,7 @@ int main(int argc, char **argv) {
 
   audio_block(&audio);
   audio_free(&audio);
+  fs_file_unmap(&map);
 
   return 0;
 }
@@ -40,8 +40,7 @@ typedef struct {
 	}\
 }while(0)
 
-// TODO: wrtten is never checked
-Fs_Error job_serialize(Fs_File *f, Job *j) {
+Fs_Error job_serialize(Fs_Writer *w, Job *j) {
 
 	u64 job_len = 0;
 
@@ -62,32 +61,31 @@ Fs_Error job_serialize(Fs_File *f, Job *j) {
 
 	Ebml_Vint vint_job = ebml_to_vint(job_len);
 
-	u64 written;
 	u8 id;
 
 	id = EBML_ID_Job;
-	fs_unwrap(fs_file_write(f, &id, 1, &written));
-	fs_unwrap(fs_file_write(f, (u8 *) &vint_job.data, vint_job.len, &written));
+	fs_unwrap(fs_writer_write(w, &id, 1));
+	fs_unwrap(fs_writer_write(w, (u8 *) &vint_job.data, vint_job.len));
 
 	id = EBML_ID_exit_code;
-	fs_unwrap(fs_file_write(f, &id, 1, &written));
-	fs_unwrap(fs_file_write(f, (u8 *) &vint_exit_code.data, vint_exit_code.len, &written));
-	fs_unwrap(fs_file_write(f, &j->exit_code, 1, &written));
+	fs_unwrap(fs_writer_write(w, &id, 1));
+	fs_unwrap(fs_writer_write(w, (u8 *) &vint_exit_code.data, vint_exit_code.len));
+	fs_unwrap(fs_writer_write(w, &j->exit_code, 1));
 
 	id = EBML_ID_command;
-	fs_unwrap(fs_file_write(f, &id, 1, &written));
-	fs_unwrap(fs_file_write(f, (u8 *) &vint_command.data, vint_command.len, &written));
-	fs_unwrap(fs_file_write(f, j->command.data, j->command.len, &written));
+	fs_unwrap(fs_writer_write(w, &id, 1));
+	fs_unwrap(fs_writer_write(w, (u8 *) &vint_command.data, vint_command.len));
+	fs_unwrap(fs_writer_write(w, j->command.data, j->command.len));
 
 	id = EBML_ID_out;
-	fs_unwrap(fs_file_write(f, &id, 1, &written));
-	fs_unwrap(fs_file_write(f, (u8 *) &vint_out.data, vint_out.len, &written));
-	fs_unwrap(fs_file_write(f, j->out.data, j->out.len, &written));
+	fs_unwrap(fs_writer_write(w, &id, 1));
+	fs_unwrap(fs_writer_write(w, (u8 *) &vint_out.data, vint_out.len));
+	fs_unwrap(fs_writer_write(w, j->out.data, j->out.len));
 
 	id = EBML_ID_err;
-	fs_unwrap(fs_file_write(f, &id, 1, &written));
-	fs_unwrap(fs_file_write(f, (u8 *) &vint_err.data, vint_err.len, &written));
-	fs_unwrap(fs_file_write(f, j->err.data, j->err.len, &written));
+	fs_unwrap(fs_writer_write(w, &id, 1));
+	fs_unwrap(fs_writer_write(w, (u8 *) &vint_err.data, vint_err.len));
+	fs_unwrap(fs_writer_write(w, j->err.data, j->err.len));
 
 	return FS_ERROR_NONE;
 }
@@ -171,14 +169,15 @@ int capture(char *program, s32 argc, char **argv, void *userdata) {
 	char *filepath = argv[0];
 	char *out_filepath = argv[1];
 
-	str content;
-	if(fs_slurp_filec(filepath, &content.data, &content.len) != FS_ERROR_NONE) {
+	Fs_Map content_map;
+	if(fs_load_filec(filepath, &content_map, FS_MAP_SEQUENTIAL) != FS_ERROR_NONE) {
 		TODO();
 	}
-	str content_copy = content;
+	str content = str_from(content_map.data, content_map.len);
 
-	Fs_File f;
-	if(fs_file_wopenc(&f, out_filepath) != FS_ERROR_NONE) {
+	// Replaces 'out_filepath' only once every job is in
+	Fs_Writer w;
+	if(fs_writer_openc(&w, out_filepath, 0, 0, FS_WRITER_ATOMIC) != FS_ERROR_NONE) {
 		TODO();
 	}
 
@@ -210,7 +209,7 @@ int capture(char *program, s32 argc, char **argv, void *userdata) {
 			.out = str_from(sb_out.data, sb_out.len), 
 			.err = str_from(sb_err.data, sb_err.len),
 		};
-		if(job_serialize(&f, &job) != FS_ERROR_NONE) {
+		if(job_serialize(&w, &job) != FS_ERROR_NONE) {
 			TODO();
 		}
 
@@ -220,9 +219,11 @@ int capture(char *program, s32 argc, char **argv, void *userdata) {
 	free(sb_out.data);
 	free(sb_err.data);
 
-	fs_file_close(&f);
+	if(fs_writer_close(&w) != FS_ERROR_NONE) {
+		TODO();
+	}
 
-	FS_FREE(content_copy.data);
+	fs_file_unmap(&content_map);
 
 	zh_log(ZH_INFO, "Saved '%s'\n", out_filepath);
 
@@ -268,15 +269,17 @@ int probe(char *program, s32 argc, char **argv, void *userdata) {
 	char *filepath = argv[0];
 	char *out_filepath = argv[1];
 
-	Ebml ebml;
-	if(fs_slurp_filec(out_filepath, &ebml.data, &ebml.len) != FS_ERROR_NONE) {
+	Fs_Map ebml_map;
+	if(fs_load_filec(out_filepath, &ebml_map, FS_MAP_WILLNEED) != FS_ERROR_NONE) {
 		TODO();
 	}
+	Ebml ebml = ebml_from(ebml_map.data, ebml_map.len);
 
-	str content;
-	if(fs_slurp_filec(filepath, &content.data, &content.len) != FS_ERROR_NONE) {
+	Fs_Map content_map;
+	if(fs_load_filec(filepath, &content_map, FS_MAP_SEQUENTIAL) != FS_ERROR_NONE) {
 		TODO();
 	}
+	str content = str_from(content_map.data, content_map.len);
 
 	Zh zh = {0};
 	Zh_str_builder sb_out = {0};
@@ -327,7 +330,8 @@ int probe(char *program, s32 argc, char **argv, void *userdata) {
 	free(sb_out.data);
 	free(sb_err.data);
 
-	FS_FREE(ebml.data);
+	fs_file_unmap(&ebml_map);
+	fs_file_unmap(&content_map);
 
 	return 0;
 }